@@ -9,6 +9,7 @@ namespace PROJ6850 {
 
 class Vector2D;
 class Vector3D;
+class Vec3f;
 class Vector4D;
 
 class Matrix3x3;
@@ -0,0 +1,173 @@
+#ifndef PROJ6850_VEC3F_H
+#define PROJ6850_VEC3F_H
+
+#include "PROJ6850.h"
+#include "vector3D.h"
+
+#include <ostream>
+#include <cmath>
+
+namespace PROJ6850 {
+
+/**
+ * Defines single precision 3D vectors.
+ * This is the vector type of the render core (rays, bounding boxes and
+ * primitives used by the pathtracer). Modeling and animation code keeps
+ * using the double precision Vector3D; the two convert explicitly.
+ */
+class Vec3f {
+ public:
+
+  // components
+  float x, y, z;
+
+  /**
+   * Constructor.
+   * Initializes tp vector (0,0,0).
+   */
+  Vec3f() : x( 0.0f ), y( 0.0f ), z( 0.0f ) { }
+
+  /**
+   * Constructor.
+   * Initializes to vector (x,y,z).
+   */
+  Vec3f( float x, float y, float z) : x( x ), y( y ), z( z ) { }
+
+  /**
+   * Constructor.
+   * Initializes to vector (c,c,c)
+   */
+  explicit Vec3f( float c ) : x( c ), y( c ), z( c ) { }
+
+  /**
+   * Constructor.
+   * Initializes from a double precision vector (rounds to nearest).
+   */
+  explicit Vec3f( const Vector3D& v ) : x( (float) v.x ), y( (float) v.y ), z( (float) v.z ) { }
+
+  /**
+   * Returns the double precision copy of this vector.
+   */
+  inline Vector3D toVector3D( void ) const {
+    return Vector3D( x, y, z );
+  }
+
+  // returns reference to the specified component (0-based indexing: x, y, z)
+  inline float& operator[] ( const int& index ) {
+    return ( &x )[ index ];
+  }
+
+  // returns const reference to the specified component (0-based indexing: x, y, z)
+  inline const float& operator[] ( const int& index ) const {
+    return ( &x )[ index ];
+  }
+
+  inline bool operator==( const Vec3f& v) const {
+    return v.x == x && v.y == y && v.z == z;
+  }
+
+  // negation
+  inline Vec3f operator-( void ) const {
+    return Vec3f( -x, -y, -z );
+  }
+
+  // addition
+  inline Vec3f operator+( const Vec3f& v ) const {
+    return Vec3f( x + v.x, y + v.y, z + v.z );
+  }
+
+  // subtraction
+  inline Vec3f operator-( const Vec3f& v ) const {
+    return Vec3f( x - v.x, y - v.y, z - v.z );
+  }
+
+  // right scalar multiplication
+  inline Vec3f operator*( const float& c ) const {
+    return Vec3f( x * c, y * c, z * c );
+  }
+
+  // scalar division
+  inline Vec3f operator/( const float& c ) const {
+    const float rc = 1.0f/c;
+    return Vec3f( rc * x, rc * y, rc * z );
+  }
+
+  // addition / assignment
+  inline void operator+=( const Vec3f& v ) {
+    x += v.x; y += v.y; z += v.z;
+  }
+
+  // subtraction / assignment
+  inline void operator-=( const Vec3f& v ) {
+    x -= v.x; y -= v.y; z -= v.z;
+  }
+
+  // scalar multiplication / assignment
+  inline void operator*=( const float& c ) {
+    x *= c; y *= c; z *= c;
+  }
+
+  // scalar division / assignment
+  inline void operator/=( const float& c ) {
+    (*this) *= ( 1.f/c );
+  }
+
+  /**
+   * Returns Euclidean length.
+   */
+  inline float norm( void ) const {
+    return sqrtf( x*x + y*y + z*z );
+  }
+
+  /**
+   * Returns Euclidean length squared.
+   */
+  inline float norm2( void ) const {
+    return x*x + y*y + z*z;
+  }
+
+  /**
+   * Returns unit vector.
+   */
+  inline Vec3f unit( void ) const {
+    float rNorm = 1.f / sqrtf( x*x + y*y + z*z );
+    return Vec3f( rNorm*x, rNorm*y, rNorm*z );
+  }
+
+  /**
+   * Divides by Euclidean length.
+   */
+  inline void normalize( void ) {
+    (*this) /= norm();
+  }
+
+}; // class Vec3f
+
+// left scalar multiplication
+inline Vec3f operator* ( const float& c, const Vec3f& v ) {
+  return Vec3f( c * v.x, c * v.y, c * v.z );
+}
+
+// dot product (a.k.a. inner or scalar product)
+inline float dot( const Vec3f& u, const Vec3f& v ) {
+  return u.x*v.x + u.y*v.y + u.z*v.z ;
+}
+
+// cross product
+inline Vec3f cross( const Vec3f& u, const Vec3f& v ) {
+  return Vec3f( u.y*v.z - u.z*v.y,
+                u.z*v.x - u.x*v.z,
+                u.x*v.y - u.y*v.x );
+}
+
+// component wise absolute value
+inline Vec3f abs( const Vec3f& v ) {
+  return Vec3f( fabsf( v.x ), fabsf( v.y ), fabsf( v.z ) );
+}
+
+// prints components
+std::ostream& operator<<( std::ostream& os, const Vec3f& v );
+
+} // namespace PROJ6850
+
+#endif // PROJ6850_VEC3F_H
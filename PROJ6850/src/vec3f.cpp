@@ -0,0 +1,10 @@
+#include "vec3f.h"
+
+namespace PROJ6850 {
+
+  std::ostream& operator<<( std::ostream& os, const Vec3f& v ) {
+    os << "(" << v.x << "," << v.y << "," << v.z << ")";
+    return os;
+  }
+
+} // namespace PROJ6850
@@ -10,12 +10,14 @@
 #include "dynamic_scene/widgets.h"
 #include "dynamic_scene/skeleton.h"
 #include "dynamic_scene/joint.h"
+#include "work_queue.h"
 
 #include "PROJ6850/lodepng.h"
 
 #include "GLFW/glfw3.h"
 
 #include <sstream>
+#include <map>
 #include <chrono>
 #include <thread>
 using namespace std;
@@ -31,12 +33,27 @@ namespace PROJ6850 {
 
     Application::Application(AppConfig config) {
       scene = nullptr;
+      sceneCache = nullptr;
+      sceneCacheKey = 0;
+      memset(&view, 0, sizeof(view));
 
       pathtracer =
               new PathTracer(config.pathtracer_ns_aa, config.pathtracer_max_ray_depth,
                              config.pathtracer_ns_area_light, config.pathtracer_ns_diff,
                              config.pathtracer_ns_glsy, config.pathtracer_ns_refr,
                              config.pathtracer_num_threads, config.pathtracer_envmap);
+      pathtracer->set_aov_channels(config.pathtracer_aovs);
+      pathtracer->set_denoising(config.pathtracer_denoise);
+      framesInFlight = std::max<size_t>(1, config.pathtracer_frames_in_flight);
+      camera.set_shutter(0, config.pathtracer_shutter);
+      imageWriter = new ImageWriter(framesInFlight, config.pathtracer_writer_threads);
+      imageWriter->set_options(config.pathtracer_image_options);
+      frameFormat = config.pathtracer_frame_format;
+      checkpointInterval = config.pathtracer_checkpoint_interval;
+      resumeRender = config.pathtracer_resume;
+      tileServer = config.pathtracer_tile_server;
+      tileTimeout = config.pathtracer_tile_timeout;
+      loadThreads = std::max<size_t>(1, config.pathtracer_num_threads);
 
       timestep = 0.1;
       damping_factor = 0.0;
@@ -49,6 +66,9 @@ namespace PROJ6850 {
     Application::~Application() {
       if (pathtracer != nullptr) delete pathtracer;
       if (scene != nullptr) delete scene;
+      delete sceneCache;
+      for (StaticScene::Mesh *mesh : renderMeshes) delete mesh;
+      delete imageWriter;
     }
 
     void Application::init() {
@@ -224,6 +244,10 @@ namespace PROJ6850 {
           pathtracer->update_screen();
           break;
         case ANIMATE_MODE:
+          for (auto o : scene->objects) {
+            DynamicScene::Mesh *mesh = dynamic_cast<DynamicScene::Mesh *>(o);
+            if (mesh != nullptr) mesh->set_playing(timeline.isCurrentlyPlaying());
+          }
           if (timeline.isCurrentlyPlaying()) {
             for (auto o : scene->objects) {
               DynamicScene::Mesh *mesh = dynamic_cast<DynamicScene::Mesh *>(o);
@@ -269,7 +293,8 @@ namespace PROJ6850 {
 
           if (!timeline.isCurrentlyPlaying()) scene->draw_spline_curves(timeline);
           scene->render_splines_at(timeline.getCurrentFrame(),
-                                   timeline.isCurrentlyPlaying(), useCapsuleRadius);
+                                   timeline.isCurrentlyPlaying(), useCapsuleRadius,
+                                   loadThreads);
 
           if (action == Action::Rasterize_Video) {
             rasterize_video();
@@ -344,15 +369,63 @@ namespace PROJ6850 {
       }
     }
 
-    void Application::load(SceneInfo *sceneInfo) {
+    void Application::load(SceneInfo *sceneInfo, bool render_only) {
       vector<Collada::Node> &nodes = sceneInfo->nodes;
       vector<DynamicScene::SceneLight *> lights;
       vector<DynamicScene::SceneObject *> objects;
 
+      // meshes created so far and their node transform, so that nodes sharing
+      // geometry become instances of the first mesh instead of copies
+      std::map<PolymeshInfo *, std::pair<DynamicScene::Mesh *, Matrix4x4> > instanced;
+
       // save camera position to update camera control later
       CameraInfo *c;
       Vector3D c_pos = Vector3D();
       Vector3D c_dir = Vector3D();
+      memset(&view, 0, sizeof(view));
+
+      // the meshes are independent, so they are built in parallel first, one
+      // for the first node of each polymesh. The nodes are then walked in
+      // order and the scene objects created on this thread, which keeps the
+      // scene the same for any number of threads. A render-only scene gets
+      // the render copies of its meshes right away.
+      // Later nodes are placed through the inverse of the first transform, so
+      // a singular first one (e.g. a zero scale) leaves every node a build
+      // of its own.
+      vector<std::pair<PolymeshInfo *, const Matrix4x4 *> > builds;
+      std::map<PolymeshInfo *, size_t> built;
+      vector<size_t> nodeBuilds(nodes.size());  // build of each polymesh node
+      for (size_t i = 0; i < nodes.size(); i++) {
+        const Collada::Node &node = nodes[i];
+        if (node.instance->type != Collada::Instance::POLYMESH) continue;
+        PolymeshInfo *polymesh = static_cast<PolymeshInfo *>(node.instance);
+        auto first = built.find(polymesh);
+        if (first != built.end() && builds[first->second].second->det() != 0) {
+          nodeBuilds[i] = first->second;
+          continue;
+        }
+        nodeBuilds[i] = builds.size();
+        if (first == built.end()) built[polymesh] = builds.size();
+        builds.push_back(std::make_pair(polymesh, &node.transform));
+      }
+      vector<HalfedgeMesh> halfedgeMeshes(render_only ? 0 : builds.size());
+      vector<StaticScene::Mesh *> staticMeshes(render_only ? builds.size() : 0);
+      vector<BBox> staticBoxes(staticMeshes.size());
+      // threads left over from the meshes sort the edges within them
+      size_t meshThreads = std::max<size_t>(1, loadThreads / std::max<size_t>(1, builds.size()));
+      Timer meshTimer;
+      meshTimer.start();
+      parallel_for(builds.size(), loadThreads, [&](size_t i) {
+        if (render_only) {
+          staticMeshes[i] = DynamicScene::Mesh::build_static_mesh(
+                  *builds[i].first, *builds[i].second, &staticBoxes[i]);
+        } else {
+          DynamicScene::Mesh::build_halfedge_mesh(*builds[i].first, *builds[i].second,
+                                                  &halfedgeMeshes[i], meshThreads);
+        }
+      });
+      meshTimer.stop();
+      renderMeshes = staticMeshes;
 
       int len = nodes.size();
       for (int i = 0; i < len; i++) {
@@ -366,6 +439,11 @@ namespace PROJ6850 {
             c_pos = (transform * Vector4D(c_pos, 1)).to3D();
             c_dir = (transform * Vector4D(c->view_dir, 1)).to3D().unit();
             init_camera(*c, transform);
+            view.configured = true;
+            view.hFov = c->hFov;
+            view.vFov = c->vFov;
+            view.nClip = c->nClip;
+            view.fClip = c->fClip;
             break;
           case Collada::Instance::LIGHT: {
             lights.push_back(
@@ -376,10 +454,30 @@ namespace PROJ6850 {
             objects.push_back(
                     init_sphere(static_cast<SphereInfo &>(*instance), transform));
             break;
-          case Collada::Instance::POLYMESH:
-            objects.push_back(
-                    init_polymesh(static_cast<PolymeshInfo &>(*instance), transform));
+          case Collada::Instance::POLYMESH: {
+            PolymeshInfo *polymesh = static_cast<PolymeshInfo *>(instance);
+            size_t b = nodeBuilds[i];
+            if (render_only) {
+              // the first node of the polymesh placed the render copy
+              if (builds[b].second != &transform) {
+                staticMeshes[b]->instances.push_back(transform * builds[b].second->inv());
+              }
+              break;
+            }
+            if (builds[b].second != &transform) {
+              // the mesh vertices are already in world space for its own node
+              auto shared = instanced.find(polymesh);
+              DynamicScene::Mesh *mesh = shared->second.first;
+              mesh->add_instance(transform * shared->second.second.inv());
+              break;
+            }
+            DynamicScene::SceneObject *mesh = init_polymesh(*polymesh, halfedgeMeshes[b]);
+            if (b == built[polymesh]) {
+              instanced[polymesh] = std::make_pair(static_cast<DynamicScene::Mesh *>(mesh), transform);
+            }
+            objects.push_back(mesh);
             break;
+          }
           case Collada::Instance::MATERIAL:
             init_material(static_cast<MaterialInfo &>(*instance));
             break;
@@ -391,8 +489,24 @@ namespace PROJ6850 {
         lights.push_back(new DynamicScene::AmbientLight(default_light));
       }
       scene = new DynamicScene::Scene(objects, lights);
-
-      const BBox &bbox = scene->get_bbox();
+      fprintf(stdout, "[Collada] Loaded scene with %zu threads: XML %.4f sec, arrays %.4f sec, "
+              "meshes %.4f sec\n", loadThreads, sceneInfo->xmlTime, sceneInfo->numberTime,
+              meshTimer.duration());
+
+      BBox bbox = scene->get_bbox();
+      for (size_t i = 0; i < staticMeshes.size(); i++) {
+        // copies: transformed corners of the mesh box, as Mesh::get_bbox
+        const BBox &meshBox = staticBoxes[i];
+        bbox.expand(meshBox);
+        for (const Matrix4x4 &T : staticMeshes[i]->instances) {
+          for (int corner = 0; corner < 8; corner++) {
+            Vector3D p((corner & 1) ? meshBox.max.x : meshBox.min.x,
+                       (corner & 2) ? meshBox.max.y : meshBox.min.y,
+                       (corner & 4) ? meshBox.max.z : meshBox.min.z);
+            bbox.expand((T * Vector4D(p, 1.0)).projectTo3D());
+          }
+        }
+      }
       if (!bbox.empty()) {
         Vector3D target = bbox.centroid();
         canonical_view_distance = bbox.extent.norm() / 2 * 1.5;
@@ -408,6 +522,14 @@ namespace PROJ6850 {
                      min_view_distance, max_view_distance);
 
         set_scroll_rate();
+
+        view.placed = true;
+        for (int i = 0; i < 3; i++) view.target[i] = target[i];
+        view.phi = acos(c_dir.y);
+        view.theta = atan2(c_dir.x, c_dir.z);
+        view.distance = view_distance;
+        view.minDistance = min_view_distance;
+        view.maxDistance = max_view_distance;
       }
 
       // set default draw styles for meshEdit -
@@ -434,6 +556,58 @@ namespace PROJ6850 {
       // cerr << "==================================" << endl;
     }
 
+    bool Application::load_scene_cache(const std::string &filename, uint64_t key) {
+      sceneCacheFile = filename;
+      sceneCacheKey = key;
+      Timer timer;
+      timer.start();
+      SceneCache *cache = new SceneCache();
+      const char *error = cache->open(filename, key);
+      if (error) {
+        fprintf(stdout, "[SceneCache] Not using %s: %s\n", filename.c_str(), error);
+        delete cache;
+        return false;
+      }
+      sceneCache = cache;
+
+      // the camera as load() would set it up
+      view = cache->view();
+      if (view.configured) {
+        CameraInfo info;
+        info.hFov = view.hFov;
+        info.vFov = view.vFov;
+        info.nClip = view.nClip;
+        info.fClip = view.fClip;
+        init_camera(info, Matrix4x4::identity());
+      }
+      if (view.placed) {
+        Vector3D target(view.target[0], view.target[1], view.target[2]);
+        canonical_view_distance = view.distance / 2;
+        canonicalCamera.place(target, view.phi, view.theta, view.distance,
+                              view.minDistance, view.maxDistance);
+        camera.place(target, view.phi, view.theta, view.distance,
+                     view.minDistance, view.maxDistance);
+      }
+      timer.stop();
+      fprintf(stdout, "[SceneCache] Loaded %s, %zu triangles (%.4f sec)\n",
+              filename.c_str(), cache->num_triangles(), timer.duration());
+      return true;
+    }
+
+    void Application::save_scene_cache() {
+      if (sceneCacheFile.empty() || sceneCache) return;
+      Timer timer;
+      timer.start();
+      const char *error = pathtracer->save_scene_cache(sceneCacheFile, sceneCacheKey, view);
+      timer.stop();
+      if (error) {
+        fprintf(stdout, "[SceneCache] Not writing %s: %s\n", sceneCacheFile.c_str(), error);
+      } else {
+        fprintf(stdout, "[SceneCache] Wrote %s (%.4f sec)\n", sceneCacheFile.c_str(),
+                timer.duration());
+      }
+    }
+
     void Application::init_camera(CameraInfo &cameraInfo,
                                   const Matrix4x4 &transform) {
       camera.configure(cameraInfo, screenW, screenH);
@@ -481,8 +655,8 @@ namespace PROJ6850 {
     }
 
     DynamicScene::SceneObject *Application::init_polymesh(
-            PolymeshInfo &polymesh, const Matrix4x4 &transform) {
-      return new DynamicScene::Mesh(polymesh, transform);
+            PolymeshInfo &polymesh, HalfedgeMesh &built) {
+      return new DynamicScene::Mesh(polymesh, built);
     }
 
     void Application::set_scroll_rate() {
@@ -635,7 +809,7 @@ namespace PROJ6850 {
             case 'i':
             case 'I':
               // i for isotropic.
-              scene->resample_selected_mesh();
+              scene->resample_selected_mesh(loadThreads);
               break;
             case 'f':
             case 'F':
@@ -660,11 +834,11 @@ namespace PROJ6850 {
               break;
             case 's':
               // Catmull-Clark subdivision
-              scene->subdivideSelection(true);
+              scene->subdivideSelection(true, loadThreads);
               break;
             case 'S':
               // linear subdivision
-              scene->subdivideSelection(false);
+              scene->subdivideSelection(false, loadThreads);
               break;
             case 'h':
               scene->selectHalfedge();
@@ -1086,7 +1260,7 @@ namespace PROJ6850 {
       Camera originalCanonicalCamera = canonicalCamera;
 
       Collada::SceneInfo *sceneInfo = new Collada::SceneInfo();
-      if (Collada::ColladaParser::load(filename, sceneInfo) < 0) {
+      if (Collada::ColladaParser::load(filename, sceneInfo, loadThreads) < 0) {
         cerr << "Warning: scene file failed to load." << endl;
         delete sceneInfo;
         return;
@@ -1350,6 +1524,12 @@ namespace PROJ6850 {
           leftDown = false;
           draggingTimeline = false;
           scene->elementTransform->updateGeometry();
+          // Meshes whose elements were dragged can have their levels of
+          // detail built again.
+          for (DynamicScene::SceneObject *o : scene->objects) {
+            DynamicScene::Mesh *mesh = dynamic_cast<DynamicScene::Mesh *>(o);
+            if (mesh) mesh->mesh_settled();
+          }
           break;
         case RIGHT:
           rightDown = false;
@@ -1548,6 +1728,7 @@ namespace PROJ6850 {
       for (auto o : scene->objects) {
         if (o->getInfo()[0][0] == 'M' && o != scene->elementTransform) {  // Mesh
           ((DynamicScene::Mesh *)o)->resetWave();
+          ((DynamicScene::Mesh *)o)->set_playing(false);
         }
       }
 
@@ -1594,11 +1775,19 @@ namespace PROJ6850 {
     void Application::set_up_pathtracer() {
       if (mode != MODEL_MODE && mode != ANIMATE_MODE) return;
       pathtracer->set_camera(&camera);
-      if (action == Action::Raytrace_Video) {
+      if (sceneCache) {
+        pathtracer->set_scene(sceneCache->scene(), sceneCache);
+      } else if (action == Action::Raytrace_Video) {
         pathtracer->set_scene(
-                scene->get_transformed_static_scene(timeline.getCurrentFrame()));
+                scene->get_transformed_static_scene(timeline.getCurrentFrame(),
+                                                    camera.shutter_open(),
+                                                    camera.shutter_close()));
       } else {
-        pathtracer->set_scene(scene->get_static_scene());
+        StaticScene::Scene *staticScene = scene->get_static_scene(loadThreads);
+        staticScene->objects.insert(staticScene->objects.end(), renderMeshes.begin(),
+                                    renderMeshes.end());
+        renderMeshes.clear();
+        pathtracer->set_scene(staticScene);
       }
       pathtracer->set_frame_size(screenW, screenH);
     }
@@ -1626,16 +1815,17 @@ namespace PROJ6850 {
         uint32_t *frame = (uint32_t *)colors;
         size_t w = screenW;
         size_t h = screenH;
-        uint32_t *frame_out = new uint32_t[w * h];
+        ImageBuffer *frame_out = new ImageBuffer(w, h);
         for (size_t i = 0; i < h; ++i) {
-          memcpy(frame_out + i * w, frame + (h - i - 1) * w, 4 * w);
+          memcpy(&frame_out->data[i * w], frame + (h - i - 1) * w, 4 * w);
         }
+        delete[] colors;
 
-        fprintf(stderr, "[Animator] Saving to file: %s... ", fname.c_str());
-        lodepng::encode(fname, (unsigned char *)frame_out, w, h);
-        fprintf(stderr, "Done!\n");
+        // encoded on the writer thread while the next frame is drawn
+        imageWriter->write(fname, frame_out);
 
         if (timeline.getCurrentFrame() == timeline.getMaxFrame()) {
+          imageWriter->flush();
           timeline.action_rewind();
           cout << "Done rendering video!" << endl;
           action = Action::Object;
@@ -1655,19 +1845,30 @@ namespace PROJ6850 {
         if (pathtracer->is_done()) {
           char num[32];
           sprintf(num, "%04d", timeline.getCurrentFrame());
-          pathtracer->save_image(videoPrefix + num + string(".png"));
+          pathtracer->save_image(videoPrefix + num + string(".png"), imageWriter);
           timeline.step();
 
           if (timeline.getCurrentFrame() == timeline.getMaxFrame()) {
+            imageWriter->flush();
             timeline.action_stop();
             timeline.action_rewind();
             cout << "Done rendering video!" << endl;
             action = Action::Object;
             return;
           }
+          // consecutive frames share their topology, so the accelerators
+          // are updated in place rather than built again
           pathtracer->stop();
-          pathtracer->clear();
-          set_up_pathtracer();
+          Timer timer;
+          timer.start();
+          StaticScene::Scene *frame =
+                  scene->get_transformed_static_scene(timeline.getCurrentFrame(),
+                                                      camera.shutter_open(),
+                                                      camera.shutter_close());
+          timer.stop();
+          fprintf(stdout, "[Animator] Frame %d: scene conversion (%.4f sec)\n",
+                  timeline.getCurrentFrame(), timer.duration());
+          pathtracer->update_scene(frame);
           pathtracer->start_raytracing();
         }
       } else {
@@ -1699,6 +1900,8 @@ namespace PROJ6850 {
       dy *= -2. / screenH;
 
       if (scene->selected.element) {
+        DynamicScene::Mesh *mesh = dynamic_cast<DynamicScene::Mesh *>(scene->selected.object);
+        if (mesh) mesh->mesh_changing();
         scene->selected.element->translate(dx, dy, modelViewProj);
       } else {
         scene->selected.object->drag(x, y, dx, dy, modelViewProj);
@@ -1979,14 +2182,119 @@ namespace PROJ6850 {
 
     void Application::render_scene(std::string saveFileLocation) {
 
+      // the checkpoint is kept until the render is saved
+      std::string checkpoint = saveFileLocation + ".ckpt";
+      bool checkpointed = checkpointInterval > 0 || resumeRender;
+      if (checkpointed) {
+        pathtracer->set_checkpoint(checkpoint,
+                                   checkpointInterval > 0 ? checkpointInterval : 60,
+                                   resumeRender);
+      }
+      // only set here: the frames of an animation would not match the workers
+      if (!tileServer.empty()) pathtracer->set_tile_server(tileServer, tileTimeout);
+
       set_up_pathtracer();
+      save_scene_cache();
       pathtracer->start_raytracing();
 
       while(!pathtracer->is_done()) {
         std::this_thread::sleep_for(std::chrono::milliseconds(5));
       }
 
-      pathtracer->save_image(saveFileLocation);
+      pathtracer->save_image(saveFileLocation, imageWriter);
+      imageWriter->flush();
+      if (checkpointed) {
+        pathtracer->set_checkpoint("", 0, false);
+        remove(checkpoint.c_str());
+      }
+      if (!tileServer.empty()) pathtracer->set_tile_server("", tileTimeout);
+    }
+
+    void Application::render_tiles_for(const std::string& address) {
+      set_up_pathtracer();
+      save_scene_cache();
+      pathtracer->render_remote_tiles(address);
+    }
+
+    // a frame converted to a static scene, waiting to be rendered
+    struct PreparedFrame {
+      int frame;
+      StaticScene::Scene *scene;
+      PrimitiveList *primitives;  ///< NULL for the first frame, built by set_scene
+      double prepTime;
+    };
+
+    void Application::render_animation(int start, int end, std::string prefix) {
+      if (end < start) return;
+
+      // The dynamic scene is only read by the preparation thread from here on:
+      // the GUI is not running, so nothing advances the simulation meanwhile.
+      // The render threads only see the static scenes handed over by the queue.
+      BoundedQueue<PreparedFrame> prepared(framesInFlight);
+      std::thread prepThread([&]() {
+        for (int f = start; f <= end; f++) {
+          Timer timer;
+          timer.start();
+          PreparedFrame next;
+          next.frame = f;
+          next.scene = scene->get_transformed_static_scene(f, camera.shutter_open(),
+                                                           camera.shutter_close());
+          next.primitives = NULL;
+          if (f != start) {
+            next.primitives = new PrimitiveList();
+            for (StaticScene::SceneObject *obj : next.scene->objects) {
+              obj->get_primitives(next.primitives);
+            }
+          }
+          timer.stop();
+          next.prepTime = timer.duration();
+          prepared.push(next);
+        }
+        prepared.close();
+      });
+
+      pathtracer->stop();
+      pathtracer->clear();
+      pathtracer->set_camera(&camera);
+      pathtracer->set_frame_size(screenW, screenH);
+
+      Timer total;
+      total.start();
+      PreparedFrame frame;
+      int frames = 0;
+      while (prepared.pop(&frame)) {
+        Timer timer;
+        timer.start();
+        if (frame.primitives == NULL) {
+          pathtracer->set_scene(frame.scene);
+        } else {
+          pathtracer->update_scene(frame.scene, frame.primitives);
+        }
+        timer.stop();
+        double accelTime = timer.duration();
+
+        timer.start();
+        pathtracer->start_raytracing();
+        while (!pathtracer->is_done()) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        timer.stop();
+
+        char num[32];
+        sprintf(num, "%04d", frame.frame);
+        pathtracer->save_image(prefix + num + string(".") + frameFormat, imageWriter);
+        pathtracer->stop();
+        frames++;
+
+        fprintf(stdout, "[Animator] Frame %d: prepare %.4f sec, accelerators %.4f sec, render %.4f sec\n",
+                frame.frame, frame.prepTime, accelTime, timer.duration());
+      }
+      prepThread.join();
+      imageWriter->flush();
+      total.stop();
+
+      fprintf(stdout, "[Animator] Rendered %d frames in %.2f sec (%.2f frames per minute)\n",
+              frames, total.duration(), frames * 60.0 / total.duration());
     }
 
 }  // namespace PROJ6850
\ No newline at end of file
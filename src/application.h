@@ -31,6 +31,7 @@
 #include "static_scene/scene.h"
 #include "pathtracer.h"
 #include "image.h"
+#include "image_writer.h"
 
 // Animator
 #include "timeline.h"
@@ -55,6 +56,21 @@ namespace PROJ6850 {
           pathtracer_num_threads = 1;
           pathtracer_envmap = NULL;
           pathtracer_result_path = "";
+
+          pathtracer_frame_start = -1;
+          pathtracer_frame_end = -1;
+          pathtracer_frames_in_flight = 2;
+          pathtracer_shutter = 0;
+          pathtracer_frame_format = "png";
+          pathtracer_writer_threads = 2;
+          pathtracer_aovs = 0;
+          pathtracer_denoise = false;
+          pathtracer_checkpoint_interval = 0;
+          pathtracer_resume = false;
+          pathtracer_tile_server = "";
+          pathtracer_tile_worker = "";
+          pathtracer_tile_timeout = 300;
+          pathtracer_scene_cache = "";
         }
 
         size_t pathtracer_ns_aa;
@@ -66,6 +82,22 @@ namespace PROJ6850 {
         size_t pathtracer_num_threads;
         HDRImageBuffer* pathtracer_envmap;
         std::string pathtracer_result_path;
+
+        int pathtracer_frame_start;          ///< first frame of a batch render, -1 for none
+        int pathtracer_frame_end;            ///< last frame of a batch render
+        size_t pathtracer_frames_in_flight;  ///< frames prepared or encoded ahead of the render
+        double pathtracer_shutter;           ///< shutter interval of animation frames, in frames
+        std::string pathtracer_frame_format; ///< file extension of animation frames: png, exr or pfm
+        size_t pathtracer_writer_threads;    ///< number of images encoded at the same time
+        ImageWriter::Options pathtracer_image_options;  ///< how EXR images are stored
+        unsigned pathtracer_aovs;            ///< AOV channels saved with EXR renders
+        bool pathtracer_denoise;             ///< denoise renders once all their tiles are done
+        double pathtracer_checkpoint_interval;  ///< seconds between checkpoints of -w renders, 0 for none
+        bool pathtracer_resume;              ///< resume -w renders from their checkpoint
+        std::string pathtracer_tile_server;  ///< address -w renders serve tiles on, "" for none
+        std::string pathtracer_tile_worker;  ///< address of the server to render tiles for, "" for none
+        double pathtracer_tile_timeout;      ///< seconds a tile worker may take to return a tile
+        std::string pathtracer_scene_cache;  ///< scene cache of -w renders and tile workers, "" for none
     };
 
     class Application : public Renderer {
@@ -87,7 +119,13 @@ namespace PROJ6850 {
         void keyboard_event(int key, int event, unsigned char mods);
         void char_event(unsigned int codepoint);
 
-        void load(Collada::SceneInfo* sceneInfo);
+        /**
+         * Load a parsed scene.
+         * \param render_only whether the scene is only rendered by the path
+         *        tracer, in which case its meshes go straight to triangle
+         *        buffers without halfedge meshes, and are not shown or edited
+         */
+        void load(Collada::SceneInfo* sceneInfo, bool render_only = false);
         void writeScene(const char* filename);
         void loadScene(const char* filename);
 
@@ -96,6 +134,38 @@ namespace PROJ6850 {
 
         void render_scene(std::string saveFileLocation);
 
+        /**
+         * Render tiles handed out by the tile server of another process until
+         * its render is done. The other process must render the same scene
+         * with the same settings.
+         * \param address address of the tile server
+         */
+        void render_tiles_for(const std::string& address);
+
+        /**
+         * Load the scene of a headless render from a scene cache instead of
+         * the scene file. If the cache is missing or stale, the scene must be
+         * loaded with load() and the cache is written once its BVH is built.
+         * Either way, the scene can only be rendered, not edited.
+         * \param filename scene cache
+         * \param key key of the scene file, see SceneCache::key
+         * \return whether the scene was loaded from the cache
+         */
+        bool load_scene_cache(const std::string& filename, uint64_t key);
+
+        /**
+         * Render a range of animation frames to disk without the GUI.
+         * Frames are pipelined: while frame N renders, a background thread
+         * converts the scene of the next frames and collects their primitives,
+         * and the image writer encodes the previous frames. At most
+         * framesInFlight frames are prepared ahead and waiting to be encoded.
+         * \param start first frame
+         * \param end last frame, included
+         * \param prefix path prefix of the frame images, which are named
+         *        prefix0000.ext with the configured frame format
+         */
+        void render_animation(int start, int end, std::string prefix);
+
     private:
         // Mode determines which type of data is visualized/
         // which mode we're currently in (e.g., modeling vs. rendering vs. animation)
@@ -137,11 +207,28 @@ namespace PROJ6850 {
         void to_pose_action();
         void cycle_edit_action();
         void set_up_pathtracer();
+        void save_scene_cache();  ///< write the scene cache if the scene was parsed
         void raytrace_video();
         void rasterize_video();
 
         DynamicScene::Scene* scene;
         PathTracer* pathtracer;
+        ImageWriter* imageWriter;  ///< saves video frames off the main thread
+        size_t framesInFlight;     ///< bound of the frame pipeline queues
+        std::string frameFormat;   ///< file extension of batch rendered frames
+        double checkpointInterval; ///< seconds between checkpoints of render_scene, 0 for none
+        bool resumeRender;         ///< resume render_scene from its checkpoint
+        std::string tileServer;    ///< address render_scene serves tiles on, "" for none
+        std::string sceneCacheFile;   ///< scene cache of headless renders, "" for none
+        uint64_t sceneCacheKey;       ///< key of the scene file
+        SceneCache* sceneCache;       ///< cache the scene was loaded from, NULL if parsed
+        SceneCache::View view;        ///< camera as set up by load(), for the scene cache
+        double tileTimeout;        ///< seconds a tile worker may take to return a tile
+        size_t loadThreads;        ///< threads parsing and building the meshes of a scene,
+                                   ///< subdividing and remeshing them, and
+                                   ///< skinning them to the skeleton
+        std::vector<StaticScene::Mesh*> renderMeshes;  ///< meshes of a render-only scene,
+                                                       ///< handed to the first static scene
 
         // View Frustrum Variables.
         // On resize, the aspect ratio is changed. On reset_camera, the position and
@@ -189,7 +276,7 @@ namespace PROJ6850 {
         DynamicScene::SceneObject* init_sphere(Collada::SphereInfo& polymesh,
                                                const Matrix4x4& transform);
         DynamicScene::SceneObject* init_polymesh(Collada::PolymeshInfo& polymesh,
-                                                 const Matrix4x4& transform);
+                                                 HalfedgeMesh& built);
         void init_material(Collada::MaterialInfo& material);
 
         void set_scroll_rate();
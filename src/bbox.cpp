@@ -34,6 +34,26 @@ bool BBox::intersect(const Ray &r, double &t0, double &t1) const {
   return true;
 }
 
+bool BBoxf::intersect(const Rayf &r, float &t0, float &t1) const {
+  // Same slab test as BBox::intersect, in single precision.
+  t0 = r.min_t, t1 = r.max_t;
+  for (int i = 0; i < 3; i++) {
+    float t_small = (min[i] - r.o[i]) * r.inv_d[i];
+    float t_large = (max[i] - r.o[i]) * r.inv_d[i];
+    if (t_small > t_large)
+      std::swap(t_small, t_large);
+
+    if (t_small > t0)
+      t0 = t_small;
+    if (t_large < t1)
+      t1 = t_large;
+    if (t0 > t1)
+      return false;
+  }
+
+  return true;
+}
+
 void BBox::draw(Color c) const {
   glColor4f(c.r, c.g, c.b, c.a);
 
@@ -68,8 +88,16 @@ void BBox::draw(Color c) const {
   glEnd();
 }
 
+void BBoxf::draw(Color c) const {
+  BBox(min.toVector3D(), max.toVector3D()).draw(c);
+}
+
 std::ostream &operator<<(std::ostream &os, const BBox &b) {
   return os << "BBOX(" << b.min << ", " << b.max << ")";
 }
 
+std::ostream &operator<<(std::ostream &os, const BBoxf &b) {
+  return os << "BBOX(" << b.min << ", " << b.max << ")";
+}
+
 }  // namespace PROJ6850
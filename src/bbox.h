@@ -164,7 +164,148 @@ struct BBox {
 
 };
 
+/**
+  * Single precision axis-aligned bounding box.
+  * Same interface as BBox, used by the render core (primitives and accelerator
+  * nodes) so box tests run in float against Rayf.
+  */
+struct BBoxf {
+  Vec3f max;     ///< max corner of the bounding box
+  Vec3f min;     ///< min corner of the bounding box
+  Vec3f extent;  ///< extent of the bounding box (min -> max)
+
+  /**
+    * Constructor.
+    * The default constructor creates a new bounding box which contains no
+    * points.
+    */
+  BBoxf() {
+    max = Vec3f(-INF_F, -INF_F, -INF_F);
+    min = Vec3f(INF_F, INF_F, INF_F);
+    extent = max - min;
+  }
+
+  /**
+    * Constructor.
+    * Creates a bounding box that includes a single point.
+    */
+  BBoxf(const Vec3f &p) : max(p), min(p) { extent = max - min; }
+
+  /**
+    * Constructor.
+    * Creates a bounding box with given bounds.
+    * \param min the min corner
+    * \param max the max corner
+    */
+  BBoxf(const Vec3f &min, const Vec3f &max) : max(max), min(min) {
+    extent = max - min;
+  }
+
+  /**
+    * Constructor.
+    * Rounds a double precision bounding box outwards so that the result still
+    * encloses everything the original did.
+    */
+  explicit BBoxf(const BBox &b) {
+    for (int i = 0; i < 3; i++) {
+      min[i] = std::nextafter((float)b.min[i], -INF_F);
+      max[i] = std::nextafter((float)b.max[i], INF_F);
+    }
+    extent = max - min;
+  }
+
+  /**
+    * Expand the bounding box to include another (union).
+    * \param bbox the bounding box to be included
+    */
+  void expand(const BBoxf &bbox) {
+    min.x = std::min(min.x, bbox.min.x);
+    min.y = std::min(min.y, bbox.min.y);
+    min.z = std::min(min.z, bbox.min.z);
+    max.x = std::max(max.x, bbox.max.x);
+    max.y = std::max(max.y, bbox.max.y);
+    max.z = std::max(max.z, bbox.max.z);
+    extent = max - min;
+  }
+
+  /**
+    * Expand the bounding box to include a new point in space.
+    * \param p the point to be included
+    */
+  void expand(const Vec3f &p) {
+    min.x = std::min(min.x, p.x);
+    min.y = std::min(min.y, p.y);
+    min.z = std::min(min.z, p.z);
+    max.x = std::max(max.x, p.x);
+    max.y = std::max(max.y, p.y);
+    max.z = std::max(max.z, p.z);
+    extent = max - min;
+  }
+
+  void intersect(const BBoxf& bbox) {
+    for (int i = 0; i < 3; i++)  {
+      min[i] = std::max(min[i], bbox.min[i]);
+      max[i] = std::min(max[i], bbox.max[i]);
+    }
+  }
+
+  Vec3f centroid() const { return (min + max) / 2; }
+
+  /**
+    * Compute the surface area of the bounding box.
+    * \return surface area of the bounding box.
+    */
+  float surface_area() const {
+    if (empty()) return 0.0f;
+    return 2 *
+           (extent.x * extent.z + extent.x * extent.y + extent.y * extent.z);
+  }
+
+  /**
+    * Check if bounding box is empty.
+    */
+  bool empty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+
+  /**
+    * Ray - bbox intersection.
+    * Intersects ray with bounding box, does not store shading information.
+    * \param r the ray to intersect with
+    * \param t0 lower bound of intersection time
+    * \param t1 upper bound of intersection time
+    */
+  bool intersect(const Rayf &r, float &t0, float &t1) const;
+
+  bool isInside(const Vec3f& p) const {
+    for (int i = 0; i < 3; i++){
+      if (p[i] < min[i])
+        return false;
+      if (p[i] > max[i])
+        return false;
+    }
+    return true;
+  }
+
+  /**
+    * Draw box wireframe with OpenGL.
+    * \param c color of the wireframe
+    */
+  void draw(Color c) const;
+
+  /**
+    * \return longest axis of this boundingbox
+    */
+  int longestDimension() const {
+    if (extent.x > extent.y && extent.x > extent.z) {
+      return 0;
+    } else if (extent.y > extent.z) {
+      return 1;
+    } else
+      return 2;
+  }
+};
+
 std::ostream &operator<<(std::ostream &os, const BBox &b);
+std::ostream &operator<<(std::ostream &os, const BBoxf &b);
 
 }  // namespace PROJ6850
 
@@ -42,6 +42,8 @@ namespace PROJ6850 {
 
     void make_coord_space(Matrix3x3& o2w, const Vector3D& n);
 
+    class SceneCache;
+
 /**
  * Interface for BSDFs.
  */
@@ -87,6 +89,12 @@ namespace PROJ6850 {
          */
         virtual bool is_delta() const = 0;
 
+        /**
+         * Get the albedo of the surface material, the color it reflects or
+         * transmits, in [0, 1]. Used for the albedo AOV.
+         */
+        virtual Spectrum get_albedo() const { return rasterize_color; }
+
         /**
          * Reflection helper
          */
@@ -114,6 +122,7 @@ namespace PROJ6850 {
         bool is_delta() const { return false; }
 
     private:
+        friend class SceneCache;
         Spectrum albedo;
         CosineWeightedHemisphereSampler3D sampler;
 
@@ -134,6 +143,7 @@ namespace PROJ6850 {
         bool is_delta() const { return true; }
 
     private:
+        friend class SceneCache;
         float roughness;
         Spectrum reflectance;
 
@@ -177,6 +187,7 @@ Spectrum reflectance;
         bool is_delta() const { return true; }
 
     private:
+        friend class SceneCache;
         float ior;
         float roughness;
         Spectrum transmittance;
@@ -203,6 +214,7 @@ Spectrum reflectance;
         bool is_delta() const { return true; }
 
     private:
+        friend class SceneCache;
         float ior;
         float roughness;
         Spectrum reflectance;
@@ -221,8 +233,14 @@ Spectrum reflectance;
         Spectrum sample_f(const Vector3D& wo, Vector3D* wi, float* pdf);
         Spectrum get_emission() const { return radiance; }
         bool is_delta() const { return false; }
+        Spectrum get_albedo() const {
+          // color of the light, normalized to the albedo range
+          float peak = std::max(radiance.r, std::max(radiance.g, radiance.b));
+          return peak > 0 ? radiance * (1.0f / peak) : Spectrum();
+        }
 
     private:
+        friend class SceneCache;
         Spectrum radiance;
         CosineWeightedHemisphereSampler3D sampler;
 
@@ -4,6 +4,7 @@
 
 #include <stack>
 #include <cassert>
+#include <algorithm>
 
 using namespace std;
 
@@ -11,56 +12,255 @@ namespace PROJ6850 {
     namespace StaticScene {
 
 
-        BVHAccel::BVHAccel(const std::vector<Primitive *> &_primitives, size_t max_leaf_size) {
+        // SAH cost of a traversal step relative to one ray - primitive test
+        static const float SAH_TRAVERSAL_COST = 0.125f;
+
+        BVHAccel::BVHAccel(const PrimitiveList &_primitives, size_t max_leaf_size) {
 
 //           Construct a BVH from the given vector of primitives and maximum leaf
 //           size configuration. The starter code build a BVH aggregate with a
 //           single leaf node (which is also the root) that encloses all the
 //           primitives.
-          size_t totalNodeBuilt = 0;
-          std::vector<Primitive *> orderedPrimitives;
-          orderedPrimitives.reserve(_primitives.size());
+          primitiveList = &_primitives;
+          primitives = _primitives.get_ids();
+          maxLeafSize = max_leaf_size;
           TreeStat stat = {};
-          root = recursiveBuild(0, _primitives.size(), totalNodeBuilt, orderedPrimitives, _primitives, max_leaf_size, 0, stat);
-          std::printf("Primitive Size: %d\n", _primitives.size());
-          std::printf("\n--------------------\nStatistics of BVH:\nTotal Nodes: %d\n Total Leaf Nodes: %d\n Total Leaf Triangles: %d\n Level: %d\n", stat.totalNodes, stat.totalLeafNodes, stat.totalLeafTriangles, stat.maxLevel);
-          assert(root->range == _primitives.size());
+          build(stat);
+          std::printf("Primitive Size: %zu\n", _primitives.size());
+          std::printf("\n--------------------\nStatistics of BVH:\nTotal Nodes: %d\n Total Leaf Nodes: %d\n Total Leaf Triangles: %d\n Level: %d\n Node Memory: %.2f MB (%.2f MB reserved)\n", stat.totalNodes, stat.totalLeafNodes, stat.totalLeafTriangles, stat.maxLevel,
+                      arena.used() / (1024.0 * 1024.0), arena.reserved() / (1024.0 * 1024.0));
+
+
+        }
+
+        BVHAccel::BVHAccel(const PrimitiveList &_primitives, const FlatNode *nodes, size_t num_nodes,
+                           const PrimitiveID *ids, size_t max_leaf_size) {
+          primitiveList = &_primitives;
+          primitives.assign(ids, ids + nodes[0].range);
+          maxLeafSize = max_leaf_size;
+          arena.reset();
+          root = unflatten(nodes, num_nodes, 0);
+
+          float area = root->bb.surface_area();
+          sahCost = area > 0 ? subtreeCost(root, false, false, 0, NULL) / area : 0;
+          builtArenaBytes = arena.used();
+        }
+
+        AccelNode *BVHAccel::unflatten(const FlatNode *nodes, size_t num_nodes, uint32_t i) {
+          assert(i < num_nodes);
+          const FlatNode &flat = nodes[i];
+          BBoxf bb(Vec3f(flat.min[0], flat.min[1], flat.min[2]),
+                   Vec3f(flat.max[0], flat.max[1], flat.max[2]));
+          AccelNode *node = arena.create<AccelNode>(bb, flat.start, flat.range);
+          node->sah = flat.sah;
+          if (flat.right) {
+            // children come after their parent, which also rules out cycles
+            assert(flat.right > i + 1 && flat.right < num_nodes);
+            node->l = unflatten(nodes, num_nodes, i + 1);
+            node->r = unflatten(nodes, num_nodes, flat.right);
+          }
+          return node;
+        }
+
+        void BVHAccel::flatten(std::vector<FlatNode> *nodes) const {
+          std::stack<std::pair<const AccelNode*, size_t> > todo;  // node, index of its parent
+          todo.push(std::make_pair(root, (size_t) -1));
+          while (!todo.empty()) {
+            const AccelNode *node = todo.top().first;
+            size_t parent = todo.top().second;
+            todo.pop();
+            // only right children wait on the stack, the left ones follow their parent
+            if (parent != (size_t) -1) (*nodes)[parent].right = nodes->size();
+
+            FlatNode flat;
+            for (int k = 0; k < 3; k++) {
+              flat.min[k] = node->bb.min[k];
+              flat.max[k] = node->bb.max[k];
+            }
+            flat.start = node->start;
+            flat.range = node->range;
+            flat.right = 0;
+            flat.sah = node->sah;
+            size_t index = nodes->size();
+            nodes->push_back(flat);
+            if (!node->isLeaf()) {
+              todo.push(std::make_pair(node->r, index));
+              todo.push(std::make_pair(node->l, (size_t) -1));
+            }
+          }
+        }
+
+        void BVHAccel::build(TreeStat &stat) {
+          arena.reset();
+          size_t totalNodeBuilt = 0;
+          std::vector<PrimitiveID> orderedPrimitives;
+          orderedPrimitives.reserve(primitives.size());
+          root = recursiveBuild(0, primitives.size(), totalNodeBuilt, orderedPrimitives, primitives, maxLeafSize, 0, stat);
+          assert(root->range == primitives.size());
           assert(orderedPrimitives.size() == root->range);
-          primitives = orderedPrimitives;
+          primitives.swap(orderedPrimitives);
+
+          float cost = subtreeCost(root, false, true, 0, NULL);
+          float area = root->bb.surface_area();
+          sahCost = area > 0 ? cost / area : 0;
+          builtArenaBytes = arena.used();
+        }
+
+        float BVHAccel::subtreeCost(AccelNode *node, bool refitBounds, bool record,
+                                    float threshold, std::vector<AccelNode*> *degraded) {
+          // every node costs a traversal step and every leaf primitive a test,
+          // weighted by the surface area of the node they belong to
+          float cost;
+          bool degradedBelow = false;
+          if (node->isLeaf()) {
+            if (refitBounds) {
+              BBoxf bb;
+              for (size_t i = node->start; i < node->start + node->range; i++) {
+                bb.expand(primitiveList->get_bbox(primitives[i]));
+              }
+              node->bb = bb;
+              if (node->motion) {
+                *node->motion = motionBounds(node->start, node->start + node->range, primitives);
+              }
+            }
+            cost = node->range ? node->bb.surface_area() * node->range : 0;
+          } else {
+            size_t flagged = degraded ? degraded->size() : 0;
+            cost = subtreeCost(node->l, refitBounds, record, threshold, degraded) +
+                   subtreeCost(node->r, refitBounds, record, threshold, degraded);
+            if (refitBounds) {
+              node->bb = node->l->bb;
+              node->bb.expand(node->r->bb);
+              if (node->motion) {
+                *node->motion = *node->l->motion;
+                node->motion->open.expand(node->r->motion->open);
+                node->motion->close.expand(node->r->motion->close);
+              }
+            }
+            cost += SAH_TRAVERSAL_COST * node->bb.surface_area();
+            degradedBelow = degraded && degraded->size() > flagged;
+          }
+
+          float area = node->bb.surface_area();
+          float costPerArea = area > 0 ? cost / area : node->range;
+          if (record) {
+            node->sah = costPerArea;
+          } else if (degraded && !node->isLeaf() && !degradedBelow &&
+                     costPerArea > threshold * node->sah) {
+            // only the lowest degraded nodes are kept, their ancestors are
+            // checked again once these are rebuilt
+            degraded->push_back(node);
+          }
+          return cost;
+        }
+
+        size_t BVHAccel::update(const PrimitiveList &_primitives,
+                                float partial_rebuild_ratio, float full_rebuild_ratio) {
+          primitiveList = &_primitives;
+          std::vector<AccelNode*> degraded;
+          float cost = subtreeCost(root, true, false, partial_rebuild_ratio, &degraded);
+          float area = root->bb.surface_area();
+          sahCost = area > 0 ? cost / area : 0;
+
+          // rebuilt subtrees leave the nodes they replace in the arena, so the
+          // tree starts over once they take as much room as the tree itself
+          if (sah_ratio() > full_rebuild_ratio || arena.used() > 2 * builtArenaBytes) {
+            TreeStat stat = {};
+            build(stat);
+            return primitives.size();
+          }
+
+          size_t rebuilt = 0;
+          for (AccelNode *node : degraded) {
+            rebuildSubtree(node);
+            rebuilt += node->range;
+          }
+          if (rebuilt) {
+            cost = subtreeCost(root, false, false, 0, NULL);
+            sahCost = area > 0 ? cost / area : 0;
+          }
+          return rebuilt;
+        }
 
+        void BVHAccel::rebuildSubtree(AccelNode *node) {
+          std::vector<PrimitiveID> originalPrimitives(primitives.begin() + node->start,
+                                                      primitives.begin() + node->start + node->range);
+          std::vector<PrimitiveID> orderedPrimitives;
+          orderedPrimitives.reserve(node->range);
+          size_t totalNodeBuilt = 0;
+          TreeStat stat = {};
+          AccelNode *subtree = recursiveBuild(0, originalPrimitives.size(), totalNodeBuilt, orderedPrimitives,
+                                              originalPrimitives, maxLeafSize, 0, stat);
+          assert(orderedPrimitives.size() == node->range);
+          std::copy(orderedPrimitives.begin(), orderedPrimitives.end(), primitives.begin() + node->start);
+
+          // the new nodes index from the start of the rebuilt range
+          std::stack<AccelNode*> nodes;
+          nodes.push(subtree);
+          while (!nodes.empty()) {
+            AccelNode *current = nodes.top();
+            nodes.pop();
+            current->start += node->start;
+            if (current->l) nodes.push(current->l);
+            if (current->r) nodes.push(current->r);
+          }
 
+          // take the place of the old root so that its parent stays valid
+          *node = *subtree;
+          subtreeCost(node, false, true, 0, NULL);
         }
 
-        double  findSplitPlane(const std::vector<Primitive *> & originalPrimitives, int start, int end, int  splitAxis) {
+        float BVHAccel::sah_cost() const {
+          return sahCost;
+        }
+
+        float BVHAccel::sah_ratio() const {
+          return root->sah > 0 ? sahCost / root->sah : 1.0f;
+        }
+
+        MotionBounds BVHAccel::motionBounds(size_t start, size_t end,
+                                            const std::vector<PrimitiveID> &ids) const {
+          BBoxf open, close;
+          for (size_t i = start; i < end; i++) {
+            open.expand(primitiveList->get_bbox(ids[i], 0.0f));
+            close.expand(primitiveList->get_bbox(ids[i], 1.0f));
+          }
+          return MotionBounds(open, close);
+        }
+
+        float  findSplitPlane(const PrimitiveList* primitiveList, const std::vector<PrimitiveID> & originalPrimitives, int start, int end, int  splitAxis) {
           // Use naive sorting for split plane
-          std::vector<double> vals;
+          std::vector<float> vals;
           for (int idx = start ; idx < end; idx++) {
-            BBox elemBBox = originalPrimitives[idx]->get_bbox();
+            BBoxf elemBBox = primitiveList->get_bbox(originalPrimitives[idx]);
             vals.emplace_back(elemBBox.centroid()[splitAxis]);
           }
 
           std::sort(vals.begin(), vals.end());
           if (vals.size() % 2 == 0) {
             // use middle value
-            return (vals[vals.size() / 2] + vals[vals.size() / 2 - 1]) / 2.0;
+            return (vals[vals.size() / 2] + vals[vals.size() / 2 - 1]) / 2.0f;
           } else {
             return vals[vals.size() / 2];
           }
         }
 
         AccelNode *BVHAccel::recursiveBuild(size_t start, size_t end, size_t &totalNodesBuild,
-                                            std::vector<Primitive *> &orderedPrimitives,
-                                            const std::vector<Primitive *> &originalPrimitives,
+                                            std::vector<PrimitiveID> &orderedPrimitives,
+                                            const std::vector<PrimitiveID> &originalPrimitives,
                                             size_t max_leaf_size, int level, TreeStat& treeStat) {
           treeStat.totalNodes++;
           treeStat.maxLevel = std::max(treeStat.maxLevel, level);
           size_t range = end - start;
 
-          BBox boundBox; // boundBox for all primitives in this range
+          BBoxf boundBox; // boundBox for all primitives in this range
           for (size_t i = start; i < end; i++) {
-            boundBox.expand(originalPrimitives[i]->get_bbox());
+            boundBox.expand(primitiveList->get_bbox(originalPrimitives[i]));
+          }
+          AccelNode *thisNode = arena.create<AccelNode>(boundBox, orderedPrimitives.size(), range);
+          if (primitiveList->has_motion()) {
+            thisNode->motion = arena.create<MotionBounds>(motionBounds(start, end, originalPrimitives));
           }
-          AccelNode *thisNode = new AccelNode(boundBox, orderedPrimitives.size(), range);
            if (range <= max_leaf_size) {
             // Leafnode
             for (size_t i = start; i < end; i++) {
@@ -74,10 +274,10 @@ namespace PROJ6850 {
           // interior node, needs recursive call
           // compute bounding box for all primitives' centroid, choose split dimension
           // according to the axis that has maximum bounding box extent
-          BBox boundCentroidAll;
+          BBoxf boundCentroidAll;
           int splitDimension;
           for (size_t i = start; i < end; i++) {
-            boundCentroidAll.expand(originalPrimitives[i]->get_bbox().centroid());
+            boundCentroidAll.expand(primitiveList->get_bbox(originalPrimitives[i]).centroid());
           }
           splitDimension = boundCentroidAll.longestDimension();
 
@@ -88,8 +288,8 @@ namespace PROJ6850 {
             struct BucketInfo {
                 BucketInfo() { count = 0; }
                 int count;
-                BBox bound;
-                std::vector<Primitive *> prims;
+                BBoxf bound;
+                std::vector<PrimitiveID> prims;
             };
             BucketInfo buckets[BUCKET_NUM];
             for (int i = 0; i < BUCKET_NUM; i++) {
@@ -97,24 +297,24 @@ namespace PROJ6850 {
               buckets[i].prims.reserve(range);
             }
             // put primitives into corresponding bucket
-            double maxDimensionRange = boundCentroidAll.extent[splitDimension];
+            float maxDimensionRange = boundCentroidAll.extent[splitDimension];
             for (size_t i = start; i < end; i++) {
               int bucketIndex =
-                      (int) (BUCKET_NUM * ((originalPrimitives[i]->get_bbox().centroid()[splitDimension] -
+                      (int) (BUCKET_NUM * ((primitiveList->get_bbox(originalPrimitives[i]).centroid()[splitDimension] -
                                             boundCentroidAll.min[splitDimension])
                                            / maxDimensionRange));
               if (bucketIndex >= BUCKET_NUM)
                 bucketIndex = BUCKET_NUM - 1;
-              buckets[bucketIndex].bound.expand(originalPrimitives[i]->get_bbox());
+              buckets[bucketIndex].bound.expand(primitiveList->get_bbox(originalPrimitives[i]));
               buckets[bucketIndex].count++;
               buckets[bucketIndex].prims.push_back(originalPrimitives[i]);
             }
 
             // find the best bucket for partition
-            double cost[BUCKET_NUM - 1];
+            float cost[BUCKET_NUM - 1];
             std::fill_n(cost, BUCKET_NUM - 1, 0.0f);
             for (int i = 0; i < BUCKET_NUM - 1; i++) {
-              BBox leftBox, rightBox;
+              BBoxf leftBox, rightBox;
               int pLEFT = 0, pRIGHT = 0;
               for (int j = 0; j <= i; j++) {
                 leftBox.expand(buckets[j].bound);
@@ -125,7 +325,7 @@ namespace PROJ6850 {
                 rightBox.expand(buckets[j].bound);
                 pRIGHT++;
               }
-              cost[i] = 0.125 + (pLEFT * leftBox.surface_area() + pRIGHT * rightBox.surface_area()) / boundBox.surface_area();
+              cost[i] = 0.125f + (pLEFT * leftBox.surface_area() + pRIGHT * rightBox.surface_area()) / boundBox.surface_area();
             }
 
             size_t minBucketSplit = 0;
@@ -140,7 +340,7 @@ namespace PROJ6850 {
             // split primitives
             AccelNode *leftNode, *rightNode;
             if (cost[minBucketSplit] < range) {
-              std::vector<Primitive *> left, right;
+              std::vector<PrimitiveID> left, right;
               size_t countLeft = 0;
               for (int i = 0; i <= minBucketSplit; i++) {
                 countLeft += buckets[i].count;
@@ -170,11 +370,11 @@ namespace PROJ6850 {
             thisNode->r = rightNode;
 
           } else {
-            double medianOnAxis = findSplitPlane(originalPrimitives, start, end, splitDimension);
+            float medianOnAxis = findSplitPlane(primitiveList, originalPrimitives, start, end, splitDimension);
             AccelNode *leftNode, *rightNode;
-            std::vector<Primitive *> left, right;
+            std::vector<PrimitiveID> left, right;
             for (int i = start; i < end; i++) {
-              if (originalPrimitives[i]->get_bbox().centroid()[splitDimension] < medianOnAxis) {
+              if (primitiveList->get_bbox(originalPrimitives[i]).centroid()[splitDimension] < medianOnAxis) {
                 left.emplace_back(originalPrimitives[i]);
               } else {
                 right.emplace_back(originalPrimitives[i]);
@@ -206,10 +406,10 @@ namespace PROJ6850 {
 
 
 
-        void BVHAccel::traverse(const Ray &ray, AccelNode *currentNode, Intersection *isect, bool &hits, RenderingStat& renderingStat) const {
+        void BVHAccel::traverse(const Rayf &ray, AccelNode *currentNode, Intersection *isect, bool &hits, RenderingStat& renderingStat) const {
           renderingStat.totalVisitedNodes++;
-          double t0 = 0, t1 = 0;
-          if (currentNode == nullptr || !currentNode->bb.intersect(ray, t0, t1)) {
+          float t0 = 0, t1 = 0;
+          if (currentNode == nullptr || !currentNode->intersect(ray, t0, t1)) {
 
             return;
           }
@@ -223,16 +423,16 @@ namespace PROJ6850 {
 //            printf("this is a leaf node");
             for (size_t i = currentNode->start; i < currentNode->start + currentNode->range; i++) {
                renderingStat.totalRayTriangleTest++;
-              if (((isect != nullptr) && primitives[i]->intersect(ray, isect)) ||
-                  ((isect == nullptr) && primitives[i]->intersect(ray))) {
+              if (((isect != nullptr) && primitiveList->intersect(primitives[i], ray, isect)) ||
+                  ((isect == nullptr) && primitiveList->intersect(primitives[i], ray))) {
                 hits = true;
               }
             }
           } else {
-            double tminLeft = 0, tmaxLeft = 0, tminRight = 0, tmaxRight = 0;
-            bool leftIntersect = (currentNode->l != nullptr) && (currentNode->l->bb.intersect(ray, tminLeft, tmaxLeft));
+            float tminLeft = 0, tmaxLeft = 0, tminRight = 0, tmaxRight = 0;
+            bool leftIntersect = (currentNode->l != nullptr) && (currentNode->l->intersect(ray, tminLeft, tmaxLeft));
             bool rightIntersect =
-                    (currentNode->r != nullptr) && (currentNode->r->bb.intersect(ray, tminRight, tmaxRight));
+                    (currentNode->r != nullptr) && (currentNode->r->intersect(ray, tminRight, tmaxRight));
 
             // first traverse the node that has closer hit
             if (leftIntersect && rightIntersect) { //traversal optimization
@@ -251,7 +451,8 @@ namespace PROJ6850 {
           }
         }
 
-        bool BVHAccel::intersect(const Ray &ray, Intersection *isect, RenderingStat& renderingStat) const {
+        bool BVHAccel::intersect(const Rayf &ray, Intersection *isect, RenderingStat& renderingStat) const {
+          renderingStat.totalRays++;
           // Implement ray - bvh aggregate intersection test. A ray intersects
           // with a BVH aggregate if and only if it intersects a primitive in
           // the BVH that is not an aggregate. When an intersection does happen.
@@ -262,7 +463,7 @@ namespace PROJ6850 {
           return hit;
         }
 
-        bool BVHAccel::intersect(const Ray &ray, Intersection *isect) const {
+        bool BVHAccel::intersect(const Rayf &ray, Intersection *isect) const {
           // Implement ray - bvh aggregate intersection test. A ray intersects
           // with a BVH aggregate if and only if it intersects a primitive in
           // the BVH that is not an aggregate. When an intersection does happen.
@@ -276,7 +477,8 @@ namespace PROJ6850 {
           return hit;
         }
 
-        bool BVHAccel::intersect(const Ray &ray, RenderingStat& renderingStat) const {
+        bool BVHAccel::intersect(const Rayf &ray, RenderingStat& renderingStat) const {
+          renderingStat.totalRays++;
           // Implement ray - bvh aggregate intersection test. A ray intersects
           // with a BVH aggregate if and only if it intersects a primitive in
           // the BVH that is not an aggregate.
@@ -285,7 +487,7 @@ namespace PROJ6850 {
           return hit;
         }
 
-        bool BVHAccel::intersect(const Ray &ray) const {
+        bool BVHAccel::intersect(const Rayf &ray) const {
           // Implement ray - bvh aggregate intersection test. A ray intersects
           // with a BVH aggregate if and only if it intersects a primitive in
           // the BVH that is not an aggregate.
@@ -297,18 +499,8 @@ namespace PROJ6850 {
         }
 
 
-        void BVHAccel::recursiveDelete(AccelNode* node) {
-          if (node->isLeaf()) {
-            delete node;
-          } else {
-            recursiveDelete(node->l);
-            recursiveDelete(node->r);
-          }
-        }
-
         BVHAccel::~BVHAccel() {
-          // Implement a proper destructor for your BVH accelerator aggregate
-          recursiveDelete(root);
+          // nodes are owned by the arena, which frees them with its blocks
         }
 
 
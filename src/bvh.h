@@ -3,6 +3,7 @@
 
 #include "static_scene/scene.h"
 #include "static_scene/aggregate.h"
+#include "memory_arena.h"
 
 #include <vector>
 
@@ -19,22 +20,51 @@ namespace PROJ6850 {
  */
         class BVHAccel : public Aggregate {
         public:
+            /**
+             * A node stored flat, e.g. in a scene cache. Nodes are in depth
+             * first order: the left child of an inner node follows it and
+             * right is the index of its right child, 0 for a leaf.
+             */
+            struct FlatNode {
+                float min[3], max[3];  ///< bounding box
+                uint32_t start;        ///< start index into the primitive ids
+                uint32_t range;        ///< number of primitives below the node
+                uint32_t right;        ///< index of the right child, 0 for a leaf
+                float sah;             ///< see AccelNode::sah
+            };
+
             BVHAccel() {}
 
             /**
              * Parameterized Constructor.
              * Create BVH from a list of primitives. Note that the BVHAccel Aggregate
-             * stores pointers to the primitives and thus the primitives need be kept
+             * stores ids into the primitive list and thus the list needs be kept
              * in memory for the aggregate to function properly.
              * \param primitives primitives to build from
              * \param max_leaf_size maximum number of primitives to be stored in leaves
              */
-            BVHAccel(const std::vector<Primitive *> &primitives, size_t max_leaf_size = 4);
+            BVHAccel(const PrimitiveList &primitives, size_t max_leaf_size = 4);
+
+            /**
+             * Constructor.
+             * Restore a BVH saved with flatten() over the same primitive list,
+             * without building it again. The nodes and ids are trusted, see
+             * SceneCache for their validation.
+             * \param primitives primitives the BVH was built from
+             * \param nodes flattened nodes, the root first
+             * \param num_nodes number of nodes, the child indices are asserted
+             *        to stay below it
+             * \param ids primitive ids in the order the leaves index them
+             * \param max_leaf_size maximum leaf size it was built with
+             */
+            BVHAccel(const PrimitiveList &primitives, const FlatNode *nodes, size_t num_nodes,
+                     const PrimitiveID *ids, size_t max_leaf_size);
 
             /**
              * Destructor.
              * The destructor only destroys the Aggregate itself, the primitives that
-             * it contains are left untouched.
+             * it contains are left untouched. All nodes live in the node arena and
+             * are released at once.
              */
             ~BVHAccel();
 
@@ -42,7 +72,7 @@ namespace PROJ6850 {
              * Get the world space bounding box of the aggregate.
              * \return world space bounding box of the aggregate
              */
-            BBox get_bbox() const {
+            BBoxf get_bbox() const {
               return  root->bb;
             }
 
@@ -54,8 +84,8 @@ namespace PROJ6850 {
              * \return true if the given ray intersects with the aggregate,
                        false otherwise
              */
-            bool intersect(const Ray &r, RenderingStat& renderingStat) const;
-            bool intersect(const Ray &r) const;
+            bool intersect(const Rayf &r, RenderingStat& renderingStat) const;
+            bool intersect(const Rayf &r) const;
             /**
              * Ray - Aggregate intersection 2.
              * Check if the given ray intersects with the aggregate (any primitive in
@@ -69,8 +99,8 @@ namespace PROJ6850 {
              * \return true if the given ray intersects with the aggregate,
                        false otherwise
              */
-            bool intersect(const Ray &r, Intersection *i, RenderingStat& renderingStat) const;
-            bool intersect(const Ray &r, Intersection *i ) const;
+            bool intersect(const Rayf &r, Intersection *i, RenderingStat& renderingStat) const;
+            bool intersect(const Rayf &r, Intersection *i) const;
 
             /**
              * Get BSDF of the surface material
@@ -80,6 +110,46 @@ namespace PROJ6850 {
              */
             BSDF *get_bsdf() const { return NULL; }
 
+            /**
+             * Update the BVH after the primitives moved.
+             * The list must hold the same primitive ids as the one the BVH was
+             * built from, only their geometry may differ (e.g. the deformed
+             * vertices of an animated mesh). Node bounds are refitted bottom-up
+             * in a single pass and the SAH cost of the refitted tree is compared
+             * with its cost when built. Past full_rebuild_ratio the whole tree is
+             * rebuilt, otherwise the lowest subtrees whose cost grew past
+             * partial_rebuild_ratio are rebuilt in place.
+             * \param primitives list the ids now refer to
+             * \param partial_rebuild_ratio cost growth that triggers rebuilding a subtree
+             * \param full_rebuild_ratio cost growth that triggers rebuilding the tree
+             * \return number of primitives in rebuilt subtrees, 0 for a pure refit
+             */
+            size_t update(const PrimitiveList &primitives,
+                          float partial_rebuild_ratio = 1.3f,
+                          float full_rebuild_ratio = 2.0f);
+
+            /**
+             * SAH cost of the tree, in primitive tests per ray hitting the root.
+             */
+            float sah_cost() const;
+
+            /**
+             * SAH cost of the tree relative to its cost when it was built.
+             */
+            float sah_ratio() const;
+
+            /**
+             * Append the nodes of the tree in depth first order, see FlatNode.
+             * Bounds at shutter open and close are not kept, so the BVH of
+             * moving primitives cannot be flattened.
+             */
+            void flatten(std::vector<FlatNode> *nodes) const;
+
+            /**
+             * Maximum number of primitives in leaves.
+             */
+            size_t max_leaf_size() const { return maxLeafSize; }
+
             /**
              * Get entry point (root) - used in visualizer
              */
@@ -97,12 +167,22 @@ namespace PROJ6850 {
 
         private:
             AccelNode *root;  ///< root node of the BVH
+            size_t maxLeafSize;  ///< maximum number of primitives in leaves
+            size_t builtArenaBytes;  ///< arena usage after the last full build
+            float sahCost;  ///< current SAH cost of the tree, see sah_cost()
+            void build(TreeStat &treeStat);  ///< (re)build the whole tree over the current primitives
+            void rebuildSubtree(AccelNode *node);  ///< rebuild a subtree in place over its primitive range
+            MotionBounds motionBounds(size_t start, size_t end,
+                                      const std::vector<PrimitiveID> &ids) const;  ///< bounds of ids[start, end) at shutter open and close
+            float subtreeCost(AccelNode *node, bool refitBounds, bool record,
+                              float threshold, std::vector<AccelNode*> *degraded); ///< SAH cost of a subtree, optionally refitting it
             AccelNode *recursiveBuild(size_t start, size_t end, size_t &totalNodesBuild,
-                                      std::vector<Primitive *> &orderedPrimitives,
-                                      const std::vector<Primitive *> &originalPrimitives,
+                                      std::vector<PrimitiveID> &orderedPrimitives,
+                                      const std::vector<PrimitiveID> &originalPrimitives,
                                       size_t max_leaf_size, int level, TreeStat& treeStat); ///< helper function for recursively building BVH
-            void traverse(const Ray &ray, AccelNode* currentNode, Intersection *isect, bool &hits, RenderingStat& renderingStat) const;
-            void  recursiveDelete(AccelNode* node);
+            AccelNode *unflatten(const FlatNode *nodes, size_t num_nodes, uint32_t i);  ///< helper function for restoring flattened nodes
+            void traverse(const Rayf &ray, AccelNode* currentNode, Intersection *isect, bool &hits, RenderingStat& renderingStat) const;
+            MemoryArena arena;  ///< storage of all the nodes
 
         };  // namespace StaticScene
     };
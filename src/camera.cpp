@@ -108,7 +108,7 @@ namespace PROJ6850 {
       // to the world space view direction
     }
 
-    Ray Camera::generate_ray(double x, double y) const {
+    Ray Camera::generate_ray(double x, double y, double time) const {
       // compute position of the input sensor sample coordinate on the
       // canonical sensor plane one unit away from the pinhole.
 
@@ -121,7 +121,9 @@ namespace PROJ6850 {
       Vector3D d_camera = Vector3D(camera_x,camera_y ,-1); // technically should - o_camera but that's (0,0,0)
       Vector3D  d_world = c2w * d_camera;
       d_world.normalize();
-      return Ray(position(), d_world);
+      Ray r(position(), d_world);
+      r.time = time;
+      return r;
     }
 
 }  // namespace PROJ6850
\ No newline at end of file
@@ -16,6 +16,8 @@ namespace PROJ6850 {
  */
 class Camera {
  public:
+  Camera() : shutterOpen(0), shutterClose(0) {}
+
   /*
     Sets the field of view to match screen screenW/H.
     NOTE: data and screenW/H will almost certainly disagree about the aspect
@@ -68,6 +70,19 @@ class Camera {
   double near_clip() const { return nClip; }
   double far_clip() const { return fClip; }
 
+  /*
+    Sets the shutter interval, in frames relative to the frame being
+    rendered. An empty interval (the default) renders the instant of the
+    frame; e.g. [0, 0.5] is a 180 degree shutter.
+  */
+  void set_shutter(double open, double close) {
+    shutterOpen = open;
+    shutterClose = close;
+  }
+  double shutter_open() const { return shutterOpen; }
+  double shutter_close() const { return shutterClose; }
+  bool has_motion_blur() const { return shutterClose > shutterOpen; }
+
   /**
    * Returns a world-space ray from the camera that corresponds to a
    * ray exiting the camera that deposits light at the sensor plane
@@ -77,13 +92,17 @@ class Camera {
    *
    * \param x x-coordinate of the ray sample in the view plane
    * \param y y-coordinate of the ray sample in the view plane
+   * \param time time of the ray within the shutter interval, in [0, 1]
    */
-  Ray generate_ray(double x, double y) const;
+  Ray generate_ray(double x, double y, double time = 0.0) const;
 
  private:
   // Computes pos, screenXDir, screenYDir from target, r, phi, theta.
   void compute_position();
 
+  // Shutter interval, in frames relative to the rendered frame.
+  double shutterOpen, shutterClose;
+
   // Field of view aspect ratio, clipping planes.
   double hFov, vFov, ar, nClip, fClip;
 
@@ -1,7 +1,12 @@
 #include "collada.h"
 #include "math.h"
+#include "../work_queue.h"
+
+#include "PROJ6850/timer.h"
 
 #include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <map>
 #include <ctime>
 #include <string>
@@ -23,9 +28,123 @@ SceneInfo* ColladaParser::scene;  // pointer to output scene description
 Vector3D ColladaParser::up;                       // scene up direction
 Matrix4x4 ColladaParser::transform;               // current transformation
 map<string, XMLElement*> ColladaParser::sources;  // URI lookup table
+map<string, PolymeshInfo*> ColladaParser::polymeshes;  // shared geometry
+vector<pair<XMLElement*, PolymeshInfo*> > ColladaParser::pending;  // to parse
 
 // Parser Helpers //
 
+/*
+  Reads whitespace separated numbers from the text of an element in place.
+  The arrays of large meshes hold millions of numbers, so this does not copy
+  the text or go through a stream.
+*/
+class NumberReader {
+ public:
+  explicit NumberReader(const char* text) : p(text ? text : "") {}
+
+  bool read(float* value) {
+    skip_space();
+    const char* start = p;
+    bool negative = *p == '-';
+    if (*p == '-' || *p == '+') p++;
+
+    // up to 19 significant digits fit the mantissa, the others are dropped
+    uint64_t mantissa = 0;
+    int exponent = 0, digits = 0;
+    bool dropped = false, any = false;
+    for (; is_digit(*p); p++, any = true) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        if (mantissa) digits++;
+      } else {
+        exponent++;
+        dropped |= *p != '0';
+      }
+    }
+    if (*p == '.') {
+      for (p++; is_digit(*p); p++, any = true) {
+        if (digits < 19) {
+          mantissa = mantissa * 10 + (*p - '0');
+          if (mantissa) digits++;
+          exponent--;
+        } else {
+          dropped |= *p != '0';
+        }
+      }
+    }
+    if (any && (*p == 'e' || *p == 'E')) {
+      const char* e = p + 1;
+      bool negative_exponent = *e == '-';
+      if (*e == '-' || *e == '+') e++;
+      if (is_digit(*e)) {
+        int n = 0;
+        for (; is_digit(*e); e++) n = n < 1000 ? n * 10 + (*e - '0') : n;
+        exponent += negative_exponent ? -n : n;
+        p = e;
+      }
+    }
+
+    // a mantissa and a power of ten both exact in a float give a correctly
+    // rounded quotient or product; anything else goes to the C library
+    static const float powers[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f,
+                                   1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+    if (any && !dropped && mantissa <= (1u << 24) && exponent >= -10 &&
+        exponent <= 10) {
+      float f = (float) mantissa;
+      f = exponent < 0 ? f / powers[-exponent] : f * powers[exponent];
+      *value = negative ? -f : f;
+      return true;
+    }
+    char* end;
+    *value = strtof(start, &end);
+    p = end;
+    return end != start;
+  }
+
+  bool read(size_t* value) {
+    skip_space();
+    if (!is_digit(*p)) return false;
+    size_t n = 0;
+    for (; is_digit(*p); p++) n = n * 10 + (*p - '0');
+    *value = n;
+    return true;
+  }
+
+ private:
+  static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+  void skip_space() {
+    while (*p == ' ' || *p == '\n' || *p == '\t' || *p == '\r') p++;
+  }
+
+  const char* p;
+};
+
+// float array of vectors, sized from its count attribute
+inline bool read_vectors(XMLElement* e_float_array, vector<Vector3D>& vectors) {
+  size_t num_vectors = e_float_array->UnsignedAttribute("count") / 3;
+  vectors.resize(num_vectors);
+  NumberReader reader(e_float_array->GetText());
+  float x, y, z;
+  for (size_t i = 0; i < num_vectors; ++i) {
+    if (!reader.read(&x) || !reader.read(&y) || !reader.read(&z)) return false;
+    vectors[i] = Vector3D(x, y, z);
+  }
+  return true;
+}
+
+inline bool read_vectors(XMLElement* e_float_array, vector<Vector2D>& vectors) {
+  size_t num_vectors = e_float_array->UnsignedAttribute("count") / 2;
+  vectors.resize(num_vectors);
+  NumberReader reader(e_float_array->GetText());
+  float x, y;
+  for (size_t i = 0; i < num_vectors; ++i) {
+    if (!reader.read(&x) || !reader.read(&y)) return false;
+    vectors[i] = Vector2D(x, y);
+  }
+  return true;
+}
+
 inline Spectrum spectrum_from_string(string spectrum_string) {
   Spectrum s;
 
@@ -113,7 +232,8 @@ XMLElement* ColladaParser::get_technique_PROJ6850(XMLElement* xml) {
   return NULL;
 }
 
-int ColladaParser::load(const char* filename, SceneInfo* sceneInfo) {
+int ColladaParser::load(const char* filename, SceneInfo* sceneInfo,
+                        size_t num_threads) {
   ifstream in(filename);
   if (!in.is_open()) {
     cerr << "Warning: could not open file " << filename << endl;
@@ -121,8 +241,12 @@ int ColladaParser::load(const char* filename, SceneInfo* sceneInfo) {
   }
   in.close();
 
+  Timer timer;
+  timer.start();
   XMLDocument doc;
   doc.LoadFile(filename);
+  timer.stop();
+  sceneInfo->xmlTime = timer.duration();
   if (doc.Error()) {
     stat("XML error: ");
     doc.PrintError();
@@ -142,6 +266,8 @@ int ColladaParser::load(const char* filename, SceneInfo* sceneInfo) {
 
   // Build uri table
   uri_load(root);
+  polymeshes.clear();
+  pending.clear();
 
   // Load assets - correct up direction
   if (XMLElement* e_asset = get_element(root, "asset")) {
@@ -206,6 +332,36 @@ int ColladaParser::load(const char* filename, SceneInfo* sceneInfo) {
     return -1;
   }
 
+  // Load meshes -
+  // the geometries are independent, so their arrays are parsed in parallel
+  // once the walk above has found them all. A geometry bound to several
+  // materials is parsed once and copied, as tinyxml2 decodes text in place
+  // on first access and two threads must not read the same element.
+  timer.start();
+  vector<size_t> parsed;  // first mesh of each geometry in pending
+  map<XMLElement*, size_t> first;
+  for (size_t i = 0; i < pending.size(); ++i) {
+    if (first.insert(make_pair(pending[i].first, i)).second) parsed.push_back(i);
+  }
+  parallel_for(parsed.size(), num_threads, [&](size_t i) {
+    parse_polymesh(pending[parsed[i]].first, *pending[parsed[i]].second);
+  });
+  for (size_t i = 0; i < pending.size(); ++i) {
+    const PolymeshInfo& source = *pending[first[pending[i].first]].second;
+    PolymeshInfo& polymesh = *pending[i].second;
+    if (&source == &polymesh) continue;
+    polymesh.id = source.id;
+    polymesh.name = source.name;
+    polymesh.type = source.type;
+    polymesh.vertices = source.vertices;
+    polymesh.normals = source.normals;
+    polymesh.texcoords = source.texcoords;
+    polymesh.polygons = source.polygons;
+  }
+  timer.stop();
+  sceneInfo->numberTime = timer.duration();
+  pending.clear();
+
   return 0;
 }
 
@@ -361,14 +517,28 @@ void ColladaParser::parse_node(XMLElement* xml) {
     node.instance = light;
   } else if (e_geometry) {
     if (get_element(e_geometry, "mesh")) {
-      // mesh geometry
-      PolymeshInfo* polymesh = new PolymeshInfo();
-      parse_polymesh(e_geometry, *polymesh);
-
-      // mesh material
       XMLElement* e_instance_material = get_element(
           xml,
           "instance_geometry/bind_material/technique_common/instance_material");
+
+      // geometry instanced before with the same material - share it
+      string polymesh_key = e_geometry->Attribute("id");
+      if (e_instance_material && e_instance_material->Attribute("target")) {
+        polymesh_key += e_instance_material->Attribute("target");
+      }
+      auto shared = polymeshes.find(polymesh_key);
+      if (shared != polymeshes.end()) {
+        node.instance = shared->second;
+        scene->nodes.push_back(node);
+        return;
+      }
+
+      // mesh geometry, parsed once the whole scene is walked
+      PolymeshInfo* polymesh = new PolymeshInfo();
+      pending.push_back(make_pair(e_geometry, polymesh));
+      polymeshes[polymesh_key] = polymesh;
+
+      // mesh material
       if (e_instance_material) {
         if (!e_instance_material->Attribute("target")) {
           stat(
@@ -610,32 +780,15 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
     exit(EXIT_FAILURE);
   }
 
-  // array sources
-  map<string, vector<float> > arr_sources;
+  // array sources - parsed once an input refers to them, straight from the
+  // text of the document into the mesh arrays
+  map<string, XMLElement*> arr_sources;
   XMLElement* e_source = e_mesh->FirstChildElement("source");
   while (e_source) {
-    // source id
-    string source_id = e_source->Attribute("id");
-
     // source float array - other formats not handled
     XMLElement* e_float_array = e_source->FirstChildElement("float_array");
     if (e_float_array) {
-      float f;
-      vector<float> floats;
-
-      // load float array string
-      string s = e_float_array->GetText();
-      stringstream ss(s);
-
-      // load float array
-      size_t num_floats = e_float_array->IntAttribute("count");
-      for (size_t i = 0; i < num_floats; ++i) {
-        ss >> f;
-        floats.push_back(f);
-      }
-
-      // add to array sources
-      arr_sources[source_id] = floats;
+      arr_sources[e_source->Attribute("id")] = e_float_array;
     }
 
     // parse next source
@@ -661,17 +814,14 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
     // semantic - position
     if (semantic == "POSITION") {
       string source = e_input->Attribute("source") + 1;
-      if (arr_sources.find(source) != arr_sources.end()) {
-        vector<float>& floats = arr_sources[source];
-        size_t num_floats = floats.size();
-        for (size_t i = 0; i < num_floats; i += 3) {
-          Vector3D v = Vector3D(floats[i], floats[i + 1], floats[i + 2]);
-          vertices.push_back(v);
-        }
-      } else {
+      if (arr_sources.find(source) == arr_sources.end()) {
         stat("Error: undefined input source: " << source);
         exit(EXIT_FAILURE);
       }
+      if (!read_vectors(arr_sources[source], vertices)) {
+        stat("Error: short float array: " << source);
+        exit(EXIT_FAILURE);
+      }
     }
 
     // NOTE (sky) : only positions are handled currently
@@ -689,6 +839,7 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
     size_t normal_offset = 0;
     bool has_texcoord_array = false;
     size_t texcoord_offset = 0;
+    size_t stride = 0;
 
     // input arr_sources
     XMLElement* e_input = e_polylist->FirstChildElement("input");
@@ -696,6 +847,7 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
       string semantic = e_input->Attribute("semantic");
       string source = e_input->Attribute("source") + 1;
       size_t offset = e_input->IntAttribute("offset");
+      stride = max(stride, offset + 1);
 
       // vertex array source
       if (semantic == "VERTEX") {
@@ -703,8 +855,7 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
         vertex_offset = offset;
 
         if (source == vertices_id) {
-          polymesh.vertices.resize(vertices.size());
-          copy(vertices.begin(), vertices.end(), polymesh.vertices.begin());
+          polymesh.vertices.swap(vertices);
         } else {
           stat("Error: undefined source for VERTEX semantic: " << source);
           exit(EXIT_FAILURE);
@@ -716,17 +867,14 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
         has_normal_array = true;
         normal_offset = offset;
 
-        if (arr_sources.find(source) != arr_sources.end()) {
-          vector<float>& floats = arr_sources[source];
-          size_t num_floats = floats.size();
-          for (size_t i = 0; i < num_floats; i += 3) {
-            Vector3D n = Vector3D(floats[i], floats[i + 1], floats[i + 2]);
-            polymesh.normals.push_back(n);
-          }
-        } else {
+        if (arr_sources.find(source) == arr_sources.end()) {
           stat("Error: undefined source for NORMAL semantic: " << source);
           exit(EXIT_FAILURE);
         }
+        if (!read_vectors(arr_sources[source], polymesh.normals)) {
+          stat("Error: short float array: " << source);
+          exit(EXIT_FAILURE);
+        }
       }
 
       // texcoord array source
@@ -734,40 +882,30 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
         has_texcoord_array = true;
         texcoord_offset = offset;
 
-        if (arr_sources.find(source) != arr_sources.end()) {
-          vector<float>& floats = arr_sources[source];
-          size_t num_floats = floats.size();
-          for (size_t i = 0; i < num_floats; i += 2) {
-            Vector2D n = Vector2D(floats[i], floats[i + 1]);
-            polymesh.texcoords.push_back(n);
-          }
-        } else {
+        if (arr_sources.find(source) == arr_sources.end()) {
           stat("Error: undefined source for TEXCOORD semantic: " << source);
           exit(EXIT_FAILURE);
         }
+        if (!read_vectors(arr_sources[source], polymesh.texcoords)) {
+          stat("Error: short float array: " << source);
+          exit(EXIT_FAILURE);
+        }
       }
 
       e_input = e_input->NextSiblingElement("input");
     }
 
-    // polygon info
-    size_t num_polygons = e_polylist->IntAttribute("count");
-    size_t stride = (has_vertex_array ? 1 : 0) + (has_normal_array ? 1 : 0) +
-                    (has_texcoord_array ? 1 : 0);
-
-    // create polygon size array and compute size of index array
-    vector<size_t> sizes;
-    size_t num_indices = 0;
+    // polygon sizes
+    size_t num_polygons = e_polylist->UnsignedAttribute("count");
+    vector<size_t> sizes(num_polygons);
     XMLElement* e_vcount = e_polylist->FirstChildElement("vcount");
     if (e_vcount) {
-      size_t size;
-      string s = e_vcount->GetText();
-      stringstream ss(s);
-
+      NumberReader reader(e_vcount->GetText());
       for (size_t i = 0; i < num_polygons; ++i) {
-        ss >> size;
-        sizes.push_back(size);
-        num_indices += size * stride;
+        if (!reader.read(&sizes[i])) {
+          stat("Error: short polygon size array in geometry: " << polymesh.id);
+          exit(EXIT_FAILURE);
+        }
       }
 
     } else {
@@ -775,59 +913,36 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
       exit(EXIT_FAILURE);
     }
 
-    // index array
-    vector<size_t> indices;
+    // polygons - the index array holds stride indices for each corner, one
+    // for each input at its offset
     XMLElement* e_p = e_polylist->FirstChildElement("p");
-    if (e_p) {
-      size_t index;
-      string s = e_p->GetText();
-      stringstream ss(s);
-
-      for (size_t i = 0; i < num_indices; ++i) {
-        ss >> index;
-        indices.push_back(index);
-      }
-
-    } else {
+    if (!e_p) {
       stat("Error: no index array defined in geometry: " << polymesh.id);
       exit(EXIT_FAILURE);
     }
-
-    // create polygons
     polymesh.polygons.resize(num_polygons);
-
-    // vertex array indices
-    if (has_vertex_array) {
-      size_t k = 0;
-      for (size_t i = 0; i < num_polygons; ++i) {
-        for (size_t j = 0; j < sizes[i]; ++j) {
-          polymesh.polygons[i].vertex_indices.push_back(
-              indices[k * stride + vertex_offset]);
-          k++;
+    NumberReader reader(e_p->GetText());
+    vector<size_t> corner(stride);
+    for (size_t i = 0; i < num_polygons; ++i) {
+      Polygon& polygon = polymesh.polygons[i];
+      if (has_vertex_array) polygon.vertex_indices.reserve(sizes[i]);
+      if (has_normal_array) polygon.normal_indices.reserve(sizes[i]);
+      if (has_texcoord_array) polygon.texcoord_indices.reserve(sizes[i]);
+      for (size_t j = 0; j < sizes[i]; ++j) {
+        for (size_t k = 0; k < stride; ++k) {
+          if (!reader.read(&corner[k])) {
+            stat("Error: short index array in geometry: " << polymesh.id);
+            exit(EXIT_FAILURE);
+          }
         }
-      }
-    }
-
-    // normal array indices
-    if (has_normal_array) {
-      size_t k = 0;
-      for (size_t i = 0; i < num_polygons; ++i) {
-        for (size_t j = 0; j < sizes[i]; ++j) {
-          polymesh.polygons[i].normal_indices.push_back(
-              indices[k * stride + normal_offset]);
-          k++;
+        if (has_vertex_array) {
+          polygon.vertex_indices.push_back(corner[vertex_offset]);
         }
-      }
-    }
-
-    // texcoord array indices
-    if (has_normal_array) {
-      size_t k = 0;
-      for (size_t i = 0; i < num_polygons; ++i) {
-        for (size_t j = 0; j < sizes[i]; ++j) {
-          polymesh.polygons[i].texcoord_indices.push_back(
-              indices[k * stride + texcoord_offset]);
-          k++;
+        if (has_normal_array) {
+          polygon.normal_indices.push_back(corner[normal_offset]);
+        }
+        if (has_texcoord_array) {
+          polygon.texcoord_indices.push_back(corner[texcoord_offset]);
         }
       }
     }
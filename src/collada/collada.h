@@ -30,7 +30,10 @@ namespace Collada {
 */
 class ColladaParser {
  public:
-  static int load(const char* filename, SceneInfo* sceneInfo);
+  // Meshes are parsed on up to num_threads threads. The scene is the same
+  // for any number of threads.
+  static int load(const char* filename, SceneInfo* sceneInfo,
+                  size_t num_threads = 1);
   static int save(const char* filename, const SceneInfo* sceneInfo);
 
  private:
@@ -47,6 +50,14 @@ class ColladaParser {
   // The lookup table is constructed when the file is loaded
   static std::map<std::string, XMLElement*> sources;
 
+  // Meshes already parsed, keyed by geometry id and bound material. Nodes
+  // instancing the same geometry share one PolymeshInfo.
+  static std::map<std::string, PolymeshInfo*> polymeshes;
+
+  // Meshes found while walking the scene, with their geometry element. Their
+  // arrays are parsed in parallel once the walk is done.
+  static std::vector<std::pair<XMLElement*, PolymeshInfo*> > pending;
+
   // Load Collada elements with UUID into lookup table
   static void uri_load(XMLElement* xml);
 
@@ -49,6 +49,11 @@ struct Node {
 */
 struct SceneInfo {
   vector<Node> nodes;
+
+  double xmlTime;     ///< seconds spent parsing the XML of the file
+  double numberTime;  ///< seconds spent parsing the arrays of the meshes
+
+  SceneInfo() : xmlTime(0), numberTime(0) {}
 };
 
 }  // namespace Collada
@@ -0,0 +1,281 @@
+#include "denoiser.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+namespace PROJ6850 {
+
+namespace {
+
+// B3 spline, the 1D a-trous kernel
+const float KERNEL[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16};
+
+// depth of pixels whose camera rays missed, far from any hit
+const float MISS_DEPTH = 1e30f;
+
+// albedo below this is treated as missing instead of dividing by it
+const float MIN_ALBEDO = 0.01f;
+
+inline float luminance(float r, float g, float b) {
+  return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+}
+
+// exp(x) for x <= 0, free of branches and of float compares and
+// conversions, which keep gcc from vectorizing the loops calling it
+inline float exp_negative(float x) {
+  // clamp to -87 on the bits: below it the result is no longer a normal float
+  uint32_t x_bits;
+  memcpy(&x_bits, &x, sizeof(x_bits));
+  x_bits = std::min(x_bits, 0xc2ae0000u);
+  memcpy(&x, &x_bits, sizeof(x));
+
+  float t = x * 1.44269504f;  // exponent in base 2
+  // adding 1.5 * 2^23 rounds t to an integer held in the low mantissa bits
+  float rounded = t + 12582912.0f;
+  float f = t - (rounded - 12582912.0f);  // in [-0.5, 0.5]
+  int32_t i;
+  memcpy(&i, &rounded, sizeof(i));
+  int32_t scale_bits = (i - 0x4b400000 + 127) << 23;
+  float scale;
+  memcpy(&scale, &scale_bits, sizeof(scale));
+  float p = 1.0f + f * (0.69314718f + f * (0.24022650f + f * (0.05550411f +
+            f * (0.00961813f + f * 0.00133336f))));
+  return p * scale;
+}
+
+// max(0, x) on the bits, as float compares keep loops from vectorizing
+inline float positive_part(float x) {
+  int32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  bits &= ~(bits >> 31);
+  memcpy(&x, &bits, sizeof(x));
+  return x;
+}
+
+// x^128, the sharpness of the normal weight
+inline float pow128(float x) {
+  x *= x;
+  x *= x;
+  x *= x;
+  x *= x;
+  x *= x;
+  x *= x;
+  return x * x;
+}
+
+inline float modulation(float albedo) {
+  return albedo < MIN_ALBEDO ? 1.0f : albedo;
+}
+
+}  // namespace
+
+Denoiser::Denoiser(size_t num_threads, int iterations)
+    : sigmaLuminance(4.0f),
+      sigmaDepth(1.0f),
+      sigmaAlbedo(0.1f),
+      numThreads(std::max<size_t>(1, num_threads)),
+      iterations(iterations),
+      w(0),
+      h(0) {}
+
+template <typename F>
+void Denoiser::parallel_rows(F f) {
+  size_t bands = std::min(numThreads, h);
+  std::vector<std::thread> threads;
+  for (size_t band = 1; band < bands; band++) {
+    threads.push_back(std::thread(f, band * h / bands, (band + 1) * h / bands));
+  }
+  f(0, h / std::max<size_t>(1, bands));
+  for (std::thread& thread : threads) thread.join();
+}
+
+bool Denoiser::denoise(HDRImageBuffer& image, const AOVBuffer& aovs) {
+  if (aovs.w != image.w || aovs.h != image.h ||
+      (aovs.channels & REQUIRED_AOVS) != REQUIRED_AOVS) {
+    return false;
+  }
+  w = image.w;
+  h = image.h;
+  size_t n = w * h;
+  in.resize(n);
+  out.resize(n);
+  ar.resize(n);
+  ag.resize(n);
+  ab.resize(n);
+  nx.resize(n);
+  ny.resize(n);
+  nz.resize(n);
+  depth.resize(n);
+  depthSlope.resize(n);
+
+  // demodulate, misses get an arbitrary normal and a depth no hit is close to,
+  // the normal also stands in when the hit ones cancelled out
+  for (size_t i = 0; i < n; i++) {
+    const Spectrum& c = image.data[i];
+    const Spectrum& a = aovs.albedo[i];
+    in.r[i] = c.r / modulation(a.r);
+    in.g[i] = c.g / modulation(a.g);
+    in.b[i] = c.b / modulation(a.b);
+    ar[i] = a.r;
+    ag[i] = a.g;
+    ab[i] = a.b;
+    bool hit = std::isfinite(aovs.depth[i]);
+    depth[i] = hit ? aovs.depth[i] : MISS_DEPTH;
+    bool normal = hit && aovs.normal[i].norm2() > 0;
+    nx[i] = normal ? aovs.normal[i].x : 1.0f;
+    ny[i] = normal ? aovs.normal[i].y : 0.0f;
+    nz[i] = normal ? aovs.normal[i].z : 0.0f;
+  }
+
+  // depth slope, taking the smoother side of each axis so that pixels on a
+  // silhouette do not see the jump to the background
+  for (size_t y = 0; y < h; y++) {
+    for (size_t x = 0; x < w; x++) {
+      size_t i = x + y * w;
+      float z = depth[i];
+      float left = x > 0 ? std::fabs(z - depth[i - 1]) : INFINITY;
+      float right = x + 1 < w ? std::fabs(z - depth[i + 1]) : INFINITY;
+      float down = y > 0 ? std::fabs(z - depth[i - w]) : INFINITY;
+      float up = y + 1 < h ? std::fabs(z - depth[i + w]) : INFINITY;
+      float slope = std::max(std::min(left, right), std::min(down, up));
+      depthSlope[i] = std::min(slope, z);
+    }
+  }
+
+  parallel_rows([this](size_t y0, size_t y1) { estimate_variance(y0, y1); });
+  for (int pass = 0; pass < iterations; pass++) {
+    int step = 1 << pass;
+    parallel_rows([this, step](size_t y0, size_t y1) {
+      filter_rows(step, y0, y1);
+    });
+    std::swap(in, out);
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    const Spectrum& a = aovs.albedo[i];
+    image.data[i] = Spectrum(in.r[i] * modulation(a.r),
+                             in.g[i] * modulation(a.g),
+                             in.b[i] * modulation(a.b));
+  }
+  return true;
+}
+
+// the noise of path traced pixels is skewed by rare bright samples, so taps are
+// compared on the 5x5 mean luminance rather than on their own, which would
+// reject the bright samples and darken the image
+void Denoiser::estimate_variance(size_t y0, size_t y1) {
+  std::vector<float> sum(w), sum2(w), count(w);
+  for (size_t y = y0; y < y1; y++) {
+    std::fill(sum.begin(), sum.end(), 0.0f);
+    std::fill(sum2.begin(), sum2.end(), 0.0f);
+    std::fill(count.begin(), count.end(), 0.0f);
+    for (int dy = -2; dy <= 2; dy++) {
+      long yy = (long) y + dy;
+      if (yy < 0 || yy >= (long) h) continue;
+      const float* r = &in.r[yy * w];
+      const float* g = &in.g[yy * w];
+      const float* b = &in.b[yy * w];
+      for (int dx = -2; dx <= 2; dx++) {
+        size_t x0 = std::max(0, -dx), x1 = std::min<long>(w, (long) w - dx);
+        for (size_t x = x0; x < x1; x++) {
+          float l = luminance(r[x + dx], g[x + dx], b[x + dx]);
+          sum[x] += l;
+          sum2[x] += l * l;
+          count[x] += 1.0f;
+        }
+      }
+    }
+    float* mean = &in.luminance[y * w];
+    float* variance = &in.variance[y * w];
+    for (size_t x = 0; x < w; x++) {
+      mean[x] = sum[x] / count[x];
+      variance[x] = std::max(0.0f, sum2[x] / count[x] - mean[x] * mean[x]);
+    }
+  }
+}
+
+void Denoiser::filter_rows(int step, size_t y0, size_t y1) {
+  std::vector<float> sr(w), sg(w), sb(w), sv(w), sw(w);
+  std::vector<float> inv_l_tolerance(w);
+  float inv_a_tolerance = 1.0f / sigmaAlbedo;
+  for (size_t y = y0; y < y1; y++) {
+    size_t row = y * w;
+    const float* cl = &in.luminance[row];
+    const float* car = &ar[row];
+    const float* cag = &ag[row];
+    const float* cab = &ab[row];
+    const float* cnx = &nx[row];
+    const float* cny = &ny[row];
+    const float* cnz = &nz[row];
+    const float* cz = &depth[row];
+    const float* cslope = &depthSlope[row];
+    for (size_t x = 0; x < w; x++) {
+      inv_l_tolerance[x] =
+          1.0f / (sigmaLuminance * std::sqrt(in.variance[row + x]) + 1e-4f);
+    }
+    std::fill(sr.begin(), sr.end(), 0.0f);
+    std::fill(sg.begin(), sg.end(), 0.0f);
+    std::fill(sb.begin(), sb.end(), 0.0f);
+    std::fill(sv.begin(), sv.end(), 0.0f);
+    std::fill(sw.begin(), sw.end(), 0.0f);
+
+    for (int ty = -2; ty <= 2; ty++) {
+      long yy = (long) y + ty * step;
+      if (yy < 0 || yy >= (long) h) continue;
+      for (int tx = -2; tx <= 2; tx++) {
+        long dx = tx * step;
+        size_t x0 = std::max<long>(0, -dx);
+        size_t x1 = std::max<long>(x0, std::min<long>(w, (long) w - dx));
+        float kernel = KERNEL[ty + 2] * KERNEL[tx + 2];
+        float distance = step * std::sqrt((float) (tx * tx + ty * ty));
+        // shifted so that x indexes the tap of pixel x
+        long tap_row = yy * w + dx;
+        const float* r = in.r.data() + tap_row;
+        const float* g = in.g.data() + tap_row;
+        const float* b = in.b.data() + tap_row;
+        const float* l = in.luminance.data() + tap_row;
+        const float* v = in.variance.data() + tap_row;
+        const float* tar = ar.data() + tap_row;
+        const float* tag = ag.data() + tap_row;
+        const float* tab = ab.data() + tap_row;
+        const float* tnx = nx.data() + tap_row;
+        const float* tny = ny.data() + tap_row;
+        const float* tnz = nz.data() + tap_row;
+        const float* tz = depth.data() + tap_row;
+        // the sums never alias the planes, too many pointers for gcc to check
+#pragma GCC ivdep
+        for (size_t x = x0; x < x1; x++) {
+          float wn = pow128(positive_part(cnx[x] * tnx[x] + cny[x] * tny[x] +
+                                          cnz[x] * tnz[x]));
+          float z_tolerance = sigmaDepth * cslope[x] * distance + 1e-3f * cz[x];
+          float e = std::fabs(cz[x] - tz[x]) / z_tolerance +
+                    std::fabs(cl[x] - l[x]) * inv_l_tolerance[x] +
+                    (std::fabs(car[x] - tar[x]) + std::fabs(cag[x] - tag[x]) +
+                     std::fabs(cab[x] - tab[x])) * inv_a_tolerance;
+          float weight = kernel * wn * exp_negative(-e);
+          sr[x] += weight * r[x];
+          sg[x] += weight * g[x];
+          sb[x] += weight * b[x];
+          sv[x] += weight * weight * v[x];
+          sw[x] += weight;
+        }
+      }
+    }
+
+    // the center tap always has a positive weight
+    for (size_t x = 0; x < w; x++) {
+      float inv = 1.0f / sw[x];
+      out.r[row + x] = sr[x] * inv;
+      out.g[row + x] = sg[x] * inv;
+      out.b[row + x] = sb[x] * inv;
+      out.luminance[row + x] =
+          luminance(out.r[row + x], out.g[row + x], out.b[row + x]);
+      out.variance[row + x] = sv[x] * inv * inv;
+    }
+  }
+}
+
+}  // namespace PROJ6850
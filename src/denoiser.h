@@ -0,0 +1,85 @@
+#ifndef PROJ6850_DENOISER_H
+#define PROJ6850_DENOISER_H
+
+#include "image.h"
+
+#include <vector>
+
+namespace PROJ6850 {
+
+/**
+ * Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010, with the
+ * variance guided luminance weight of SVGF) for noisy renders.
+ *
+ * The image is divided by the first hit albedo so that only the noisy
+ * illumination is filtered and texture detail survives. The illumination is
+ * then blurred by a 5x5 B-spline kernel whose taps spread out by a factor of
+ * two at each iteration. Each tap is weighted by how close its normal, depth,
+ * albedo and luminance are to the center pixel, so the blur stops at
+ * geometric and material edges and at lighting edges that stand out of the
+ * noise.
+ *
+ * All buffers are planar floats and each filter pass runs over whole rows,
+ * so the inner loops vectorize; the rows are split between threads.
+ */
+class Denoiser {
+ public:
+  /**
+   * AOV channels the filter needs.
+   */
+  static const unsigned REQUIRED_AOVS =
+      AOVBuffer::ALBEDO | AOVBuffer::NORMAL | AOVBuffer::DEPTH;
+
+  /**
+   * Constructor.
+   * \param num_threads number of threads filtering the image
+   * \param iterations number of a-trous passes, the filter footprint is
+   *        4 * 2^iterations - 3 pixels wide
+   */
+  explicit Denoiser(size_t num_threads = 1, int iterations = 5);
+
+  /**
+   * Filter an image in place.
+   * \param image noisy radiance
+   * \param aovs first hits of the image, with the REQUIRED_AOVS channels
+   * \return false if the AOVs do not match the image, which is left as is
+   */
+  bool denoise(HDRImageBuffer& image, const AOVBuffer& aovs);
+
+  float sigmaLuminance;  ///< luminance tolerance, in standard deviations
+  float sigmaDepth;      ///< depth tolerance, in multiples of the local slope
+  float sigmaAlbedo;     ///< albedo tolerance, summed over the channels
+
+ private:
+  // per pixel planes of one a-trous pass
+  struct Planes {
+    void resize(size_t n) {
+      r.resize(n);
+      g.resize(n);
+      b.resize(n);
+      luminance.resize(n);
+      variance.resize(n);
+    }
+    std::vector<float> r, g, b;      ///< demodulated radiance
+    std::vector<float> luminance;    ///< luminance the taps are compared on
+    std::vector<float> variance;     ///< variance of its luminance
+  };
+
+  void estimate_variance(size_t y0, size_t y1);
+  void filter_rows(int step, size_t y0, size_t y1);
+  template <typename F> void parallel_rows(F f);
+
+  size_t numThreads;
+  int iterations;
+
+  size_t w, h;
+  Planes in, out;                    ///< input and output of the current pass
+  std::vector<float> ar, ag, ab;     ///< albedos
+  std::vector<float> nx, ny, nz;     ///< normals
+  std::vector<float> depth;          ///< hit distances, huge for misses
+  std::vector<float> depthSlope;     ///< depth change to the next pixel
+};
+
+}  // namespace PROJ6850
+
+#endif  // PROJ6850_DENOISER_H
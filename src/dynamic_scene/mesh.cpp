@@ -2,11 +2,14 @@
 #include "joint.h"
 #include "widgets.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <sstream>
 
 #include "../static_scene/object.h"
 #include "../error_dialog.h"
+#include "../work_queue.h"
 
 using std::ostringstream;
 
@@ -18,7 +21,43 @@ namespace PROJ6850 {
         static const double mid_threshold = .2;
         static const double high_threshold = 1.0 - low_threshold;
 
+// Meshes whose bounding sphere spans at least this fraction of the viewport
+// height are drawn at full resolution, smaller ones with a number of faces
+// in proportion to the area they cover.
+        static const double lod_full_size = 0.5;
+
+// Joints blended into each skinned vertex, and frames skinned between two
+// reports of the skinning time.
+        static const int skin_influences = 4;
+        static const Size skin_report_frames = 100;
+
+        static double secondsSince(chrono::steady_clock::time_point start) {
+          return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+
+// Reads an OpenGL matrix, stored column major, into a Matrix4x4.
+        static Matrix4x4 gl_matrix(GLenum name) {
+          GLdouble m[16];
+          glGetDoublev(name, m);
+          Matrix4x4 M;
+          for (int c = 0; c < 4; c++)
+            for (int r = 0; r < 4; r++) M(r, c) = m[4 * c + r];
+          return M;
+        }
+
         Mesh::Mesh(Collada::PolymeshInfo &polyMesh, const Matrix4x4 &transform) {
+          build_halfedge_mesh(polyMesh, transform, &mesh);
+          init(polyMesh);
+        }
+
+        Mesh::Mesh(Collada::PolymeshInfo &polyMesh, HalfedgeMesh &built) {
+          mesh.swap(built);
+          init(polyMesh);
+        }
+
+        void Mesh::build_halfedge_mesh(const Collada::PolymeshInfo &polyMesh,
+                                       const Matrix4x4 &transform,
+                                       HalfedgeMesh *mesh, size_t num_threads) {
           // Build halfedge mesh from polygon soup
           vector<vector<size_t>> polygons;
           for (const Collada::Polygon &p : polyMesh.polygons) {
@@ -29,7 +68,82 @@ namespace PROJ6850 {
             vertices[i] = (transform * Vector4D(vertices[i], 1)).projectTo3D();
           }
 
-          mesh.build(polygons, vertices);
+          mesh->build(polygons, vertices, num_threads);
+        }
+
+        StaticScene::Mesh *Mesh::build_static_mesh(const Collada::PolymeshInfo &polyMesh,
+                                                   const Matrix4x4 &transform,
+                                                   BBox *bbox) {
+          size_t numVertices = polyMesh.vertices.size();
+          vector<Vector3D> positions(numVertices);
+          for (size_t i = 0; i < numVertices; i++) {
+            positions[i] = (transform * Vector4D(polyMesh.vertices[i], 1)).projectTo3D();
+            bbox->expand(positions[i]);
+          }
+
+          // Triangles in the order and with the first corner get_static_object
+          // gives them from a triangulated halfedge mesh, so both paths render
+          // the same: triangles stay in place, starting at their last corner,
+          // and the fans of larger polygons around their last vertex follow.
+          size_t numTriangles = 0;
+          for (const Collada::Polygon &p : polyMesh.polygons) {
+            const vector<size_t> &v = p.vertex_indices;
+            if (v.size() >= 3) numTriangles += v.size() - 2;
+            for (size_t i : v) {
+              if (i >= numVertices) {
+                cerr << "Error converting polygons to triangles: vertex index " << i
+                     << " is out of range (" << numVertices << " vertices)." << endl;
+                exit(1);
+              }
+            }
+          }
+          vector<uint32_t> indices;
+          indices.reserve(3 * numTriangles);
+          for (const Collada::Polygon &p : polyMesh.polygons) {
+            const vector<size_t> &v = p.vertex_indices;
+            if (v.size() != 3) continue;
+            indices.push_back(v[2]);
+            indices.push_back(v[0]);
+            indices.push_back(v[1]);
+          }
+          for (const Collada::Polygon &p : polyMesh.polygons) {
+            const vector<size_t> &v = p.vertex_indices;
+            size_t n = v.size();
+            if (n <= 3) continue;
+            for (size_t i = 0; i + 2 < n; i++) {
+              indices.push_back(v[i + 1]);
+              indices.push_back(v[n - 1]);
+              indices.push_back(v[i]);
+            }
+          }
+
+          // area-weighted vertex normals, summed as Vertex::normal sums them
+          // around the vertices inside the surface
+          vector<Vector3D> normals(numVertices, Vector3D(0., 0., 0.));
+          for (size_t t = 0; t < indices.size(); t += 3) {
+            for (int c = 0; c < 3; c++) {
+              uint32_t i = indices[t + c];
+              const Vector3D &pi = positions[i];
+              const Vector3D &pj = positions[indices[t + (c + 1) % 3]];
+              const Vector3D &pk = positions[indices[t + (c + 2) % 3]];
+              normals[i] += cross(pj - pi, pk - pi);
+            }
+          }
+
+          vector<Vec3f> renderPositions(numVertices), renderNormals(numVertices);
+          for (size_t i = 0; i < numVertices; i++) {
+            normals[i].normalize();
+            renderPositions[i] = Vec3f(positions[i]);
+            renderNormals[i] = Vec3f(normals[i]);
+          }
+
+          BSDF *bsdf = polyMesh.material ? polyMesh.material->bsdf
+                                         : new DiffuseBSDF(Spectrum(1., 1., 1.));
+          return new StaticScene::Mesh(renderPositions.data(), renderNormals.data(),
+                                       numVertices, indices.data(), indices.size(), bsdf);
+        }
+
+        void Mesh::init(Collada::PolymeshInfo &polyMesh) {
           if (polyMesh.material) {
             bsdf = polyMesh.material->bsdf;
           } else {
@@ -42,49 +156,171 @@ namespace PROJ6850 {
           skeleton = new Skeleton(this);
 
           alreadyCheckingPositions = false;
+          lodFailed = false;
+          lodDeferred = false;
+          isPlaying = false;
+          skinBuilt = false;
+          skinSeconds = 0.;
+          skinFrames = 0;
         }
 
 
 
-        void Mesh::linearBlendSkinning(bool useCapsuleRadius) {
-          vector<LBSInfo> info;
-          unsigned long n = skeleton->joints.size();
-          info.reserve(n);
-          Matrix4x4 sceneObj_T[n], joint_T[n], bindInv[n], overall_T[n], bind[n], rotate[n];
-          for (int i = 0; i < n; i++) {
-            Joint *j = skeleton->joints[i];
-            overall_T[i] = j->Joint::getTransformation() * j->SceneObject::getTransformation();
-            bindInv[i] = j->getBindTransformation().inv();
-
+        void Mesh::ensure_skin_weights(bool useCapsuleRadius, size_t num_threads) {
+          Size n = skeleton->joints.size();
+          vector<Matrix4x4> bindInverses(n);
+          vector<double> capsuleRadii(n);
+          for (Size i = 0; i < n; i++) {
+            bindInverses[i] = skeleton->joints[i]->getBindTransformation().inv();
+            capsuleRadii[i] = skeleton->joints[i]->capsuleRadius;
+          }
+          if (skinBuilt && useCapsuleRadius == skinUsedCapsuleRadius &&
+              capsuleRadii == skinCapsuleRadii &&
+              equal(bindInverses.begin(), bindInverses.end(), skinBindInverses.begin(),
+                    [](const Matrix4x4 &A, const Matrix4x4 &B) {
+                      for (int r = 0; r < 4; r++)
+                        for (int c = 0; c < 4; c++)
+                          if (A(r, c) != B(r, c)) return false;
+                      return true;
+                    })) {
+            return;
           }
+
+          chrono::steady_clock::time_point start = chrono::steady_clock::now();
+          skinVertices.clear();
+          skinVertices.reserve(mesh.nVertices());
           for (VertexIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
-            info.clear();
-            double totalLenInv = 0.0;
-            for (int i = 0; i < n; i++) {
-              Joint *j = skeleton->joints[i];
-              Vector3D v_jointSpace =   bindInv[i] * v->bindPosition;
-              Vector3D endPos =  overall_T[i] * v_jointSpace ;
-
-              double distance = (v_jointSpace - closestPoint(v_jointSpace, Vector3D(), j->axis)).norm();
-              if (!useCapsuleRadius || (distance <= j->capsuleRadius)) {
-                info.push_back(LBSInfo());
-                info[info.size() - 1].blendPos = endPos;
-                info[info.size() - 1].distance = clamp(distance, EPS_D, INF_D);
-                totalLenInv += 1.0 / info[info.size() - 1].distance;
-              }
+            skinVertices.push_back(&*v);
+          }
 
+          // The skeleton poses the vertices, or the cage of a subdivided mesh,
+          // which the vertices then follow.
+          bool cage = !subdivisionCage.empty();
+          vector<Vector3D> bindPositions;
+          if (cage) {
+            bindPositions = subdivisionCage;
+          } else {
+            bindPositions.resize(skinVertices.size());
+            for (size_t v = 0; v < skinVertices.size(); v++) {
+              bindPositions[v] = skinVertices[v]->bindPosition;
             }
+          }
 
-            if (info.size() != 0) {
-              Vector3D newV;
-              for (int i = 0; i < info.size(); i++) {
-                double weight = 1.0f / totalLenInv * (1.0f / info[i].distance);
-                newV += info[i].blendPos * weight;
+          // Each point keeps the skin_influences joints nearest to it, their
+          // distances in increasing order, and unused slots left at distance 0.
+          vector<uint32_t> joints(skin_influences * bindPositions.size(), 0);
+          vector<double> distances(skin_influences * bindPositions.size(), 0.);
+          parallel_for_ranges(bindPositions.size(), num_threads, [&](size_t begin, size_t end) {
+            for (size_t v = begin; v < end; v++) {
+              uint32_t *vJoints = &joints[skin_influences * v];
+              double *vDistances = &distances[skin_influences * v];
+              int count = 0;
+              for (Size i = 0; i < n; i++) {
+                Vector3D p = bindInverses[i] * bindPositions[v];
+                double distance = (p - closestPoint(p, Vector3D(), skeleton->joints[i]->axis)).norm();
+                if (useCapsuleRadius && distance > capsuleRadii[i]) continue;
+                distance = clamp(distance, EPS_D, INF_D);
+                if (count == skin_influences && distance >= vDistances[count - 1]) continue;
+                int k = count < skin_influences ? count++ : count - 1;
+                for (; k > 0 && vDistances[k - 1] > distance; k--) {
+                  vJoints[k] = vJoints[k - 1];
+                  vDistances[k] = vDistances[k - 1];
+                }
+                vJoints[k] = i;
+                vDistances[k] = distance;
               }
-              v->position = newV;
+            }
+          });
+
+          // Only the points some joint influences are kept, with inverse
+          // distance weights scaled to sum to one.
+          skinPoints.clear();
+          skinBindPositions.clear();
+          skinJoints.clear();
+          skinWeights.clear();
+          for (size_t v = 0; v < bindPositions.size(); v++) {
+            const double *vDistances = &distances[skin_influences * v];
+            if (vDistances[0] == 0.) continue;
+            double totalLenInv = 0.;
+            for (int k = 0; k < skin_influences && vDistances[k] != 0.; k++) {
+              totalLenInv += 1.0 / vDistances[k];
+            }
+            skinPoints.push_back(v);
+            skinBindPositions.push_back(bindPositions[v]);
+            for (int k = 0; k < skin_influences; k++) {
+              skinJoints.push_back(joints[skin_influences * v + k]);
+              skinWeights.push_back(vDistances[k] != 0. ? 1.0 / totalLenInv * (1.0 / vDistances[k]) : 0.);
             }
           }
 
+          if (cage) skinCagePositions.swap(bindPositions);
+          skinBuilt = true;
+          skinUsedCapsuleRadius = useCapsuleRadius;
+          skinBindInverses.swap(bindInverses);
+          skinCapsuleRadii.swap(capsuleRadii);
+          skinSeconds = 0.;
+          skinFrames = 0;
+          printf("[Animation] Bound %zu of %zu %svertices to %zu joints in %.3f s\n",
+                 skinPoints.size(), cage ? skinCagePositions.size() : skinVertices.size(),
+                 cage ? "cage " : "", (size_t) n, secondsSince(start));
+        }
+
+        void Mesh::linearBlendSkinning(bool useCapsuleRadius, size_t num_threads) {
+          Size n = skeleton->joints.size();
+          if (n == 0) return;
+          ensure_skin_weights(useCapsuleRadius, num_threads);
+
+          // The palette takes bind positions straight to posed ones, so that
+          // each vertex blends its joints' matrices and transforms once.
+          chrono::steady_clock::time_point start = chrono::steady_clock::now();
+          skinPalette.resize(12 * n);
+          for (Size i = 0; i < n; i++) {
+            Joint *j = skeleton->joints[i];
+            Matrix4x4 T = j->Joint::getTransformation() * j->SceneObject::getTransformation() *
+                          skinBindInverses[i];
+            for (int r = 0; r < 3; r++)
+              for (int c = 0; c < 4; c++) skinPalette[12 * i + 4 * r + c] = T(r, c);
+          }
+
+          const double *palette = skinPalette.data();
+          bool cage = !subdivisionCage.empty();
+          parallel_for_ranges(skinPoints.size(), num_threads, [&](size_t begin, size_t end) {
+            for (size_t v = begin; v < end; v++) {
+              const uint32_t *vJoints = &skinJoints[skin_influences * v];
+              const double *vWeights = &skinWeights[skin_influences * v];
+              double M[12] = {0.};
+              for (int k = 0; k < skin_influences; k++) {
+                const double *T = palette + 12 * vJoints[k];
+                double w = vWeights[k];
+                for (int e = 0; e < 12; e++) M[e] += w * T[e];
+              }
+              const Vector3D &p = skinBindPositions[v];
+              Vector3D q(M[0] * p.x + M[1] * p.y + M[2] * p.z + M[3],
+                         M[4] * p.x + M[5] * p.y + M[6] * p.z + M[7],
+                         M[8] * p.x + M[9] * p.y + M[10] * p.z + M[11]);
+              if (cage) {
+                skinCagePositions[skinPoints[v]] = q;
+              } else {
+                skinVertices[skinPoints[v]]->position = q;
+              }
+            }
+          });
+
+          // The subdivided mesh follows its cage through the stencils.
+          if (cage) {
+            subdivision.refinePositions(skinCagePositions, &skinRefinedPositions, num_threads);
+            parallel_for_ranges(skinVertices.size(), num_threads, [&](size_t begin, size_t end) {
+              for (size_t v = begin; v < end; v++) skinVertices[v]->position = skinRefinedPositions[v];
+            });
+          }
+
+          skinSeconds += secondsSince(start);
+          if (++skinFrames == skin_report_frames) {
+            printf("[Animation] Skinned %zu %svertices in %.3f ms per frame\n",
+                   skinPoints.size(), cage ? "cage " : "", 1e3 * skinSeconds / skinFrames);
+            skinSeconds = 0.;
+            skinFrames = 0;
+          }
         }
 
         VertexIter v1;
@@ -157,6 +393,10 @@ namespace PROJ6850 {
 
           check_finite_positions();
 
+          // Unless something else moves it, the mesh is drawn at the level
+          // of detail suiting its distance from the camera.
+          bool useLod = lod_drawable();
+
           vector<Vector3D> offsets;
           vector<Vector3D> originalPositions;
 
@@ -190,10 +430,23 @@ namespace PROJ6850 {
           // Enable lighting for faces
           glEnable(GL_LIGHTING);
           glDisable(GL_BLEND);
-          draw_faces(true);
+
+          Size lodFaces = mesh.nFaces();
+          if (useLod) {
+            lodFaces = lod_face_count(gl_matrix(GL_MODELVIEW_MATRIX),
+                                      gl_matrix(GL_PROJECTION_MATRIX)(1, 1));
+          }
+          if (lodFaces < mesh.nFaces()) {
+            lod.setFaceCount(lodFaces);
+            draw_lod_faces(true);
+          } else {
+            draw_faces(true);
+          }
 
           glPopMatrix();
 
+          draw_instances(true, useLod);
+
           i = 0;
           for (VertexIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
             v->position = originalPositions[i++];
@@ -204,6 +457,8 @@ namespace PROJ6850 {
 
           check_finite_positions();
 
+          bool useLod = lod_drawable();
+
           vector<Vector3D> offsets;
           vector<Vector3D> originalPositions;
 
@@ -249,6 +504,8 @@ namespace PROJ6850 {
 
           glPopMatrix();
 
+          draw_instances(false, useLod);
+
           i = 0;
           for (VertexIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
             v->position = originalPositions[i++];
@@ -294,6 +551,145 @@ namespace PROJ6850 {
           }
         }
 
+        void Mesh::draw_instances(bool smooth, bool useLod) {
+          if (instances.empty()) return;
+
+          // With useLod, from lod_drawable(), each copy is drawn at the level
+          // of detail suiting its distance from the camera. The copies go
+          // from the finest level down, so that moving between levels takes
+          // as few vertex splits as possible.
+          vector<pair<Size, size_t>> order;
+          Matrix4x4 view = gl_matrix(GL_MODELVIEW_MATRIX);
+          double projectionScale = gl_matrix(GL_PROJECTION_MATRIX)(1, 1);
+          for (size_t i = 0; i < instances.size(); i++) {
+            Size faces = useLod ? lod_face_count(view * instances[i] * getTransformation(),
+                                                 projectionScale)
+                                : mesh.nFaces();
+            order.push_back(make_pair(faces, i));
+          }
+          sort(order.rbegin(), order.rend());
+
+          for (const pair<Size, size_t> &o : order) {
+            const Matrix4x4 &T = instances[o.second];
+
+            // Matrix4x4 is indexed (row, col), OpenGL expects column major
+            GLdouble m[16];
+            for (int c = 0; c < 4; c++)
+              for (int r = 0; r < 4; r++) m[4 * c + r] = T(r, c);
+
+            glPushMatrix();
+            glMultMatrixd(m);
+            glTranslatef(position.x, position.y, position.z);
+            glRotatef(rotation.x, 1.0f, 0.0f, 0.0f);
+            glRotatef(rotation.y, 0.0f, 1.0f, 0.0f);
+            glRotatef(rotation.z, 0.0f, 0.0f, 1.0f);
+            glScalef(scale.x, scale.y, scale.z);
+            glEnable(GL_LIGHTING);
+            glDisable(GL_BLEND);
+            if (o.first < mesh.nFaces()) {
+              lod.setFaceCount(o.first);
+              draw_lod_faces(smooth);
+            } else {
+              draw_faces(smooth);
+            }
+            glPopMatrix();
+          }
+        }
+
+        // Draws the faces of the current level of detail as draw_faces()
+        // would, with no highlighted elements.
+        void Mesh::draw_lod_faces(bool smooth) const {
+          GLfloat white[4] = {1., 1., 1., 1.};
+          GLfloat faceColor[4] = {1., 1., 1., 1.};
+          if (isGhosted) {
+            faceColor[0] = faceColor[1] = faceColor[2] = faceColor[3] = 0.25;
+          }
+          glEnable(GL_LIGHTING);
+          glEnable(GL_LIGHT0);
+          glLightfv(GL_LIGHT0, GL_DIFFUSE, white);
+          if (!smooth) glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, faceColor);
+          glEnable(GL_POLYGON_OFFSET_FILL);
+          glPolygonOffset(1.0, 1.0);
+
+          const vector<ProgressiveMesh::Id> &triangles = lod.triangles();
+          const vector<Vector3D> &positions = lod.vertexPositions();
+          vector<Vector3D> normals;
+          if (smooth) {
+            // Area-weighted vertex normals, as Vertex::normal() computes them.
+            normals.assign(lod.nVertices(), Vector3D());
+            for (Size f = 0; f < lod.nFaces(); f++) {
+              const ProgressiveMesh::Id *t = &triangles[3 * f];
+              Vector3D N = cross(positions[t[1]] - positions[t[0]],
+                                 positions[t[2]] - positions[t[0]]);
+              for (int k = 0; k < 3; k++) normals[t[k]] += N;
+            }
+            for (Vector3D &N : normals) N.normalize();
+          }
+
+          glBegin(GL_TRIANGLES);
+          for (Size f = 0; f < lod.nFaces(); f++) {
+            const ProgressiveMesh::Id *t = &triangles[3 * f];
+            if (!smooth) {
+              Vector3D N = cross(positions[t[1]] - positions[t[0]],
+                                 positions[t[2]] - positions[t[0]]);
+              N.normalize();
+              glNormal3dv(&N.x);
+            }
+            for (int k = 0; k < 3; k++) {
+              if (smooth) glNormal3dv(&normals[t[k]].x);
+              glVertex3dv(&positions[t[k]].x);
+            }
+          }
+          glEnd();
+        }
+
+        bool Mesh::ensure_lod() {
+          if (lod.empty() && !lodFailed && !lodDeferred) lodFailed = !lod.build(mesh);
+          return !lod.empty();
+        }
+
+        bool Mesh::lod_drawable() {
+          // The levels of detail hold the positions they were built from, so
+          // they would freeze the waves and poses of that moment.
+          if (isPlaying || !skeleton->joints.empty()) return false;
+          for (VertexIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
+            if (v->offset != 0.f) return false;
+          }
+          return ensure_lod();
+        }
+
+        void Mesh::mesh_changed() {
+          lod.clear();
+          lodFailed = false;
+          skinBuilt = false;
+          subdivisionCage.clear();
+        }
+
+        void Mesh::mesh_changing() {
+          lod.clear();
+          lodFailed = false;
+          lodDeferred = true;
+        }
+
+        Size Mesh::lod_face_count(const Matrix4x4 &modelView,
+                                  double projectionScale) const {
+          // Eye-space bounding sphere; the camera looks down -z.
+          Vector3D center = modelView * lod.boundCenter();
+          double scale = 0;
+          for (int c = 0; c < 3; c++) {
+            scale = max(scale, Vector3D(modelView(0, c), modelView(1, c),
+                                        modelView(2, c)).norm());
+          }
+          double radius = lod.boundRadius() * scale;
+          double depth = -center.z;
+          if (depth <= radius) return mesh.nFaces();
+
+          // Fraction of the viewport height the sphere spans.
+          double size = radius * projectionScale / depth / lod_full_size;
+          if (size >= 1) return mesh.nFaces();
+          return max(lod.nBaseFaces(), (Size) (mesh.nFaces() * size * size));
+        }
+
         void Mesh::draw_faces(bool smooth) const {
           GLfloat white[4] = {1., 1., 1., 1.};
           GLfloat faceColor[4] = {1., 1., 1., 1.};
@@ -445,6 +841,17 @@ namespace PROJ6850 {
           for (VertexIter it = mesh.verticesBegin(); it != mesh.verticesEnd(); it++) {
             bbox.expand(it->position);
           }
+
+          // copies: transformed corners of the mesh box
+          BBox meshBox = bbox;
+          for (const Matrix4x4 &T : instances) {
+            for (int corner = 0; corner < 8; corner++) {
+              Vector3D p((corner & 1) ? meshBox.max.x : meshBox.min.x,
+                         (corner & 2) ? meshBox.max.y : meshBox.min.y,
+                         (corner & 4) ? meshBox.max.z : meshBox.min.z);
+              bbox.expand((T * Vector4D(p, 1.0)).projectTo3D());
+            }
+          }
           return bbox;
         }
 
@@ -478,6 +885,7 @@ namespace PROJ6850 {
           } else {
             return;
           }
+          mesh_changed();
 
           scene->hovered.clear();
           scene->elementTransform->target.clear();
@@ -498,6 +906,7 @@ namespace PROJ6850 {
           } else {
             return;
           }
+          mesh_changed();
 
           scene->selected.element = elementAddress(v);
           scene->hovered.clear();
@@ -511,6 +920,7 @@ namespace PROJ6850 {
           Edge *edge = element->getEdge();
           if (edge == nullptr) return;
           EdgeIter e = mesh.flipEdge(edge->halfedge()->edge());
+          mesh_changed();
           scene->selected.element = elementAddress(e);
           scene->hovered.clear();
           scene->elementTransform->target.clear();
@@ -523,6 +933,7 @@ namespace PROJ6850 {
           Edge *edge = element->getEdge();
           if (edge == nullptr) return;
           VertexIter v = mesh.splitEdge(edge->halfedge()->edge());
+          mesh_changed();
           scene->selected.element = elementAddress(v);
           scene->hovered.clear();
           scene->elementTransform->target.clear();
@@ -542,6 +953,7 @@ namespace PROJ6850 {
           } else {
             return;
           }
+          mesh_changed();
           scene->selected.clear();
           scene->selected.object = this;
           scene->selected.element = elementAddress(f);
@@ -587,6 +999,7 @@ namespace PROJ6850 {
           } else {
             return;
           }
+          mesh_changed();
           // handle n-gons generated with this new face
           vector<FaceIter> fcs;
           // new face
@@ -619,7 +1032,10 @@ namespace PROJ6850 {
           scene->elementTransform->target.clear();
         }
 
-        void Mesh::triangulate() { mesh.triangulate(); }
+        void Mesh::triangulate() {
+          mesh.triangulate();
+          mesh_changed();
+        }
 
         void Mesh::upsample() {
           for (FaceCIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++) {
@@ -632,6 +1048,7 @@ namespace PROJ6850 {
             }
           }
           resampler.upsample(mesh);
+          mesh_changed();
           // Make sure the bind position is set
           for (VertexIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
             v->bindPosition = v->position;
@@ -642,19 +1059,61 @@ namespace PROJ6850 {
         }
 
         void Mesh::downsample() {
-          resampler.downsample(mesh);
+          // The levels of detail are built once, and later calls step down
+          // them without simplifying the mesh again.
+          if (ensure_lod()) {
+            lod.setFaceCount(mesh.nFaces() / 2);
+            if (lod.nFaces() < mesh.nFaces()) {
+              vector<vector<Index>> polygons;
+              vector<Vector3D> positions;
+              lod.getPolygons(polygons, positions);
+              mesh.rebuild(polygons, positions);
+            }
+          } else {
+            resampler.downsample(mesh);
+          }
+          // The levels of detail stay valid, but the vertices the skinning
+          // weights point to are gone.
+          skinBuilt = false;
+          subdivisionCage.clear();
           scene->selected.clear();
           scene->hovered.clear();
           scene->elementTransform->target.clear();
         }
 
-        void Mesh::resample() {
-          resampler.resample(mesh);
+        void Mesh::resample(size_t num_threads) {
+          if (mesh.nEdges() > 0) {
+            resampler.resample(mesh, MeshResampler::meanEdgeLength(mesh), 5, num_threads);
+          }
+          mesh_changed();
+          for (VertexIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
+            v->bindPosition = v->position;
+          }
           scene->selected.clear();
           scene->hovered.clear();
           scene->elementTransform->target.clear();
         }
 
+        void Mesh::subdivide(bool useCatmullClark, size_t num_threads) {
+          vector<Vector3D> cage;
+          cage.reserve(mesh.nVertices());
+          for (VertexIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
+            cage.push_back(v->bindPosition);
+          }
+          mesh.subdivideQuad(useCatmullClark, num_threads, &subdivision);
+          mesh_changed();
+
+          // The bind pose is refined from the cage's rather than taken from
+          // the current pose.
+          vector<Vector3D> bindPositions;
+          subdivision.refinePositions(cage, &bindPositions, num_threads);
+          size_t i = 0;
+          for (VertexIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
+            v->bindPosition = bindPositions[i++];
+          }
+          subdivisionCage.swap(cage);
+        }
+
         void Mesh::newPickElement(int &pickID, HalfedgeElement *e) {
           unsigned char R, G, B;
           IndexToRGB(pickID, R, G, B);
@@ -775,7 +1234,9 @@ namespace PROJ6850 {
         BSDF *Mesh::get_bsdf() { return bsdf; }
 
         StaticScene::SceneObject *Mesh::get_static_object() {
-          return new StaticScene::Mesh(mesh, bsdf);
+          StaticScene::Mesh *output = new StaticScene::Mesh(mesh, bsdf);
+          output->instances = instances;
+          return output;
         }
 
         Matrix3x3 rotateMatrix(float ux, float uy, float uz, float theta) {
@@ -794,9 +1255,7 @@ namespace PROJ6850 {
           return out;
         }
 
-        StaticScene::SceneObject *Mesh::get_transformed_static_object(double t) {
-          vector<Vector3D> originalPositions;
-
+        Matrix4x4 Mesh::transformation_at(double t) {
           Vector3D position = positions(t);
           Vector3D rotate = rotations(t);
           Vector3D scale = scales(t);
@@ -818,7 +1277,12 @@ namespace PROJ6850 {
 
           Matrix4x4 T = Matrix4x4::translation(position);
 
-          Matrix4x4 transform = T * R_homogeneous * S;
+          return T * R_homogeneous * S;
+        }
+
+        StaticScene::SceneObject *Mesh::get_transformed_static_object(double t) {
+          vector<Vector3D> originalPositions;
+          Matrix4x4 transform = transformation_at(t);
 
           for (VertexIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
             originalPositions.push_back(v->position);
@@ -826,7 +1290,8 @@ namespace PROJ6850 {
             v->position = (transform * tmp).to3D();
           }
 
-          StaticScene::SceneObject *output = new StaticScene::Mesh(mesh, bsdf);
+          StaticScene::Mesh *output = new StaticScene::Mesh(mesh, bsdf);
+          output->instances = instances;
 
           int i = 0;
           for (VertexIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
@@ -836,6 +1301,23 @@ namespace PROJ6850 {
           return output;
         }
 
+        StaticScene::SceneObject *Mesh::get_moving_static_object(double t0, double t1) {
+          StaticScene::Mesh *output =
+                  (StaticScene::Mesh *) get_transformed_static_object(t0);
+
+          // keyframes move the mesh as a whole, so the geometry at t1 is the
+          // one at t0 taken back to object space and placed at t1
+          Matrix4x4 open = transformation_at(t0), close = transformation_at(t1);
+          bool moving = false;
+          for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 4; j++) {
+              if (open(i, j) != close(i, j)) moving = true;
+            }
+          }
+          if (moving) output->set_motion(close * open.inv());
+          return output;
+        }
+
         Vector3D Mesh::closestPoint(Vector3D A, Vector3D B, Vector3D P) {
           Vector3D AP = P - A, AB = B - A;
           Vector3D b = AB;
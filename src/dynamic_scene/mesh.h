@@ -6,6 +6,9 @@
 #include "../collada/polymesh_info.h"
 #include "../halfEdgeMesh.h"
 #include "../meshEdit.h"
+#include "../progressive_mesh.h"
+#include "../static_scene/object.h"
+#include "../subdivision.h"
 #include "skeleton.h"
 
 #include <map>
@@ -13,17 +16,37 @@
 namespace PROJ6850 {
 namespace DynamicScene {
 
-// A structure for holding linear blend skinning information
-class LBSInfo {
- public:
-  Vector3D blendPos;
-  double distance;
-};
-
 class Mesh : public SceneObject {
  public:
   Mesh(Collada::PolymeshInfo &polyMesh, const Matrix4x4 &transform);
 
+  /**
+   * Creates a mesh from the halfedge mesh of a polymesh built with
+   * build_halfedge_mesh, which is taken over and left empty.
+   */
+  Mesh(Collada::PolymeshInfo &polyMesh, HalfedgeMesh &built);
+
+  /**
+   * Builds the halfedge mesh of a polymesh, with its vertices moved to world
+   * space. Only reads the polymesh, so meshes can be built in parallel.
+   * \param num_threads threads sorting the edges of the mesh
+   */
+  static void build_halfedge_mesh(const Collada::PolymeshInfo &polyMesh,
+                                  const Matrix4x4 &transform,
+                                  HalfedgeMesh *mesh, size_t num_threads = 1);
+
+  /**
+   * Builds the render copy of a polymesh straight from its polygons, for
+   * scenes that are rendered but never edited. Polygons are fanned into
+   * triangles and the vertex normals summed over the triangles in flat
+   * arrays, without the halfedge mesh get_static_object goes through.
+   * Only reads the polymesh, so meshes can be built in parallel.
+   * \param bbox expanded by the world-space vertices of the mesh
+   */
+  static StaticScene::Mesh *build_static_mesh(const Collada::PolymeshInfo &polyMesh,
+                                              const Matrix4x4 &transform,
+                                              BBox *bbox);
+
   ~Mesh();
 
   void set_draw_styles(DrawStyle *defaultStyle, DrawStyle *hoveredStyle,
@@ -34,6 +57,7 @@ class Mesh : public SceneObject {
   void draw_pretty() override;
 
   StaticScene::SceneObject *get_transformed_static_object(double t) override;
+  StaticScene::SceneObject *get_moving_static_object(double t0, double t1) override;
 
   BBox get_bbox() override;
 
@@ -53,14 +77,78 @@ class Mesh : public SceneObject {
   void erase_selected_element();
   void bevel_selected_element();
   void upsample();
+
+  /**
+   * Halves the number of faces, stepping down levels of detail that are
+   * built from the mesh on the first call.
+   */
   void downsample();
-  void resample();
+
+  /**
+   * Remeshes toward uniform triangles, smoothing on up to num_threads
+   * threads (see MeshResampler::resample).
+   */
+  void resample(size_t num_threads = 1);
   void triangulate();
 
+  /**
+   * Splits all faces into quads (see HalfedgeMesh::subdivideQuad), on up to
+   * num_threads threads. The mesh before subdivision is kept as a cage,
+   * along with the stencils refining it, until the next edit: the skeleton
+   * then poses the cage, and the subdivided vertices follow it through one
+   * sparse matrix-vector product per frame.
+   */
+  void subdivide(bool useCatmullClark, size_t num_threads = 1);
+
+  /**
+   * Drops the levels of detail and skinning weights built from the halfedge
+   * mesh. Must be called whenever the halfedge mesh is edited.
+   */
+  void mesh_changed();
+
+  /**
+   * Marks the mesh as moving over many frames, e.g. while its elements are
+   * dragged. The levels of detail are dropped, and rather than being
+   * rebuilt on every frame the mesh is drawn in full until mesh_settled().
+   * Only positions may change; other edits call mesh_changed().
+   */
+  void mesh_changing();
+
+  /**
+   * Ends the moves of mesh_changing(), so that the levels of detail are
+   * built again the next time they are drawn.
+   */
+  void mesh_settled() { lodDeferred = false; }
+
+  /**
+   * Tells the mesh whether the timeline is playing. Its waves and skeleton
+   * may then move it on every frame, so it is drawn in full rather than
+   * from the levels of detail.
+   */
+  void set_playing(bool playing) { isPlaying = playing; }
+
+  /**
+   * Place another copy of the mesh, e.g. a Collada node instancing the same
+   * geometry. The copies share the halfedge mesh (edits apply to all of them)
+   * and are rendered as instances of a single BVH.
+   * \param t transform from this mesh to the copy
+   */
+  void add_instance(const Matrix4x4 &t) { instances.push_back(t); }
+
   HalfedgeMesh mesh;
+  std::vector<Matrix4x4> instances;  ///< transforms of the copies of the mesh
 
   Skeleton *skeleton;  // skeleton for mesh
-  void linearBlendSkinning(bool useCapsuleRadius);
+
+  /**
+   * Moves the vertices to the current pose of the skeleton, blending the
+   * transforms of the joints that influence each vertex in its bind pose.
+   * The influences are built on the first call and again whenever the bind
+   * pose changes: each vertex keeps its nearest joints by distance to their
+   * axis (those whose capsule contains it if useCapsuleRadius), weighted by
+   * inverse distance. Vertices split among up to num_threads threads.
+   */
+  void linearBlendSkinning(bool useCapsuleRadius, size_t num_threads = 1);
   void forward_euler(float timestep, float damping_factor);
   void symplectic_euler(float timestep, float damping_factor);
   void resetWave();
@@ -85,9 +173,17 @@ class Mesh : public SceneObject {
   virtual void setSelection(int pickID, Selection &selection) override;
 
  private:
+  // Material, keyframes and skeleton of a mesh whose halfedge mesh is built.
+  void init(Collada::PolymeshInfo &polyMesh);
+
+  // Keyframed placement of the mesh at time t.
+  Matrix4x4 transformation_at(double t);
+
   // Helpers for draw().
     Vector3D closestPoint(Vector3D A, Vector3D B, Vector3D P);
   void draw_faces(bool smooth = false) const;
+  void draw_instances(bool smooth, bool useLod);
+  void draw_lod_faces(bool smooth) const;
   void draw_edges() const;
   void draw_feature_if_needed(Selection *s) const;
   void draw_vertex(const Vertex *v) const;
@@ -111,6 +207,61 @@ class Mesh : public SceneObject {
 
   MeshResampler resampler;
 
+  // Builds the levels of detail unless they are built or cannot be.
+  bool ensure_lod();
+
+  // Builds the levels of detail like ensure_lod(), and tells whether they
+  // may be drawn: only while nothing but the halfedge mesh places the
+  // vertices. Must be called before the wave offsets are applied.
+  bool lod_drawable();
+
+  // Number of faces to draw the mesh with where modelView places it, given
+  // the scale of the projection, (1, 1) entry of its matrix.
+  Size lod_face_count(const Matrix4x4 &modelView, double projectionScale) const;
+
+  // Levels of detail of the halfedge mesh, which downsample() steps through
+  // and which distant copies are drawn from.
+  ProgressiveMesh lod;
+  bool lodFailed;    // whether the mesh has faces that are not triangles
+  bool lodDeferred;  // whether the mesh is moving, see mesh_changing()
+  bool isPlaying;    // whether the timeline is playing, see set_playing()
+
+  // Builds the skinning weights unless they are built for the current bind
+  // pose of the skeleton.
+  void ensure_skin_weights(bool useCapsuleRadius, size_t num_threads);
+
+  // Skinning weights of the points some joint influences, skin_influences
+  // slots per point, unused slots with weight 0. The points are the
+  // vertices, or those of the cage if the mesh was subdivided.
+  bool skinBuilt;
+  std::vector<Vertex *> skinVertices;      // vertices in list order
+  std::vector<uint32_t> skinPoints;        // index of each point skinned
+  std::vector<Vector3D> skinBindPositions; // bind position of each point skinned
+  std::vector<uint32_t> skinJoints;
+  std::vector<double> skinWeights;
+
+  // Posed cage, and the vertex positions refined from it.
+  std::vector<Vector3D> skinCagePositions, skinRefinedPositions;
+
+  // Bind pose the weights were built for.
+  bool skinUsedCapsuleRadius;
+  std::vector<Matrix4x4> skinBindInverses;
+  std::vector<double> skinCapsuleRadii;
+
+  // Joint transforms of the current frame, from bind pose to posed, as the
+  // top three rows of each matrix in row-major order.
+  std::vector<double> skinPalette;
+
+  // Skinning time over the frames since it was last reported.
+  double skinSeconds;
+  Size skinFrames;
+
+  // Bind positions of the vertices of the mesh before its last
+  // subdivision, empty if it was edited since, and the stencils refining
+  // them into the vertices of the mesh.
+  std::vector<Vector3D> subdivisionCage;
+  QuadSubdivision subdivision;
+
   // map from picking IDs to mesh elements, generated during draw_pick
   // and used by setSelection
   std::map<int, HalfedgeElement *> idToElement;
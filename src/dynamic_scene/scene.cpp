@@ -3,6 +3,7 @@
 #include "../halfEdgeMesh.h"
 #include "mesh.h"
 #include "widgets.h"
+#include "../work_queue.h"
 #include <fstream>
 
 using std::cout;
@@ -85,7 +86,8 @@ void Scene::render_in_opengl() {
   }
 }
 
-void Scene::render_splines_at(double time, bool pretty, bool useCapsuleRadius) {
+void Scene::render_splines_at(double time, bool pretty, bool useCapsuleRadius,
+                              size_t num_threads) {
   // Update splines
   for (SceneObject *obj : objects) {
     obj->position = obj->positions.evaluate(time);
@@ -97,7 +99,7 @@ void Scene::render_splines_at(double time, bool pretty, bool useCapsuleRadius) {
   for (SceneObject *obj : objects) {
     Mesh *mesh = dynamic_cast<Mesh *>(obj);
     if (mesh != nullptr) {
-      mesh->linearBlendSkinning(useCapsuleRadius);
+      mesh->linearBlendSkinning(useCapsuleRadius, num_threads);
     }
   }
 
@@ -351,16 +353,17 @@ void Scene::triangulateSelection() {
   Mesh *mesh = dynamic_cast<Mesh *>(selected.object);
   if (mesh) {
     mesh->mesh.triangulate();
+    mesh->mesh_changed();
     clearSelections();
   }
 }
 
-void Scene::subdivideSelection(bool useCatmullClark) {
+void Scene::subdivideSelection(bool useCatmullClark, size_t num_threads) {
   if (selected.object == nullptr) return;
 
   Mesh *mesh = dynamic_cast<Mesh *>(selected.object);
   if (mesh) {
-    mesh->mesh.subdivideQuad(useCatmullClark);
+    mesh->subdivide(useCatmullClark, num_threads);
 
     // Old elements are invalid
     clearSelections();
@@ -439,19 +442,22 @@ void Scene::downsample_selected_mesh() {
   clearSelections();
 }
 
-void Scene::resample_selected_mesh() {
+void Scene::resample_selected_mesh(size_t num_threads) {
   if (selected.object == nullptr || selected.element == nullptr) return;
   Mesh *m = dynamic_cast<Mesh *>(selected.object);
-  if (m) m->resample();
+  if (m) m->resample(num_threads);
   clearSelections();
 }
 
-StaticScene::Scene *Scene::get_static_scene() {
+StaticScene::Scene *Scene::get_static_scene(size_t num_threads) {
   std::vector<StaticScene::SceneObject *> staticObjects;
   std::vector<StaticScene::SceneLight *> staticLights;
 
-  for (SceneObject *obj : objects) {
-    auto staticObject = obj->get_static_object();
+  std::vector<SceneObject *> list(objects.begin(), objects.end());
+  std::vector<StaticScene::SceneObject *> converted(list.size());
+  parallel_for(list.size(), num_threads,
+               [&](size_t i) { converted[i] = list[i]->get_static_object(); });
+  for (StaticScene::SceneObject *staticObject : converted) {
     if (staticObject != nullptr) staticObjects.push_back(staticObject);
   }
   for (SceneLight *light : lights) {
@@ -475,6 +481,25 @@ StaticScene::Scene *Scene::get_transformed_static_scene(double t) {
   return new StaticScene::Scene(staticObjects, staticLights);
 }
 
+StaticScene::Scene *Scene::get_transformed_static_scene(double t,
+                                                        double shutter_open,
+                                                        double shutter_close) {
+  if (shutter_close <= shutter_open) return get_transformed_static_scene(t);
+
+  std::vector<StaticScene::SceneObject *> staticObjects;
+  std::vector<StaticScene::SceneLight *> staticLights;
+
+  for (SceneObject *obj : objects) {
+    auto staticObject = obj->get_moving_static_object(t + shutter_open,
+                                                      t + shutter_close);
+    if (staticObject != nullptr) staticObjects.push_back(staticObject);
+  }
+  for (SceneLight *light : lights) {
+    staticLights.push_back(light->get_static_light());
+  }
+  return new StaticScene::Scene(staticObjects, staticLights);
+}
+
 void Scene::bevel_selected_element() {
   // Don't re-bevel an element that we're already editing (i.e., beveling)
   if (edited.element == selected.element) return;
@@ -96,6 +96,15 @@ class SceneObject {
     return get_static_object();
   }
 
+  /**
+   * Same as get_transformed_static_object, over a shutter interval: the
+   * static object holds the geometry at t0 along with how it moves until t1,
+   * for motion blur. Objects that do not animate keep the default.
+   */
+  virtual StaticScene::SceneObject *get_moving_static_object(double t0, double /*t1*/) {
+    return get_transformed_static_object(t0);
+  }
+
   /**
    * Rather than drawing the object geometry for display, this method draws the
    * object with unique colors that can be used to determine which object was
@@ -226,9 +235,11 @@ class Scene {
 
   /**
    * Renders the scene at the given time in OpenGL, according to the
-   * splines specified in the animator.
+   * splines specified in the animator. Meshes are skinned on up to
+   * num_threads threads.
    */
-  void render_splines_at(double time, bool pretty, bool useCapsuleRadius);
+  void render_splines_at(double time, bool pretty, bool useCapsuleRadius,
+                         size_t num_threads = 1);
 
   /**
    * Draws the actual curves corresponding to a spline.
@@ -280,26 +291,37 @@ class Scene {
 
   void upsample_selected_mesh();
   void downsample_selected_mesh();
-  void resample_selected_mesh();
+  void resample_selected_mesh(size_t num_threads = 1);
 
   void selectNextHalfedge();
   void selectTwinHalfedge();
   void selectHalfedge();
 
   void triangulateSelection();
-  void subdivideSelection(bool useCatmullClark = false);
+  /**
+   * Subdivides the selected mesh into quads, on up to num_threads threads.
+   */
+  void subdivideSelection(bool useCatmullClark = false, size_t num_threads = 1);
 
   /**
    * Builds a static scene that's equivalent to the current scene and is easier
-   * to use in raytracing, but doesn't allow modifications.
+   * to use in raytracing, but doesn't allow modifications. The objects are
+   * converted on up to num_threads threads.
    */
-  StaticScene::Scene *get_static_scene();
+  StaticScene::Scene *get_static_scene(size_t num_threads = 1);
   /**
    * Does the same thing as get_static_scene, but applies all objects'
    * transformations.
    */
   StaticScene::Scene *get_transformed_static_scene(double t);
 
+  /**
+   * Static scene over the shutter interval [t + shutter_open, t + shutter_close]
+   * of frame t, with animated objects moving across it for motion blur.
+   */
+  StaticScene::Scene *get_transformed_static_scene(double t, double shutter_open,
+                                                   double shutter_close);
+
   /* Keep track of which elements of the scene (if any) are currently
    * under the cursor, selected, or being edited. */
   Selection hovered;
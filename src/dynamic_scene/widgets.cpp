@@ -383,6 +383,11 @@ void XFormWidget::drag(double x, double y, double dx, double dy,
     return;
   }
 
+  // Moving elements changes the geometry the levels of detail come from,
+  // which are built again once the drag is over.
+  Mesh* mesh = dynamic_cast<Mesh*>(target.object);
+  if (mesh) mesh->mesh_changing();
+
   if (mode == Mode::Translate && target.axis == Selection::Axis::Center) {
     target.element->translate(dx, dy, modelViewProj);
     // TODO uniform scale, free rotate
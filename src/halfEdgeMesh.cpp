@@ -1,7 +1,9 @@
 #include "halfEdgeMesh.h"
+#include <cstdint>
 #include <sstream>
 
 #include "error_dialog.h"
+#include "work_queue.h"
 
 namespace PROJ6850 {
 
@@ -45,7 +47,8 @@ namespace PROJ6850 {
     }
 
     void HalfedgeMesh::build(const vector<vector<Index> >& polygons,
-                             const vector<Vector3D>& vertexPositions)
+                             const vector<Vector3D>& vertexPositions,
+                             size_t num_threads)
 // This method initializes the halfedge data structure from a raw list of
 // polygons, where each input polygon is specified as a list of vertex indices.
 // The input must describe a manifold, oriented surface, where the orientation
@@ -54,9 +57,9 @@ namespace PROJ6850 {
 // on the vertex indices, i.e., they do not have to start at 0 or 1, nor does
 // the collection of indices have to be contiguous.  Overall, this initializer
 // is designed to be robust but perhaps not incredibly fast (though of course
-// this does not affect the performance of the resulting data structure).  One
-// could also implement faster initializers that handle important special cases
-// (e.g., all triangles, or data that is known to be manifold). Since there are
+// this does not affect the performance of the resulting data structure).  Most
+// input goes through the faster HalfedgeMesh::buildFast() instead, which falls
+// back to this path for sparse indices and invalid input. Since there are
 // no strong conditions on the indices of polygons, we assume that the list of
 // vertex positions is given in lexicographic order (i.e., that the lowest index
 // appearing in any polygon corresponds to the first entry of the list of
@@ -78,6 +81,14 @@ namespace PROJ6850 {
       faces.clear();
       boundaries.clear();
 
+      if (buildFast(polygons, vertexPositions, num_threads)) return;
+      // start over from what the fast path built before giving up
+      halfedges.clear();
+      vertices.clear();
+      edges.clear();
+      faces.clear();
+      boundaries.clear();
+
       // Since the vertices in our halfedge mesh are stored in a linked list,
       // we will temporarily need to keep track of the correspondence between
       // indices of vertices in our input and pointers to vertices in the new
@@ -252,6 +263,72 @@ namespace PROJ6850 {
 
       }  // done building basic halfedge connectivity
 
+      buildBoundaryLoops();
+
+      // Finally, we check that all vertices are manifold.
+      for (VertexIter v = vertices.begin(); v != vertices.end(); v++) {
+        // First check that this vertex is not a "floating" vertex;
+        // if it is then we do not have a valid 2-manifold surface.
+        if (v->halfedge() == halfedges.end()) {
+          cerr << "Error converting polygons to halfedge mesh: some vertices are "
+                  "not referenced by any polygon."
+               << endl;
+          exit(1);
+        }
+
+        // Next, check that the number of halfedges emanating from this vertex in
+        // our half edge data structure equals the number of polygons containing
+        // this vertex, which we counted during our first pass over the mesh.  If
+        // not, then our vertex is not a "fan" of polygons, but instead has some
+        // other (nonmanifold) structure.
+        Size count = 0;
+        HalfedgeIter h = v->halfedge();
+        do {
+          if (!h->face()->isBoundary()) {
+            count++;
+          }
+          h = h->twin()->next();
+        } while (h != v->halfedge());
+
+        if (count != vertexDegree[v]) {
+          cerr << "Error converting polygons to halfedge mesh: at least one of the "
+                  "vertices is nonmanifold."
+               << endl;
+          exit(1);
+        }
+      }  // end loop over vertices
+
+      // Now that we have the connectivity, we copy the list of vertex
+      // positions into member variables of the individual vertices.
+      if (vertexPositions.size() < vertices.size()) {
+        cerr << "Error converting polygons to halfedge mesh: number of vertex "
+                "positions is different from the number of distinct vertices!"
+             << endl;
+        cerr << "(number of positions in input: " << vertexPositions.size() << ")"
+             << endl;
+        cerr << "(  number of vertices in mesh: " << vertices.size() << ")" << endl;
+        exit(1);
+      }
+      // Since an STL map internally sorts its keys, we can iterate over the map
+      // from vertex indices to vertex iterators to visit our (input) vertices in
+      // lexicographic order
+      int i = 0;
+      for (map<Index, VertexIter>::const_iterator e = indexToVertex.begin();
+           e != indexToVertex.end(); e++) {
+        // grab a pointer to the vertex associated with the current key (i.e., the
+        // current index)
+        VertexIter v = e->second;
+
+        // set the att of this vertex to the corresponding
+        // position in the input
+        v->position = vertexPositions[i];
+        v->bindPosition = v->position;
+        i++;
+      }
+
+    }  // end HalfedgeMesh::build()
+
+    void HalfedgeMesh::buildBoundaryLoops() {
       // For each vertex on the boundary, advance its halfedge pointer to one that
       // is also on the boundary.
       for (VertexIter v = verticesBegin(); v != verticesEnd(); v++) {
@@ -354,69 +431,189 @@ namespace PROJ6850 {
       for (VertexIter v = verticesBegin(); v != verticesEnd(); v++) {
         v->halfedge() = v->halfedge()->twin()->next();
       }
+    }
 
-      // Finally, we check that all vertices are manifold.
-      for (VertexIter v = vertices.begin(); v != vertices.end(); v++) {
-        // First check that this vertex is not a "floating" vertex;
-        // if it is then we do not have a valid 2-manifold surface.
-        if (v->halfedge() == halfedges.end()) {
-          cerr << "Error converting polygons to halfedge mesh: some vertices are "
-                  "not referenced by any polygon."
-               << endl;
-          exit(1);
+    namespace {
+
+    // an undirected edge, its two vertices packed into one integer, and the
+    // halfedge it comes from
+    struct EdgeKey {
+      uint64_t key;
+      uint32_t halfedge;
+    };
+
+    // Stable LSD radix sort of edge keys on their low bits, 11 bits per
+    // pass. Each pass counts and then scatters contiguous chunks of the keys,
+    // in parallel with several threads; the chunks go to each bucket in
+    // order, which keeps the sort stable.
+    void sortEdgeKeys(vector<EdgeKey>& keys, unsigned bits, size_t num_threads) {
+      const unsigned DIGIT_BITS = 11;
+      const size_t BUCKETS = size_t(1) << DIGIT_BITS;
+      size_t n = keys.size();
+      size_t chunks = min(max(num_threads, size_t(1)), n / 65536 + 1);
+      size_t chunkSize = (n + chunks - 1) / chunks;
+      vector<EdgeKey> sorted(n);
+      vector<size_t> offsets(chunks * BUCKETS);
+      for (unsigned shift = 0; shift < bits; shift += DIGIT_BITS) {
+        parallel_for(chunks, num_threads, [&](size_t c) {
+          size_t* count = &offsets[c * BUCKETS];
+          fill(count, count + BUCKETS, 0);
+          size_t end = min(n, (c + 1) * chunkSize);
+          for (size_t i = c * chunkSize; i < end; i++) {
+            count[(keys[i].key >> shift) & (BUCKETS - 1)]++;
+          }
+        });
+        size_t offset = 0;
+        for (size_t d = 0; d < BUCKETS; d++) {
+          for (size_t c = 0; c < chunks; c++) {
+            size_t count = offsets[c * BUCKETS + d];
+            offsets[c * BUCKETS + d] = offset;
+            offset += count;
+          }
         }
+        parallel_for(chunks, num_threads, [&](size_t c) {
+          size_t* next = &offsets[c * BUCKETS];
+          size_t end = min(n, (c + 1) * chunkSize);
+          for (size_t i = c * chunkSize; i < end; i++) {
+            sorted[next[(keys[i].key >> shift) & (BUCKETS - 1)]++] = keys[i];
+          }
+        });
+        keys.swap(sorted);
+      }
+    }
 
-        // Next, check that the number of halfedges emanating from this vertex in
-        // our half edge data structure equals the number of polygons containing
-        // this vertex, which we counted during our first pass over the mesh.  If
-        // not, then our vertex is not a "fan" of polygons, but instead has some
-        // other (nonmanifold) structure.
-        Size count = 0;
-        HalfedgeIter h = v->halfedge();
-        do {
-          if (!h->face()->isBoundary()) {
-            count++;
+    }  // namespace
+
+    bool HalfedgeMesh::buildFast(const vector<vector<Index> >& polygons,
+                                 const vector<Vector3D>& vertexPositions,
+                                 size_t num_threads) {
+      const uint32_t NONE = 0xffffffff;
+
+      // Check the polygons, and leave very sparse indices to the map of the
+      // general path.
+      Size nHalfedges = 0;
+      Index maxIndex = 0;
+      for (const vector<Index>& p : polygons) {
+        if (p.size() < 3) return false;
+        for (Size i = 0; i < p.size(); i++) {
+          maxIndex = max(maxIndex, p[i]);
+          for (Size j = 0; j < i; j++) {
+            if (p[i] == p[j]) return false;
           }
-          h = h->twin()->next();
-        } while (h != v->halfedge());
+        }
+        nHalfedges += p.size();
+      }
+      if (polygons.empty() || nHalfedges >= NONE ||
+          maxIndex > 2 * (nHalfedges + vertexPositions.size())) {
+        return false;
+      }
 
-        if (count != vertexDegree[v]) {
-          cerr << "Error converting polygons to halfedge mesh: at least one of the "
-                  "vertices is nonmanifold."
-               << endl;
-          exit(1);
+      // Vertices are numbered in order of first appearance, which is the
+      // order of the vertex list. The halfedges of a face are created in
+      // order, and each vertex points to the last halfedge leaving it, as in
+      // the general path.
+      vector<uint32_t> indexToVertex(maxIndex + 1, NONE);
+      vector<VertexIter> vertexList;
+      vector<Size> vertexDegree;
+      vector<HalfedgeIter> halfedgeList;
+      vector<uint32_t> halfedgeFrom, halfedgeTo;  // vertices of each halfedge
+      halfedgeList.reserve(nHalfedges);
+      halfedgeFrom.reserve(nHalfedges);
+      halfedgeTo.resize(nHalfedges);
+      faces.resize(polygons.size());
+      FaceIter f = faces.begin();
+      for (const vector<Index>& p : polygons) {
+        Size first = halfedgeList.size();
+        for (Index i : p) {
+          uint32_t& v = indexToVertex[i];
+          if (v == NONE) {
+            v = vertexList.size();
+            vertexList.push_back(newVertex());
+            vertexDegree.push_back(0);
+          }
+          vertexDegree[v]++;
+
+          HalfedgeIter h = newHalfedge();
+          h->face() = f;
+          h->vertex() = vertexList[v];
+          h->vertex()->halfedge() = h;
+          halfedgeList.push_back(h);
+          halfedgeFrom.push_back(v);
         }
-      }  // end loop over vertices
+        for (Size i = first; i < halfedgeList.size(); i++) {
+          Size j = i + 1 < halfedgeList.size() ? i + 1 : first;
+          halfedgeList[i]->next() = halfedgeList[j];
+          halfedgeTo[i] = halfedgeFrom[j];
+        }
+        f->halfedge() = halfedgeList.back();
+        f++;
+      }
+      Size nVertices = vertexList.size();
+      if (vertexPositions.size() < nVertices) return false;
+
+      // Sort the halfedges by undirected edge, the lower vertex in the high
+      // bits of the key, so that twins end up next to each other. An edge
+      // must have one halfedge, or two going opposite ways.
+      unsigned vertexBits = 1;
+      while ((Size(1) << vertexBits) < nVertices) vertexBits++;
+      vector<EdgeKey> keys(nHalfedges);
+      for (Size h = 0; h < nHalfedges; h++) {
+        uint64_t a = halfedgeFrom[h], b = halfedgeTo[h];
+        keys[h].key = a < b ? a << vertexBits | b : b << vertexBits | a;
+        keys[h].halfedge = h;
+      }
+      sortEdgeKeys(keys, 2 * vertexBits, num_threads);
 
-      // Now that we have the connectivity, we copy the list of vertex
-      // positions into member variables of the individual vertices.
-      if (vertexPositions.size() < vertices.size()) {
-        cerr << "Error converting polygons to halfedge mesh: number of vertex "
-                "positions is different from the number of distinct vertices!"
-             << endl;
-        cerr << "(number of positions in input: " << vertexPositions.size() << ")"
-             << endl;
-        cerr << "(  number of vertices in mesh: " << vertices.size() << ")" << endl;
-        exit(1);
+      vector<uint32_t> twin(nHalfedges, NONE);
+      for (Size i = 0, j; i < nHalfedges; i = j) {
+        for (j = i + 1; j < nHalfedges && keys[j].key == keys[i].key; j++) {
+        }
+        if (j - i == 1) continue;
+        uint32_t h0 = keys[i].halfedge, h1 = keys[i + 1].halfedge;
+        if (j - i > 2 || halfedgeFrom[h0] == halfedgeFrom[h1]) return false;
+        twin[h0] = h1;
+        twin[h1] = h0;
       }
-      // Since an STL map internally sorts its keys, we can iterate over the map
-      // from vertex indices to vertex iterators to visit our (input) vertices in
-      // lexicographic order
-      int i = 0;
-      for (map<Index, VertexIter>::const_iterator e = indexToVertex.begin();
-           e != indexToVertex.end(); e++) {
-        // grab a pointer to the vertex associated with the current key (i.e., the
-        // current index)
-        VertexIter v = e->second;
 
-        // set the att of this vertex to the corresponding
-        // position in the input
-        v->position = vertexPositions[i];
-        v->bindPosition = v->position;
-        i++;
+      // Edges are created with the second halfedge of their pair, in the
+      // order of the general path.
+      for (Size h = 0; h < nHalfedges; h++) {
+        HalfedgeIter hab = halfedgeList[h];
+        if (twin[h] == NONE) {
+          hab->twin() = halfedges.end();
+        } else if (twin[h] < h) {
+          HalfedgeIter hba = halfedgeList[twin[h]];
+          hab->twin() = hba;
+          hba->twin() = hab;
+          EdgeIter e = newEdge();
+          hab->edge() = e;
+          hba->edge() = e;
+          e->halfedge() = hab;
+        }
       }
 
-    }  // end HalfedgeMesh::build()
+      buildBoundaryLoops();
+
+      // Check that the faces around each vertex form a single fan.
+      for (Size v = 0; v < nVertices; v++) {
+        Size count = 0;
+        HalfedgeIter h = vertexList[v]->halfedge();
+        do {
+          if (!h->face()->isBoundary()) count++;
+          h = h->twin()->next();
+        } while (h != vertexList[v]->halfedge());
+        if (count != vertexDegree[v]) return false;
+      }
+
+      // The positions are those of the indices used, in increasing order.
+      Size i = 0;
+      for (uint32_t v : indexToVertex) {
+        if (v == NONE) continue;
+        vertexList[v]->position = vertexPositions[i++];
+        vertexList[v]->bindPosition = vertexList[v]->position;
+      }
+      return true;
+    }
 
 /**
  * This method does the same thing as HalfedgeMesh::build(), but also
@@ -426,7 +623,8 @@ namespace PROJ6850 {
  * by this call.
  */
     void HalfedgeMesh::rebuild(const vector<vector<Index> >& polygons,
-                               const vector<Vector3D>& vertexPositions) {
+                               const vector<Vector3D>& vertexPositions,
+                               size_t num_threads) {
       // Clear old elements
       halfedges.clear();
       vertices.clear();
@@ -435,7 +633,7 @@ namespace PROJ6850 {
       boundaries.clear();
 
       // Create new mesh
-      build(polygons, vertexPositions);
+      build(polygons, vertexPositions, num_threads);
     }
 
     const HalfedgeMesh& HalfedgeMesh::operator=(const HalfedgeMesh& mesh)
@@ -500,9 +698,13 @@ namespace PROJ6850 {
     HalfedgeMesh::HalfedgeMesh(const HalfedgeMesh& mesh) { *this = mesh; }
 
     void HalfedgeMesh::triangulate() {
-      for (FaceIter f = facesBegin(); f != facesEnd(); f++) {
-        HalfedgeIter h = f->halfedge();
+      // splitPolygon erases the face it splits, so step past it first; the
+      // triangles it appends are visited last and left alone
+      for (FaceIter f = facesBegin(); f != facesEnd();) {
+        FaceIter next = f;
+        next++;
         splitPolygon(f);
+        f = next;
       }
     }
 
@@ -172,6 +172,8 @@ namespace PROJ6850 {
     class Face;
     class Halfedge;
 
+    class QuadSubdivision;
+
 /*
  * Rather than using raw pointers to mesh elements, we store references
  * as STL::iterators---for convenience, we give shorter names to these
@@ -816,15 +818,28 @@ namespace PROJ6850 {
          */
         HalfedgeMesh(const HalfedgeMesh &mesh);
 
+        /**
+         * Exchanges the elements of two meshes without copying them. Iterators
+         * to the elements stay valid, and refer to the other mesh afterwards.
+         */
+        void swap(HalfedgeMesh &mesh) {
+          halfedges.swap(mesh.halfedges);
+          vertices.swap(mesh.vertices);
+          edges.swap(mesh.edges);
+          faces.swap(mesh.faces);
+          boundaries.swap(mesh.boundaries);
+        }
+
         /**
          * This method initializes the halfedge data structure from a raw list of
          * polygons, where each input polygon is specified as a list of (0-based)
          * vertex indices. The input must describe a manifold, oriented surface,
          * where the orientation of a polygon is determined by the order of vertices
-         * in the list.
+         * in the list. num_threads threads sort the edges of large meshes.
          */
         void build(const vector<vector<Index>> &polygons,
-                   const vector<Vector3D> &vertexPositions);
+                   const vector<Vector3D> &vertexPositions,
+                   size_t num_threads = 1);
 
         /**
          * This method does the same thing as HalfedgeMesh::build(), but also
@@ -834,7 +849,8 @@ namespace PROJ6850 {
          * by this call.
          */
         void rebuild(const vector<vector<Index>> &polygons,
-                     const vector<Vector3D> &vertexPositions);
+                     const vector<Vector3D> &vertexPositions,
+                     size_t num_threads = 1);
 
         // These methods return the total number of elements of each type.
         Size nHalfedges() const {
@@ -970,7 +986,7 @@ namespace PROJ6850 {
         /**
          * Split an edge, returning a pointer to the inserted midpoint vertex; the
          * halfedge of this vertex should refer to one of the edges in the original
-         * mesh
+         * mesh. On the boundary, only the triangle next to the edge is split.
          */
         VertexIter splitEdge(EdgeIter e);
 
@@ -1004,9 +1020,13 @@ namespace PROJ6850 {
         /**
          * Split all faces into quads by inserting a vertex at their
          * centroid (possibly using Catmull-Clark rules to compute
-         * new vertex positions).
+         * new vertex positions). The work is split among num_threads
+         * threads (see QuadSubdivision).
+         * \param subdivision if given, keeps the stencils, so that new
+         *        positions of the coarse vertices can be refined later
          */
-        void subdivideQuad(bool useCatmullClark = false);
+        void subdivideQuad(bool useCatmullClark = false, size_t num_threads = 1,
+                           QuadSubdivision *subdivision = NULL);
 
         /**
          * Compute new vertex positions for a mesh that splits each polygon
@@ -1082,6 +1102,23 @@ namespace PROJ6850 {
         void splitPolygons(vector<FaceIter> &fcs);
 
     protected:
+        /**
+         * Builds the mesh with arrays indexed by vertex and twins matched by
+         * sorting the edges, rather than with maps. Returns false, leaving
+         * the mesh to be cleared, for very sparse vertex indices and for any
+         * input build() rejects, so that the general path reports the error.
+         */
+        bool buildFast(const vector<vector<Index>> &polygons,
+                       const vector<Vector3D> &vertexPositions,
+                       size_t num_threads);
+
+        /**
+         * Closes the boundaries of a mesh being built with boundary loops, once
+         * the twins of all interior halfedges are linked and the others point
+         * to halfedges.end(), and points each vertex at its first halfedge.
+         */
+        void buildBoundaryLoops();
+
         /*
          * Here's where the mesh elements are actually stored---this is the one
          * and only place we have actual data (rather than pointers/iterators).
@@ -3,7 +3,13 @@
 
 #include "PROJ6850/color.h"
 #include "PROJ6850/spectrum.h"
+#include "PROJ6850/vec3f.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <thread>
 #include <vector>
 #include <string.h>
 
@@ -74,6 +80,108 @@ struct ImageBuffer {
   std::vector<uint32_t> data;  ///< pixel buffer
 };
 
+/**
+ * Display transform from linear radiance to 8-bit color: a scale followed by
+ * a gamma curve, read from a lookup table instead of calling pow for every
+ * channel.
+ *
+ * The table is indexed by the bits of the scaled value, so it has the same
+ * resolution in every octave: 256 entries per octave from 2^-20 to 1. A table
+ * indexed by the value itself would flatten the steep low end of the gamma
+ * curve. Values under 2^-20 are black and values over 1 are white, as
+ * clamping made them before.
+ */
+class ToneCurve {
+ public:
+  /**
+   * Scale of an exposure level adjustment.
+   */
+  static float exposure(float level) { return sqrt(pow(2, level)); }
+
+  /**
+   * Constructor.
+   * \param gamma gamma value
+   * \param scale factor applied to the radiance before the gamma curve
+   */
+  explicit ToneCurve(float gamma = 2.2f, float scale = exposure(1.0f))
+      : gamma(0), scale(scale) {
+    set_gamma(gamma);
+  }
+
+  /**
+   * Change the gamma value, rebuilding the table if it differs.
+   */
+  void set_gamma(float gamma) {
+    if (gamma == this->gamma) return;
+    this->gamma = gamma;
+    float one_over_gamma = 1.0f / gamma;
+    lut.resize(TABLE_SIZE);
+    lut[0] = 0;
+    for (uint32_t i = 1; i < TABLE_SIZE - 1; i++) {
+      // middle of the values sharing the index
+      uint32_t low_bits = LOW_BITS + (i << MANTISSA_SHIFT);
+      uint32_t high_bits = low_bits + (1u << MANTISSA_SHIFT);
+      float low, high;
+      memcpy(&low, &low_bits, sizeof(low));
+      memcpy(&high, &high_bits, sizeof(high));
+      float x = 0.5f * (low + high);
+      lut[i] = (uint8_t)(std::min(1.0f, powf(x, one_over_gamma)) * 255);
+    }
+    lut[TABLE_SIZE - 1] = 255;
+  }
+
+  /**
+   * Change the scale applied before the gamma curve.
+   */
+  void set_scale(float scale) { this->scale = scale; }
+
+  /**
+   * Convert a run of pixels to opaque RGBA colors.
+   * \param src linear radiance
+   * \param dst packed colors, as ImageBuffer stores them
+   * \param n number of pixels
+   */
+  void apply(const Spectrum* src, uint32_t* dst, size_t n) const {
+    static_assert(sizeof(Spectrum) == 3 * sizeof(float),
+                  "spectrum channels are read as a float array");
+    const float* channels = &src->r;
+    const uint32_t low = LOW_BITS, high = HIGH_BITS;
+    uint32_t index[3 * BLOCK];
+    for (size_t start = 0; start < n; start += BLOCK) {
+      size_t count = n - start < BLOCK ? n - start : BLOCK;
+      // table indices of a block of channels, free of float compares and
+      // conversions so that the loop is vectorized
+      const float* c = channels + 3 * start;
+      for (size_t i = 0; i < 3 * count; i++) {
+        float x = c[i] * scale;
+        uint32_t bits;
+        memcpy(&bits, &x, sizeof(bits));
+        bits &= ~(uint32_t)((int32_t)bits >> 31);  // negative values are black
+        bits = std::min(std::max(bits, low), high);
+        index[i] = (bits - low) >> MANTISSA_SHIFT;
+      }
+      const uint8_t* table = &lut[0];
+      uint32_t* d = dst + start;
+      for (size_t i = 0; i < count; i++) {
+        d[i] = 0xff000000u | (uint32_t)table[index[3 * i + 2]] << 16 |
+               (uint32_t)table[index[3 * i + 1]] << 8 | table[index[3 * i]];
+      }
+    }
+  }
+
+ private:
+  static const uint32_t LOW_BITS = (127 - 20) << 23;  ///< bits of 2^-20
+  static const uint32_t HIGH_BITS = 127 << 23;        ///< bits of 1
+  static const uint32_t MANTISSA_SHIFT = 23 - 8;      ///< keeps 8 mantissa bits
+  static const uint32_t TABLE_SIZE =
+      ((HIGH_BITS - LOW_BITS) >> MANTISSA_SHIFT) + 1;
+  static const size_t BLOCK = 64;  ///< pixels converted at a time
+
+  float gamma;               ///< gamma of the table
+  float scale;               ///< factor applied before the table
+  std::vector<uint8_t> lut;  ///< 8-bit value of each index
+};
+
 /**
  * High Dynamic Range image buffer which stores linear space spectrum
  * values with 32 bit floating points.
@@ -132,58 +240,63 @@ struct HDRImageBuffer {
     data[x + y * w] = s * r + (1 - r) * data[x + y * w];
   }
 
+  /**
+   * Global log average luminance, summed over bands of rows in parallel.
+   * \param num_threads number of threads summing rows
+   */
+  float log_average_luminance(size_t num_threads = 1) const {
+    size_t n = w * h;
+    if (n == 0) return 0;
+    size_t bands = std::max<size_t>(1, std::min(num_threads, h));
+    std::vector<double> sums(bands, 0.0);
+    auto sum_rows = [this, &sums, bands](size_t band) {
+      size_t end = (band + 1) * h / bands * w;
+      double sum = 0;
+      for (size_t i = band * h / bands * w; i < end; ++i) {
+        // the small delta value below is used to avoids singularity
+        sum += log(0.0000001f + data[i].illum());
+      }
+      sums[band] = sum;
+    };
+    std::vector<std::thread> threads;
+    for (size_t band = 1; band < bands; band++) {
+      threads.push_back(std::thread(sum_rows, band));
+    }
+    sum_rows(0);
+    for (std::thread& thread : threads) thread.join();
+    double sum = 0;
+    for (double s : sums) sum += s;
+    return exp(sum / n);
+  }
+
   /**
    * Tonemap and convert to color space image.
+   * The key, white point and exposure only scale the image, so they are
+   * folded into the scale of a single tone curve pass.
    * \param target target color buffer to store output
    * \param gamma gamma value
    * \param level exposure level adjustment
-   * \key   key value to map average tone to (higher means brighter)
-   * \why   white point (higher means larger dynamic range)
+   * \param key key value to map average tone to (higher means brighter)
+   * \param wht white point (higher means larger dynamic range)
+   * \param num_threads number of threads computing the average luminance
    */
   void tonemap(ImageBuffer& target, float gamma, float level, float key,
-               float wht) {
-    // compute global log average luminance!
-    float avg = 0;
-    for (size_t i = 0; i < w * h; ++i) {
-      // the small delta value below is used to avoids singularity
-      avg += log(0.0000001f + data[i].illum());
-    }
-    avg = exp(avg / (w * h));
-
-    // apply on pixels
-    float one_over_gamma = 1.0f / gamma;
-    float exposure = sqrt(pow(2, level));
-    for (size_t y = 0; y < h; ++y) {
-      for (size_t x = 0; x < w; ++x) {
-        Spectrum s = data[x + y * w];
-        float l = s.illum();
-        s *= key / avg;
-        s *= ((l + 1) / (wht * wht)) / (l + 1);
-        float r = pow(s.r * exposure, one_over_gamma);
-        float g = pow(s.g * exposure, one_over_gamma);
-        float b = pow(s.b * exposure, one_over_gamma);
-        target.update_pixel(Color(r, g, b, 1.0), x, y);
-      }
-    }
+               float wht, size_t num_threads = 1) const {
+    float avg = log_average_luminance(num_threads);
+    ToneCurve curve(gamma, key / avg / (wht * wht) * ToneCurve::exposure(level));
+    toColor(target, 0, 0, w, h, curve);
   }
 
   /**
    * Convert the given tile of the buffer to color.
+   * \param target target color buffer, same size as the buffer
+   * \param curve display transform
    */
   void toColor(ImageBuffer& target, size_t x0, size_t y0, size_t x1,
-               size_t y1) {
-    float gamma = 2.2f;
-    float level = 1.0f;
-    float one_over_gamma = 1.0f / gamma;
-    float exposure = sqrt(pow(2, level));
+               size_t y1, const ToneCurve& curve) const {
+    if (x1 <= x0) return;
     for (size_t y = y0; y < y1; ++y) {
-      for (size_t x = x0; x < x1; ++x) {
-        const Spectrum& s = data[x + y * w];
-        float r = pow(s.r * exposure, one_over_gamma);
-        float g = pow(s.g * exposure, one_over_gamma);
-        float b = pow(s.b * exposure, one_over_gamma);
-        target.update_pixel(Color(r, g, b, 1.0), x, y);
-      }
+      curve.apply(&data[x0 + y * w], &target.data[x0 + y * w], x1 - x0);
     }
   }
 
@@ -205,6 +318,128 @@ struct HDRImageBuffer {
 
 };  // class HDRImageBuffer
 
+/**
+ * What the camera rays of a pixel saw at their first hit, accumulated by
+ * the pathtracer for the AOV buffer.
+ */
+struct AOVSample {
+  AOVSample()
+      : depth(INFINITY), primId(UINT32_MAX), samples(0) {}
+
+  Spectrum albedo;   ///< sum of the surface albedos
+  Vec3f normal;      ///< sum of the world space shading normals
+  float depth;       ///< hit distance of the pixel center ray
+  uint32_t primId;   ///< primitive hit by the pixel center ray
+  uint32_t samples;  ///< number of camera rays
+};
+
+/**
+ * Arbitrary output variables: per pixel data of the first hit of the camera
+ * rays, stored next to the beauty image for denoising and compositing.
+ * Only the channels asked for are allocated. Albedo and normal are averaged
+ * over the camera rays of a pixel, depth and primitive id come from the ray
+ * through the pixel center. Pixels whose center ray misses get an infinite
+ * depth and the id UINT32_MAX.
+ */
+struct AOVBuffer {
+  enum Channel {
+    ALBEDO = 1 << 0,   ///< first hit surface albedo
+    NORMAL = 1 << 1,   ///< first hit shading normal, world space
+    DEPTH = 1 << 2,    ///< distance from the camera to the first hit
+    PRIM_ID = 1 << 3,  ///< id of the primitive hit first
+    SAMPLES = 1 << 4   ///< number of camera rays of the pixel
+  };
+
+  /**
+   * Parse a comma separated list of channel names (albedo, normal, depth,
+   * id, samples, or all).
+   * \param list channel names
+   * \param channels address to store the channel mask
+   * \return false if a name is unknown
+   */
+  static bool parse_channels(const std::string& list, unsigned* channels) {
+    static const char* names[5] = {"albedo", "normal", "depth", "id", "samples"};
+    *channels = 0;
+    size_t start = 0;
+    while (start <= list.size()) {
+      size_t end = list.find(',', start);
+      if (end == std::string::npos) end = list.size();
+      std::string name = list.substr(start, end - start);
+      unsigned channel = name == "all" ? (1u << 5) - 1 : 0;
+      for (int i = 0; i < 5; i++) {
+        if (name == names[i]) channel = 1u << i;
+      }
+      if (!channel) return false;
+      *channels |= channel;
+      start = end + 1;
+    }
+    return true;
+  }
+
+  /**
+   * Default constructor.
+   * The default constructor creates an empty buffer with no channels.
+   */
+  AOVBuffer() : w(0), h(0), channels(0) {}
+
+  /**
+   * Resize the buffer and select its channels.
+   * \param w new width of the image
+   * \param h new height of the image
+   * \param channels mask of Channel values to store
+   */
+  void resize(size_t w, size_t h, unsigned channels) {
+    this->w = w;
+    this->h = h;
+    this->channels = channels;
+    size_t n = w * h;
+    albedo.assign(has(ALBEDO) ? n : 0, Spectrum());
+    normal.assign(has(NORMAL) ? n : 0, Vec3f());
+    depth.assign(has(DEPTH) ? n : 0, INFINITY);
+    primId.assign(has(PRIM_ID) ? n : 0, UINT32_MAX);
+    samples.assign(has(SAMPLES) ? n : 0, 0);
+  }
+
+  /**
+   * Whether the buffer stores a channel.
+   */
+  bool has(Channel c) const { return (channels & c) != 0; }
+
+  /**
+   * Store the first hits of the camera rays of a pixel.
+   * \param s accumulated first hits
+   * \param x row of the pixel
+   * \param y column of the pixel
+   */
+  void update_pixel(const AOVSample& s, size_t x, size_t y) {
+    size_t i = x + y * w;
+    float weight = s.samples ? 1.0f / s.samples : 0.0f;
+    if (has(ALBEDO)) albedo[i] = s.albedo * weight;
+    if (has(NORMAL)) {
+      float length = s.normal.norm();
+      normal[i] = length > 0 ? s.normal / length : Vec3f();
+    }
+    if (has(DEPTH)) depth[i] = s.depth;
+    if (has(PRIM_ID)) primId[i] = s.primId;
+    if (has(SAMPLES)) samples[i] = (float) s.samples;
+  }
+
+  /**
+   * Clear all channels.
+   */
+  void clear() { resize(w, h, channels); }
+
+  size_t w;                      ///< width
+  size_t h;                      ///< height
+  unsigned channels;             ///< stored channels, a mask of Channel values
+  std::vector<Spectrum> albedo;  ///< mean first hit albedo
+  std::vector<Vec3f> normal;     ///< mean first hit shading normal
+  std::vector<float> depth;      ///< first hit distance
+  std::vector<uint32_t> primId;  ///< first hit primitive
+  std::vector<float> samples;    ///< camera rays per pixel
+
+};  // struct AOVBuffer
+
 }  // namespace PROJ6850
 
 #endif  // PROJ6850_IMAGE_H
@@ -0,0 +1,380 @@
+#include "image_writer.h"
+
+#include "PROJ6850/lodepng.h"
+#include "PROJ6850/timer.h"
+#include "PROJ6850/tinyexr.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace PROJ6850 {
+
+namespace {
+
+// One channel of an EXR file, read from an interleaved or planar buffer
+struct ExrChannel {
+  std::string name;
+  const unsigned char* data;  ///< value of the first pixel
+  size_t stride;              ///< bytes from one pixel to the next
+  int type;                   ///< TINYEXR_PIXELTYPE_* stored in the file
+
+  bool operator<(const ExrChannel& other) const { return name < other.name; }
+
+  // source values are 32-bit: uint for UINT channels, float otherwise
+  uint32_t value(size_t i) const {
+    uint32_t v;
+    memcpy(&v, data + i * stride, sizeof(v));
+    return v;
+  }
+};
+
+void add_channel(std::vector<ExrChannel>& channels, const std::string& name,
+                 const void* data, size_t stride, int type) {
+  ExrChannel channel = {name, (const unsigned char*) data, stride, type};
+  channels.push_back(channel);
+}
+
+void add_rgb(std::vector<ExrChannel>& channels, const std::string& layer,
+             const std::vector<Spectrum>& data, int type) {
+  add_channel(channels, layer + "R", &data[0].r, sizeof(Spectrum), type);
+  add_channel(channels, layer + "G", &data[0].g, sizeof(Spectrum), type);
+  add_channel(channels, layer + "B", &data[0].b, sizeof(Spectrum), type);
+}
+
+// Channels of the beauty image and of its AOVs, in the alphabetical order
+// EXR requires. Color and normal follow the half float option, the other
+// channels keep their precision.
+std::vector<ExrChannel> exr_channels(const HDRImageBuffer& image,
+                                     const AOVBuffer* aovs, bool half_float) {
+  int color = half_float ? TINYEXR_PIXELTYPE_HALF : TINYEXR_PIXELTYPE_FLOAT;
+  std::vector<ExrChannel> channels;
+  add_rgb(channels, "", image.data, color);
+  if (aovs && aovs->w == image.w && aovs->h == image.h) {
+    if (aovs->has(AOVBuffer::ALBEDO)) {
+      add_rgb(channels, "albedo.", aovs->albedo, color);
+    }
+    if (aovs->has(AOVBuffer::NORMAL)) {
+      const Vec3f* n = &aovs->normal[0];
+      add_channel(channels, "N.X", &n->x, sizeof(Vec3f), color);
+      add_channel(channels, "N.Y", &n->y, sizeof(Vec3f), color);
+      add_channel(channels, "N.Z", &n->z, sizeof(Vec3f), color);
+    }
+    if (aovs->has(AOVBuffer::DEPTH)) {
+      add_channel(channels, "Z", &aovs->depth[0], sizeof(float),
+                  TINYEXR_PIXELTYPE_FLOAT);
+    }
+    if (aovs->has(AOVBuffer::PRIM_ID)) {
+      add_channel(channels, "id", &aovs->primId[0], sizeof(uint32_t),
+                  TINYEXR_PIXELTYPE_UINT);
+    }
+    if (aovs->has(AOVBuffer::SAMPLES)) {
+      add_channel(channels, "samples", &aovs->samples[0], sizeof(float),
+                  TINYEXR_PIXELTYPE_FLOAT);
+    }
+  }
+  std::sort(channels.begin(), channels.end());
+  return channels;
+}
+
+// float to half with round to nearest even, as in OpenEXR's half class
+uint16_t float_to_half(float f) {
+  uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+  uint16_t sign = (uint16_t) ((x >> 16) & 0x8000);
+  uint32_t mantissa = x & 0x7fffff;
+  int exponent = (int) ((x >> 23) & 0xff);
+
+  if (exponent == 0xff) {  // infinity or NaN
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  }
+  exponent += 15 - 127;
+  if (exponent >= 0x1f) return sign | 0x7c00;  // overflow
+  if (exponent <= 0) {
+    if (exponent < -10) return sign;  // underflow
+    mantissa |= 0x800000;
+    int shift = 14 - exponent;
+    uint32_t half = mantissa >> shift;
+    uint32_t rest = mantissa & ((1u << shift) - 1);
+    uint32_t middle = 1u << (shift - 1);
+    if (rest > middle || (rest == middle && (half & 1))) half++;
+    return sign | (uint16_t) half;
+  }
+  uint32_t half = ((uint32_t) exponent << 10) | (mantissa >> 13);
+  uint32_t rest = mantissa & 0x1fff;
+  // a carry out of the mantissa correctly bumps the exponent
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+  return sign | (uint16_t) half;
+}
+
+void put_bytes(std::vector<unsigned char>& out, const void* data, size_t size) {
+  const unsigned char* bytes = (const unsigned char*) data;
+  out.insert(out.end(), bytes, bytes + size);
+}
+
+void put_attribute(std::vector<unsigned char>& out, const char* name,
+                   const char* type, const void* value, int32_t size) {
+  put_bytes(out, name, strlen(name) + 1);
+  put_bytes(out, type, strlen(type) + 1);
+  put_bytes(out, &size, sizeof(size));
+  put_bytes(out, value, size);
+}
+
+// Uncompressed scanline EXR, written one line at a time straight from the
+// buffers. Little-endian hosts only, like the rest of the image I/O.
+const char* write_exr_uncompressed(FILE* file,
+                                   const std::vector<ExrChannel>& channels,
+                                   size_t width, size_t height,
+                                   bool bottom_up) {
+  int32_t w = (int32_t) width, h = (int32_t) height;
+
+  std::vector<unsigned char> header;
+  const unsigned char magic[8] = {0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0};
+  put_bytes(header, magic, sizeof(magic));
+
+  std::vector<unsigned char> chlist;
+  int32_t line_size = 0;
+  for (const ExrChannel& channel : channels) {
+    const unsigned char linear_reserved[4] = {0, 0, 0, 0};
+    const int32_t sampling[2] = {1, 1};
+    put_bytes(chlist, channel.name.c_str(), channel.name.size() + 1);
+    put_bytes(chlist, &channel.type, sizeof(channel.type));
+    put_bytes(chlist, linear_reserved, sizeof(linear_reserved));
+    put_bytes(chlist, sampling, sizeof(sampling));
+    line_size += w * (channel.type == TINYEXR_PIXELTYPE_HALF ? 2 : 4);
+  }
+  chlist.push_back(0);
+  put_attribute(header, "channels", "chlist", &chlist[0],
+                (int32_t) chlist.size());
+
+  unsigned char compression = 0, line_order = 0;
+  int32_t window[4] = {0, 0, w - 1, h - 1};
+  float aspect = 1.0f, center[2] = {0.0f, 0.0f}, screen_width = 1.0f;
+  put_attribute(header, "compression", "compression", &compression, 1);
+  put_attribute(header, "dataWindow", "box2i", window, sizeof(window));
+  put_attribute(header, "displayWindow", "box2i", window, sizeof(window));
+  put_attribute(header, "lineOrder", "lineOrder", &line_order, 1);
+  put_attribute(header, "pixelAspectRatio", "float", &aspect, sizeof(aspect));
+  put_attribute(header, "screenWindowCenter", "v2f", center, sizeof(center));
+  put_attribute(header, "screenWindowWidth", "float", &screen_width,
+                sizeof(screen_width));
+  header.push_back(0);
+
+  // one block per scanline, all of the same size
+  uint64_t offset = header.size() + h * sizeof(uint64_t);
+  for (int32_t y = 0; y < h; y++) {
+    put_bytes(header, &offset, sizeof(offset));
+    offset += 2 * sizeof(int32_t) + line_size;
+  }
+  if (fwrite(&header[0], 1, header.size(), file) != header.size()) {
+    return "Cannot write the header.";
+  }
+
+  std::vector<unsigned char> line(2 * sizeof(int32_t) + line_size);
+  memcpy(&line[sizeof(int32_t)], &line_size, sizeof(line_size));
+  for (int32_t y = 0; y < h; y++) {
+    memcpy(&line[0], &y, sizeof(y));
+    size_t row = (size_t) (bottom_up ? h - 1 - y : y) * w;
+    unsigned char* out = &line[2 * sizeof(int32_t)];
+    for (const ExrChannel& channel : channels) {
+      if (channel.type == TINYEXR_PIXELTYPE_HALF) {
+        for (int32_t x = 0; x < w; x++, out += 2) {
+          uint32_t bits = channel.value(row + x);
+          float f;
+          memcpy(&f, &bits, sizeof(f));
+          uint16_t half = float_to_half(f);
+          memcpy(out, &half, sizeof(half));
+        }
+      } else {
+        for (int32_t x = 0; x < w; x++, out += 4) {
+          uint32_t bits = channel.value(row + x);
+          memcpy(out, &bits, sizeof(bits));
+        }
+      }
+    }
+    if (fwrite(&line[0], 1, line.size(), file) != line.size()) {
+      return "Cannot write a scanline.";
+    }
+  }
+  return NULL;
+}
+
+// ZIP compressed EXR through tinyexr, which compresses blocks of 16
+// scanlines in parallel when built with OpenMP. tinyexr takes whole planar
+// channels, so rows are flipped while splitting the pixels into channels.
+const char* write_exr_zip(FILE* file, const std::vector<ExrChannel>& channels,
+                          size_t w, size_t h, bool bottom_up) {
+  size_t num_channels = channels.size();
+  std::vector<uint32_t> planes(num_channels * w * h);
+  for (size_t y = 0; y < h; y++) {
+    size_t row = (bottom_up ? h - 1 - y : y) * w;
+    for (size_t c = 0; c < num_channels; c++) {
+      uint32_t* out = &planes[(c * h + y) * w];
+      for (size_t x = 0; x < w; x++) out[x] = channels[c].value(row + x);
+    }
+  }
+
+  std::vector<const char*> names(num_channels);
+  std::vector<unsigned char*> images(num_channels);
+  std::vector<int> pixel_types(num_channels), requested_pixel_types(num_channels);
+  for (size_t c = 0; c < num_channels; c++) {
+    names[c] = channels[c].name.c_str();
+    images[c] = (unsigned char*) &planes[c * w * h];
+    requested_pixel_types[c] = channels[c].type;
+    pixel_types[c] = channels[c].type == TINYEXR_PIXELTYPE_UINT
+                     ? TINYEXR_PIXELTYPE_UINT : TINYEXR_PIXELTYPE_FLOAT;
+  }
+
+  EXRImage exr;
+  InitEXRImage(&exr);
+  exr.num_channels = (int) num_channels;
+  exr.channel_names = &names[0];
+  exr.images = &images[0];
+  exr.pixel_types = &pixel_types[0];
+  exr.requested_pixel_types = &requested_pixel_types[0];
+  exr.width = (int) w;
+  exr.height = (int) h;
+
+  const char* error = NULL;
+  unsigned char* memory = NULL;
+  size_t size = SaveMultiChannelEXRToMemory(&exr, &memory, &error);
+  if (!memory) return error ? error : "Cannot encode the image.";
+  bool ok = fwrite(memory, 1, size, file) == size;
+  free(memory);
+  return ok ? NULL : "Cannot write the image.";
+}
+
+// PFM stores rows bottom to top, the renderer's own order
+const char* write_pfm(FILE* file, const HDRImageBuffer& image, bool bottom_up) {
+  size_t w = image.w, h = image.h;
+  fprintf(file, "PF\n%zu %zu\n-1.0\n", w, h);
+  for (size_t y = 0; y < h; y++) {
+    const Spectrum* row = &image.data[(bottom_up ? y : h - 1 - y) * w];
+    if (fwrite(row, sizeof(Spectrum), w, file) != w) {
+      return "Cannot write a scanline.";
+    }
+  }
+  return NULL;
+}
+
+}  // namespace
+
+ImageWriter::Format ImageWriter::format_of(const std::string& filename) {
+  size_t dot = filename.rfind('.');
+  if (dot == std::string::npos) return PNG;
+  std::string extension = filename.substr(dot + 1);
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 ::tolower);
+  if (extension == "exr") return EXR;
+  if (extension == "pfm") return PFM;
+  return PNG;
+}
+
+const char* ImageWriter::encode(const std::string& filename,
+                                const ImageBuffer& image) {
+  unsigned error = lodepng::encode(filename,
+                                   (const unsigned char*)&image.data[0],
+                                   image.w, image.h);
+  return error ? lodepng_error_text(error) : NULL;
+}
+
+const char* ImageWriter::encode(const std::string& filename,
+                                const HDRImageBuffer& image, bool bottom_up,
+                                const Options& options,
+                                const AOVBuffer* aovs) {
+  Format format = format_of(filename);
+  if (format == PNG) return "Linear images are saved as EXR or PFM.";
+
+  FILE* file = fopen(filename.c_str(), "wb");
+  if (!file) return "Cannot open the file.";
+  const char* error;
+  if (format == PFM) {
+    error = write_pfm(file, image, bottom_up);
+  } else {
+    std::vector<ExrChannel> channels = exr_channels(image, aovs,
+                                                    options.halfFloat);
+    if (options.zip) {
+      error = write_exr_zip(file, channels, image.w, image.h, bottom_up);
+    } else {
+      error = write_exr_uncompressed(file, channels, image.w, image.h,
+                                     bottom_up);
+    }
+  }
+  if (fclose(file) != 0 && !error) error = "Cannot write the file.";
+  return error;
+}
+
+ImageWriter::ImageWriter(size_t max_pending, size_t num_threads)
+    : queue(max_pending), pending(0) {
+  num_threads = std::max<size_t>(1, num_threads);
+  for (size_t i = 0; i < num_threads; i++) {
+    threads.push_back(std::thread(&ImageWriter::writer_thread, this));
+  }
+}
+
+ImageWriter::~ImageWriter() {
+  queue.close();
+  for (std::thread& thread : threads) thread.join();
+}
+
+void ImageWriter::set_options(const Options& options) {
+  this->options = options;
+}
+
+void ImageWriter::write(const std::string& filename, ImageBuffer* image) {
+  PendingImage item = {filename, image, NULL, NULL, false, options};
+  queue_image(item);
+}
+
+void ImageWriter::write(const std::string& filename, HDRImageBuffer* image,
+                        bool bottom_up, AOVBuffer* aovs) {
+  PendingImage item = {filename, NULL, image, aovs, bottom_up, options};
+  queue_image(item);
+}
+
+void ImageWriter::queue_image(const PendingImage& item) {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    pending++;
+  }
+  queue.push(item);
+}
+
+void ImageWriter::flush() {
+  std::unique_lock<std::mutex> guard(lock);
+  written.wait(guard, [this] { return pending == 0; });
+}
+
+void ImageWriter::writer_thread() {
+  PendingImage item;
+  while (queue.pop(&item)) {
+    Timer timer;
+    timer.start();
+    const char* error;
+    if (item.hdr) {
+      error = encode(item.filename, *item.hdr, item.bottomUp, item.options,
+                     item.aovs);
+    } else {
+      error = encode(item.filename, *item.image);
+    }
+    timer.stop();
+    if (error) {
+      fprintf(stderr, "[ImageWriter] Error saving %s: %s\n",
+              item.filename.c_str(), error);
+    } else {
+      fprintf(stderr, "[ImageWriter] Saved %s (%.4f sec)\n",
+              item.filename.c_str(), timer.duration());
+    }
+    delete item.image;
+    delete item.hdr;
+    delete item.aovs;
+
+    std::lock_guard<std::mutex> guard(lock);
+    pending--;
+    written.notify_all();
+  }
+}
+
+}  // namespace PROJ6850
@@ -0,0 +1,145 @@
+#ifndef PROJ6850_IMAGE_WRITER_H
+#define PROJ6850_IMAGE_WRITER_H
+
+#include "image.h"
+#include "work_queue.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace PROJ6850 {
+
+/**
+ * Saves images on background threads so that the render threads do not
+ * wait for encoding. Images are queued with the file they go to; the queue
+ * is bounded, so write() blocks once too many images are pending instead of
+ * letting their buffers pile up.
+ *
+ * Tonemapped images are saved as 8-bit PNG. Linear radiance is saved as
+ * OpenEXR or PFM depending on the file extension; EXR files can also hold
+ * the AOVs of the render as extra layers. HDR buffers are queued
+ * with their rows in the order the renderer stores them and flipped while
+ * they are encoded, so no flipped copy of the frame is made.
+ */
+class ImageWriter {
+ public:
+  enum Format {
+    PNG,  ///< 8-bit RGBA
+    EXR,  ///< OpenEXR, RGB 16 or 32-bit float
+    PFM   ///< portable float map, RGB 32-bit float
+  };
+
+  /**
+   * How linear images are stored.
+   */
+  struct Options {
+    Options() : halfFloat(false), zip(true) {}
+
+    bool halfFloat;  ///< store EXR channels as 16-bit floats
+    bool zip;        ///< ZIP compress EXR blocks of 16 scanlines
+  };
+
+  /**
+   * Format of a file, from its extension. Unknown extensions are PNG.
+   */
+  static Format format_of(const std::string& filename);
+
+  /**
+   * Save a tonemapped image as a PNG on the calling thread.
+   * \param filename file to write
+   * \param image image to write, rows stored top to bottom
+   * \return NULL on success, the error message otherwise
+   */
+  static const char* encode(const std::string& filename,
+                            const ImageBuffer& image);
+
+  /**
+   * Save a linear image as an EXR or PFM on the calling thread.
+   * In EXR files the image is the RGB layer and the AOVs follow as the
+   * albedo.RGB, N.XYZ, Z, id and samples layers. PFM files only hold the
+   * image.
+   * \param filename file to write, its extension selects the format
+   * \param image image to write
+   * \param bottom_up whether the rows are stored bottom to top
+   * \param options how to store the pixels
+   * \param aovs AOVs of the image, same size and row order, or NULL
+   * \return NULL on success, the error message otherwise
+   */
+  static const char* encode(const std::string& filename,
+                            const HDRImageBuffer& image, bool bottom_up,
+                            const Options& options,
+                            const AOVBuffer* aovs = NULL);
+
+  /**
+   * Constructor.
+   * Starts the writer threads.
+   * \param max_pending number of images that can wait to be written
+   * \param num_threads number of images encoded at the same time
+   */
+  explicit ImageWriter(size_t max_pending = 4, size_t num_threads = 1);
+
+  /**
+   * Destructor.
+   * Writes the images still pending and stops the writer threads.
+   */
+  ~ImageWriter();
+
+  /**
+   * Set how the linear images queued from now on are stored.
+   */
+  void set_options(const Options& options);
+
+  /**
+   * Queue an image to be saved as a PNG. The writer takes ownership of the
+   * image, whose rows are stored top to bottom.
+   * \param filename file to write
+   * \param image image to write, deleted once written
+   */
+  void write(const std::string& filename, ImageBuffer* image);
+
+  /**
+   * Queue a linear image to be saved as an EXR or PFM. The writer takes
+   * ownership of the image and of its AOVs.
+   * \param filename file to write, its extension selects the format
+   * \param image image to write, deleted once written
+   * \param bottom_up whether the rows are stored bottom to top
+   * \param aovs AOVs of the image or NULL, deleted once written
+   */
+  void write(const std::string& filename, HDRImageBuffer* image,
+             bool bottom_up, AOVBuffer* aovs = NULL);
+
+  /**
+   * Wait until all the queued images are written.
+   */
+  void flush();
+
+ private:
+  struct PendingImage {
+    std::string filename;
+    ImageBuffer* image;     ///< tonemapped image, or NULL
+    HDRImageBuffer* hdr;    ///< linear image, or NULL
+    AOVBuffer* aovs;        ///< AOVs of the linear image, or NULL
+    bool bottomUp;          ///< row order of the linear image
+    Options options;        ///< options when the image was queued
+  };
+
+  ImageWriter(const ImageWriter&);
+  ImageWriter& operator=(const ImageWriter&);
+
+  void queue_image(const PendingImage& item);
+  void writer_thread();
+
+  BoundedQueue<PendingImage> queue;  ///< images waiting to be written
+  std::vector<std::thread> threads;  ///< the writer threads
+  Options options;                   ///< options of new linear images
+  size_t pending;                    ///< queued images not written yet
+  std::mutex lock;                   ///< guards pending
+  std::condition_variable written;   ///< signaled when pending drops
+};
+
+}  // namespace PROJ6850
+
+#endif  // PROJ6850_IMAGE_WRITER_H
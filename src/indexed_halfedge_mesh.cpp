@@ -0,0 +1,735 @@
+#include "indexed_halfedge_mesh.h"
+
+#include <unordered_map>
+
+namespace PROJ6850 {
+
+const IndexedHalfedgeMesh::Id IndexedHalfedgeMesh::NONE = 0xffffffffu;
+const IndexedHalfedgeMesh::Id IndexedHalfedgeMesh::DELETED = 0xfffffffeu;
+
+namespace {
+
+void buildError(const char* message) {
+  cerr << "Error converting polygons to halfedge mesh: " << message << endl;
+  exit(1);
+}
+
+// new index of each slot, NONE for deleted slots, and the number kept
+IndexedHalfedgeMesh::Id renumber(const std::vector<IndexedHalfedgeMesh::Id>& key,
+                                 std::vector<IndexedHalfedgeMesh::Id>* map) {
+  IndexedHalfedgeMesh::Id kept = 0;
+  map->resize(key.size());
+  for (size_t i = 0; i < key.size(); i++) {
+    (*map)[i] = key[i] == IndexedHalfedgeMesh::DELETED ? IndexedHalfedgeMesh::NONE
+                                                       : kept++;
+  }
+  return kept;
+}
+
+// moves the kept entries of an array to their new slots and drops the others
+template <typename T>
+void move_kept(std::vector<T>& values,
+               const std::vector<IndexedHalfedgeMesh::Id>& map,
+               IndexedHalfedgeMesh::Id kept) {
+  // new slots never come after old ones, so a forward pass only overwrites
+  // entries already moved
+  for (size_t i = 0; i < map.size(); i++) {
+    if (map[i] != IndexedHalfedgeMesh::NONE) values[map[i]] = values[i];
+  }
+  values.resize(kept);
+}
+
+void remap(std::vector<IndexedHalfedgeMesh::Id>& ids,
+           const std::vector<IndexedHalfedgeMesh::Id>& map) {
+  for (IndexedHalfedgeMesh::Id& id : ids) {
+    if (id != IndexedHalfedgeMesh::NONE) id = map[id];
+  }
+}
+
+}  // namespace
+
+void IndexedHalfedgeMesh::build(const vector<vector<Index>>& polygons,
+                                const vector<Vector3D>& vertexPositions) {
+  clear();
+
+  // Number the vertex indices used in increasing order, which is the order
+  // of their positions.
+  Index maxIndex = 0;
+  Size nHalfedges = 0;
+  for (const vector<Index>& p : polygons) {
+    if (p.size() < 3) {
+      buildError("each polygon must have at least three vertices.");
+    }
+    for (size_t i = 0; i < p.size(); i++) {
+      maxIndex = max(maxIndex, p[i]);
+      for (size_t j = 0; j < i; j++) {
+        if (p[i] == p[j]) {
+          buildError("one of the input polygons does not have distinct vertices!");
+        }
+      }
+    }
+    nHalfedges += p.size();
+  }
+  if (polygons.empty()) return;
+  if (nHalfedges >= DELETED) buildError("too many polygons.");
+
+  std::vector<Id> indexToVertex(maxIndex + 1, NONE);
+  for (const vector<Index>& p : polygons) {
+    for (Index i : p) indexToVertex[i] = 0;
+  }
+  Id nVertices = 0;
+  for (Id& v : indexToVertex) {
+    if (v != NONE) v = nVertices++;
+  }
+  if (vertexPositions.size() < nVertices) {
+    buildError("number of vertex positions is different from the number of "
+               "distinct vertices!");
+  }
+  vertexHalfedge.assign(nVertices, NONE);
+  position.assign(vertexPositions.begin(), vertexPositions.begin() + nVertices);
+
+  // The halfedges of a polygon are consecutive. A vertex first refers to the
+  // last halfedge leaving it, as in HalfedgeMesh::build.
+  halfedgeNext.resize(nHalfedges);
+  halfedgeTwin.assign(nHalfedges, NONE);
+  halfedgeVertex.resize(nHalfedges);
+  halfedgeEdge.assign(nHalfedges, NONE);
+  halfedgeFace.resize(nHalfedges);
+  faceHalfedge.resize(polygons.size());
+  faceIsBoundary.assign(polygons.size(), 0);
+  std::vector<Id> vertexFaces(nVertices, 0);
+  for (Id f = 0, h = 0; f < polygons.size(); f++) {
+    const vector<Index>& p = polygons[f];
+    Id first = h;
+    faceHalfedge[f] = first;
+    for (size_t i = 0; i < p.size(); i++, h++) {
+      Id v = indexToVertex[p[i]];
+      halfedgeNext[h] = i + 1 < p.size() ? h + 1 : first;
+      halfedgeVertex[h] = v;
+      halfedgeFace[h] = f;
+      vertexHalfedge[v] = h;
+      vertexFaces[v]++;
+    }
+  }
+
+  // Group the halfedges by the vertex they leave from; the twin of a
+  // halfedge from a to b is then among the few leaving b.
+  std::vector<Id> outStart(nVertices + 1, 0);
+  for (Id h = 0; h < nHalfedges; h++) outStart[halfedgeVertex[h] + 1]++;
+  for (Id v = 0; v < nVertices; v++) outStart[v + 1] += outStart[v];
+  std::vector<Id> out(nHalfedges);
+  {
+    std::vector<Id> cursor(outStart.begin(), outStart.end() - 1);
+    for (Id h = 0; h < nHalfedges; h++) out[cursor[halfedgeVertex[h]]++] = h;
+  }
+
+  // Edges are created when the second halfedge of a pair is reached, in the
+  // order HalfedgeMesh::build creates them.
+  for (Id h = 0; h < nHalfedges; h++) {
+    Id a = halfedgeVertex[h], b = halfedgeVertex[halfedgeNext[h]];
+    for (Id i = outStart[a]; i < outStart[a + 1]; i++) {
+      Id o = out[i];
+      if (o != h && halfedgeVertex[halfedgeNext[o]] == b) {
+        cerr << "Error converting polygons to halfedge mesh: found multiple "
+                "oriented edges with indices (" << a << ", " << b << ")."
+             << endl;
+        exit(1);
+      }
+    }
+    for (Id i = outStart[b]; i < outStart[b + 1]; i++) {
+      Id o = out[i];
+      if (halfedgeVertex[halfedgeNext[o]] == a) {
+        if (o < h) {
+          halfedgeTwin[h] = o;
+          halfedgeTwin[o] = h;
+          Id e = newEdge();
+          edgeHalfedge[e] = h;
+          halfedgeEdge[h] = e;
+          halfedgeEdge[o] = e;
+        }
+        break;
+      }
+    }
+  }
+
+  // A boundary vertex refers to the halfedge leaving it along the boundary.
+  for (Id v = 0; v < nVertices; v++) {
+    Id h = vertexHalfedge[v];
+    do {
+      if (halfedgeTwin[h] == NONE) {
+        vertexHalfedge[v] = h;
+        break;
+      }
+      h = halfedgeNext[halfedgeTwin[h]];
+    } while (h != vertexHalfedge[v]);
+  }
+
+  // Close each boundary with a loop of new halfedges, walking it as
+  // HalfedgeMesh::build does.
+  std::vector<Id> loop;
+  for (Id h = 0; h < nHalfedges; h++) {
+    if (halfedgeTwin[h] != NONE) continue;
+    Id b = newFace(true);
+    loop.clear();
+    Id i = h;
+    do {
+      Id t = newHalfedge();
+      loop.push_back(t);
+      halfedgeTwin[i] = t;
+      halfedgeTwin[t] = i;
+      halfedgeFace[t] = b;
+      halfedgeVertex[t] = halfedgeVertex[halfedgeNext[i]];
+      Id e = newEdge();
+      edgeHalfedge[e] = i;
+      halfedgeEdge[i] = e;
+      halfedgeEdge[t] = e;
+
+      i = halfedgeNext[i];
+      while (i != h && halfedgeTwin[i] != NONE) {
+        i = halfedgeNext[halfedgeTwin[i]];
+      }
+    } while (i != h);
+
+    faceHalfedge[b] = loop.front();
+    Size degree = loop.size();
+    for (Size p = 0; p < degree; p++) {
+      halfedgeNext[loop[p]] = loop[(p - 1 + degree) % degree];
+    }
+  }
+
+  // Check that the faces around each vertex form a single fan.
+  for (Id v = 0; v < nVertices; v++) {
+    vertexHalfedge[v] = halfedgeNext[halfedgeTwin[vertexHalfedge[v]]];
+    if (vertexDegree(v) != vertexFaces[v]) {
+      buildError("at least one of the vertices is nonmanifold.");
+    }
+  }
+}
+
+void IndexedHalfedgeMesh::fromHalfedgeMesh(const HalfedgeMesh& mesh) {
+  clear();
+
+  std::unordered_map<const Halfedge*, Id> halfedgeIds;
+  std::unordered_map<const Vertex*, Id> vertexIds;
+  std::unordered_map<const Edge*, Id> edgeIds;
+  std::unordered_map<const Face*, Id> faceIds;
+  for (HalfedgeCIter h = mesh.halfedgesBegin(); h != mesh.halfedgesEnd(); h++) {
+    halfedgeIds[elementAddress(h)] = newHalfedge();
+  }
+  for (VertexCIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
+    Id id = newVertex();
+    vertexIds[elementAddress(v)] = id;
+    position[id] = v->position;
+  }
+  for (EdgeCIter e = mesh.edgesBegin(); e != mesh.edgesEnd(); e++) {
+    edgeIds[elementAddress(e)] = newEdge();
+  }
+  for (FaceCIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++) {
+    faceIds[elementAddress(f)] = newFace(false);
+  }
+  for (FaceCIter b = mesh.boundariesBegin(); b != mesh.boundariesEnd(); b++) {
+    faceIds[elementAddress(b)] = newFace(true);
+  }
+
+  for (HalfedgeCIter h = mesh.halfedgesBegin(); h != mesh.halfedgesEnd(); h++) {
+    setNeighbors(halfedgeIds[elementAddress(h)],
+                 halfedgeIds[elementAddress(h->next())],
+                 halfedgeIds[elementAddress(h->twin())],
+                 vertexIds[elementAddress(h->vertex())],
+                 edgeIds[elementAddress(h->edge())],
+                 faceIds[elementAddress(h->face())]);
+  }
+  for (VertexCIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
+    vertexHalfedge[vertexIds[elementAddress(v)]] =
+        halfedgeIds[elementAddress(v->halfedge())];
+  }
+  for (EdgeCIter e = mesh.edgesBegin(); e != mesh.edgesEnd(); e++) {
+    edgeHalfedge[edgeIds[elementAddress(e)]] =
+        halfedgeIds[elementAddress(e->halfedge())];
+  }
+  for (FaceCIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++) {
+    faceHalfedge[faceIds[elementAddress(f)]] =
+        halfedgeIds[elementAddress(f->halfedge())];
+  }
+  for (FaceCIter b = mesh.boundariesBegin(); b != mesh.boundariesEnd(); b++) {
+    faceHalfedge[faceIds[elementAddress(b)]] =
+        halfedgeIds[elementAddress(b->halfedge())];
+  }
+}
+
+void IndexedHalfedgeMesh::fromHalfedgeMeshIndices(HalfedgeMesh& mesh) {
+  Index i = 0;
+  for (VertexIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
+    v->index = i++;
+  }
+  i = 0;
+  for (EdgeIter e = mesh.edgesBegin(); e != mesh.edgesEnd(); e++) e->index = i++;
+  i = 0;
+  for (FaceIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++) f->index = i++;
+  for (FaceIter b = mesh.boundariesBegin(); b != mesh.boundariesEnd(); b++) {
+    b->index = i++;
+  }
+  resize(2 * mesh.nEdges(), mesh.nVertices(), mesh.nEdges(), mesh.nFaces(),
+         mesh.nBoundaries());
+
+  auto id = [](HalfedgeCIter h) {
+    return (Id) (2 * h->edge()->index + (h != h->edge()->halfedge() ? 1 : 0));
+  };
+  for (EdgeCIter e = mesh.edgesBegin(); e != mesh.edgesEnd(); e++) {
+    HalfedgeCIter h = e->halfedge();
+    for (int side = 0; side < 2; side++, h = h->twin()) {
+      setNeighbors(id(h), id(h->next()), id(h->twin()), h->vertex()->index,
+                   e->index, h->face()->index);
+    }
+    edgeHalfedge[e->index] = 2 * e->index;
+  }
+  for (VertexCIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
+    vertexHalfedge[v->index] = id(v->halfedge());
+    position[v->index] = v->position;
+  }
+  for (FaceCIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++) {
+    faceHalfedge[f->index] = id(f->halfedge());
+  }
+  for (FaceCIter b = mesh.boundariesBegin(); b != mesh.boundariesEnd(); b++) {
+    faceHalfedge[b->index] = id(b->halfedge());
+  }
+}
+
+void IndexedHalfedgeMesh::toHalfedgeMesh(HalfedgeMesh& mesh) const {
+  HalfedgeMesh empty;
+  mesh.swap(empty);
+
+  std::vector<HalfedgeIter> halfedges(halfedgeNext.size());
+  std::vector<VertexIter> vertices(vertexHalfedge.size());
+  std::vector<EdgeIter> edges(edgeHalfedge.size());
+  std::vector<FaceIter> faces(faceHalfedge.size());
+  for (Id h = 0; h < halfedges.size(); h++) {
+    if (!isDeletedHalfedge(h)) halfedges[h] = mesh.newHalfedge();
+  }
+  for (Id v = 0; v < vertices.size(); v++) {
+    if (isDeletedVertex(v)) continue;
+    vertices[v] = mesh.newVertex();
+    vertices[v]->position = position[v];
+    vertices[v]->bindPosition = position[v];
+  }
+  for (Id e = 0; e < edges.size(); e++) {
+    if (!isDeletedEdge(e)) edges[e] = mesh.newEdge();
+  }
+  for (Id f = 0; f < faces.size(); f++) {
+    if (isDeletedFace(f)) continue;
+    faces[f] = faceIsBoundary[f] ? mesh.newBoundary() : mesh.newFace();
+  }
+
+  for (Id h = 0; h < halfedges.size(); h++) {
+    if (isDeletedHalfedge(h)) continue;
+    halfedges[h]->setNeighbors(
+        halfedges[halfedgeNext[h]], halfedges[halfedgeTwin[h]],
+        vertices[halfedgeVertex[h]], edges[halfedgeEdge[h]],
+        faces[halfedgeFace[h]]);
+  }
+  for (Id v = 0; v < vertices.size(); v++) {
+    if (!isDeletedVertex(v)) vertices[v]->halfedge() = halfedges[vertexHalfedge[v]];
+  }
+  for (Id e = 0; e < edges.size(); e++) {
+    if (!isDeletedEdge(e)) edges[e]->halfedge() = halfedges[edgeHalfedge[e]];
+  }
+  for (Id f = 0; f < faces.size(); f++) {
+    if (!isDeletedFace(f)) faces[f]->halfedge() = halfedges[faceHalfedge[f]];
+  }
+}
+
+void IndexedHalfedgeMesh::clear() {
+  halfedgeNext.clear();
+  halfedgeTwin.clear();
+  halfedgeVertex.clear();
+  halfedgeEdge.clear();
+  halfedgeFace.clear();
+  vertexHalfedge.clear();
+  position.clear();
+  edgeHalfedge.clear();
+  faceHalfedge.clear();
+  faceIsBoundary.clear();
+  freeHalfedges.clear();
+  freeVertices.clear();
+  freeEdges.clear();
+  freeFaces.clear();
+  boundaryCount = 0;
+}
+
+void IndexedHalfedgeMesh::resize(Size nHalfedges, Size nVertices, Size nEdges,
+                                 Size nFaces, Size nBoundaries) {
+  clear();
+  halfedgeNext.resize(nHalfedges, NONE);
+  halfedgeTwin.resize(nHalfedges, NONE);
+  halfedgeVertex.resize(nHalfedges, NONE);
+  halfedgeEdge.resize(nHalfedges, NONE);
+  halfedgeFace.resize(nHalfedges, NONE);
+  vertexHalfedge.resize(nVertices, NONE);
+  position.resize(nVertices);
+  edgeHalfedge.resize(nEdges, NONE);
+  faceHalfedge.resize(nFaces + nBoundaries, NONE);
+  faceIsBoundary.resize(nFaces, 0);
+  faceIsBoundary.resize(nFaces + nBoundaries, 1);
+  boundaryCount = nBoundaries;
+}
+
+void IndexedHalfedgeMesh::compact() {
+  std::vector<Id> halfedgeMap, vertexMap, edgeMap, faceMap;
+  Id halfedges = renumber(halfedgeNext, &halfedgeMap);
+  Id vertices = renumber(vertexHalfedge, &vertexMap);
+  Id edges = renumber(edgeHalfedge, &edgeMap);
+  Id faces = renumber(faceHalfedge, &faceMap);
+
+  move_kept(halfedgeNext, halfedgeMap, halfedges);
+  move_kept(halfedgeTwin, halfedgeMap, halfedges);
+  move_kept(halfedgeVertex, halfedgeMap, halfedges);
+  move_kept(halfedgeEdge, halfedgeMap, halfedges);
+  move_kept(halfedgeFace, halfedgeMap, halfedges);
+  move_kept(vertexHalfedge, vertexMap, vertices);
+  move_kept(position, vertexMap, vertices);
+  move_kept(edgeHalfedge, edgeMap, edges);
+  move_kept(faceHalfedge, faceMap, faces);
+  move_kept(faceIsBoundary, faceMap, faces);
+
+  remap(halfedgeNext, halfedgeMap);
+  remap(halfedgeTwin, halfedgeMap);
+  remap(halfedgeVertex, vertexMap);
+  remap(halfedgeEdge, edgeMap);
+  remap(halfedgeFace, faceMap);
+  remap(vertexHalfedge, halfedgeMap);
+  remap(edgeHalfedge, halfedgeMap);
+  remap(faceHalfedge, halfedgeMap);
+
+  freeHalfedges.clear();
+  freeVertices.clear();
+  freeEdges.clear();
+  freeFaces.clear();
+}
+
+bool IndexedHalfedgeMesh::isBoundaryVertex(Id v) const {
+  Id h = vertexHalfedge[v];
+  do {
+    if (isBoundaryHalfedge(h)) return true;
+    h = halfedgeNext[halfedgeTwin[h]];
+  } while (h != vertexHalfedge[v]);
+  return false;
+}
+
+Size IndexedHalfedgeMesh::vertexDegree(Id v) const {
+  Size d = 0;
+  Id h = vertexHalfedge[v];
+  do {
+    if (!isBoundaryHalfedge(h)) d++;
+    h = halfedgeNext[halfedgeTwin[h]];
+  } while (h != vertexHalfedge[v]);
+  return d;
+}
+
+Size IndexedHalfedgeMesh::faceDegree(Id f) const {
+  Size d = 0;
+  Id h = faceHalfedge[f];
+  do {
+    d++;
+    h = halfedgeNext[h];
+  } while (h != faceHalfedge[f]);
+  return d;
+}
+
+Vector3D IndexedHalfedgeMesh::faceNormal(Id f) const {
+  Vector3D N(0., 0., 0.);
+  Id h = faceHalfedge[f];
+  do {
+    Id n = halfedgeNext[h];
+    N += cross(position[halfedgeVertex[h]], position[halfedgeVertex[n]]);
+    h = n;
+  } while (h != faceHalfedge[f]);
+  return N.unit();
+}
+
+Vector3D IndexedHalfedgeMesh::vertexNormal(Id v) const {
+  Vector3D N(0., 0., 0.);
+  Vector3D pi = position[v];
+  Id h = vertexHalfedge[v];
+  do {
+    if (!isBoundaryHalfedge(h)) {
+      Vector3D pj = position[halfedgeVertex[halfedgeNext[h]]];
+      Vector3D pk = position[halfedgeVertex[prev(h)]];
+      N += cross(pj - pi, pk - pi);
+    }
+    h = halfedgeNext[halfedgeTwin[h]];
+  } while (h != vertexHalfedge[v]);
+  N.normalize();
+  return N;
+}
+
+IndexedHalfedgeMesh::Id IndexedHalfedgeMesh::newHalfedge() {
+  if (!freeHalfedges.empty()) {
+    Id h = freeHalfedges.back();
+    freeHalfedges.pop_back();
+    setNeighbors(h, NONE, NONE, NONE, NONE, NONE);
+    return h;
+  }
+  halfedgeNext.push_back(NONE);
+  halfedgeTwin.push_back(NONE);
+  halfedgeVertex.push_back(NONE);
+  halfedgeEdge.push_back(NONE);
+  halfedgeFace.push_back(NONE);
+  return halfedgeNext.size() - 1;
+}
+
+IndexedHalfedgeMesh::Id IndexedHalfedgeMesh::newVertex() {
+  if (!freeVertices.empty()) {
+    Id v = freeVertices.back();
+    freeVertices.pop_back();
+    vertexHalfedge[v] = NONE;
+    position[v] = Vector3D();
+    return v;
+  }
+  vertexHalfedge.push_back(NONE);
+  position.push_back(Vector3D());
+  return vertexHalfedge.size() - 1;
+}
+
+IndexedHalfedgeMesh::Id IndexedHalfedgeMesh::newEdge() {
+  if (!freeEdges.empty()) {
+    Id e = freeEdges.back();
+    freeEdges.pop_back();
+    edgeHalfedge[e] = NONE;
+    return e;
+  }
+  edgeHalfedge.push_back(NONE);
+  return edgeHalfedge.size() - 1;
+}
+
+IndexedHalfedgeMesh::Id IndexedHalfedgeMesh::newFace(bool isBoundary) {
+  if (isBoundary) boundaryCount++;
+  if (!freeFaces.empty()) {
+    Id f = freeFaces.back();
+    freeFaces.pop_back();
+    faceHalfedge[f] = NONE;
+    faceIsBoundary[f] = isBoundary;
+    return f;
+  }
+  faceHalfedge.push_back(NONE);
+  faceIsBoundary.push_back(isBoundary);
+  return faceHalfedge.size() - 1;
+}
+
+void IndexedHalfedgeMesh::deleteHalfedge(Id h) {
+  halfedgeNext[h] = DELETED;
+  freeHalfedges.push_back(h);
+}
+
+void IndexedHalfedgeMesh::deleteVertex(Id v) {
+  vertexHalfedge[v] = DELETED;
+  freeVertices.push_back(v);
+}
+
+void IndexedHalfedgeMesh::deleteEdge(Id e) {
+  edgeHalfedge[e] = DELETED;
+  freeEdges.push_back(e);
+}
+
+void IndexedHalfedgeMesh::deleteFace(Id f) {
+  if (faceIsBoundary[f]) boundaryCount--;
+  faceHalfedge[f] = DELETED;
+  freeFaces.push_back(f);
+}
+
+IndexedHalfedgeMesh::Id IndexedHalfedgeMesh::splitEdge(Id e0) {
+  // The elements are named and rewired as in HalfedgeMesh::splitEdge.
+  if (isBoundaryEdge(e0)) {
+    // The triangle on the edge splits in two, and the boundary loop gets
+    // one more halfedge.
+    Id h0 = edgeHalfedge[e0];
+    if (isBoundaryHalfedge(h0)) h0 = twin(h0);
+    Id h1 = next(h0), h2 = next(h1), h3 = twin(h0);
+    if (next(h2) != h0) return NONE;
+    Id v0 = vertex(h0), v2 = vertex(h1), v3 = vertex(h2);
+    Id f0 = face(h0), b = face(h3);
+
+    Id v4 = newVertex();
+    Id h4 = newHalfedge(), h5 = newHalfedge(), h6 = newHalfedge(),
+       h7 = newHalfedge();
+    Id e1 = newEdge(), e2 = newEdge();
+    Id f1 = newFace();
+
+    setNeighbors(h7, next(h3), h0, v4, e0, b);
+    setNeighbors(h3, h7, h5, v2, e1, b);
+    setNeighbors(h0, h4, h7, v0, e0, f0);
+    setNeighbors(h4, h2, h6, v4, e2, f0);
+    setNeighbors(h5, h1, h3, v4, e1, f1);
+    setNeighbors(h1, h6, twin(h1), v2, edge(h1), f1);
+    setNeighbors(h6, h5, h4, v3, e2, f1);
+
+    vertexHalfedge[v4] = h7;
+    edgeHalfedge[e0] = h0;
+    edgeHalfedge[e1] = h5;
+    edgeHalfedge[e2] = h4;
+    faceHalfedge[f0] = h0;
+    faceHalfedge[f1] = h1;
+    position[v4] = (position[v0] + position[v2]) / 2;
+    return v4;
+  }
+  Id h0 = edgeHalfedge[e0];
+  if (faceDegree(face(h0)) != 3 || faceDegree(face(twin(h0))) != 3) {
+    return NONE;
+  }
+
+  Id h1 = next(h0), h2 = next(h1), h3 = twin(h0), h4 = next(h3),
+     h5 = next(h4), ou0 = twin(h4), ou1 = twin(h5), ou2 = twin(h1),
+     ou3 = twin(h2);
+  Id v0 = vertex(h0), v1 = vertex(h5), v2 = vertex(h3), v3 = vertex(h2);
+  Id e4 = edge(h2), e5 = edge(h4), e6 = edge(h5), e7 = edge(h1);
+  Id f0 = face(h0), f1 = face(h3);
+
+  Id v4 = newVertex();
+  Id h6 = newHalfedge(), h7 = newHalfedge(), h8 = newHalfedge(),
+     h9 = newHalfedge(), h10 = newHalfedge(), h11 = newHalfedge();
+  Id e1 = newEdge(), e2 = newEdge(), e3 = newEdge();
+  Id f2 = newFace(), f3 = newFace();
+
+  setNeighbors(h0, h1, h3, v0, e0, f0);
+  setNeighbors(h1, h2, h11, v4, e3, f0);
+  setNeighbors(h2, h0, ou3, v3, e4, f0);
+
+  setNeighbors(h3, h4, h0, v4, e0, f1);
+  setNeighbors(h4, h5, ou0, v0, e5, f1);
+  setNeighbors(h5, h3, h7, v1, e1, f1);
+
+  setNeighbors(h6, h7, h9, v2, e2, f2);
+  setNeighbors(h7, h8, h5, v4, e1, f2);
+  setNeighbors(h8, h6, ou1, v1, e6, f2);
+
+  setNeighbors(h9, h10, h6, v4, e2, f3);
+  setNeighbors(h10, h11, ou2, v2, e7, f3);
+  setNeighbors(h11, h9, h1, v3, e3, f3);
+
+  // Only h1 and h3 now leave another vertex, so the other vertices keep
+  // their halfedges, and boundary vertices the boundary halfedge.
+  if (vertexHalfedge[v2] == h1 || vertexHalfedge[v2] == h3) {
+    vertexHalfedge[v2] = h10;
+  }
+  vertexHalfedge[v4] = h9;
+
+  edgeHalfedge[e0] = h0;
+  edgeHalfedge[e1] = h5;
+  edgeHalfedge[e2] = h9;
+  edgeHalfedge[e3] = h1;
+  edgeHalfedge[e6] = h8;
+  edgeHalfedge[e7] = h10;
+
+  faceHalfedge[f0] = h1;
+  faceHalfedge[f1] = h5;
+  faceHalfedge[f2] = h7;
+  faceHalfedge[f3] = h11;
+
+  halfedgeTwin[ou0] = h4;
+  halfedgeTwin[ou1] = h8;
+  halfedgeTwin[ou2] = h10;
+  halfedgeTwin[ou3] = h2;
+
+  position[v4] = (position[v0] + position[v2]) / 2;
+  return v4;
+}
+
+IndexedHalfedgeMesh::Id IndexedHalfedgeMesh::collapseEdge(Id e) {
+  // The elements are named and rewired as in HalfedgeMesh::collapseEdge.
+  Id h0 = edgeHalfedge[e];
+  Id h1 = next(h0), h2 = next(h1), h3 = twin(h0), h4 = next(h3),
+     h5 = next(h4), h6 = twin(h2), h7 = next(h6), h8 = next(h7),
+     h9 = twin(h4), h10 = next(h9), h11 = next(h10);
+  Id f0 = face(h0), f1 = face(h3), f2 = face(h6), f3 = face(h10);
+  Id e0 = edge(h0), e3 = edge(h2), e4 = edge(h4);
+  Id v0 = vertex(h0), v1 = vertex(h3), v2 = vertex(h2), v3 = vertex(h5);
+
+  if (v0 == v1) return v0;
+  if (faceDegree(f0) != 3 || faceDegree(f1) != 3 || faceDegree(f2) != 3 ||
+      faceDegree(f3) != 3) {
+    return NONE;
+  }
+
+  Vector3D newPosition = (position[v0] + position[v1]) / 2;
+
+  Id curr = vertexHalfedge[v0];
+  do {
+    halfedgeVertex[curr] = v1;
+    curr = next(twin(curr));
+  } while (curr != vertexHalfedge[v0]);
+
+  halfedgeNext[h1] = h7;
+  halfedgeFace[h1] = f2;
+  halfedgeNext[h5] = h10;
+  halfedgeFace[h5] = f3;
+  halfedgeNext[h8] = h1;
+  halfedgeNext[h11] = h5;
+
+  // The remaining vertices keep their halfedges unless those are deleted,
+  // so that boundary vertices keep the boundary halfedge.
+  if (vertexHalfedge[v1] == h3) vertexHalfedge[v1] = h1;
+  if (vertexHalfedge[v2] == h2) vertexHalfedge[v2] = h7;
+  if (vertexHalfedge[v3] == h9) vertexHalfedge[v3] = h5;
+
+  faceHalfedge[f2] = h7;
+  faceHalfedge[f3] = h11;
+  if (f2 == f3) {
+    halfedgeNext[h5] = h1;
+    halfedgeNext[h1] = h7;
+    halfedgeNext[h7] = h5;
+  }
+
+  deleteHalfedge(h0);
+  deleteHalfedge(h3);
+  if (e3 == e4) {
+    deleteHalfedge(h4);
+    deleteHalfedge(h2);
+    deleteEdge(e3);
+  } else {
+    deleteHalfedge(h6);
+    deleteHalfedge(h4);
+    deleteHalfedge(h2);
+    deleteHalfedge(h9);
+    deleteEdge(e3);
+    deleteEdge(e4);
+  }
+  deleteVertex(v0);
+  deleteEdge(e0);
+  deleteFace(f0);
+  deleteFace(f1);
+
+  position[v1] = newPosition;
+  return v1;
+}
+
+IndexedHalfedgeMesh::Id IndexedHalfedgeMesh::flipEdge(Id e) {
+  if (isBoundaryEdge(e)) return NONE;
+
+  // The edge goes from a to b between faces f0 = (a, b, c, ...) and
+  // f1 = (b, a, d, ...), and ends up going from d to c, with f0 = (d, c, ...,
+  // a) and f1 = (c, d, ..., b).
+  Id h0 = edgeHalfedge[e], h3 = twin(h0);
+  Id h1 = next(h0), h4 = next(h3);
+  Id n1 = next(h1), n4 = next(h4);
+  Id p0 = prev(h0), p1 = prev(h3);
+  Id a = vertex(h0), b = vertex(h3), c = vertex(n1), d = vertex(n4);
+  Id f0 = face(h0), f1 = face(h3);
+
+  halfedgeNext[h0] = n1;
+  halfedgeNext[p0] = h4;
+  halfedgeNext[h4] = h0;
+  halfedgeNext[h3] = n4;
+  halfedgeNext[p1] = h1;
+  halfedgeNext[h1] = h3;
+  halfedgeFace[h4] = f0;
+  halfedgeFace[h1] = f1;
+  halfedgeVertex[h0] = d;
+  halfedgeVertex[h3] = c;
+
+  if (vertexHalfedge[a] == h0) vertexHalfedge[a] = h4;
+  if (vertexHalfedge[b] == h3) vertexHalfedge[b] = h1;
+  faceHalfedge[f0] = h0;
+  faceHalfedge[f1] = h3;
+  return e;
+}
+
+}  // namespace PROJ6850
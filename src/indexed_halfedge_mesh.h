@@ -0,0 +1,219 @@
+#ifndef PROJ6850_INDEXED_HALFEDGE_MESH_H
+#define PROJ6850_INDEXED_HALFEDGE_MESH_H
+
+#include "halfEdgeMesh.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace PROJ6850 {
+
+/**
+ * Halfedge mesh stored as arrays, one per attribute, with elements referring
+ * to each other by 32-bit index rather than by list iterator. Traversals walk
+ * contiguous arrays, and whole-mesh passes can loop over (and split among
+ * threads) plain index ranges.
+ *
+ * The connectivity is that of HalfedgeMesh: halfedges have a next halfedge,
+ * a twin, a root vertex, an edge and a face; vertices, edges and faces have
+ * one of their halfedges; boundary loops are faces flagged as boundaries,
+ * and a boundary vertex refers to the boundary halfedge leaving it.
+ *
+ * Deleting an element leaves a tombstone in its slot, which goes on a free
+ * list and is reused by the next element of its kind, so the indices of the
+ * other elements stay valid through edits. compact() drops the tombstones
+ * and renumbers the elements.
+ *
+ * The arrays are public so that passes over the mesh can read and write them
+ * directly; the connectivity should only be edited through the operations
+ * below.
+ */
+class IndexedHalfedgeMesh {
+ public:
+  typedef uint32_t Id;
+  static const Id NONE;     ///< no element
+  static const Id DELETED;  ///< marks the slot of a deleted element
+
+  IndexedHalfedgeMesh() : boundaryCount(0) {}
+
+  /**
+   * Build the mesh from polygons, each a list of vertex indices, with the
+   * requirements and the vertex numbering of HalfedgeMesh::build: the
+   * polygons must form a manifold, oriented surface, and the positions are
+   * those of the indices used, in increasing order.
+   */
+  void build(const vector<vector<Index>>& polygons,
+             const vector<Vector3D>& vertexPositions);
+
+  /**
+   * Copy the connectivity and vertex positions of a halfedge mesh. Elements
+   * are numbered in the order of its lists, boundary loops after the faces.
+   */
+  void fromHalfedgeMesh(const HalfedgeMesh& mesh);
+
+  /**
+   * Same as fromHalfedgeMesh(), for a mesh whose index members can be
+   * overwritten: vertices, edges and faces are numbered through them rather
+   * than looked up in hash tables, which is several times faster on large
+   * meshes. Halfedges are numbered after their edges, 2e for the halfedge of
+   * edge e and 2e + 1 for its twin.
+   */
+  void fromHalfedgeMeshIndices(HalfedgeMesh& mesh);
+
+  /**
+   * Replace a halfedge mesh with a copy of this one, elements in index
+   * order. Bind positions are set to the positions.
+   */
+  void toHalfedgeMesh(HalfedgeMesh& mesh) const;
+
+  /**
+   * Remove all elements.
+   */
+  void clear();
+
+  /**
+   * Replace the mesh with the given numbers of elements, none of them
+   * deleted and their references all left to be set, for passes that fill in
+   * the arrays of a whole mesh. The nBoundaries boundary loops come after
+   * the nFaces faces.
+   */
+  void resize(Size nHalfedges, Size nVertices, Size nEdges, Size nFaces,
+              Size nBoundaries);
+
+  /**
+   * Drop the tombstones of deleted elements and renumber the others in
+   * their order, which invalidates all indices held outside the mesh.
+   */
+  void compact();
+
+  // Numbers of elements, deleted ones not counted.
+  Size nHalfedges() const { return halfedgeNext.size() - freeHalfedges.size(); }
+  Size nVertices() const { return vertexHalfedge.size() - freeVertices.size(); }
+  Size nEdges() const { return edgeHalfedge.size() - freeEdges.size(); }
+  Size nFaces() const {
+    return faceHalfedge.size() - freeFaces.size() - boundaryCount;
+  }
+  Size nBoundaries() const { return boundaryCount; }
+
+  // Whether a slot holds a deleted element.
+  bool isDeletedHalfedge(Id h) const { return halfedgeNext[h] == DELETED; }
+  bool isDeletedVertex(Id v) const { return vertexHalfedge[v] == DELETED; }
+  bool isDeletedEdge(Id e) const { return edgeHalfedge[e] == DELETED; }
+  bool isDeletedFace(Id f) const { return faceHalfedge[f] == DELETED; }
+
+  // Connectivity of a halfedge.
+  Id next(Id h) const { return halfedgeNext[h]; }
+  Id twin(Id h) const { return halfedgeTwin[h]; }
+  Id vertex(Id h) const { return halfedgeVertex[h]; }
+  Id edge(Id h) const { return halfedgeEdge[h]; }
+  Id face(Id h) const { return halfedgeFace[h]; }
+
+  /**
+   * Halfedge before a halfedge around its face.
+   */
+  Id prev(Id h) const {
+    Id p = h;
+    while (halfedgeNext[p] != h) p = halfedgeNext[p];
+    return p;
+  }
+
+  bool isBoundaryHalfedge(Id h) const { return faceIsBoundary[halfedgeFace[h]]; }
+  bool isBoundaryEdge(Id e) const {
+    Id h = edgeHalfedge[e];
+    return isBoundaryHalfedge(h) || isBoundaryHalfedge(halfedgeTwin[h]);
+  }
+  bool isBoundaryVertex(Id v) const;
+
+  /**
+   * Number of faces around a vertex, boundary loops not counted.
+   */
+  Size vertexDegree(Id v) const;
+
+  /**
+   * Number of vertices of a face.
+   */
+  Size faceDegree(Id f) const;
+
+  /**
+   * Unit normal of a face.
+   */
+  Vector3D faceNormal(Id f) const;
+
+  /**
+   * Unit normal of a vertex, the area-weighted normals of its faces averaged.
+   */
+  Vector3D vertexNormal(Id v) const;
+
+  double edgeLength(Id e) const {
+    Id h = edgeHalfedge[e];
+    return (position[halfedgeVertex[h]] -
+            position[halfedgeVertex[halfedgeTwin[h]]]).norm();
+  }
+
+  /*
+   * Element allocation. New elements take the slot of a deleted one if there
+   * is any; their references are NONE until set.
+   */
+  Id newHalfedge();
+  Id newVertex();
+  Id newEdge();
+  Id newFace(bool isBoundary = false);
+
+  void deleteHalfedge(Id h);
+  void deleteVertex(Id v);
+  void deleteEdge(Id e);
+  void deleteFace(Id f);
+
+  void setNeighbors(Id h, Id next, Id twin, Id vertex, Id edge, Id face) {
+    halfedgeNext[h] = next;
+    halfedgeTwin[h] = twin;
+    halfedgeVertex[h] = vertex;
+    halfedgeEdge[h] = edge;
+    halfedgeFace[h] = face;
+  }
+
+  /**
+   * Split an edge at its midpoint, as HalfedgeMesh::splitEdge does: the
+   * triangles on both sides split in two, or only the one next to a boundary
+   * edge.
+   * \return the new vertex, NONE if a face of the edge is not a triangle
+   */
+  Id splitEdge(Id e);
+
+  /**
+   * Collapse an edge to its midpoint, as HalfedgeMesh::collapseEdge does: the
+   * halfedges of its first vertex move to the second one, which is returned.
+   * \return the remaining vertex, NONE if a face next to the edge is not a
+   *         triangle
+   */
+  Id collapseEdge(Id e);
+
+  /**
+   * Rotate an edge counterclockwise within the two faces it joins, which may
+   * be any polygons. The halfedges other than the edge's keep their twins.
+   * \return the edge, NONE for a boundary edge
+   */
+  Id flipEdge(Id e);
+
+  std::vector<Id> halfedgeNext;    ///< next halfedge around the face
+  std::vector<Id> halfedgeTwin;    ///< halfedge on the other side of the edge
+  std::vector<Id> halfedgeVertex;  ///< vertex the halfedge leaves from
+  std::vector<Id> halfedgeEdge;    ///< edge of the halfedge
+  std::vector<Id> halfedgeFace;    ///< face or boundary loop of the halfedge
+
+  std::vector<Id> vertexHalfedge;  ///< a halfedge leaving the vertex
+  std::vector<Vector3D> position;  ///< vertex positions
+
+  std::vector<Id> edgeHalfedge;    ///< one of the two halfedges of the edge
+
+  std::vector<Id> faceHalfedge;    ///< a halfedge of the face
+  std::vector<uint8_t> faceIsBoundary;  ///< whether the face is a boundary loop
+
+ private:
+  std::vector<Id> freeHalfedges, freeVertices, freeEdges, freeFaces;
+  Size boundaryCount;  ///< boundary loops not deleted
+};
+
+}  // namespace PROJ6850
+
+#endif  // PROJ6850_INDEXED_HALFEDGE_MESH_H
@@ -2,8 +2,10 @@
 #define PROJ6850_INTERSECT_H
 
 #include <vector>
+#include <cstdint>
 
 #include "PROJ6850/vector3D.h"
+#include "PROJ6850/vec3f.h"
 #include "PROJ6850/spectrum.h"
 #include "PROJ6850/misc.h"
 
@@ -12,20 +14,22 @@
 namespace PROJ6850 {
     namespace StaticScene {
 
-        class Primitive;
-
 /**
  * A record of an intersection point which includes the time of intersection
  * and other information needed for shading
  */
         struct Intersection {
-            Intersection() : t(INF_D), primitive(NULL), bsdf(NULL) {}
+            Intersection() : t(INF_F), prim_id(UINT32_MAX), bsdf(NULL) {}
+
+            float t;  ///< time of intersection
 
-            double t;  ///< time of intersection
+            uint32_t prim_id;  ///< id of the primitive intersected (see PrimitiveList)
 
-            const Primitive* primitive;  ///< the primitive intersected
+            Vec3f p;        ///< point of intersection, as computed by the primitive
+            Vec3f p_error;  ///< absolute floating point error bound of p
 
-            Vector3D n;  ///< normal at point of intersection
+            Vec3f n;   ///< (shading) normal at point of intersection
+            Vec3f ng;  ///< geometric normal, used to offset spawned rays
 
             BSDF* bsdf;  ///< BSDF of the surface at point of intersection
 
@@ -13,7 +13,7 @@ namespace PROJ6850 {
     namespace StaticScene {
 
 
-        KDTREEAccel::KDTREEAccel(const std::vector<Primitive *> &_primitives, size_t max_leaf_size) {
+        KDTREEAccel::KDTREEAccel(const PrimitiveList &_primitives, size_t max_leaf_size) {
 
 //           Construct a KD Tree from the given vector of primitives and maximum leaf
 //           size configuration. The starter code build a kd-tree aggregate with a
@@ -21,96 +21,98 @@ namespace PROJ6850 {
 //           primitives.
           size_t totalNodeBuilt = 0;
           std::set<int> indices;
-          BBox box;
+          BBoxf box;
 
-          for (int i = 0; i < _primitives.size(); i++) {
+          primitiveList = &_primitives;
+          const std::vector<PrimitiveID> &ids = _primitives.get_ids();
+          for (size_t i = 0; i < ids.size(); i++) {
             indices.insert(i);
-            box.expand(_primitives[i]->get_bbox());
+            box.expand(primitiveList->get_bbox(ids[i]));
           }
 
+          // leaves append their primitives to the flat list in depth first order
           TreeStat stat = {};
-          root = recursiveBuild(   indices , _primitives, max_leaf_size, 0, box, stat);
-          std::printf("\n--------------------\nStatistics of KD-Tree:\nTotal Nodes: %d\n Total Leaf Nodes: %d\n Total Leaf Triangles: %d\n Level: %d\n", stat.totalNodes, stat.totalLeafNodes, stat.totalLeafTriangles, stat.maxLevel);
+          primitives.clear();
+          root = recursiveBuild(   indices , ids, max_leaf_size, 0, box, stat);
+          std::printf("\n--------------------\nStatistics of KD-Tree:\nTotal Nodes: %d\n Total Leaf Nodes: %d\n Total Leaf Triangles: %d\n Level: %d\n Node Memory: %.2f MB (%.2f MB reserved)\n", stat.totalNodes, stat.totalLeafNodes, stat.totalLeafTriangles, stat.maxLevel,
+                      arena.used() / (1024.0 * 1024.0), arena.reserved() / (1024.0 * 1024.0));
 
-          primitives = _primitives;
-
-        }
-
-        void KDTREEAccel::recursiveDelete(AccelNode* node) {
-          if (node->isLeaf()) {
-            delete node;
-          } else {
-            recursiveDelete(node->l);
-            recursiveDelete(node->r);
-          }
         }
 
         KDTREEAccel::~KDTREEAccel() {
-          // free any memories allocated as needed
-          recursiveDelete(root);
+          // nodes are owned by the arena, which frees them with its blocks
         }
 
 
 
-        double  findSplitPlane(const std::vector<Primitive *> & originalPrimitives, std::set<int>& indices, int  splitAxis) {
+        float  findSplitPlane(const PrimitiveList* primitiveList, const std::vector<PrimitiveID> & originalPrimitives, std::set<int>& indices, int  splitAxis) {
           // Use naive sorting for split plane
-          std::vector<double> vals;
+          std::vector<float> vals;
           for (int idx : indices) {
-            BBox elemBBox = originalPrimitives[idx]->get_bbox();
+            BBoxf elemBBox = primitiveList->get_bbox(originalPrimitives[idx]);
             vals.emplace_back(elemBBox.centroid()[splitAxis]);
           }
 
           std::sort(vals.begin(), vals.end());
           if (vals.size() % 2 == 0) {
             // use middle value
-            return (vals[vals.size() / 2] + vals[vals.size() / 2 - 1]) / 2.0;
+            return (vals[vals.size() / 2] + vals[vals.size() / 2 - 1]) / 2.0f;
           } else {
             return vals[vals.size() / 2];
           }
         }
 
 
+        void KDTREEAccel::makeLeaf(AccelNode *node, const std::set<int> &indices,
+                                   const std::vector<PrimitiveID> &originalPrimitives) {
+          for (int idx : indices) {
+            primitives.push_back(originalPrimitives[idx]);
+          }
+          node->range = indices.size();
+        }
+
         AccelNode *KDTREEAccel::recursiveBuild( std::set<int>& indices,
-                                               const std::vector<Primitive *> &originalPrimitives,
-                                               size_t max_leaf_size, int level, BBox& bbox, TreeStat& treeStat) {
+                                               const std::vector<PrimitiveID> &originalPrimitives,
+                                               size_t max_leaf_size, int level, BBoxf& bbox, TreeStat& treeStat) {
           treeStat.maxLevel = std::max(treeStat.maxLevel, level);
           treeStat.totalNodes++;
           int N = indices.size();
 
-          BBox bboxAll; // boundBox for all primitives in this range
+          BBoxf bboxAll; // boundBox for all primitives in this range
           for (int idx : indices) {
-            bboxAll.expand(originalPrimitives[idx]->get_bbox());
+            bboxAll.expand(primitiveList->get_bbox(originalPrimitives[idx]));
           }
 
           bbox.intersect(bboxAll);
 
-          AccelNode *thisNode = new AccelNode(bbox, indices);
+          AccelNode *thisNode = arena.create<AccelNode>(bbox, primitives.size(), 0);
 
           if ((N <= max_leaf_size) || (level >  8 + 1.3 * std::log(originalPrimitives.size())) ) {
             // build leaf node
             treeStat.totalLeafNodes++;
             treeStat.totalLeafTriangles += indices.size();
+            makeLeaf(thisNode, indices, originalPrimitives);
             return thisNode;
           } else {
-            BBox boundCentroidAll;
+            BBoxf boundCentroidAll;
             int splitAxis;
             for (int idx : indices) {
-              BBox box = originalPrimitives[idx]->get_bbox();
+              BBoxf box = primitiveList->get_bbox(originalPrimitives[idx]);
               boundCentroidAll.expand(box.centroid());
             }
 
             splitAxis = boundCentroidAll.longestDimension();
 
-            double medianOnAxis = findSplitPlane(originalPrimitives, indices, splitAxis);
+            float medianOnAxis = findSplitPlane(primitiveList, originalPrimitives, indices, splitAxis);
             // split primitives on the splitaxis according to median, build left and right tree node
             AccelNode *leftNode, *rightNode;
             std::set<int> left, right;
-            BBox leftBBox, rightBBox;
+            BBoxf leftBBox, rightBBox;
             leftBBox = rightBBox = bbox;
             leftBBox.max[splitAxis] = rightBBox.min[splitAxis] = medianOnAxis;
 
             for (int idx : indices) {
-              BBox elemBBox = originalPrimitives[idx]->get_bbox();
+              BBoxf elemBBox = primitiveList->get_bbox(originalPrimitives[idx]);
               if (elemBBox.max[splitAxis] <= medianOnAxis) { // triangle should be put in the left bbox
                 // add to left
                 left.insert(idx);
@@ -127,6 +129,7 @@ namespace PROJ6850 {
             if ((left.size() > 0.9 * indices.size()) || (right.size() > 0.9 * indices.size())) { // bad split, return tree node
               treeStat.totalLeafNodes++;
               treeStat.totalLeafTriangles += indices.size();
+              makeLeaf(thisNode, indices, originalPrimitives);
               return thisNode;
             }
 
@@ -136,6 +139,8 @@ namespace PROJ6850 {
                                        max_leaf_size, level + 1, rightBBox, treeStat);
             thisNode->l = leftNode;
             thisNode->r = rightNode;
+            // an interior node spans the primitives of all its leaves
+            thisNode->range = primitives.size() - thisNode->start;
             return thisNode;
           }
 
@@ -143,10 +148,10 @@ namespace PROJ6850 {
         }
 
 
-        void KDTREEAccel::traverse(const Ray &ray, AccelNode *currentNode, Intersection *isect, bool &hits, int level, int& maxLevel, RenderingStat& renderingStat) const {
+        void KDTREEAccel::traverse(const Rayf &ray, AccelNode *currentNode, Intersection *isect, bool &hits, int level, int& maxLevel, RenderingStat& renderingStat) const {
           renderingStat.totalVisitedNodes++;
           maxLevel = std::max(level, maxLevel);
-          double t0 = 0, t1 = 0;
+          float t0 = 0, t1 = 0;
           if (currentNode == nullptr ||
               !currentNode->bb.intersect(ray, t0, t1)) { // no intersection with the bounding box
             return;
@@ -158,15 +163,15 @@ namespace PROJ6850 {
           }
 
           if (currentNode->isLeaf()) {
-            for (int idx : currentNode->indices) {
+            for (size_t i = currentNode->start; i < currentNode->start + currentNode->range; i++) {
               renderingStat.totalRayTriangleTest++;
-              if (((isect != nullptr) && primitives[idx]->intersect(ray, isect)) ||
-                  ((isect == nullptr) && primitives[idx]->intersect(ray))) {
+              if (((isect != nullptr) && primitiveList->intersect(primitives[i], ray, isect)) ||
+                  ((isect == nullptr) && primitiveList->intersect(primitives[i], ray))) {
                 hits = true;
               }
             }
           } else {
-            double tminLeft = 0, tmaxLeft = 0, tminRight = 0, tmaxRight = 0;
+            float tminLeft = 0, tmaxLeft = 0, tminRight = 0, tmaxRight = 0;
             bool leftIntersect = (currentNode->l != nullptr) && (currentNode->l->bb.intersect(ray, tminLeft, tmaxLeft));
             bool rightIntersect =
                     (currentNode->r != nullptr) && (currentNode->r->bb.intersect(ray, tminRight, tmaxRight));
@@ -185,7 +190,7 @@ namespace PROJ6850 {
               // If there is intersection with first node, and intersection point is within node, terminate search process
               bool skipSecondNode = false;
               if (hits) {
-                Vector3D p = ray.o + ray.d * isect->t;
+                Vec3f p = ray.o + ray.d * isect->t;
                 if (firstNode->bb.isInside(p))
                   skipSecondNode = true;
               }
@@ -198,7 +203,8 @@ namespace PROJ6850 {
           }
         }
 
-        bool KDTREEAccel::intersect(const Ray &ray, Intersection *isect, RenderingStat& renderingStat) const {
+        bool KDTREEAccel::intersect(const Rayf &ray, Intersection *isect, RenderingStat& renderingStat) const {
+          renderingStat.totalRays++;
           // Implement ray - bvh aggregate intersection test. A ray intersects
           // with a kdtree aggregate if and only if it intersects a primitive in
           // the BVH that is not an aggregate. When an intersection does happen.
@@ -212,7 +218,8 @@ namespace PROJ6850 {
           return hit;
         }
 
-        bool KDTREEAccel::intersect(const Ray &ray, RenderingStat& renderingStat) const {
+        bool KDTREEAccel::intersect(const Rayf &ray, RenderingStat& renderingStat) const {
+          renderingStat.totalRays++;
           // Implement ray - bvh aggregate intersection test. A ray intersects
           // with a kdtree aggregate if and only if it intersects a primitive in
           // the BVH that is not an aggregate.
@@ -225,7 +232,7 @@ namespace PROJ6850 {
         }
 
 
-        bool KDTREEAccel::intersect(const Ray &ray, Intersection *isect) const {
+        bool KDTREEAccel::intersect(const Rayf &ray, Intersection *isect) const {
           // Implement ray - bvh aggregate intersection test. A ray intersects
           // with a kdtree aggregate if and only if it intersects a primitive in
           // the BVH that is not an aggregate. When an intersection does happen.
@@ -240,7 +247,7 @@ namespace PROJ6850 {
           return hit;
         }
 
-        bool KDTREEAccel::intersect(const Ray &ray) const {
+        bool KDTREEAccel::intersect(const Rayf &ray) const {
           // Implement ray - bvh aggregate intersection test. A ray intersects
           // with a kdtree aggregate if and only if it intersects a primitive in
           // the BVH that is not an aggregate.
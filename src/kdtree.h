@@ -3,6 +3,7 @@
 
 #include "static_scene/scene.h"
 #include "static_scene/aggregate.h"
+#include "memory_arena.h"
 
 #include <vector>
 #include <set>
@@ -25,17 +26,18 @@ namespace PROJ6850 {
             /**
              * Parameterized Constructor.
              * Create BVH from a list of primitives. Note that the KDTREEAccel Aggregate
-             * stores pointers to the primitives and thus the primitives need be kept
+             * stores ids into the primitive list and thus the list needs be kept
              * in memory for the aggregate to function properly.
              * \param primitives primitives to build from
              * \param max_leaf_size maximum number of primitives to be stored in leaves
              */
-            KDTREEAccel(const std::vector<Primitive *> &primitives, size_t max_leaf_size = 4);
+            KDTREEAccel(const PrimitiveList &primitives, size_t max_leaf_size = 4);
 
             /**
              * Destructor.
              * The destructor only destroys the Aggregate itself, the primitives that
-             * it contains are left untouched.
+             * it contains are left untouched. All nodes live in the node arena and
+             * are released at once.
              */
             ~KDTREEAccel();
 
@@ -43,7 +45,7 @@ namespace PROJ6850 {
              * Get the world space bounding box of the aggregate.
              * \return world space bounding box of the aggregate
              */
-            BBox get_bbox() const {
+            BBoxf get_bbox() const {
               return root->bb;
             }
 
@@ -55,8 +57,8 @@ namespace PROJ6850 {
              * \return true if the given ray intersects with the aggregate,
                        false otherwise
              */
-            bool intersect(const Ray &r, RenderingStat& renderingStat) const;
-            bool intersect(const Ray &r) const;
+            bool intersect(const Rayf &r, RenderingStat& renderingStat) const;
+            bool intersect(const Rayf &r) const;
 
             /**
              * Ray - Aggregate intersection 2.
@@ -71,8 +73,8 @@ namespace PROJ6850 {
              * \return true if the given ray intersects with the aggregate,
                        false otherwise
              */
-            bool intersect(const Ray &r, Intersection *i, RenderingStat& renderingStat) const;
-            bool intersect(const Ray &r, Intersection *i) const;
+            bool intersect(const Rayf &r, Intersection *i, RenderingStat& renderingStat) const;
+            bool intersect(const Rayf &r, Intersection *i) const;
 
 
 
@@ -103,10 +105,12 @@ namespace PROJ6850 {
             AccelNode *root;  ///< root node of the kd tree
             AccelNode *recursiveBuild(
                                       std::set<int>& indices,
-                                      const std::vector<Primitive *> &originalPrimitives,
-                                      size_t max_leaf_size, int level,  BBox& bbox, TreeStat& treeStat); ///< helper function for recursively building kd tree
-            void traverse(const Ray &ray, AccelNode* currentNode, Intersection *isect, bool &hits, int level, int& maxLevel, RenderingStat& renderingStat) const;
-            void  recursiveDelete(AccelNode* node);
+                                      const std::vector<PrimitiveID> &originalPrimitives,
+                                      size_t max_leaf_size, int level,  BBoxf& bbox, TreeStat& treeStat); ///< helper function for recursively building kd tree
+            void makeLeaf(AccelNode *node, const std::set<int> &indices,
+                          const std::vector<PrimitiveID> &originalPrimitives); ///< append the leaf primitives to the flat list
+            void traverse(const Rayf &ray, AccelNode* currentNode, Intersection *isect, bool &hits, int level, int& maxLevel, RenderingStat& renderingStat) const;
+            MemoryArena arena;  ///< storage of all the nodes
 
         };  // namespace StaticScene
     };
@@ -31,6 +31,38 @@ void usage(const char* binaryName) {
   printf("  -m  <INT>        Maximum ray depth\n");
   printf("  -e  <PATH>       Path to environment map\n");
   printf("  -w  <PATH>       Run Pathtracer without GUI, save render to PATH\n");
+  printf("  -a  <INT>:<INT>  Render animation frames START to END without GUI,\n");
+  printf("                   save them to PATH0000.EXT... (PATH set by -w,\n");
+  printf("                   EXT set by -f)\n");
+  printf("  -q  <INT>        Number of animation frames in flight (default 2)\n");
+  printf("  -b  <FLOAT>      Shutter interval of animation frames, in frames,\n");
+  printf("                   for motion blur (default 0)\n");
+  printf("  -f  <EXT>        Format of animation frames: png (default), exr\n");
+  printf("                   or pfm. Renders saved to .exr or .pfm files get\n");
+  printf("                   linear radiance instead of the tonemapped image\n");
+  printf("  -H               Store EXR images as 16-bit floats\n");
+  printf("  -u               Store EXR images uncompressed instead of ZIP\n");
+  printf("  -o  <INT>        Number of image writer threads (default 2)\n");
+  printf("  -v  <LIST>       AOVs saved as extra layers of EXR renders, comma\n");
+  printf("                   separated: albedo, normal, depth, id, samples\n");
+  printf("                   or all\n");
+  printf("  -d               Denoise renders, guided by their albedo, normal\n");
+  printf("                   and depth\n");
+  printf("  -c  <FLOAT>      Checkpoint the finished tiles of the -w render to\n");
+  printf("                   PATH.ckpt every FLOAT seconds\n");
+  printf("  -r               Resume the -w render from PATH.ckpt, tracing only\n");
+  printf("                   the tiles it misses (checkpoints every 60 s\n");
+  printf("                   unless -c is given)\n");
+  printf("  -S  <ADDR>       Serve the tiles of the -w render to workers on\n");
+  printf("                   ADDR, [HOST:]PORT or the path of a Unix socket\n");
+  printf("  -W  <ADDR>       Render tiles for the server on ADDR, then exit.\n");
+  printf("                   Workers load the same scene with the same\n");
+  printf("                   settings as the server\n");
+  printf("  -T  <FLOAT>      Seconds a worker may take to return a tile before\n");
+  printf("                   its tile goes to the others (default 300)\n");
+  printf("  -C  <PATH>       Load the scene of the -w render or -W worker from\n");
+  printf("                   the scene cache PATH, written there if it is\n");
+  printf("                   missing or does not match the scene file\n");
   printf("  -h               Print this help message\n");
   printf("\n");
 }
@@ -75,7 +107,7 @@ int main(int argc, char** argv) {
   // get the options
   AppConfig config;
   int opt;
-  while ((opt = getopt(argc, argv, "s:l:t:m:e:w:h")) !=
+  while ((opt = getopt(argc, argv, "s:l:t:m:e:w:a:q:b:f:Huo:v:dc:rS:W:T:C:h")) !=
          -1) {  // for each option...
     switch (opt) {
       case 's':
@@ -98,6 +130,60 @@ int main(int argc, char** argv) {
           config.pathtracer_result_path = optarg;
         }
         break;
+      case 'a':
+        if (sscanf(optarg, "%d:%d", &config.pathtracer_frame_start,
+                   &config.pathtracer_frame_end) != 2 ||
+            config.pathtracer_frame_start < 0 ||
+            config.pathtracer_frame_end < config.pathtracer_frame_start) {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'q':
+        config.pathtracer_frames_in_flight = atoi(optarg);
+        break;
+      case 'b':
+        config.pathtracer_shutter = atof(optarg);
+        break;
+      case 'f':
+        config.pathtracer_frame_format = optarg;
+        break;
+      case 'H':
+        config.pathtracer_image_options.halfFloat = true;
+        break;
+      case 'u':
+        config.pathtracer_image_options.zip = false;
+        break;
+      case 'o':
+        config.pathtracer_writer_threads = atoi(optarg);
+        break;
+      case 'v':
+        if (!AOVBuffer::parse_channels(optarg, &config.pathtracer_aovs)) {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'd':
+        config.pathtracer_denoise = true;
+        break;
+      case 'c':
+        config.pathtracer_checkpoint_interval = atof(optarg);
+        break;
+      case 'r':
+        config.pathtracer_resume = true;
+        break;
+      case 'S':
+        config.pathtracer_tile_server = optarg;
+        break;
+      case 'W':
+        config.pathtracer_tile_worker = optarg;
+        break;
+      case 'T':
+        config.pathtracer_tile_timeout = atof(optarg);
+        break;
+      case 'C':
+        config.pathtracer_scene_cache = optarg;
+        break;
       default:
         usage(argv[0]);
         return 1;
@@ -113,14 +199,6 @@ int main(int argc, char** argv) {
   string sceneFilePath = argv[optind];
   msg("Input scene file: " << sceneFilePath);
 
-  // parse scene
-  Collada::SceneInfo* sceneInfo = new Collada::SceneInfo();
-  if (Collada::ColladaParser::load(sceneFilePath.c_str(), sceneInfo) < 0) {
-    msg("Error: parsing failed!");
-    delete sceneInfo;
-    exit(0);
-  }
-
   // create viewer
   Viewer viewer = Viewer();
 
@@ -133,15 +211,50 @@ int main(int argc, char** argv) {
   // init viewer
   viewer.init();
 
-  // load scene
-  app.load(sceneInfo);
+  // headless renders of a single frame never edit the scene, and may skip
+  // parsing it
+  bool render_only = config.pathtracer_frame_start < 0 &&
+                     (config.pathtracer_result_path != "" ||
+                      config.pathtracer_tile_worker != "");
+  bool cached = false;
+  if (config.pathtracer_scene_cache != "" && render_only) {
+    cached = app.load_scene_cache(config.pathtracer_scene_cache,
+                                  SceneCache::key(sceneFilePath));
+  }
+
+  if (!cached) {
+    // parse scene
+    Collada::SceneInfo* sceneInfo = new Collada::SceneInfo();
+    if (Collada::ColladaParser::load(sceneFilePath.c_str(), sceneInfo,
+                                     config.pathtracer_num_threads) < 0) {
+      msg("Error: parsing failed!");
+      delete sceneInfo;
+      exit(0);
+    }
+
+    // load scene
+    app.load(sceneInfo, render_only);
 
-  delete sceneInfo;
+    delete sceneInfo;
+  }
 
   // NOTE (sky): are we copying everything to dynamic scene? If so:
   // TODO (sky): check and make sure the destructor is freeing everything
 
   // Run in terminal mode if requested
+  if (config.pathtracer_tile_worker != "") {
+    app.render_tiles_for(config.pathtracer_tile_worker);
+    exit(EXIT_SUCCESS);
+  }
+
+  if (config.pathtracer_frame_start >= 0) {
+    string prefix = config.pathtracer_result_path != "" ?
+                    config.pathtracer_result_path : string("frame_");
+    app.render_animation(config.pathtracer_frame_start,
+                         config.pathtracer_frame_end, prefix);
+    exit(EXIT_SUCCESS);
+  }
+
   if(config.pathtracer_result_path != "") {
     app.render_scene(config.pathtracer_result_path);
     exit(EXIT_SUCCESS);
@@ -0,0 +1,101 @@
+#ifndef PROJ6850_MEMORY_ARENA_H
+#define PROJ6850_MEMORY_ARENA_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <utility>
+#include <type_traits>
+
+namespace PROJ6850 {
+
+/**
+ * Bump allocator for objects that share one lifetime, such as the nodes of
+ * an acceleration structure. Memory is carved out of large blocks and is only
+ * released all at once when the arena is reset or destroyed, so objects are
+ * laid out contiguously in allocation order and freeing them costs one free
+ * per block rather than one delete per object. Destructors are not run, which
+ * is why create() only accepts trivially destructible types.
+ */
+class MemoryArena {
+ public:
+  /**
+   * Constructor.
+   * \param block_size size of the blocks requested from the system, in bytes
+   */
+  explicit MemoryArena(size_t block_size = 256 * 1024)
+      : block_size(block_size), current(NULL), offset(0), capacity(0),
+        bytes_used(0), bytes_reserved(0) {}
+
+  ~MemoryArena() { reset(); }
+
+  /**
+   * Allocate uninitialized memory, aligned to ALIGNMENT bytes.
+   */
+  void* alloc(size_t bytes) {
+    bytes = (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (offset + bytes > capacity) {
+      // requests larger than a block get a block of their own
+      capacity = std::max(bytes, block_size);
+      current = (char*) std::malloc(capacity);
+      if (!current) throw std::bad_alloc();
+      blocks.push_back(current);
+      bytes_reserved += capacity;
+      offset = 0;
+    }
+    void* ptr = current + offset;
+    offset += bytes;
+    bytes_used += bytes;
+    return ptr;
+  }
+
+  /**
+   * Construct an object in the arena.
+   */
+  template <typename T, typename... Args>
+  T* create(Args&&... args) {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "MemoryArena does not run destructors");
+    return new (alloc(sizeof(T))) T(std::forward<Args>(args)...);
+  }
+
+  /**
+   * Release all the memory handed out by the arena.
+   */
+  void reset() {
+    for (char* block : blocks) std::free(block);
+    blocks.clear();
+    current = NULL;
+    offset = capacity = bytes_used = bytes_reserved = 0;
+  }
+
+  /**
+   * Bytes handed out since the last reset.
+   */
+  size_t used() const { return bytes_used; }
+
+  /**
+   * Bytes reserved from the system.
+   */
+  size_t reserved() const { return bytes_reserved; }
+
+ private:
+  static const size_t ALIGNMENT = 16;
+
+  MemoryArena(const MemoryArena&);
+  MemoryArena& operator=(const MemoryArena&);
+
+  size_t block_size;          ///< default size of new blocks
+  std::vector<char*> blocks;  ///< all blocks, the last one is current
+  char* current;              ///< block being carved
+  size_t offset;              ///< first free byte in the current block
+  size_t capacity;            ///< size of the current block
+  size_t bytes_used;          ///< total bytes handed out
+  size_t bytes_reserved;      ///< total size of the blocks
+};
+
+}  // namespace PROJ6850
+
+#endif  // PROJ6850_MEMORY_ARENA_H
@@ -1,9 +1,15 @@
 #include <float.h>
 #include <assert.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
 #include <unordered_map>
 #include "meshEdit.h"
-#include "mutablePriorityQueue.h"
 #include "error_dialog.h"
+#include "indexed_halfedge_mesh.h"
+#include "subdivision.h"
+#include "work_queue.h"
 
 namespace PROJ6850 {
     //Helper functions
@@ -16,6 +22,14 @@ namespace PROJ6850 {
       return prev;
     }
 
+    namespace {
+
+        double secondsSince(chrono::steady_clock::time_point start) {
+          return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+
+    }  // namespace
+
     bool isTriangle(HalfedgeIter self) {
       FaceIter f = self->face();
       Size n = f->degree();
@@ -50,6 +64,40 @@ namespace PROJ6850 {
       // This method should split the given edge and return an iterator to the
       // newly inserted vertex. The halfedge of this vertex should point along
       // the edge that was split, rather than the new edges.
+      if (e0->isBoundary()) {
+        // The triangle on the edge splits in two, and the boundary loop gets
+        // one more halfedge.
+        HalfedgeIter h0 = e0->halfedge()->isBoundary() ? e0->halfedge()->twin() : e0->halfedge();
+        HalfedgeIter h1 = h0->next(), h2 = h1->next(), h3 = h0->twin();
+        if (h2->next() != h0) {
+          showError("splitEdge() only supports triangle meshes");
+          return VertexIter();
+        }
+        VertexIter v0 = h0->vertex(), v2 = h1->vertex(), v3 = h2->vertex();
+        FaceIter f0 = h0->face();
+
+        VertexIter v4 = newVertex();
+        HalfedgeIter h4 = newHalfedge(), h5 = newHalfedge(), h6 = newHalfedge(), h7 = newHalfedge();
+        EdgeIter e1 = newEdge(), e2 = newEdge();
+        FaceIter f1 = newFace();
+
+        h7->setNeighbors(h3->next(), h0, v4, e0, h3->face());
+        h3->setNeighbors(h7, h5, v2, e1, h3->face());
+        h0->setNeighbors(h4, h7, v0, e0, f0);
+        h4->setNeighbors(h2, h6, v4, e2, f0);
+        h5->setNeighbors(h1, h3, v4, e1, f1);
+        h1->setNeighbors(h6, h1->twin(), v2, h1->edge(), f1);
+        h6->setNeighbors(h5, h4, v3, e2, f1);
+
+        v4->halfedge() = h7;
+        e0->halfedge() = h0;
+        e1->halfedge() = h5;
+        e2->halfedge() = h4;
+        f0->halfedge() = h0;
+        f1->halfedge() = h1;
+        v4->position = (v0->position + v2->position) / 2;
+        return v4;
+      }
       if (e0->halfedge()->face()->degree() != 3 || e0->halfedge()->twin()->face()->degree() != 3) {
         showError("splitEdge() only supports triangle meshes");
         return VertexIter();
@@ -89,16 +137,18 @@ namespace PROJ6850 {
       h10->setNeighbors(h11, ou2, v2, e7, f3);
       h11->setNeighbors(h9, h1, v3, e3, f3);
 
-      v0->halfedge() = h4;
-      v1->halfedge() = h8;
-      v2->halfedge() = h10;
-      v3->halfedge() = h2;
+      // Only h1 and h3 now leave another vertex, so the other vertices keep
+      // their halfedges, and boundary vertices the boundary halfedge.
+      if (v2->halfedge() == h1 || v2->halfedge() == h3) v2->halfedge() = h10;
       v4->halfedge() = h9;
 
       e0->halfedge() = h0;
       e1->halfedge() = h5;
       e2->halfedge() = h9;
       e3->halfedge() = h1;
+      // h1 and h5 moved to new edges, their old edges keep the other halfedge
+      e6->halfedge() = h8;
+      e7->halfedge() = h10;
 
       f0->halfedge() = h1;
       f1->halfedge() = h5;
@@ -171,9 +221,11 @@ namespace PROJ6850 {
       h8->next() = h1;
       h11->next() = h5;
 
-      v1->halfedge() = h1;
-      v2->halfedge() = h7;
-      v3->halfedge() = h5;
+      // The remaining vertices keep their halfedges unless those are deleted,
+      // so that boundary vertices keep the boundary halfedge.
+      if (v1->halfedge() == h3) v1->halfedge() = h1;
+      if (v2->halfedge() == h2) v2->halfedge() = h7;
+      if (v3->halfedge() == h9) v3->halfedge() = h5;
 
       f2->halfedge() = h7;
       f3->halfedge() = h11;
@@ -330,10 +382,12 @@ namespace PROJ6850 {
       h9->setNeighbors(h9->next(), h4, h9->vertex(), e1, h9->face());
 
 // VERTICES
-      v0->halfedge() = h2;
-      v1->halfedge() = h5;
-      v2->halfedge() = h4;
-      v3->halfedge() = h3;
+      // Only reassigned if their halfedge now leaves another vertex, so that
+      // boundary vertices keep the boundary halfedge.
+      if (v0->halfedge()->vertex() != v0) v0->halfedge() = h2;
+      if (v1->halfedge()->vertex() != v1) v1->halfedge() = h5;
+      if (v2->halfedge()->vertex() != v2) v2->halfedge() = h4;
+      if (v3->halfedge()->vertex() != v3) v3->halfedge() = h3;
 
 // EDGES
       e0->halfedge() = h0;
@@ -349,23 +403,22 @@ namespace PROJ6850 {
       return e0;
     }
 
-    void HalfedgeMesh::subdivideQuad(bool useCatmullClark) {
-      if (useCatmullClark) {
-        computeCatmullClarkPositions();
-      } else {
-        computeLinearSubdivisionPositions();
-      }
-
-      assignSubdivisionIndices();
-
-      vector<vector<Index> > subDFaces;
-      vector<Vector3D> subDVertices;
-      subDFaces.clear();
-      subDVertices.clear();
-      buildSubdivisionFaceList(subDFaces);
-      buildSubdivisionVertexList(subDVertices);
-
-      rebuild(subDFaces, subDVertices);
+    void HalfedgeMesh::subdivideQuad(bool useCatmullClark, size_t num_threads,
+                                     QuadSubdivision *subdivision) {
+      // The refined mesh is built on a copy stored as arrays, where each pass
+      // splits among threads, and is copied back in the same order as
+      // assignSubdivisionIndices() and buildSubdivisionFaceList() number the
+      // vertices and quads.
+      auto start = std::chrono::steady_clock::now();
+      IndexedHalfedgeMesh coarse, fine;
+      coarse.fromHalfedgeMeshIndices(*this);
+      QuadSubdivision local;
+      if (!subdivision) subdivision = &local;
+      subdivision->build(coarse, useCatmullClark, &fine, num_threads);
+      fine.toHalfedgeMesh(*this);
+      printf("[MeshEdit] Subdivided %zu faces into %zu in %.3f sec\n",
+             (size_t) coarse.nFaces(), (size_t) fine.nFaces(),
+             secondsSince(start));
     }
 
 /**
@@ -846,33 +899,25 @@ namespace PROJ6850 {
     }
 
     EdgeRecord::EdgeRecord(EdgeIter &_edge) : edge(_edge) {
-      // Compute the combined quadric from the edge endpoints.
-      // -> Build the 3x3 linear system whose solution minimizes the quadric error
-      //    associated with these two endpoints.
-      // -> Use this system to solve for the optimal position, and store it in
-      //    EdgeRecord::optimalPoint.
-      // -> Also store the cost associated with collapsing this edg in
-      //    EdgeRecord::Cost.
-          this->edge =  _edge;
-          VertexIter A = _edge->halfedge()->vertex(), B = _edge->halfedge()->twin()->vertex();
-          Matrix4x4 sumQuad = A->quadric + B->quadric;
-          double a[9] ={sumQuad.operator()(0,0),sumQuad.operator()(0,1),sumQuad.operator()(0,2),
-                        sumQuad.operator()(1,0),sumQuad.operator()(1,1),sumQuad.operator()(1,2),
-                        sumQuad.operator()(2,0),sumQuad.operator()(2,1),sumQuad.operator()(2,2)};
-          Matrix3x3 matA = Matrix3x3(a);
-
-      Vector3D b = Vector3D(sumQuad.operator()(0,3),sumQuad.operator()(1,3),sumQuad.operator()(2,3)) * (-1);
-
-      Vector3D x =  matA.inv() * b;
-          this->optimalPoint = x;
-//          this->optimalPoint = (A->position + B->position) / 2.0;
-//      std::cout << "A:" << matA << "\n";
-//      std::cout << "b:" << b << "\n";
-//      std::cout << "x:" << x << "\n";
-//      std::cout  << "sumQuad:"<< sumQuad << "\n";
-          double sc = dot(optimalPoint, sumQuad * optimalPoint);
-          this->score = sc;
-//          printf("score: %.2f\n", this->score);
+      // The collapsed vertex goes where the sum of the endpoint quadrics is
+      // least, the solution of a 3x3 linear system. On flat or straight parts
+      // of the surface that system is singular, and the vertex goes to the
+      // midpoint of the edge instead. The score is the quadric error there.
+      VertexIter A = _edge->halfedge()->vertex(), B = _edge->halfedge()->twin()->vertex();
+      Matrix4x4 sumQuad = A->quadric + B->quadric;
+      Matrix3x3 matA;
+      for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) matA(i, j) = sumQuad(i, j);
+      }
+      Vector3D b = Vector3D(sumQuad(0, 3), sumQuad(1, 3), sumQuad(2, 3)) * (-1);
+
+      if (fabs(matA.det()) > 1e-10) {
+        optimalPoint = matA.inv() * b;
+      } else {
+        optimalPoint = (A->position + B->position) / 2;
+      }
+      Vector4D x(optimalPoint, 1);
+      score = dot(x, sumQuad * x);
     }
 
     void MeshResampler::upsample(HalfedgeMesh &mesh)
@@ -928,21 +973,80 @@ namespace PROJ6850 {
       showError("upsample() not implemented.");
     }
 
+    namespace {
+
+        // Entry of the collapse queue, kept small since the queue is mostly
+        // moved around; the rest of the record is in Edge::record. The entries
+        // of an edge go stale when its stamp moves on, which happens whenever
+        // the edge is deleted or its record has to be recomputed. Stale
+        // entries are dropped as they come to the top, rather than looked up
+        // and removed from the queue.
+        struct CollapseEntry {
+            double score;
+            uint32_t edge;   ///< Edge::index of the edge
+            uint32_t stamp;  ///< stamp of the edge when the entry was queued
+        };
+
+        // Orders a std heap so that the entry of least score is on top.
+        struct CollapseAfter {
+            bool operator()(const CollapseEntry &a, const CollapseEntry &b) const {
+              if (a.score != b.score) return a.score > b.score;
+              return a.edge > b.edge;
+            }
+        };
+
+        // Whether the edge can be collapsed to p while keeping a manifold
+        // triangle mesh: both endpoints are interior vertices with only
+        // triangles around them, they have exactly two neighbors in common
+        // (the apexes of the edge's triangles), the apexes keep at least three
+        // neighbors, and no triangle around the endpoints gets flipped over.
+        bool canCollapse(EdgeIter e, const Vector3D &p) {
+          HalfedgeIter h = e->halfedge();
+          VertexIter a = h->vertex(), b = h->twin()->vertex();
+          if (a == b || a->isBoundary() || b->isBoundary()) return false;
+          VertexIter c = h->next()->next()->vertex(),
+                  d = h->twin()->next()->next()->vertex();
+          if (c == d || c->degree() <= 3 || d->degree() <= 3) return false;
+
+          vector<const Vertex *> neighbors;
+          for (int i = 0; i < 2; i++) {
+            VertexIter v = i == 0 ? a : b, other = i == 0 ? b : a;
+            HalfedgeIter curr = v->halfedge();
+            do {
+              if (curr->face()->degree() != 3) return false;
+              VertexIter u = curr->twin()->vertex();
+              if (i == 0) {
+                neighbors.push_back(&*u);
+              } else if (u != a && u != c && u != d &&
+                         find(neighbors.begin(), neighbors.end(), &*u) != neighbors.end()) {
+                return false;
+              }
+
+              // Triangles (v, u, w) that are not removed by the collapse must
+              // not turn over when v moves to p.
+              VertexIter w = curr->next()->next()->vertex();
+              if (u != other && w != other) {
+                Vector3D before = cross(u->position - v->position, w->position - v->position);
+                Vector3D after = cross(u->position - p, w->position - p);
+                if (dot(before, after) <= 0) return false;
+              }
+              curr = curr->twin()->next();
+            } while (curr != v->halfedge());
+          }
+          return true;
+        }
+
+    }  // namespace
+
     void MeshResampler::downsample(HalfedgeMesh &mesh) {
-      // Compute initial quadrics for each face by simply writing the plane equation
-      // for the face in homogeneous coordinates. These quadrics should be stored
-      // in Face::quadric
-      // -> Compute an initial quadric for each vertex as the sum of the quadrics
-      //    associated with the incident faces, storing it in Vertex::quadric
-      // -> Build a priority queue of edges according to their quadric error cost,
-      //    i.e., by building an EdgeRecord for each edge and sticking it in the
-      //    queue.
-      // -> Until we reach the target edge budget, collapse the best edge. Remember
-      //    to remove from the queue any edge that touches the collapsing edge
-      //    BEFORE it gets collapsed, and add back into the queue any edge touching
-      //    the collapsed vertex AFTER it's been collapsed. Also remember to assign
-      //    a quadric to the collapsed vertex, and to pop the collapsed edge off the
-      //    top of the queue.
+      downsample(mesh, mesh.nFaces() / 2);
+    }
+
+    Size MeshResampler::downsample(HalfedgeMesh &mesh, Size targetFaces, double maxError) {
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+      // Quadric of each face from its plane, and of each vertex as the sum of
+      // those of its faces.
       for (FaceIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++) {
         Vector3D n = f->normal();
         double d = -dot(n, f->halfedge()->vertex()->position);
@@ -955,111 +1059,301 @@ namespace PROJ6850 {
         HalfedgeIter curr = v->halfedge();
         do {
           FaceIter f = curr->face();
-          sumQuad += f->quadric;
+          if (!f->isBoundary()) sumQuad += f->quadric;
           curr = curr->twin()->next();
         } while (curr != v->halfedge());
         v->quadric = sumQuad;
       }
 
-      MutablePriorityQueue<EdgeRecord> edgeRecords;
+      // The queue is a binary heap holding at most one live entry per edge.
+      // Edges are numbered by Edge::index, which the stamps and the table of
+      // edges are indexed by; collapses delete edges but never create any, so
+      // the numbers stay valid throughout.
+      vector<EdgeIter> edges;
+      edges.reserve(mesh.nEdges());
+      vector<uint32_t> stamps(mesh.nEdges(), 0);
+      vector<CollapseEntry> queue;
+      queue.reserve(mesh.nEdges());
       for (EdgeIter e = mesh.edgesBegin(); e != mesh.edgesEnd(); e++) {
-        if ((e->halfedge()->vertex()->degree() > 2) && (e->halfedge()->twin()->vertex()->degree() > 2)) {
-          EdgeRecord egR = EdgeRecord(e);
-          e->getEdge()->record = egR;
-          if (!isnan(egR.score)) {
-            edgeRecords.insert(egR);
-//            printf("Enqueue new edgeRecord for edge with edge: %p score: %.2f\n",(void *) e->getEdge(), egR.score);
-
-          }
+        e->index = edges.size();
+        edges.push_back(e);
+        e->record = EdgeRecord(e);
+        if (!isnan(e->record.score)) {
+          CollapseEntry entry = {e->record.score, (uint32_t) e->index, 0};
+          queue.push_back(entry);
         }
-
       }
-
-      Size count = 0;
-      Size collapseNum = mesh.nFaces();
-      while (count < collapseNum / 4) {
-//        printf("count:%d\n", count);
-        // get bestEdge to collapse
-        if (edgeRecords.isEmpty())
-          break;
-        EdgeRecord bestEdge = edgeRecords.top();
-        edgeRecords.pop();
-        count++;
-
-
-        // compute new quadric
-        EdgeIter oldEdge = bestEdge.edge;
-//        printf("\nRecord with edge %p to collpase\n",(void *) (oldEdge->getEdge()));
-        VertexIter A = oldEdge->halfedge()->vertex(),
-                B = oldEdge->halfedge()->twin()->vertex();
-//        printf("vertice A:%p\n",(void *)(A->getVertex()));
-
-//        printf("vertice B:%p\n",(void *)(B->getVertex()));
-        bool sameVertex = ((void *)(A->getVertex())) == ((void *)(B->getVertex()));
-
-
-        // remove any edge touching either of edge's endpoints from the queue
+      make_heap(queue.begin(), queue.end(), CollapseAfter());
+
+      printf("[MeshEdit] Downsampling %zu faces to %zu: queued %zu edges in %.3f s\n",
+             (size_t) mesh.nFaces(), (size_t) targetFaces, queue.size(), secondsSince(start));
+
+      Size collapses = 0;
+      chrono::steady_clock::time_point intervalStart = chrono::steady_clock::now();
+      while (mesh.nFaces() > targetFaces && !queue.empty()) {
+        pop_heap(queue.begin(), queue.end(), CollapseAfter());
+        CollapseEntry entry = queue.back();
+        queue.pop_back();
+        if (entry.stamp != stamps[entry.edge]) continue;
+        if (entry.score > maxError) break;
+
+        // Edges that fail the test may become collapsible once their
+        // neighborhood changes, at which point they are queued again.
+        EdgeIter edge = edges[entry.edge];
+        Vector3D optimalPoint = edge->record.optimalPoint;
+        if (!canCollapse(edge, optimalPoint)) continue;
+
+        // Every edge around the endpoints is either deleted by the collapse
+        // or gets a new record, so all their queued entries go stale.
+        VertexIter A = edge->halfedge()->vertex(),
+                B = edge->halfedge()->twin()->vertex();
         for (int i = 0; i < 2; i++) {
-          HalfedgeIter initial = (i == 0 ) ? A->halfedge() : B->halfedge();
+          HalfedgeIter initial = (i == 0) ? A->halfedge() : B->halfedge();
           HalfedgeIter curr = initial;
           do {
-            EdgeIter e = curr->edge();
-            Edge* edge = e->getEdge();
-              edgeRecords.remove(edge->record);
+            stamps[curr->edge()->index]++;
             curr = curr->twin()->next();
           } while (curr != initial);
         }
 
-        if (sameVertex || (A->degree() < 3) || (B->degree() < 3)) {
-          continue;
+        if (collapsing) collapsing(edge, optimalPoint);
+        Matrix4x4 sumQuad = A->quadric + B->quadric;
+        VertexIter newV = mesh.collapseEdge(edge);
+        newV->position = optimalPoint;
+        newV->quadric = sumQuad;
 
+        HalfedgeIter curr = newV->halfedge();
+        do {
+          EdgeIter e = curr->edge();
+          e->record = EdgeRecord(e);
+          if (!isnan(e->record.score)) {
+            CollapseEntry newEntry = {e->record.score, (uint32_t) e->index, stamps[e->index]};
+            queue.push_back(newEntry);
+            push_heap(queue.begin(), queue.end(), CollapseAfter());
+          }
+          curr = curr->twin()->next();
+        } while (curr != newV->halfedge());
+
+        // Stale entries pile up as the mesh shrinks; once they outnumber the
+        // edges, sweep them out so that the heap stays small.
+        if (queue.size() > 2 * mesh.nEdges() + 1024) {
+          queue.erase(remove_if(queue.begin(), queue.end(),
+                                [&stamps](const CollapseEntry &entry) {
+                                  return entry.stamp != stamps[entry.edge];
+                                }),
+                      queue.end());
+          make_heap(queue.begin(), queue.end(), CollapseAfter());
         }
-        Matrix4x4 sumQuad = A->quadric + B->quadric;
 
-        // collapse edge
-        void* add = addressof(oldEdge->halfedge());
-//        printf("\nCalling collapseEdge on edge %p\n",(void *)(oldEdge->getEdge()));
-        VertexIter newV = mesh.collapseEdge(oldEdge);
-        if (!(isnan(bestEdge.optimalPoint.x) || isnan(bestEdge.optimalPoint.y) || isnan(bestEdge.optimalPoint.z)))
-          newV->position = bestEdge.optimalPoint;
-        Matrix4x4 oldQuad = newV->quadric;
+        collapses++;
+        if (progressInterval && collapses % progressInterval == 0) {
+          printf("[MeshEdit] %zu collapses, %zu faces left: last %zu in %.3f s\n",
+                 (size_t) collapses, (size_t) mesh.nFaces(), (size_t) progressInterval,
+                 secondsSince(intervalStart));
+          intervalStart = chrono::steady_clock::now();
+          if (progress && !progress(collapses, mesh.nFaces())) break;
+        }
+      }
 
-        // update quadric
+      printf("[MeshEdit] Collapsed %zu edges down to %zu faces in %.3f s\n",
+             (size_t) collapses, (size_t) mesh.nFaces(), secondsSince(start));
+      return collapses;
+    }
 
-        // insert new record touching new vertex
-        HalfedgeIter curr = newV->halfedge();
-        if (newV->degree() > 2)  {
-          newV->quadric = sumQuad;
+    namespace {
+
+        // Whether flipping an edge between two triangles brings the valences
+        // of their four vertices closer to six (four on the boundary),
+        // without joining two vertices that already share an edge or turning
+        // a triangle over. Valences and boundary flags are looked up by
+        // Vertex::index.
+        bool improvesValence(EdgeIter e, const vector<int> &valence,
+                             const vector<char> &boundary) {
+          HalfedgeIter h = e->halfedge(), t = h->twin();
+          if (h->face()->isBoundary() || t->face()->isBoundary() ||
+              h->face()->degree() != 3 || t->face()->degree() != 3) {
+            return false;
+          }
+          VertexIter a = h->vertex(), b = t->vertex(),
+                  c = h->next()->next()->vertex(), d = t->next()->next()->vertex();
+          if (c == d || valence[a->index] <= 3 || valence[b->index] <= 3) return false;
+          auto deviation = [&](VertexIter v, int change) {
+            return std::abs(valence[v->index] + change - (boundary[v->index] ? 4 : 6));
+          };
+          int before = deviation(a, 0) + deviation(b, 0) + deviation(c, 0) + deviation(d, 0);
+          int after = deviation(a, -1) + deviation(b, -1) + deviation(c, 1) + deviation(d, 1);
+          if (after >= before) return false;
+
+          HalfedgeIter curr = c->halfedge();
           do {
-            EdgeIter e = curr->edge();
-            Edge* edge = e->getEdge();
-            EdgeRecord newRecord = EdgeRecord(e);
-            if (!isnan(newRecord.score))
-              edgeRecords.insert(newRecord);
-            e->record = newRecord;
-
+            if (curr->twin()->vertex() == d) return false;
             curr = curr->twin()->next();
-          } while (curr != newV->halfedge());
+          } while (curr != c->halfedge());
 
+          // the flipped triangles are (c, a, d) and (d, b, c)
+          Vector3D n = h->face()->normal() + t->face()->normal();
+          return dot(cross(a->position - c->position, d->position - c->position), n) > 0 &&
+                 dot(cross(b->position - d->position, c->position - d->position), n) > 0;
         }
 
+        // Whether collapsing an edge to p leaves the edges around it no
+        // longer than maxLength.
+        bool staysShort(EdgeIter e, const Vector3D &p, double maxLength) {
+          HalfedgeIter h = e->halfedge();
+          VertexIter ends[2] = {h->vertex(), h->twin()->vertex()};
+          for (VertexIter v : ends) {
+            HalfedgeIter curr = v->halfedge();
+            do {
+              if ((curr->twin()->vertex()->position - p).norm() > maxLength) return false;
+              curr = curr->twin()->next();
+            } while (curr != v->halfedge());
+          }
+          return true;
+        }
 
-      }
+    }  // namespace
 
+    double MeshResampler::meanEdgeLength(const HalfedgeMesh &mesh) {
+      double length = 0;
+      for (EdgeCIter e = mesh.edgesBegin(); e != mesh.edgesEnd(); e++) {
+        length += e->length();
+      }
+      return mesh.nEdges() > 0 ? length / mesh.nEdges() : 0;
     }
 
     void MeshResampler::resample(HalfedgeMesh &mesh) {
-      // TODO: (meshEdit)
-      // Compute the mean edge length.
-      // Repeat the four main steps for 5 or 6 iterations
-      // -> Split edges much longer than the target length (being careful about
-      //    how the loop is written!)
-      // -> Collapse edges much shorter than the target length.  Here we need to
-      //    be EXTRA careful about advancing the loop, because many edges may have
-      //    been destroyed by a collapse (which ones?)
-      // -> Now flip each edge if it improves vertex degree
-      // -> Finally, apply some tangential smoothing to the vertex positions
-      showError("resample() not implemented.");
+      if (mesh.nEdges() > 0) resample(mesh, meanEdgeLength(mesh));
+    }
+
+    void MeshResampler::resample(HalfedgeMesh &mesh, double targetLength, Size iterations,
+                                 size_t num_threads) {
+      for (FaceIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++) {
+        if (f->degree() != 3) {
+          showError("resample() only supports triangle meshes");
+          return;
+        }
+      }
+      const int smoothingSteps = 10;
+      const double smoothingWeight = 0.2;
+      double longLength = targetLength * 4 / 3, shortLength = targetLength * 4 / 5;
+      auto start = chrono::steady_clock::now();
+      Size splits = 0, collapses = 0, flips = 0;
+
+      vector<EdgeIter> edges;
+      vector<char> alive, boundary;
+      vector<VertexIter> vertices;
+      vector<int> valence;
+      vector<Index> neighborStart, neighbors;
+      vector<Vector3D> positions[2];
+      for (Size i = 0; i < iterations; i++) {
+        // Split the long edges. Splits append their new edges to the list,
+        // so stopping at the edges there were keeps the halves of an edge
+        // for the next iteration.
+        Size nEdges = mesh.nEdges();
+        EdgeIter e = mesh.edgesBegin();
+        for (Size k = 0; k < nEdges; k++, e++) {
+          if (e->length() > longLength) {
+            mesh.splitEdge(e);
+            splits++;
+          }
+        }
+
+        // Collapse the short edges. A collapse deletes the edge along with
+        // one other edge of each of its triangles, which are crossed off the
+        // edge table before it happens.
+        edges.clear();
+        for (e = mesh.edgesBegin(); e != mesh.edgesEnd(); e++) {
+          e->index = edges.size();
+          edges.push_back(e);
+        }
+        alive.assign(edges.size(), 1);
+        for (Size k = 0; k < edges.size(); k++) {
+          if (!alive[k] || edges[k]->length() >= shortLength) continue;
+          e = edges[k];
+          HalfedgeIter h = e->halfedge();
+          Vector3D p = (h->vertex()->position + h->twin()->vertex()->position) / 2;
+          if (!canCollapse(e, p) || !staysShort(e, p, longLength)) continue;
+          alive[e->index] = 0;
+          alive[h->next()->next()->edge()->index] = 0;
+          alive[h->twin()->next()->edge()->index] = 0;
+          mesh.collapseEdge(e);
+          collapses++;
+        }
+
+        // Flip edges toward regular valences. The vertices are numbered here
+        // for the valence table and for the smoothing below.
+        vertices.clear();
+        valence.clear();
+        boundary.clear();
+        for (VertexIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
+          v->index = vertices.size();
+          vertices.push_back(v);
+          boundary.push_back(v->isBoundary());
+          valence.push_back((int) v->degree() + boundary.back());
+        }
+        for (e = mesh.edgesBegin(); e != mesh.edgesEnd(); e++) {
+          if (!improvesValence(e, valence, boundary)) continue;
+          HalfedgeIter h = e->halfedge();
+          valence[h->vertex()->index]--;
+          valence[h->twin()->vertex()->index]--;
+          valence[h->next()->next()->vertex()->index]++;
+          valence[h->twin()->next()->next()->vertex()->index]++;
+          mesh.flipEdge(e);
+          flips++;
+        }
+
+        // Move the vertices toward the centroid of their neighbors, within
+        // their tangent plane, which is spanned by the triangles between
+        // consecutive neighbors. Steps run over arrays: the neighbors of each
+        // vertex in order around it, and two position buffers, one read and
+        // the other written by each step, so the vertices can be split among
+        // threads. The boundary stays in place.
+        neighborStart.assign(1, 0);
+        neighbors.clear();
+        for (Size k = 0; k < vertices.size(); k++) {
+          if (!boundary[k]) {
+            HalfedgeIter curr = vertices[k]->halfedge();
+            do {
+              neighbors.push_back(curr->twin()->vertex()->index);
+              curr = curr->twin()->next();
+            } while (curr != vertices[k]->halfedge());
+          }
+          neighborStart.push_back(neighbors.size());
+        }
+        positions[0].resize(vertices.size());
+        positions[1].resize(vertices.size());
+        for (Size k = 0; k < vertices.size(); k++) positions[0][k] = vertices[k]->position;
+        for (int step = 0; step < smoothingSteps; step++) {
+          const vector<Vector3D> &from = positions[step % 2];
+          vector<Vector3D> &to = positions[1 - step % 2];
+          parallel_for_ranges(vertices.size(), num_threads, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; k++) {
+              Vector3D p = from[k];
+              to[k] = p;
+              Size first = neighborStart[k], n = neighborStart[k + 1] - first;
+              if (n == 0) continue;
+              Vector3D centroid, normal;
+              for (Size j = 0; j < n; j++) {
+                const Vector3D &u = from[neighbors[first + j]];
+                const Vector3D &w = from[neighbors[first + (j + 1) % n]];
+                centroid += u;
+                normal += cross(u - p, w - p);
+              }
+              double area = normal.norm();
+              if (area > 0) normal /= area;
+              Vector3D d = centroid / n - p;
+              to[k] += smoothingWeight * (d - dot(normal, d) * normal);
+            }
+          });
+        }
+        for (Size k = 0; k < vertices.size(); k++) {
+          vertices[k]->position = positions[smoothingSteps % 2][k];
+        }
+      }
+
+      printf("[MeshEdit] Remeshed to %zu faces (%zu splits, %zu collapses, %zu flips) in %.3f s\n",
+             (size_t) mesh.nFaces(), (size_t) splits, (size_t) collapses, (size_t) flips,
+             secondsSince(start));
     }
 
 }  // namespace PROJ6850
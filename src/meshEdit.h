@@ -1,6 +1,8 @@
 #ifndef PROJ6850_MESHEDIT_H
 #define PROJ6850_MESHEDIT_H
 
+#include <functional>
+
 #include "halfEdgeMesh.h"
 
 using namespace std;
@@ -9,12 +11,60 @@ namespace PROJ6850 {
 
 class MeshResampler {
  public:
-  MeshResampler(){};
+  MeshResampler() : progressInterval(100000) {}
   ~MeshResampler() {}
 
   void upsample(HalfedgeMesh& mesh);
+
+  /**
+   * Halve the number of faces of a triangle mesh.
+   */
   void downsample(HalfedgeMesh& mesh);
+
+  /**
+   * Simplify a triangle mesh by collapsing the edges of least quadric error
+   * until it has at most targetFaces faces, or until the least error of a
+   * collapse exceeds maxError. Collapses that would make the surface
+   * non-manifold, touch its boundary or flip a triangle over are skipped, so
+   * the target may not be reached.
+   * \return the number of edges collapsed
+   */
+  Size downsample(HalfedgeMesh& mesh, Size targetFaces,
+                  double maxError = INF_D);
+
+  /**
+   * If set, called by downsample() every progressInterval collapses with the
+   * number of collapses so far and the number of faces left; returning false
+   * stops the simplification there. A progressInterval of 0 turns the
+   * reports, and these calls, off.
+   */
+  std::function<bool(Size collapses, Size faces)> progress;
+  Size progressInterval;  ///< collapses between progress reports, 0 for none
+
+  /**
+   * If set, called by downsample() before each collapse with the edge and
+   * the position its vertices merge at. The vertex the edge's halfedge
+   * leaves from goes away, and the other one moves to the position.
+   */
+  std::function<void(EdgeIter edge, const Vector3D& position)> collapsing;
+
+  /**
+   * Remesh a triangle mesh toward edges of its current mean length.
+   */
   void resample(HalfedgeMesh& mesh);
+
+  /**
+   * Isotropic remeshing of a triangle mesh toward edges of targetLength. Each
+   * iteration splits the edges longer than 4/3 of it, collapses those shorter
+   * than 4/5 of it, flips edges that bring vertex valences closer to six
+   * (four on the boundary), and smooths the vertices within their tangent
+   * planes, on up to num_threads threads. Boundary vertices stay in place
+   * and boundary edges are only split.
+   */
+  void resample(HalfedgeMesh& mesh, double targetLength, Size iterations = 5,
+                size_t num_threads = 1);
+
+  static double meanEdgeLength(const HalfedgeMesh& mesh);
 };
 
 }  // namespace PROJ6850
@@ -7,10 +7,11 @@
 #include <algorithm>
 #include <cassert>
 
+#include <sys/resource.h>
+
 #include "PROJ6850/PROJ6850.h"
 #include "PROJ6850/vector3D.h"
 #include "PROJ6850/matrix3x3.h"
-#include "PROJ6850/lodepng.h"
 
 #include "GL/glew.h"
 
@@ -27,6 +28,17 @@ namespace PROJ6850 {
 
 // #define ENABLE_RAY_LOGGING 1
 
+    // peak resident set size of the process in MB
+    static double peak_rss_mb() {
+      struct rusage usage;
+      getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+      return usage.ru_maxrss / (1024.0 * 1024.0);  // bytes
+#else
+      return usage.ru_maxrss / 1024.0;             // kilobytes
+#endif
+    }
+
     PathTracer::PathTracer(size_t ns_aa, size_t max_ray_depth, size_t ns_area_light,
                            size_t ns_diff, size_t ns_glsy, size_t ns_refr,
                            size_t num_threads, HDRImageBuffer *envmap) {
@@ -44,6 +56,7 @@ namespace PROJ6850 {
         this->envLight = NULL;
       }
 
+      primitiveList = NULL;
       bvh = NULL;
       kdtree = NULL;
       useKdtree = false;
@@ -59,19 +72,29 @@ namespace PROJ6850 {
       numWorkerThreads = num_threads;
       workerThreads.resize(numWorkerThreads);
 
+      aovChannels = 0;
+      denoise = false;
+      denoiser = Denoiser(num_threads);
+      checkpointInterval = 60;
+      resumeCheckpoint = false;
+      tileTimeout = 300;
+
       tm_gamma = 2.2f;
       tm_level = 1.0f;
       tm_key = 0.18;
       tm_wht = 5.0f;
+      toneCurve = ToneCurve(tm_gamma, ToneCurve::exposure(tm_level));
     }
 
     PathTracer::~PathTracer() {
       delete bvh;
+      delete kdtree;
+      delete primitiveList;
       delete gridSampler;
       delete hemisphereSampler;
     }
 
-    void PathTracer::set_scene(Scene *scene) {
+    void PathTracer::set_scene(Scene *scene, const SceneCache *cache) {
       if (state != INIT) {
         return;
       }
@@ -83,6 +106,7 @@ namespace PROJ6850 {
         delete bvh;
         if (kdtree != nullptr)
         delete kdtree;
+        delete primitiveList;
         selectionHistory.pop();
       }
 
@@ -91,13 +115,79 @@ namespace PROJ6850 {
       }
 
       this->scene = scene;
-      build_accel();
+      build_accel(cache);
 
       if (has_valid_configuration()) {
         state = READY;
       }
     }
 
+    const char *PathTracer::save_scene_cache(const std::string &filename, uint64_t key,
+                                             const SceneCache::View &view) {
+      if (scene == nullptr || bvh == nullptr) return "no scene";
+      return SceneCache::write(filename, key, *scene, *bvh, view);
+    }
+
+    void PathTracer::update_scene(Scene *scene) {
+      if (state != READY) {
+        return;
+      }
+
+      PrimitiveList *primitives = new PrimitiveList();
+      for (SceneObject *obj : scene->objects) {
+        obj->get_primitives(primitives);
+      }
+      update_scene(scene, primitives);
+    }
+
+    void PathTracer::update_scene(Scene *scene, PrimitiveList *primitives) {
+      if (state != READY) {
+        return;
+      }
+
+      fprintf(stdout, "[PathTracer] Updating accelerators... ");
+      fflush(stdout);
+      timer.start();
+
+      if (this->envLight != nullptr) {
+        scene->lights.push_back(this->envLight);
+      }
+      this->scene = scene;
+
+      if (primitiveList == nullptr || !primitiveList->same_layout(*primitives)) {
+        // topology changed, start over
+        timer.stop();
+        fprintf(stdout, "topology changed, rebuilding\n");
+        delete primitives;
+        delete bvh;
+        delete kdtree;
+        delete primitiveList;
+        kdtree = NULL;
+        selectionHistory.pop();
+        build_accel();
+        return;
+      }
+
+      size_t rebuilt = bvh->update(*primitives);
+      delete primitiveList;
+      primitiveList = primitives;
+
+      delete kdtree;
+      kdtree = useKdtree ? new KDTREEAccel(*primitiveList) : NULL;
+      timer.stop();
+
+      if (rebuilt == 0) {
+        fprintf(stdout, "Done! (%.4f sec) refitted BVH", timer.duration());
+      } else {
+        fprintf(stdout, "Done! (%.4f sec) rebuilt %zu of %zu BVH primitives", timer.duration(),
+                rebuilt, primitiveList->size());
+      }
+      fprintf(stdout, ", SAH cost %.2f (%.2fx built)\n", bvh->sah_cost(), bvh->sah_ratio());
+
+      selectionHistory.pop();
+      selectionHistory.push(useKdtree ? kdtree->get_root() : bvh->get_root());
+    }
+
     void PathTracer::set_camera(Camera *camera) {
       if (state != INIT) {
         return;
@@ -115,11 +205,65 @@ namespace PROJ6850 {
       }
       sampleBuffer.resize(width, height);
       frameBuffer.resize(width, height);
+      aovBuffer.resize(width, height, aovBuffer.channels);
       if (has_valid_configuration()) {
         state = READY;
       }
     }
 
+    void PathTracer::set_aov_channels(unsigned channels) {
+      if (state != INIT && state != READY) {
+        stop();
+      }
+      aovChannels = channels;
+      aovBuffer.resize(sampleBuffer.w, sampleBuffer.h,
+                       channels | (denoise ? Denoiser::REQUIRED_AOVS : 0));
+    }
+
+    void PathTracer::set_denoising(bool denoise) {
+      this->denoise = denoise;
+      set_aov_channels(aovChannels);
+    }
+
+    void PathTracer::set_checkpoint(const std::string& filename, double interval,
+                                    bool resume) {
+      checkpointFile = filename;
+      checkpointInterval = interval;
+      resumeCheckpoint = resume;
+    }
+
+    void PathTracer::set_tile_server(const std::string& address, double timeout) {
+      tileServerAddress = address;
+      tileTimeout = timeout;
+    }
+
+    uint64_t PathTracer::render_hash() const {
+      uint64_t hash = RenderCheckpoint::hash(NULL, 0);
+      auto mix = [&hash](const void *data, size_t size) {
+        hash = RenderCheckpoint::hash(data, size, hash);
+      };
+      size_t settings[] = {sampleBuffer.w, sampleBuffer.h, ns_aa, max_ray_depth,
+                           ns_area_light, ns_diff, ns_glsy, ns_refr,
+                           imageTileSize, aovBuffer.channels};
+      mix(settings, sizeof(settings));
+      double view[] = {camera->position().x, camera->position().y,
+                       camera->position().z, camera->view_point().x,
+                       camera->view_point().y, camera->view_point().z,
+                       camera->up_dir().x, camera->up_dir().y, camera->up_dir().z,
+                       camera->v_fov(), camera->aspect_ratio(),
+                       camera->shutter_open(), camera->shutter_close()};
+      mix(view, sizeof(view));
+      // the geometry, through the bounds of every primitive
+      for (PrimitiveID id : primitiveList->get_ids()) {
+        BBoxf bbox = primitiveList->get_bbox(id);
+        float bounds[] = {bbox.min.x, bbox.min.y, bbox.min.z,
+                          bbox.max.x, bbox.max.y, bbox.max.z};
+        mix(bounds, sizeof(bounds));
+      }
+      // and what it is shaded with, the BSDFs, lights and environment map
+      return SceneCache::shading_hash(*scene, hash);
+    }
+
     bool PathTracer::has_valid_configuration() {
       return scene && camera && gridSampler && hemisphereSampler &&
              (!sampleBuffer.is_empty());
@@ -138,7 +282,8 @@ namespace PROJ6850 {
                        &frameBuffer.data[0]);
           break;
         case DONE:
-          // sampleBuffer.tonemap(frameBuffer, tm_gamma, tm_level, tm_key, tm_wht);
+          // sampleBuffer.tonemap(frameBuffer, tm_gamma, tm_level, tm_key, tm_wht,
+          //                      numWorkerThreads);
           glDrawPixels(frameBuffer.w, frameBuffer.h, GL_RGBA, GL_UNSIGNED_BYTE,
                        &frameBuffer.data[0]);
           break;
@@ -159,7 +304,7 @@ namespace PROJ6850 {
         case RENDERING:
           continueRaytracing = false;
         case DONE:
-          for (int i = 0; i < numWorkerThreads; i++) {
+          for (size_t i = 0; i < workerThreads.size(); i++) {
             workerThreads[i]->join();
             delete workerThreads[i];
           }
@@ -175,6 +320,8 @@ namespace PROJ6850 {
 
       if (kdtree != nullptr)
         delete kdtree;
+      delete primitiveList;
+      primitiveList = NULL;
       bvh = NULL;
       kdtree = NULL;
       scene = NULL;
@@ -182,6 +329,7 @@ namespace PROJ6850 {
       selectionHistory.pop();
       sampleBuffer.resize(0, 0);
       frameBuffer.resize(0, 0);
+      aovBuffer.resize(0, 0, aovBuffer.channels);
       state = INIT;
     }
 
@@ -192,6 +340,16 @@ namespace PROJ6850 {
       state = VISUALIZE;
     }
 
+    void PathTracer::reset_render() {
+      sampleBuffer.clear();
+      frameBuffer.clear();
+      aovBuffer.clear();
+      num_tiles_w = sampleBuffer.w / imageTileSize + 1;
+      num_tiles_h = sampleBuffer.h / imageTileSize + 1;
+      tile_samples.resize(num_tiles_w * num_tiles_h);
+      memset(&tile_samples[0], 0, num_tiles_w * num_tiles_h * sizeof(int));
+    }
+
     void PathTracer::start_raytracing() {
       if (state != READY) return;
 
@@ -202,60 +360,152 @@ namespace PROJ6850 {
       continueRaytracing = true;
       workerDoneCount = 0;
 
-      sampleBuffer.clear();
-      frameBuffer.clear();
-      num_tiles_w = sampleBuffer.w / imageTileSize + 1;
-      num_tiles_h = sampleBuffer.h / imageTileSize + 1;
-      tile_samples.resize(num_tiles_w * num_tiles_h);
-      memset(&tile_samples[0], 0, num_tiles_w * num_tiles_h * sizeof(int));
+      reset_render();
+
+      if (!checkpointFile.empty()) {
+        // tiles finished by a killed run of the same render
+        uint64_t hash = render_hash();
+        std::vector<RenderCheckpoint::Tile> finished;
+        if (resumeCheckpoint) {
+          const char *error = RenderCheckpoint::load(checkpointFile, hash, imageTileSize,
+                                                     sampleBuffer, aovBuffer, &finished);
+          if (error) {
+            fprintf(stdout, "[PathTracer] Not resuming from %s: %s\n",
+                    checkpointFile.c_str(), error);
+          } else {
+            fprintf(stdout, "[PathTracer] Resuming from %s: %zu of %zu tiles done\n",
+                    checkpointFile.c_str(), finished.size(),
+                    ((sampleBuffer.w + imageTileSize - 1) / imageTileSize) *
+                    ((sampleBuffer.h + imageTileSize - 1) / imageTileSize));
+          }
+        }
+        for (const RenderCheckpoint::Tile &tile : finished) {
+          tile_samples[tile.x / imageTileSize + tile.y / imageTileSize * num_tiles_w] = 1;
+          sampleBuffer.toColor(frameBuffer, tile.x, tile.y, tile.x + tile.w,
+                               tile.y + tile.h, toneCurve);
+        }
+        if (!checkpoint.start(checkpointFile, checkpointInterval, hash, imageTileSize,
+                              sampleBuffer, aovBuffer, finished)) {
+          fprintf(stderr, "[PathTracer] Cannot write checkpoint %s\n",
+                  checkpointFile.c_str());
+        }
+      }
 
       // populate the tile work queue
       std::printf("Total w: %d h: %d\n", sampleBuffer.w, sampleBuffer.h);
       for (size_t y = 0; y < sampleBuffer.h; y += imageTileSize) {
         for (size_t x = 0; x < sampleBuffer.w; x += imageTileSize) {
+          if (tile_samples[x / imageTileSize + y / imageTileSize * num_tiles_w]) continue;
           workQueue.put_work(WorkItem(x, y, imageTileSize, imageTileSize));
         }
       }
 
-      // launch threads
+      // launch threads, the tile server counting as one
       fprintf(stdout, "[PathTracer] Rendering... ");
       fflush(stdout);
+      bool serve = !tileServerAddress.empty();
+      workerThreads.resize(numWorkerThreads + serve);
       for (int i = 0; i < numWorkerThreads; i++) {
         workerThreads[i] = new std::thread(&PathTracer::worker_thread, this);
       }
+      if (serve) {
+        workerThreads[numWorkerThreads] = new std::thread(&PathTracer::server_thread, this);
+      }
     }
 
-    void PathTracer::build_accel() {
-      // collect primitives //
-      fprintf(stdout, "[PathTracer] Collecting primitives... ");
+    void PathTracer::render_remote_tiles(const std::string& address) {
+      if (state != READY) return;
+
+      continueRaytracing = true;
+      reset_render();
+      uint64_t hash = render_hash();
+
+      fprintf(stdout, "[PathTracer] Rendering tiles for %s... ", address.c_str());
       fflush(stdout);
+      Timer timer;
       timer.start();
-      vector<Primitive *> primitives;
-      for (SceneObject *obj : scene->objects) {
-        const vector<Primitive *> &obj_prims = obj->get_primitives();
-        primitives.reserve(primitives.size() + obj_prims.size());
-        primitives.insert(primitives.end(), obj_prims.begin(), obj_prims.end());
+      // one connection per thread, each asking for its own tiles
+      std::vector<size_t> tiles(numWorkerThreads, 0);
+      std::vector<std::thread> threads;
+      for (size_t i = 0; i < numWorkerThreads; i++) {
+        threads.push_back(std::thread([this, &address, hash, &tiles, i]() {
+          RenderingStat renderingStat = {};
+          const char *error = TileClient::run(
+                  address, hash, sampleBuffer, aovBuffer,
+                  [this, &renderingStat](const RenderTile &tile) {
+                    raytrace_tile(tile.x, tile.y, tile.w, tile.h, renderingStat);
+                  },
+                  &tiles[i]);
+          if (error) fprintf(stderr, "[PathTracer] Tile worker %zu: %s\n", i, error);
+        }));
+      }
+      size_t total = 0;
+      for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+        total += tiles[i];
       }
       timer.stop();
-      fprintf(stdout, "Done! (%.4f sec)\n", timer.duration());
+      fprintf(stdout, "Done! %zu tiles (%.4f sec)\n", total, timer.duration());
+    }
 
-      // build BVH //
-      fprintf(stdout, "[PathTracer] Building BVH... ");
+    void PathTracer::build_accel(const SceneCache *cache) {
+      // collect primitives //
+      fprintf(stdout, "[PathTracer] Collecting primitives... ");
       fflush(stdout);
       timer.start();
-      bvh = new BVHAccel(primitives);
+      primitiveList = new PrimitiveList();
+      for (SceneObject *obj : scene->objects) {
+        obj->get_primitives(primitiveList);
+      }
       timer.stop();
       fprintf(stdout, "Done! (%.4f sec)\n", timer.duration());
+      PrimitiveList &primitives = *primitiveList;
 
+      // build BVH, unless the scene cache has it //
+      bvh = NULL;
+      if (cache) {
+        fprintf(stdout, "[PathTracer] Restoring BVH... ");
+        fflush(stdout);
+        timer.start();
+        bvh = cache->bvh(primitives);
+        timer.stop();
+        fprintf(stdout, bvh ? "Done! (%.4f sec)\n" : "does not match the scene\n",
+                timer.duration());
+      }
+      bool restored = bvh != NULL;
+      if (!restored) {
+        fprintf(stdout, "[PathTracer] Building BVH... ");
+        fflush(stdout);
+        timer.start();
+        bvh = new BVHAccel(primitives);
+        timer.stop();
+        fprintf(stdout, "Done! (%.4f sec)\n", timer.duration());
+      }
 
-      fprintf(stdout, "[PathTracer] Building KD-Tree... ");
-      fflush(stdout);
-      timer.start();
-      kdtree = new KDTREEAccel(primitives);
-      timer.stop();
-      fprintf(stdout, "Done! (%.4f sec)\n", timer.duration());
+      // geometry memory: mesh buffers, primitive list and the BVH id array
+      size_t primitive_bytes = primitives.memory_usage() +
+                               bvh->primitives.capacity() * sizeof(PrimitiveID);
+      fprintf(stdout, "[PathTracer] %zu primitives (%zu triangles, %zu instances), %.2f MB, %.1f bytes/primitive\n",
+              primitives.size(), primitives.num_triangles(), primitives.num_instances(),
+              primitive_bytes / (1024.0 * 1024.0),
+              primitives.size() ? (double) primitive_bytes / primitives.size() : 0.0);
+
+
+      // skipped to keep cached loads fast, switching to the kd-tree builds it
+      kdtree = NULL;
+      if (!restored || useKdtree) {
+        fprintf(stdout, "[PathTracer] Building KD-Tree... ");
+        fflush(stdout);
+        timer.start();
+        kdtree = new KDTREEAccel(primitives);
+        timer.stop();
+        fprintf(stdout, "Done! (%.4f sec)\n", timer.duration());
+      }
+      fprintf(stdout, "[PathTracer] Peak RSS after accelerator build: %.1f MB\n", peak_rss_mb());
 
 
+      fprintf(stdout, "[PathTracer] BVH SAH cost: %.2f\n", bvh->sah_cost());
+
       // initial visualization //
       if (!useKdtree)
         selectionHistory.push(bvh->get_root());
@@ -263,11 +513,11 @@ namespace PROJ6850 {
         selectionHistory.push(kdtree->get_root());
     }
 
-    void PathTracer::log_ray_miss(const Ray &r) {
+    void PathTracer::log_ray_miss(const Rayf &r) {
       rayLog.push_back(LoggedRay(r, -1.0));
     }
 
-    void PathTracer::log_ray_hit(const Ray &r, double hit_t) {
+    void PathTracer::log_ray_hit(const Rayf &r, double hit_t) {
       rayLog.push_back(LoggedRay(r, hit_t));
     }
 
@@ -296,53 +546,30 @@ namespace PROJ6850 {
       glPolygonOffset(1.0, 1.0);
       glEnable(GL_POLYGON_OFFSET_FILL);
 
-      if (selected->isLeaf()) {
-        if (useKdtree) {
-            for (int idx : selected->indices)
-              kdtree->primitives[idx]->draw(cprim_hl_left);
-        } else {
-          for (size_t i = 0; i < selected->range; ++i)
-            bvh->primitives[selected->start + i]->draw(cprim_hl_left);
-        }
+      // both accelerators store nodes as ranges into their primitive list
+      const Aggregate *accel = useKdtree ? (const Aggregate *) kdtree : (const Aggregate *) bvh;
 
+      if (selected->isLeaf()) {
+        for (size_t i = 0; i < selected->range; ++i)
+          accel->primitiveList->draw(accel->primitives[selected->start + i], cprim_hl_left);
       } else {
         if (selected->l) {
           AccelNode *child = selected->l;
-            if (useKdtree) {
-              for (int idx : child->indices)
-                kdtree->primitives[idx]->draw(cprim_hl_left);
-            } else {
-              for (size_t i = 0; i < child->range; ++i)
-                bvh->primitives[child->start + i]->draw(cprim_hl_left);
-            }
-
+          for (size_t i = 0; i < child->range; ++i)
+            accel->primitiveList->draw(accel->primitives[child->start + i], cprim_hl_left);
         }
         if (selected->r) {
           AccelNode *child = selected->r;
-          if (useKdtree) {
-            for (int idx : child->indices)
-              kdtree->primitives[idx]->draw(cprim_hl_right);
-          } else {
-            for (size_t i = 0; i < child->range; ++i)
-              bvh->primitives[child->start + i]->draw(cprim_hl_right);
-          }
-
-
-
+          for (size_t i = 0; i < child->range; ++i)
+            accel->primitiveList->draw(accel->primitives[child->start + i], cprim_hl_right);
         }
       }
 
       glDisable(GL_POLYGON_OFFSET_FILL);
 
       // draw geometry outline
-      if (useKdtree) {
-        for (int idx : selected->indices) {
-          kdtree->primitives[idx]->drawOutline(cprim_hl_edges);
-        }
-      } else {
-        for (size_t i = 0; i < selected->range; ++i) {
-          bvh->primitives[selected->start + i]->drawOutline(cprim_hl_edges);
-        }
+      for (size_t i = 0; i < selected->range; ++i) {
+        accel->primitiveList->drawOutline(accel->primitives[selected->start + i], cprim_hl_edges);
       }
 
 
@@ -416,6 +643,8 @@ namespace PROJ6850 {
           std::printf("switched acceleration structure to %s\n", useKdtree ? "kd-tree" : "bvh");
           while (!selectionHistory.empty())
             selectionHistory.pop();
+          if (useKdtree && kdtree == nullptr)
+            kdtree = new KDTREEAccel(*primitiveList);
           if (!useKdtree)
             selectionHistory.push(bvh->get_root());
           else
@@ -461,7 +690,8 @@ namespace PROJ6850 {
     }
 
 
-    Spectrum PathTracer::trace_ray(const Ray &r, RenderingStat& renderingStat) {
+    Spectrum PathTracer::trace_ray(const Rayf &r, RenderingStat& renderingStat,
+                                   AOVSample *aov) {
       Intersection isect, isect_shadow;
 
       if (!(useKdtree ? kdtree->intersect(r, &isect, renderingStat) : bvh->intersect(r, &isect, renderingStat))) {
@@ -484,19 +714,29 @@ namespace PROJ6850 {
       log_ray_hit(r, isect.t);
 #endif
 
+      if (aov) {
+        aov->albedo += isect.bsdf->get_albedo();
+        aov->normal += isect.n;
+        if (aov->samples == 0) {
+          aov->depth = isect.t;
+          aov->primId = isect.prim_id;
+        }
+      }
+
+      // intersection runs in single precision, shading in double
       Spectrum L_out = isect.bsdf->get_emission();  // Le
-      Vector3D hit_p = r.o + r.d * isect.t;
-      Vector3D hit_n = isect.n;
+      Vector3D hit_p = isect.p.toVector3D();
+      Vector3D hit_n = isect.n.toVector3D();
 
       // make a coordinate system for a hit point
       // with N aligned with the Z direction.
       Matrix3x3 o2w;
-      make_coord_space(o2w, isect.n);
+      make_coord_space(o2w, hit_n);
       Matrix3x3 w2o = o2w.T();
 
       // w_out points towards the source of the ray (e.g.,
       // toward the camera if this is a primary ray)
-      Vector3D w_out = w2o * (r.o - hit_p);
+      Vector3D w_out = w2o * (-r.d.toVector3D());
       w_out.normalize();
 
 
@@ -537,10 +777,10 @@ namespace PROJ6850 {
             // (Task 4) Construct a shadow ray and compute whether the intersected surface is
             // in shadow. Only accumulate light if not in shadow.
 
-            Vector3D d_shadow = dir_to_light;
-            d_shadow.normalize();
-            Vector3D o_shadow = hit_p + d_shadow * EPS_D;
-            Ray r_shadow = Ray(o_shadow, d_shadow);
+            Vec3f d_shadow = Vec3f(dir_to_light.unit());
+            Vec3f o_shadow = offset_ray_origin(isect.p, isect.p_error, isect.ng, d_shadow);
+            Rayf r_shadow = Rayf(o_shadow, d_shadow);
+            r_shadow.time = r.time;
 
             isect_shadow.t = dist_to_light;
             if ((useKdtree ? kdtree->intersect(r_shadow, &isect_shadow, renderingStat) : bvh->intersect(r_shadow, &isect_shadow, renderingStat))) {
@@ -573,8 +813,10 @@ namespace PROJ6850 {
 
        // (3) evaluate weighted reflectance contribution due
           // to light from this direction
-          Ray newRay = Ray(hit_p +  w_in * EPS_D, w_in);
+          Vec3f w_inf = Vec3f(w_in);
+          Rayf newRay = Rayf(offset_ray_origin(isect.p, isect.p_error, isect.ng, w_inf), w_inf);
           newRay.depth = r.depth + 1;
+          newRay.time = r.time;
           Spectrum L_in = f * trace_ray(newRay, renderingStat);
           double weight = fabs(dot(w_in,hit_n)) * (1.f / (pdf * (1.f - terminatingProb)));
       return  L_out + L_in * weight;
@@ -583,7 +825,8 @@ namespace PROJ6850 {
 
     }
 
-    Spectrum PathTracer::raytrace_pixel(size_t x, size_t y, RenderingStat& renderingStat) {
+    Spectrum PathTracer::raytrace_pixel(size_t x, size_t y, RenderingStat& renderingStat,
+                                        AOVSample *aov) {
       // Sample the pixel with coordinate (x,y) and return the result spectrum.
       // The sample rate is given by the number of camera rays per pixel.
       Spectrum avg_radiance;
@@ -591,7 +834,12 @@ namespace PROJ6850 {
       double_t weight = 1.0f / (float) num_samples;
       double_t pixel_center_x = (double_t)x + 0.5 , pixel_center_y = (double_t)y + 0.5,
                ndc_x = pixel_center_x / frameBuffer.w, ndc_y = pixel_center_y / frameBuffer.h;
-      avg_radiance = trace_ray(camera->generate_ray(ndc_x, ndc_y), renderingStat) * weight ;
+      // with an open shutter each camera ray also samples a time, stratified
+      // over the samples of the pixel
+      bool motion_blur = camera->has_motion_blur();
+      double time = motion_blur ? ((double) rand() / RAND_MAX) / num_samples : 0.0;
+      avg_radiance = trace_ray(Rayf(camera->generate_ray(ndc_x, ndc_y, time)), renderingStat, aov) * weight ;
+      if (aov) aov->samples++;
       if (num_samples > 1) {
         for (int i = 0; i < num_samples - 1; i++) {
           Vector2D randomSample = gridSampler->get_sample();
@@ -599,7 +847,9 @@ namespace PROJ6850 {
                   sample_y = y + randomSample.y;
           double sample_ndc_x = sample_x / frameBuffer.w,
                   sample_ndc_y = sample_y / frameBuffer.h;
-          avg_radiance += trace_ray(camera->generate_ray(sample_ndc_x, sample_ndc_y), renderingStat) * weight;
+          if (motion_blur) time = (i + 1 + (double) rand() / RAND_MAX) / num_samples;
+          avg_radiance += trace_ray(Rayf(camera->generate_ray(sample_ndc_x, sample_ndc_y, time)), renderingStat, aov) * weight;
+          if (aov) aov->samples++;
         }
       }
 
@@ -619,21 +869,29 @@ namespace PROJ6850 {
       size_t tile_end_x = std::min(tile_start_x + tile_w, w);
       size_t tile_end_y = std::min(tile_start_y + tile_h, h);
 
-      size_t tile_idx_x = tile_x / imageTileSize;
-      size_t tile_idx_y = tile_y / imageTileSize;
-      size_t num_samples_tile = tile_samples[tile_idx_x + tile_idx_y * num_tiles_w];
-
+      bool aovs = aovBuffer.channels != 0;
       for (size_t y = tile_start_y; y < tile_end_y; y++) {
         if (!continueRaytracing) return;
         for (size_t x = tile_start_x; x < tile_end_x; x++) {
-          Spectrum s = raytrace_pixel(x, y, renderingStat);
+          AOVSample aov;
+          Spectrum s = raytrace_pixel(x, y, renderingStat, aovs ? &aov : NULL);
           sampleBuffer.update_pixel(s, x, y);
+          if (aovs) aovBuffer.update_pixel(aov, x, y);
         }
       }
 
-      tile_samples[tile_idx_x + tile_idx_y * num_tiles_w] += 1;
-      sampleBuffer.toColor(frameBuffer, tile_start_x, tile_start_y, tile_end_x,
-                           tile_end_y);
+      tile_finished(tile_start_x, tile_start_y, tile_end_x, tile_end_y);
+    }
+
+    void PathTracer::tile_finished(size_t x0, size_t y0, size_t x1, size_t y1) {
+      tile_samples[x0 / imageTileSize + y0 / imageTileSize * num_tiles_w] += 1;
+      sampleBuffer.toColor(frameBuffer, x0, y0, x1, y1, toneCurve);
+
+      if (checkpoint.is_active()) {
+        RenderTile tile = {(uint32_t) x0, (uint32_t) y0, (uint32_t) (x1 - x0),
+                           (uint32_t) (y1 - y0), (uint32_t) ns_aa};
+        checkpoint.tile_done(tile);
+      }
 
     }
 
@@ -648,18 +906,81 @@ namespace PROJ6850 {
       }
 
 
-      std::printf("\n------------------\nRendering Statistics: %s\n totalNodesVisited: %d\n totalRayTriangleIntersection: %d\n", useKdtree ? "KD-Tree" : "BVH", renderingStat.totalVisitedNodes, renderingStat.totalRayTriangleTest);
+      std::printf("\n------------------\nRendering Statistics: %s\n totalNodesVisited: %d\n totalRayTriangleIntersection: %llu\n totalRays: %llu\n rayTriangleIntersectionPerRay: %.3f\n",
+                  useKdtree ? "KD-Tree" : "BVH", renderingStat.totalVisitedNodes,
+                  renderingStat.totalRayTriangleTest, renderingStat.totalRays,
+                  renderingStat.totalRays ? (double) renderingStat.totalRayTriangleTest / renderingStat.totalRays : 0.0);
+
+      worker_done(timer);
+    }
+
+    void PathTracer::server_thread() {
+      Timer timer;
+      timer.start();
+
+      TileServer server(render_hash(), sampleBuffer, aovBuffer, tileTimeout);
+      server.next_tile = [this](RenderTile *tile) {
+        WorkItem work;
+        if (!workQueue.try_get_work(&work)) return false;
+        tile->x = work.tile_x;
+        tile->y = work.tile_y;
+        tile->w = std::min<size_t>(work.tile_w, sampleBuffer.w - work.tile_x);
+        tile->h = std::min<size_t>(work.tile_h, sampleBuffer.h - work.tile_y);
+        tile->samples = ns_aa;
+        return true;
+      };
+      server.return_tile = [this](const RenderTile &tile) {
+        workQueue.put_work(WorkItem(tile.x, tile.y, imageTileSize, imageTileSize));
+      };
+      server.tile_done = [this](const RenderTile &tile) {
+        tile_finished(tile.x, tile.y, tile.x + tile.w, tile.y + tile.h);
+      };
+      server.tiles_left = [this]() { return !workQueue.is_empty(); };
+      server.canceled = [this]() { return !continueRaytracing; };
+
+      const char *error = server.run(tileServerAddress);
+      if (error) {
+        fprintf(stderr, "[PathTracer] Cannot serve tiles on %s: %s\n",
+                tileServerAddress.c_str(), error);
+      }
+
+      // tiles given back by dropped workers may outlive the render threads,
+      // render them here rather than leave them to nobody
+      RenderingStat renderingStat = {};
+      WorkItem work;
+      while (continueRaytracing && workQueue.try_get_work(&work)) {
+        raytrace_tile(work.tile_x, work.tile_y, work.tile_w, work.tile_h, renderingStat);
+      }
+      worker_done(timer);
+    }
+
+    void PathTracer::worker_done(Timer &timer) {
+      // only the last worker to finish sees the final count
+      bool last = ++workerDoneCount == workerThreads.size();
+      if (last) {
+        // before denoising, which overwrites the samples
+        checkpoint.finish();
+      }
 
-      workerDoneCount++;
-      if (!continueRaytracing && workerDoneCount == numWorkerThreads) {
+      if (!continueRaytracing && last) {
         timer.stop();
         fprintf(stdout, "Canceled!\n");
         state = READY;
       }
 
-      if (continueRaytracing && workerDoneCount == numWorkerThreads) {
+      if (continueRaytracing && last) {
         timer.stop();
         fprintf(stdout, "Done! (%.4fs)\n", timer.duration());
+        if (denoise) {
+          timer.start();
+          fprintf(stdout, "[PathTracer] Denoising... ");
+          fflush(stdout);
+          denoiser.denoise(sampleBuffer, aovBuffer);
+          sampleBuffer.toColor(frameBuffer, 0, 0, sampleBuffer.w, sampleBuffer.h,
+                               toneCurve);
+          timer.stop();
+          fprintf(stdout, "Done! (%.4f sec)\n", timer.duration());
+        }
         state = DONE;
       }
     }
@@ -681,20 +1002,44 @@ namespace PROJ6850 {
       return (state == DONE);
     }
 
-    void PathTracer::save_image(string fname) {
+    void PathTracer::save_image(string fname, ImageWriter *writer) {
       if (state != DONE) return;
 
+      if (ImageWriter::format_of(fname) != ImageWriter::PNG) {
+        // linear radiance, flipped while it is encoded
+        // only the selected channels, not those filled for the denoiser
+        AOVBuffer *aovs = aovChannels ? new AOVBuffer(aovBuffer) : NULL;
+        if (aovs) aovs->channels = aovChannels;
+        if (writer) {
+          writer->write(fname, new HDRImageBuffer(sampleBuffer), true, aovs);
+          return;
+        }
+        fprintf(stderr, "[PathTracer] Saving to file: %s... ", fname.c_str());
+        const char *error = ImageWriter::encode(fname, sampleBuffer, true,
+                                                ImageWriter::Options(), aovs);
+        fprintf(stderr, "%s\n", error ? error : "Done!");
+        delete aovs;
+        return;
+      }
+
       uint32_t *frame = &frameBuffer.data[0];
       size_t w = frameBuffer.w;
       size_t h = frameBuffer.h;
-      uint32_t *frame_out = new uint32_t[w * h];
+      ImageBuffer *out = new ImageBuffer(w, h);
+      uint32_t *frame_out = &out->data[0];
       for (size_t i = 0; i < h; ++i) {
         memcpy(frame_out + i * w, frame + (h - i - 1) * w, 4 * w);
       }
 
+      if (writer) {
+        writer->write(fname, out);
+        return;
+      }
+
       fprintf(stderr, "[PathTracer] Saving to file: %s... ", fname.c_str());
-      lodepng::encode(fname, (unsigned char *)frame_out, w, h);
-      fprintf(stderr, "Done!\n");
+      const char *error = ImageWriter::encode(fname, *out);
+      fprintf(stderr, "%s\n", error ? error : "Done!");
+      delete out;
     }
 
 }  // namespace PROJ6850
\ No newline at end of file
@@ -13,7 +13,12 @@
 #include "kdtree.h"
 #include "camera.h"
 #include "sampler.h"
+#include "denoiser.h"
 #include "image.h"
+#include "image_writer.h"
+#include "render_checkpoint.h"
+#include "scene_cache.h"
+#include "tile_server.h"
 #include "work_queue.h"
 
 #include "static_scene/scene.h"
@@ -25,6 +30,7 @@ using PROJ6850::StaticScene::EnvironmentLight;
 using PROJ6850::StaticScene::AccelNode;
 using PROJ6850::StaticScene::BVHAccel;
 using PROJ6850::StaticScene::KDTREEAccel;
+using PROJ6850::StaticScene::PrimitiveList;
 using PROJ6850::StaticScene::RenderingStat;
 
 namespace PROJ6850 {
@@ -74,8 +80,39 @@ namespace PROJ6850 {
          * This DOES take ownership of the scene, and therefore deletes it if a new
          * scene is later passed in.
          * \param scene pointer to the new scene to be rendered
+         * \param cache if not NULL, the scene cache the scene was built from,
+         *        whose BVH is restored instead of built. The kd-tree is then
+         *        only built when switched to.
          */
-        void set_scene(Scene* scene);
+        void set_scene(Scene* scene, const SceneCache* cache = NULL);
+
+        /**
+         * Write the scene and its BVH to a scene cache, see SceneCache::write.
+         * \return NULL on success, the reason the scene was not cached otherwise
+         */
+        const char* save_scene_cache(const std::string& filename, uint64_t key,
+                                     const SceneCache::View& view);
+
+        /**
+         * If in the READY state, replaces the scene by the next frame of an
+         * animation. When the new scene has the same primitives as the current
+         * one and only vertex positions moved, the BVH is refitted (and
+         * partially rebuilt if its quality degraded too much) rather than built
+         * from scratch; otherwise this falls back to a full build. The kd-tree
+         * cannot be refitted and is only rebuilt if it is in use.
+         * Takes ownership of the scene as set_scene does.
+         * \param scene pointer to the new frame to be rendered
+         */
+        void update_scene(Scene* scene);
+
+        /**
+         * Same as update_scene(Scene*), with the primitives of the new frame
+         * already collected, e.g. by a thread preparing frames ahead of the
+         * render. Takes ownership of the list.
+         * \param scene pointer to the new frame to be rendered
+         * \param primitives primitives of all the objects of the scene
+         */
+        void update_scene(Scene* scene, PrimitiveList* primitives);
 
         /**
          * If in the INIT state, configures the pathtracer to use the given camera. If
@@ -95,6 +132,55 @@ namespace PROJ6850 {
          */
         void set_frame_size(size_t width, size_t height);
 
+        /**
+         * Select the AOV channels filled during rendering and saved with the
+         * beauty image in EXR files. No channels by default.
+         * \param channels mask of AOVBuffer::Channel values
+         */
+        void set_aov_channels(unsigned channels);
+
+        /**
+         * Enable filtering the render once all its tiles are done. The
+         * denoised radiance replaces the samples, so it is what gets displayed
+         * and saved. The AOVs the denoiser needs are then filled during
+         * rendering, but only the channels selected with set_aov_channels()
+         * are saved.
+         * \param denoise whether to denoise finished renders
+         */
+        void set_denoising(bool denoise);
+
+        /**
+         * Checkpoint the finished tiles of the renders started from now on,
+         * so that a killed render can be resumed. A resumed render reads the
+         * tiles of a checkpoint of the same scene and settings and only
+         * traces the others. An empty filename disables checkpoints.
+         * \param filename checkpoint file
+         * \param interval seconds between writes to the checkpoint
+         * \param resume whether to resume from the checkpoint if it exists
+         */
+        void set_checkpoint(const std::string& filename, double interval,
+                            bool resume);
+
+        /**
+         * Also hand the tiles of the renders started from now on to worker
+         * processes (see render_remote_tiles) connecting to an address. The
+         * worker threads of this process keep rendering tiles too. An empty
+         * address disables serving.
+         * \param address address to listen on, see TileServer
+         * \param timeout seconds a worker may take to return a tile before
+         *        it is dropped and the tile goes to another one
+         */
+        void set_tile_server(const std::string& address, double timeout);
+
+        /**
+         * If in the READY state, render the tiles a coordinator process
+         * serves with set_tile_server() until it has no more, using the
+         * worker threads of this process. The coordinator must have the same
+         * scene and settings. This does not leave the READY state.
+         * \param address address of the coordinator
+         */
+        void render_remote_tiles(const std::string& address);
+
         /**
          * Update result on screen.
          * If the pathtracer is in RENDERING or DONE, it will display the result in
@@ -140,9 +226,13 @@ namespace PROJ6850 {
         void decrease_area_light_sample_count();
 
         /**
-         * Save rendered result to png file.
+         * Save rendered result to file. Files ending in .exr or .pfm get the
+         * linear radiance, anything else the tonemapped image as a PNG. EXR
+         * files also get the selected AOV channels as extra layers. With a
+         * writer the image is copied and encoded on the writer threads,
+         * otherwise it is encoded right away.
          */
-        void save_image(string filename);
+        void save_image(string filename, ImageWriter* writer = NULL);
 
         /**
          * Wait for the scene to finish raytracing.
@@ -157,23 +247,37 @@ namespace PROJ6850 {
 
         /**
          * Build acceleration structures.
+         * \param cache if not NULL, scene cache to restore the BVH from
          */
-        void build_accel();
+        void build_accel(const SceneCache* cache = NULL);
 
         /**
          * Visualize acceleration structures.
          */
         void visualize_accel() const;
 
+        /**
+         * Hash of the scene and the settings of a render, which a checkpoint
+         * must match to be resumed and a tile server's workers must match.
+         * It covers the sampling settings, image and tile size, AOV channels,
+         * camera, the bounds of every primitive, and the BSDFs, lights and
+         * environment map (see SceneCache::shading_hash).
+         */
+        uint64_t render_hash() const;
+
         /**
          * Trace an ray in the scene.
+         * \param aov if not NULL, the first hit of the ray is added to it
          */
-        Spectrum trace_ray(const Ray& ray, RenderingStat& renderingStat);
+        Spectrum trace_ray(const Rayf& ray, RenderingStat& renderingStat,
+                           AOVSample* aov = NULL);
 
         /**
          * Trace a camera ray given by the pixel coordinate.
+         * \param aov if not NULL, collects the first hits of the camera rays
          */
-        Spectrum raytrace_pixel(size_t x, size_t y, RenderingStat& renderingStat);
+        Spectrum raytrace_pixel(size_t x, size_t y, RenderingStat& renderingStat,
+                                AOVSample* aov = NULL);
 
         /**
          * Raytrace a tile of the scene and update the frame buffer. Is run
@@ -181,20 +285,42 @@ namespace PROJ6850 {
          */
         void raytrace_tile(int tile_x, int tile_y, int tile_w, int tile_h, RenderingStat& renderingStat);
 
+        /**
+         * Update the frame buffer and the checkpoint with a finished tile.
+         */
+        void tile_finished(size_t x0, size_t y0, size_t x1, size_t y1);
+
         /**
          * Implementation of a ray tracer worker thread
          */
         void worker_thread();
 
+        /**
+         * Thread handing tiles to worker processes, counted as a worker.
+         */
+        void server_thread();
+
+        /**
+         * Called by each worker thread as it exits, the last one ends the
+         * render.
+         * \param timer started with the thread
+         */
+        void worker_done(Timer& timer);
+
+        /**
+         * Clear the buffers and the tile counts before a render.
+         */
+        void reset_render();
+
         /**
          * Log a ray miss.
          */
-        void log_ray_miss(const Ray& r);
+        void log_ray_miss(const Rayf& r);
 
         /**
          * Log a ray hit.
          */
-        void log_ray_hit(const Ray& r, double hit_t);
+        void log_ray_hit(const Rayf& r, double hit_t);
 
         enum State {
             INIT,       ///< to be initialized
@@ -227,13 +353,25 @@ namespace PROJ6850 {
 
         // Components //
 
+        PrimitiveList* primitiveList;  ///< primitives the accelerators index into
         BVHAccel* bvh;                 ///< BVH accelerator aggregate
         KDTREEAccel* kdtree;                 ///< KD-Tree accelerator aggregate
         EnvironmentLight* envLight;    ///< environment map
         Sampler2D* gridSampler;        ///< samples unit grid
         Sampler3D* hemisphereSampler;  ///< samples unit hemisphere
         HDRImageBuffer sampleBuffer;   ///< sample buffer
+        AOVBuffer aovBuffer;           ///< first hit data, saved with the samples
+        unsigned aovChannels;          ///< AOV channels to save
+        bool denoise;                  ///< denoise finished renders
+        Denoiser denoiser;             ///< filter of finished renders
+        std::string checkpointFile;    ///< checkpoint of renders, or empty
+        double checkpointInterval;     ///< seconds between checkpoint writes
+        bool resumeCheckpoint;         ///< resume renders from the checkpoint
+        RenderCheckpoint checkpoint;   ///< checkpoint of the current render
+        std::string tileServerAddress; ///< address tiles are served on, or empty
+        double tileTimeout;            ///< seconds before a worker process is dropped
         ImageBuffer frameBuffer;       ///< frame buffer
+        ToneCurve toneCurve;           ///< display transform of the frame buffer
         Timer timer;                   ///< performance test timer
 
         // Internals //
@@ -243,7 +381,7 @@ namespace PROJ6850 {
 
         bool continueRaytracing;                  ///< rendering should continue
         std::vector<std::thread*> workerThreads;  ///< pool of worker threads
-        std::atomic<int> workerDoneCount;         ///< worker threads management
+        std::atomic<size_t> workerDoneCount;      ///< worker threads management
         WorkQueue<WorkItem> workQueue;            ///< queue of work for the workers
 
         // Tonemapping Controls //
@@ -0,0 +1,197 @@
+#include "progressive_mesh.h"
+
+#include "indexed_halfedge_mesh.h"
+#include "meshEdit.h"
+
+namespace PROJ6850 {
+
+namespace {
+
+// An edge collapse of the simplification, in the numbering of the full mesh.
+struct Collapse {
+  ProgressiveMesh::Id removed, kept;  // vertex going away, vertex it merges into
+  ProgressiveMesh::Id face0, face1;   // triangles going away
+  Vector3D keptBefore, keptAfter;     // where the kept vertex sits
+  size_t cornerStart;                 // start of its corners in the corner list
+};
+
+}  // namespace
+
+bool ProgressiveMesh::build(const HalfedgeMesh& mesh) {
+  clear();
+  for (FaceCIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++) {
+    if (f->degree() != 3) return false;
+  }
+
+  // The simplification works on a copy, numbered in list order.
+  HalfedgeMesh work;
+  {
+    IndexedHalfedgeMesh copy;
+    copy.fromHalfedgeMesh(mesh);
+    copy.toHalfedgeMesh(work);
+  }
+  Size nV = work.nVertices(), nF = work.nFaces();
+  std::vector<Vector3D> fullPositions(nV);
+  Id i = 0;
+  for (VertexIter v = work.verticesBegin(); v != work.verticesEnd(); v++, i++) {
+    v->index = i;
+    fullPositions[i] = v->position;
+  }
+  std::vector<Id> corners(3 * nF);
+  i = 0;
+  for (FaceIter f = work.facesBegin(); f != work.facesEnd(); f++, i++) {
+    f->index = i;
+    HalfedgeIter h = f->halfedge();
+    for (int k = 0; k < 3; k++, h = h->next()) {
+      corners[3 * i + k] = h->vertex()->index;
+    }
+  }
+  std::vector<Id> fullCorners = corners;
+
+  // Record each collapse along with the corners that move from the vertex
+  // going away to the one it merges into, and track those moves in the
+  // corner array.
+  std::vector<Collapse> collapses;
+  std::vector<Id> collapseCorners;
+  MeshResampler resampler;
+  resampler.collapsing = [&](EdgeIter e, const Vector3D& position) {
+    HalfedgeIter h = e->halfedge();
+    VertexIter removed = h->vertex(), kept = h->twin()->vertex();
+    Collapse c = {(Id) removed->index, (Id) kept->index,
+                  (Id) h->face()->index, (Id) h->twin()->face()->index,
+                  kept->position, position, collapseCorners.size()};
+    HalfedgeIter curr = removed->halfedge();
+    do {
+      Id f = curr->face()->index;
+      for (Id corner = 3 * f; corner < 3 * f + 3; corner++) {
+        if (corners[corner] == removed->index) {
+          collapseCorners.push_back(corner);
+          corners[corner] = kept->index;
+        }
+      }
+      curr = curr->twin()->next();
+    } while (curr != removed->halfedge());
+    collapses.push_back(c);
+  };
+  resampler.downsample(work, 0);
+
+  // Vertices and triangles that are never removed come first, in their
+  // order, followed by those of the last collapse, and so on back to those
+  // of the first one.
+  Size nSplits = collapses.size();
+  baseVertices = nV - nSplits;
+  baseFaces = nF - 2 * nSplits;
+  const Id none = 0xffffffffu;
+  std::vector<Id> vertexId(nV, none), faceId(nF, none);
+  for (Size s = 0; s < nSplits; s++) {
+    const Collapse& c = collapses[nSplits - 1 - s];
+    vertexId[c.removed] = baseVertices + s;
+    faceId[c.face0] = baseFaces + 2 * s;
+    faceId[c.face1] = baseFaces + 2 * s + 1;
+  }
+  Id nextVertex = 0, nextFace = 0;
+  for (Id v = 0; v < nV; v++) {
+    if (vertexId[v] == none) vertexId[v] = nextVertex++;
+  }
+  for (Id f = 0; f < nF; f++) {
+    if (faceId[f] == none) faceId[f] = nextFace++;
+  }
+
+  positions.resize(nV);
+  for (Id v = 0; v < nV; v++) positions[vertexId[v]] = fullPositions[v];
+  indices.resize(3 * nF);
+  for (Id corner = 0; corner < 3 * nF; corner++) {
+    indices[3 * faceId[corner / 3] + corner % 3] = vertexId[fullCorners[corner]];
+  }
+
+  splitParent.resize(nSplits);
+  splitParentFine.resize(nSplits);
+  splitParentCoarse.resize(nSplits);
+  splitCornerStart.resize(nSplits + 1);
+  splitCorners.reserve(collapseCorners.size());
+  for (Size s = 0; s < nSplits; s++) {
+    Size k = nSplits - 1 - s;
+    const Collapse& c = collapses[k];
+    splitParent[s] = vertexId[c.kept];
+    splitParentFine[s] = c.keptBefore;
+    splitParentCoarse[s] = c.keptAfter;
+    splitCornerStart[s] = splitCorners.size();
+    size_t end = k + 1 < nSplits ? collapses[k + 1].cornerStart : collapseCorners.size();
+    for (size_t j = c.cornerStart; j < end; j++) {
+      Id corner = collapseCorners[j];
+      splitCorners.push_back(3 * faceId[corner / 3] + corner % 3);
+    }
+  }
+  splitCornerStart[nSplits] = splitCorners.size();
+  currentVertices = nV;
+
+  // Vertices only ever move to where some collapse put them, so the sphere
+  // around those positions and the full ones bounds every resolution.
+  BBox box;
+  for (const Vector3D& p : positions) box.expand(p);
+  for (const Vector3D& p : splitParentCoarse) box.expand(p);
+  center = box.centroid();
+  radius = 0;
+  for (const Vector3D& p : positions) radius = std::max(radius, (p - center).norm());
+  for (const Vector3D& p : splitParentCoarse) {
+    radius = std::max(radius, (p - center).norm());
+  }
+
+  printf("[MeshEdit] Progressive mesh of %zu vertices, %zu splits down to %zu\n",
+         (size_t) nV, (size_t) nSplits, (size_t) baseVertices);
+  return true;
+}
+
+void ProgressiveMesh::clear() {
+  indices.clear();
+  positions.clear();
+  splitParent.clear();
+  splitParentFine.clear();
+  splitParentCoarse.clear();
+  splitCornerStart.clear();
+  splitCorners.clear();
+  baseVertices = baseFaces = currentVertices = 0;
+  center = Vector3D();
+  radius = 0;
+}
+
+void ProgressiveMesh::setVertexCount(Size n) {
+  n = std::max(baseVertices, std::min(n, nFullVertices()));
+  while (currentVertices < n) split();
+  while (currentVertices > n) collapse();
+}
+
+void ProgressiveMesh::setFaceCount(Size n) {
+  Size extra = n > baseFaces ? n - baseFaces : 0;
+  setVertexCount(baseVertices + (extra + 1) / 2);
+}
+
+void ProgressiveMesh::getPolygons(vector<vector<Index>>& polygons,
+                                  vector<Vector3D>& vertexPositions) const {
+  polygons.resize(nFaces());
+  for (Size f = 0; f < polygons.size(); f++) {
+    polygons[f].assign(indices.begin() + 3 * f, indices.begin() + 3 * f + 3);
+  }
+  vertexPositions.assign(positions.begin(), positions.begin() + currentVertices);
+}
+
+void ProgressiveMesh::split() {
+  Size s = currentVertices - baseVertices;
+  positions[splitParent[s]] = splitParentFine[s];
+  for (Id c = splitCornerStart[s]; c < splitCornerStart[s + 1]; c++) {
+    indices[splitCorners[c]] = currentVertices;
+  }
+  currentVertices++;
+}
+
+void ProgressiveMesh::collapse() {
+  currentVertices--;
+  Size s = currentVertices - baseVertices;
+  Id parent = splitParent[s];
+  positions[parent] = splitParentCoarse[s];
+  for (Id c = splitCornerStart[s]; c < splitCornerStart[s + 1]; c++) {
+    indices[splitCorners[c]] = parent;
+  }
+}
+
+}  // namespace PROJ6850
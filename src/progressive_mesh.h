@@ -0,0 +1,117 @@
+#ifndef PROJ6850_PROGRESSIVE_MESH_H
+#define PROJ6850_PROGRESSIVE_MESH_H
+
+#include "halfEdgeMesh.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace PROJ6850 {
+
+/**
+ * Progressive mesh: a triangle mesh that can be set to any resolution between
+ * a base mesh and its full resolution, built once from a quadric error
+ * simplification of the full mesh.
+ *
+ * Each edge collapse of the simplification is stored, in reverse, as a vertex
+ * split. Vertices are numbered so that the ones remaining after i splits are
+ * [0, nBaseVertices() + i): split i brings back vertex nBaseVertices() + i,
+ * along with triangles 2i and 2i + 1 after the base triangles. A split only
+ * stores its parent vertex, where the parent sits before and after the split,
+ * and the triangle corners that go from the parent to the new vertex, so
+ * moving between resolutions takes time in the number of splits applied or
+ * undone.
+ *
+ * The current resolution is kept as a triangle index buffer and a position
+ * array, ready to draw.
+ */
+class ProgressiveMesh {
+ public:
+  typedef uint32_t Id;
+
+  ProgressiveMesh()
+      : baseVertices(0), baseFaces(0), currentVertices(0), radius(0) {}
+
+  /**
+   * Simplify a copy of a triangle mesh as far as MeshResampler::downsample
+   * goes and record the collapses. The mesh is left at full resolution.
+   * \return false, leaving the mesh empty, if some face is not a triangle
+   */
+  bool build(const HalfedgeMesh& mesh);
+
+  /**
+   * Remove all vertices, triangles and splits.
+   */
+  void clear();
+
+  bool empty() const { return positions.empty(); }
+
+  // Numbers of vertices and triangles at the current, base and full
+  // resolutions.
+  Size nVertices() const { return currentVertices; }
+  Size nFaces() const { return baseFaces + 2 * (currentVertices - baseVertices); }
+  Size nBaseVertices() const { return baseVertices; }
+  Size nBaseFaces() const { return baseFaces; }
+  Size nFullVertices() const { return positions.size(); }
+  Size nFullFaces() const { return indices.size() / 3; }
+
+  /**
+   * Apply or undo vertex splits until n vertices remain, n being clamped to
+   * the base and full resolutions.
+   */
+  void setVertexCount(Size n);
+
+  /**
+   * Apply or undo vertex splits until the mesh has the triangle count closest
+   * to n from above, within the base and full resolutions.
+   */
+  void setFaceCount(Size n);
+
+  /**
+   * Vertex indices of the triangles, three per triangle; the first
+   * 3 * nFaces() make up the current resolution.
+   */
+  const std::vector<Id>& triangles() const { return indices; }
+
+  /**
+   * Vertex positions, the first nVertices() being those of the current
+   * resolution.
+   */
+  const std::vector<Vector3D>& vertexPositions() const { return positions; }
+
+  /**
+   * Copy out the current resolution, e.g. for HalfedgeMesh::rebuild.
+   */
+  void getPolygons(vector<vector<Index>>& polygons,
+                   vector<Vector3D>& vertexPositions) const;
+
+  /**
+   * Center and radius of a sphere bounding the mesh at any resolution.
+   */
+  Vector3D boundCenter() const { return center; }
+  double boundRadius() const { return radius; }
+
+ private:
+  void split();     // brings back vertex currentVertices
+  void collapse();  // removes vertex currentVertices - 1
+
+  std::vector<Id> indices;          ///< triangle corners, three per triangle
+  std::vector<Vector3D> positions;  ///< vertex positions
+
+  // Vertex split i, bringing back vertex nBaseVertices() + i.
+  std::vector<Id> splitParent;             ///< vertex that splits
+  std::vector<Vector3D> splitParentFine;   ///< parent position after the split
+  std::vector<Vector3D> splitParentCoarse; ///< parent position before it
+  std::vector<Id> splitCornerStart;        ///< start of its corners in splitCorners
+  std::vector<Id> splitCorners;            ///< corners moving to the new vertex
+
+  Size baseVertices, baseFaces;
+  Size currentVertices;
+
+  Vector3D center;
+  double radius;
+};
+
+}  // namespace PROJ6850
+
+#endif  // PROJ6850_PROGRESSIVE_MESH_H
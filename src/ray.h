@@ -3,6 +3,7 @@
 
 #include "PROJ6850/PROJ6850.h"
 #include "PROJ6850/vector3D.h"
+#include "PROJ6850/vec3f.h"
 #include "PROJ6850/vector4D.h"
 #include "PROJ6850/matrix4x4.h"
 #include "PROJ6850/spectrum.h"
@@ -16,6 +17,7 @@ struct Ray {
   Vector3D d;            ///< direction
   mutable double min_t;  ///< treat the ray as a segment (ray "begin" at max_t)
   mutable double max_t;  ///< treat the ray as a segment (ray "ends" at max_t)
+  double time;           ///< time within the camera shutter, 0 at open and 1 at close
 
   Vector3D inv_d;  ///< component wise inverse
   int sign[3];     ///< fast ray-bbox intersection
@@ -28,7 +30,7 @@ struct Ray {
    * \param depth depth of the ray
    */
   Ray(const Vector3D& o, const Vector3D& d, int depth = 0)
-      : o(o), d(d), min_t(0.0), max_t(INF_D), depth(depth) {
+      : depth(depth), o(o), d(d), min_t(0.0), max_t(INF_D), time(0.0) {
     inv_d = Vector3D(1 / d.x, 1 / d.y, 1 / d.z);
     sign[0] = (inv_d.x < 0);
     sign[1] = (inv_d.y < 0);
@@ -44,7 +46,7 @@ struct Ray {
    * \param depth depth of the ray
    */
   Ray(const Vector3D& o, const Vector3D& d, double max_t, int depth = 0)
-      : o(o), d(d), min_t(0.0), max_t(max_t), depth(depth) {
+      : depth(depth), o(o), d(d), min_t(0.0), max_t(max_t), time(0.0) {
     inv_d = Vector3D(1 / d.x, 1 / d.y, 1 / d.z);
     sign[0] = (inv_d.x < 0);
     sign[1] = (inv_d.y < 0);
@@ -62,13 +64,140 @@ struct Ray {
    */
   Ray transform_by(const Matrix4x4& t) const {
     const Vector4D& newO = t * Vector4D(o, 1.0);
-    return Ray((newO / newO.w).to3D(), (t * Vector4D(d, 0.0)).to3D());
+    Ray r((newO / newO.w).to3D(), (t * Vector4D(d, 0.0)).to3D());
+    r.time = time;
+    return r;
   }
 };
 
+/**
+ * Single precision ray used by the render core (accelerators, primitives and
+ * the integrator). It is about half the size of Ray, so traversal touches half
+ * as much memory and box / triangle tests run in float.
+ */
+struct Rayf {
+  size_t depth;  ///< depth of the Ray
+
+  Vec3f o;              ///< origin
+  Vec3f d;              ///< direction
+  mutable float min_t;  ///< treat the ray as a segment (ray "begin" at min_t)
+  mutable float max_t;  ///< treat the ray as a segment (ray "ends" at max_t)
+  float time;           ///< time within the camera shutter, 0 at open and 1 at close
+
+  Vec3f inv_d;  ///< component wise inverse
+  int sign[3];  ///< fast ray-bbox intersection
+
+  /**
+   * Constructor.
+   * Create a ray instance with given origin and direction.
+   * \param o origin of the ray
+   * \param d direction of the ray
+   * \param depth depth of the ray
+   */
+  Rayf(const Vec3f& o, const Vec3f& d, size_t depth = 0)
+      : depth(depth), o(o), d(d), min_t(0.0f), max_t(INF_F), time(0.0f) {
+    init_inv_d();
+  }
+
+  /**
+   * Constructor.
+   * Create a ray instance with given origin and direction.
+   * \param o origin of the ray
+   * \param d direction of the ray
+   * \param max_t max t value for the ray (if it's actually a segment)
+   * \param depth depth of the ray
+   */
+  Rayf(const Vec3f& o, const Vec3f& d, float max_t, size_t depth = 0)
+      : depth(depth), o(o), d(d), min_t(0.0f), max_t(max_t), time(0.0f) {
+    init_inv_d();
+  }
+
+  /**
+   * Constructor.
+   * Round a double precision ray (e.g. a camera ray) into the render core.
+   */
+  explicit Rayf(const Ray& r)
+      : depth(r.depth), o(r.o), d(r.d), min_t(r.min_t),
+        max_t(r.max_t == INF_D ? INF_F : (float)r.max_t), time((float)r.time) {
+    init_inv_d();
+  }
+
+  /**
+   * Returns the point t * |d| along the ray.
+   */
+  inline Vec3f at_time(float t) const { return o + t * d; }
+
+  /**
+   * Returns the result of transforming the ray by the given transformation
+   * matrix. The direction is not renormalized, so min_t and max_t carry over
+   * and a hit at t in the transformed space is at t in this one as well.
+   */
+  Rayf transform_by(const Matrix4x4& t) const {
+    const Vector4D& newO = t * Vector4D(o.toVector3D(), 1.0);
+    Rayf r(Vec3f((newO / newO.w).to3D()),
+           Vec3f((t * Vector4D(d.toVector3D(), 0.0)).to3D()), max_t, depth);
+    r.min_t = min_t;
+    r.time = time;
+    return r;
+  }
+
+ private:
+  void init_inv_d() {
+    inv_d = Vec3f(1 / d.x, 1 / d.y, 1 / d.z);
+    sign[0] = (inv_d.x < 0);
+    sign[1] = (inv_d.y < 0);
+    sign[2] = (inv_d.z < 0);
+  }
+};
+
+/**
+ * Conservative bound on the relative rounding error of n successive float
+ * operations, (n * u) / (1 - n * u) with u the unit roundoff.
+ */
+inline float gamma_bound(int n) {
+  const float u = std::numeric_limits<float>::epsilon() * 0.5f;
+  return (n * u) / (1 - n * u);
+}
+
+/**
+ * Next representable float above / below v.
+ */
+inline float next_float_up(float v) { return std::nextafter(v, INF_F); }
+inline float next_float_down(float v) { return std::nextafter(v, -INF_F); }
+
+/**
+ * Move a surface point off the surface it lies on, towards the side that w
+ * points to, so that a ray spawned from it cannot re-hit that surface.
+ * The offset is the projection of the point's floating point error box onto
+ * the geometric normal, so the spawned origin lies outside the region the true
+ * hit point could be in, with no scene dependent epsilon. Each coordinate is
+ * then rounded one ulp further away from the surface since the addition itself
+ * rounds.
+ * \param p computed point on the surface
+ * \param p_error absolute error bound of p, per coordinate
+ * \param ng geometric normal of the surface at p
+ * \param w direction of the ray to be spawned
+ */
+inline Vec3f offset_ray_origin(const Vec3f& p, const Vec3f& p_error,
+                               const Vec3f& ng, const Vec3f& w) {
+  float dist = dot(abs(ng), p_error);
+  Vec3f offset = dist * ng;
+  if (dot(w, ng) < 0) offset = -offset;
+  Vec3f po = p + offset;
+  for (int i = 0; i < 3; ++i) {
+    if (offset[i] > 0)
+      po[i] = next_float_up(po[i]);
+    else if (offset[i] < 0)
+      po[i] = next_float_down(po[i]);
+  }
+  return po;
+}
+
 // structure used for logging rays for subsequent visualization
 struct LoggedRay {
   LoggedRay(const Ray& r, double hit_t) : o(r.o), d(r.d), hit_t(hit_t) {}
+  LoggedRay(const Rayf& r, double hit_t)
+      : o(r.o.toVector3D()), d(r.d.toVector3D()), hit_t(hit_t) {}
 
   Vector3D o;
   Vector3D d;
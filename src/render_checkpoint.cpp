@@ -0,0 +1,234 @@
+#include "render_checkpoint.h"
+
+#include <chrono>
+#include <cstring>
+
+namespace PROJ6850 {
+
+namespace {
+
+const char MAGIC[8] = {'P', 'T', 'C', 'K', 'P', 'T', '\0', '\0'};
+const uint32_t VERSION = 1;
+
+// first bytes of a checkpoint, in the byte order of the host writing it
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t w, h;       ///< image size
+  uint32_t tileSize;   ///< tile size of the render
+  uint32_t channels;   ///< AOV channels stored with the radiance
+  uint32_t reserved;
+  uint64_t hash;       ///< hash of the scene and settings
+};
+
+// rows of one channel of a tile, between an image and a file
+template <typename T>
+bool write_rows(FILE* file, const std::vector<T>& data, size_t width,
+                const RenderCheckpoint::Tile& tile) {
+  for (size_t y = tile.y; y < tile.y + tile.h; y++) {
+    if (fwrite(&data[tile.x + y * width], sizeof(T), tile.w, file) != tile.w) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename T>
+bool read_rows(FILE* file, std::vector<T>& data, size_t width,
+               const RenderCheckpoint::Tile& tile) {
+  for (size_t y = tile.y; y < tile.y + tile.h; y++) {
+    if (fread(&data[tile.x + y * width], sizeof(T), tile.w, file) != tile.w) {
+      return false;
+    }
+  }
+  return true;
+}
+
+struct RowWriter {
+  FILE* file;
+  template <typename T>
+  bool operator()(const std::vector<T>& data, size_t width,
+                  const RenderCheckpoint::Tile& tile) const {
+    return write_rows(file, data, width, tile);
+  }
+};
+
+struct RowReader {
+  FILE* file;
+  template <typename T>
+  bool operator()(std::vector<T>& data, size_t width,
+                  const RenderCheckpoint::Tile& tile) const {
+    return read_rows(file, data, width, tile);
+  }
+};
+
+// all the channels of a tile, in the order they are stored in
+template <typename Rows, typename Image, typename AOVs>
+bool tile_rows(Rows rows, Image& image, AOVs& aovs,
+               const RenderCheckpoint::Tile& tile) {
+  size_t w = image.w;
+  return rows(image.data, w, tile) &&
+         (!aovs.has(AOVBuffer::ALBEDO) || rows(aovs.albedo, w, tile)) &&
+         (!aovs.has(AOVBuffer::NORMAL) || rows(aovs.normal, w, tile)) &&
+         (!aovs.has(AOVBuffer::DEPTH) || rows(aovs.depth, w, tile)) &&
+         (!aovs.has(AOVBuffer::PRIM_ID) || rows(aovs.primId, w, tile)) &&
+         (!aovs.has(AOVBuffer::SAMPLES) || rows(aovs.samples, w, tile));
+}
+
+}  // namespace
+
+uint64_t RenderCheckpoint::hash(const void* data, size_t size, uint64_t seed) {
+  const unsigned char* bytes = (const unsigned char*) data;
+  for (size_t i = 0; i < size; i++) {
+    seed = (seed ^ bytes[i]) * 1099511628211ull;
+  }
+  return seed;
+}
+
+const char* RenderCheckpoint::load(const std::string& filename, uint64_t hash,
+                                   size_t tile_size, HDRImageBuffer& image,
+                                   AOVBuffer& aovs, std::vector<Tile>* tiles) {
+  tiles->clear();
+  FILE* file = fopen(filename.c_str(), "rb");
+  if (!file) return "cannot open the file";
+
+  Header header;
+  const char* error = NULL;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+    error = "not a checkpoint";
+  } else if (header.version != VERSION) {
+    error = "written by another version";
+  } else if (header.hash != hash || header.tileSize != tile_size) {
+    error = "written for another scene or other settings";
+  } else if (header.w != image.w || header.h != image.h ||
+             header.channels != aovs.channels || aovs.w != image.w ||
+             aovs.h != image.h) {
+    error = "written for another image size or other AOVs";
+  }
+
+  // a short record is the one being written when the render was killed
+  Tile tile;
+  while (!error && read_tile(file, &tile, image, aovs)) {
+    tiles->push_back(tile);
+  }
+  fclose(file);
+  if (error) tiles->clear();
+  return error;
+}
+
+bool RenderCheckpoint::write_tile(FILE* file, const Tile& tile,
+                                  const HDRImageBuffer& image,
+                                  const AOVBuffer& aovs) {
+  RowWriter writer = {file};
+  return fwrite(&tile, sizeof(tile), 1, file) == 1 &&
+         tile_rows(writer, image, aovs, tile);
+}
+
+bool RenderCheckpoint::read_tile(FILE* file, Tile* tile, HDRImageBuffer& image,
+                                 AOVBuffer& aovs, const Tile* expected) {
+  if (fread(tile, sizeof(*tile), 1, file) != 1) return false;
+  if (!tile->w || !tile->h || tile->x + tile->w > image.w ||
+      tile->y + tile->h > image.h) {
+    return false;
+  }
+  if (expected && (tile->x != expected->x || tile->y != expected->y ||
+                   tile->w != expected->w || tile->h != expected->h)) {
+    return false;
+  }
+  RowReader reader = {file};
+  return tile_rows(reader, image, aovs, *tile);
+}
+
+RenderCheckpoint::RenderCheckpoint()
+    : file(NULL), interval(0), image(NULL), aovs(NULL), stopping(false) {}
+
+RenderCheckpoint::~RenderCheckpoint() { finish(); }
+
+bool RenderCheckpoint::start(const std::string& filename, double interval,
+                             uint64_t hash, size_t tile_size,
+                             const HDRImageBuffer& image,
+                             const AOVBuffer& aovs,
+                             const std::vector<Tile>& tiles) {
+  finish();
+  this->filename = filename;
+  this->interval = interval;
+  this->image = &image;
+  this->aovs = &aovs;
+
+  // the tiles already finished go to a new file which then replaces the old
+  // one, so a checkpoint is on disk at all times
+  std::string temp = filename + ".tmp";
+  file = fopen(temp.c_str(), "wb");
+  if (!file) return false;
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.w = image.w;
+  header.h = image.h;
+  header.tileSize = tile_size;
+  header.channels = aovs.channels;
+  header.hash = hash;
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  for (const Tile& tile : tiles) ok = ok && write_tile(file, tile, image, aovs);
+  ok = ok && fflush(file) == 0;
+  if (ok && rename(temp.c_str(), filename.c_str()) != 0) {
+    // the target of a rename cannot exist on some systems
+    remove(filename.c_str());
+    ok = rename(temp.c_str(), filename.c_str()) == 0;
+  }
+  if (!ok) {
+    fclose(file);
+    file = NULL;
+    remove(temp.c_str());
+    return false;
+  }
+
+  stopping = false;
+  pending.clear();
+  thread = std::thread(&RenderCheckpoint::writer_thread, this);
+  return true;
+}
+
+void RenderCheckpoint::tile_done(const Tile& tile) {
+  std::lock_guard<std::mutex> guard(lock);
+  pending.push_back(tile);
+}
+
+void RenderCheckpoint::finish() {
+  if (!file) return;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  wakeup.notify_one();
+  thread.join();
+  fclose(file);
+  file = NULL;
+}
+
+void RenderCheckpoint::writer_thread() {
+  std::unique_lock<std::mutex> guard(lock);
+  while (true) {
+    wakeup.wait_for(guard, std::chrono::duration<double>(interval),
+                    [this] { return stopping; });
+    std::vector<Tile> tiles;
+    tiles.swap(pending);
+    bool last = stopping;
+
+    // the render threads keep queueing tiles while these are written
+    guard.unlock();
+    bool ok = true;
+    for (const Tile& tile : tiles) {
+      ok = ok && write_tile(file, tile, *image, *aovs);
+    }
+    if (!ok || fflush(file) != 0) {
+      fprintf(stderr, "[Checkpoint] Error writing %s\n", filename.c_str());
+    }
+    guard.lock();
+    if (last) return;
+  }
+}
+
+}  // namespace PROJ6850
@@ -0,0 +1,142 @@
+#ifndef PROJ6850_RENDER_CHECKPOINT_H
+#define PROJ6850_RENDER_CHECKPOINT_H
+
+#include "image.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace PROJ6850 {
+
+/**
+ * Log of the finished tiles of a render, so that a render killed halfway
+ * can be resumed without tracing its finished tiles again.
+ *
+ * The file starts with a header naming the render it belongs to (a hash of
+ * the scene and settings, and the image size, tile size and AOV channels).
+ * After the header come tile records. Each record holds the tile bounds, its
+ * samples per pixel, and then its radiance and AOV pixels row by row.
+ * Records are only ever appended. A process killed while writing leaves a
+ * truncated last record, which is dropped when the file is loaded.
+ *
+ * Render threads hand finished tiles over with tile_done(), which only queues
+ * them. A background thread copies the queued tiles to the file every few
+ * seconds. A finished tile is not written to again, so it can be read without
+ * locking the image.
+ */
+class RenderCheckpoint {
+ public:
+  struct Tile {
+    uint32_t x, y, w, h;  ///< pixel bounds, clipped to the image
+    uint32_t samples;     ///< camera rays per pixel
+  };
+
+  /**
+   * Hash of a block of bytes (64-bit FNV-1a), chained through seed to hash
+   * the settings and the scene of a render.
+   */
+  static uint64_t hash(const void* data, size_t size,
+                       uint64_t seed = 14695981039346656037ull);
+
+  /**
+   * Read the tiles of a checkpoint into an image.
+   * \param filename checkpoint to read
+   * \param hash hash the checkpoint must have been written with
+   * \param tile_size tile size the checkpoint must have been written with
+   * \param image radiance, its size must match the checkpoint
+   * \param aovs AOVs, same size, their channels must match the checkpoint
+   * \param tiles address to store the tiles read
+   * \return NULL on success, the reason the checkpoint was not used otherwise
+   */
+  static const char* load(const std::string& filename, uint64_t hash,
+                          size_t tile_size, HDRImageBuffer& image,
+                          AOVBuffer& aovs, std::vector<Tile>* tiles);
+
+  /**
+   * Write a tile record: the tile, then its radiance and AOV pixels.
+   * \return false if the record could not be written
+   */
+  static bool write_tile(FILE* file, const Tile& tile,
+                         const HDRImageBuffer& image, const AOVBuffer& aovs);
+
+  /**
+   * Read a tile record into an image with the same AOV channels as the one
+   * it was written from. Records whose tile does not fit in the image, or
+   * that are not of the expected tile if one is given, are rejected before
+   * their pixels are read.
+   * \param tile address to store the tile
+   * \param expected bounds the tile must have, NULL for any
+   * \return false if the record is short, does not fit or is not expected
+   */
+  static bool read_tile(FILE* file, Tile* tile, HDRImageBuffer& image,
+                        AOVBuffer& aovs, const Tile* expected = NULL);
+
+  RenderCheckpoint();
+
+  /**
+   * Destructor.
+   * Writes the tiles still queued.
+   */
+  ~RenderCheckpoint();
+
+  /**
+   * Start a checkpoint, replacing the file, and the thread writing to it.
+   * The header and the given tiles (those loaded when resuming) are written
+   * to a temporary file which then replaces the old one. A kill at any time
+   * therefore leaves a usable checkpoint.
+   * \param filename checkpoint to write
+   * \param interval seconds between writes
+   * \param hash hash of the render
+   * \param tile_size tile size of the render
+   * \param image radiance, read as tiles are finished
+   * \param aovs AOVs, read as tiles are finished
+   * \param tiles tiles already finished
+   * \return false if the file cannot be written
+   */
+  bool start(const std::string& filename, double interval, uint64_t hash,
+             size_t tile_size, const HDRImageBuffer& image,
+             const AOVBuffer& aovs, const std::vector<Tile>& tiles);
+
+  /**
+   * Queue a finished tile to be written. Called by the render threads.
+   */
+  void tile_done(const Tile& tile);
+
+  /**
+   * Write the tiles still queued, stop the writing thread and close the
+   * file. Nothing is read from the image afterwards.
+   */
+  void finish();
+
+  /**
+   * Whether a checkpoint is being written.
+   */
+  bool is_active() const { return file != NULL; }
+
+ private:
+  RenderCheckpoint(const RenderCheckpoint&);
+  RenderCheckpoint& operator=(const RenderCheckpoint&);
+
+  void writer_thread();
+
+  FILE* file;                      ///< checkpoint being appended to
+  std::string filename;            ///< its name, for error messages
+  double interval;                 ///< seconds between writes
+  const HDRImageBuffer* image;     ///< radiance of the render
+  const AOVBuffer* aovs;           ///< AOVs of the render
+
+  std::thread thread;              ///< writes the queued tiles
+  std::vector<Tile> pending;       ///< finished tiles not written yet
+  bool stopping;                   ///< set to write the last tiles and stop
+  std::mutex lock;                 ///< guards pending and stopping
+  std::condition_variable wakeup;  ///< signaled when stopping is set
+};
+
+}  // namespace PROJ6850
+
+#endif  // PROJ6850_RENDER_CHECKPOINT_H
@@ -0,0 +1,545 @@
+#include "scene_cache.h"
+
+#include "bsdf.h"
+#include "render_checkpoint.h"
+#include "static_scene/environment_light.h"
+#include "static_scene/light.h"
+#include "static_scene/object.h"
+#include "static_scene/primitive_list.h"
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <typeinfo>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace PROJ6850 {
+
+using namespace StaticScene;
+
+namespace {
+
+const char MAGIC[8] = {'P', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+const uint32_t VERSION = 1;
+
+// arrays start on this boundary, the largest alignment of what they hold
+const uint64_t ALIGNMENT = 8;
+
+enum BSDFType { DIFFUSE, MIRROR, REFRACTION, GLASS, EMISSION, NUM_BSDF_TYPES };
+enum LightType { DIRECTIONAL, HEMISPHERE, POINT, AREA, NUM_LIGHT_TYPES };
+enum ObjectType { MESH, SPHERE, NUM_OBJECT_TYPES };
+
+// first bytes of a cache, in the byte order of the host writing it
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t leafSize;  ///< maximum leaf size of the BVH
+  uint64_t key;       ///< hash of the scene file
+  uint64_t size;      ///< size of the whole cache, to reject truncated ones
+  uint64_t bsdfs, lights, objects, nodes, ids;  ///< offsets of the tables
+  uint32_t numBsdfs, numLights, numObjects, numNodes, numIds;
+  uint32_t reserved;
+  SceneCache::View view;
+};
+
+struct ObjectRecord {
+  uint32_t type;
+  uint32_t bsdf;
+  uint64_t positions, normals, indices, instances;  ///< offsets of mesh arrays
+  uint32_t numVertices, numIndices, numInstances;
+  uint32_t reserved;
+  double center[3], radius;  ///< sphere
+};
+
+void to_floats(const Spectrum& s, float* f) {
+  f[0] = s.r;
+  f[1] = s.g;
+  f[2] = s.b;
+}
+
+void to_doubles(const Vector3D& v, double* d) {
+  for (int i = 0; i < 3; i++) d[i] = v[i];
+}
+
+Spectrum spectrum(const float* f) { return Spectrum(f[0], f[1], f[2]); }
+Vector3D vector(const double* d) { return Vector3D(d[0], d[1], d[2]); }
+
+// sequential writes, each array starting aligned
+struct Output {
+  explicit Output(FILE* file) : file(file), offset(0), ok(true) {}
+
+  uint64_t write(const void* bytes, size_t n) {
+    static const char zeros[ALIGNMENT] = {};
+    size_t pad = (ALIGNMENT - offset % ALIGNMENT) % ALIGNMENT;
+    ok = ok && fwrite(zeros, 1, pad, file) == pad;
+    offset += pad;
+    uint64_t start = offset;
+    ok = ok && (n == 0 || fwrite(bytes, 1, n, file) == n);
+    offset += n;
+    return start;
+  }
+
+  template <typename T>
+  uint64_t write(const std::vector<T>& v) {
+    return write(v.data(), v.size() * sizeof(T));
+  }
+
+  FILE* file;
+  uint64_t offset;
+  bool ok;
+};
+
+}  // namespace
+
+struct SceneCache::BSDFRecord {
+  uint32_t type;
+  float roughness, ior;
+  float color[3];       ///< albedo, reflectance, transmittance or radiance
+  float reflectance[3]; ///< reflectance of glass
+};
+
+struct SceneCache::LightRecord {
+  uint32_t type;
+  float radiance[3];
+  double position[3];
+  double direction[3];  ///< direction to directional lights, normal of area lights
+  double dimX[3], dimY[3];
+};
+
+bool SceneCache::to_record(const BSDF* bsdf, BSDFRecord* b) {
+  memset(b, 0, sizeof(*b));
+  if (const DiffuseBSDF* d = dynamic_cast<const DiffuseBSDF*>(bsdf)) {
+    b->type = DIFFUSE;
+    to_floats(d->albedo, b->color);
+  } else if (const MirrorBSDF* m = dynamic_cast<const MirrorBSDF*>(bsdf)) {
+    b->type = MIRROR;
+    to_floats(m->reflectance, b->color);
+  } else if (const RefractionBSDF* r = dynamic_cast<const RefractionBSDF*>(bsdf)) {
+    b->type = REFRACTION;
+    to_floats(r->transmittance, b->color);
+    b->roughness = r->roughness;
+    b->ior = r->ior;
+  } else if (const GlassBSDF* g = dynamic_cast<const GlassBSDF*>(bsdf)) {
+    b->type = GLASS;
+    to_floats(g->transmittance, b->color);
+    to_floats(g->reflectance, b->reflectance);
+    b->roughness = g->roughness;
+    b->ior = g->ior;
+  } else if (const EmissionBSDF* e = dynamic_cast<const EmissionBSDF*>(bsdf)) {
+    b->type = EMISSION;
+    to_floats(e->radiance, b->color);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool SceneCache::to_record(const SceneLight* light, LightRecord* record) {
+  memset(record, 0, sizeof(*record));
+  if (const DirectionalLight* d = dynamic_cast<const DirectionalLight*>(light)) {
+    record->type = DIRECTIONAL;
+    to_floats(d->radiance, record->radiance);
+    to_doubles(d->dirToLight, record->direction);
+  } else if (const InfiniteHemisphereLight* h =
+                 dynamic_cast<const InfiniteHemisphereLight*>(light)) {
+    record->type = HEMISPHERE;
+    to_floats(h->radiance, record->radiance);
+  } else if (const PointLight* p = dynamic_cast<const PointLight*>(light)) {
+    record->type = POINT;
+    to_floats(p->radiance, record->radiance);
+    to_doubles(p->position, record->position);
+  } else if (const AreaLight* a = dynamic_cast<const AreaLight*>(light)) {
+    record->type = AREA;
+    to_floats(a->radiance, record->radiance);
+    to_doubles(a->position, record->position);
+    to_doubles(a->direction, record->direction);
+    to_doubles(a->dim_x, record->dimX);
+    to_doubles(a->dim_y, record->dimY);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+uint64_t SceneCache::key(const std::string& scene_file) {
+  FILE* file = fopen(scene_file.c_str(), "rb");
+  if (!file) return 0;
+  uint64_t hash = RenderCheckpoint::hash(&VERSION, sizeof(VERSION));
+  std::vector<char> buffer(1 << 20);
+  size_t n;
+  while ((n = fread(buffer.data(), 1, buffer.size(), file)) > 0) {
+    hash = RenderCheckpoint::hash(buffer.data(), n, hash);
+  }
+  bool ok = !ferror(file);
+  fclose(file);
+  return ok ? hash : 0;
+}
+
+uint64_t SceneCache::shading_hash(const Scene& scene, uint64_t hash) {
+  auto mix = [&hash](const void* data, size_t size) {
+    hash = RenderCheckpoint::hash(data, size, hash);
+  };
+  // types the cache does not hold, which this tree never creates, are told
+  // apart by their name only
+  auto mix_type = [&mix](const char* name) { mix(name, strlen(name)); };
+
+  for (const SceneObject* object : scene.objects) {
+    const BSDF* bsdf = object->get_bsdf();
+    BSDFRecord b;
+    if (to_record(bsdf, &b)) {
+      mix(&b, sizeof(b));
+    } else {
+      mix_type(typeid(*bsdf).name());
+    }
+  }
+  for (const SceneLight* light : scene.lights) {
+    LightRecord record;
+    if (to_record(light, &record)) {
+      mix(&record, sizeof(record));
+    } else if (const EnvironmentLight* e = dynamic_cast<const EnvironmentLight*>(light)) {
+      size_t size[] = {e->envMap->w, e->envMap->h};
+      mix(size, sizeof(size));
+      mix(e->envMap->data.data(), e->envMap->data.size() * sizeof(Spectrum));
+    } else {
+      mix_type(typeid(*light).name());
+    }
+  }
+  return hash;
+}
+
+const char* SceneCache::write(const std::string& filename, uint64_t key,
+                              const Scene& scene, const BVHAccel& bvh,
+                              const View& view) {
+  // tables first, so that scenes which cannot be cached write nothing
+  std::map<const BSDF*, uint32_t> bsdfIndex;
+  std::vector<BSDFRecord> bsdfs;
+  std::vector<const Mesh*> meshes;
+  std::vector<ObjectRecord> objects;
+  for (const SceneObject* object : scene.objects) {
+    ObjectRecord record;
+    memset(&record, 0, sizeof(record));
+    const BSDF* bsdf;
+    if (const Mesh* mesh = dynamic_cast<const Mesh*>(object)) {
+      if (mesh->has_motion()) return "moving meshes are not cached";
+      record.type = MESH;
+      bsdf = mesh->get_bsdf();
+    } else if (const SphereObject* sphere = dynamic_cast<const SphereObject*>(object)) {
+      record.type = SPHERE;
+      to_doubles(sphere->o, record.center);
+      record.radius = sphere->r;
+      bsdf = sphere->get_bsdf();
+    } else {
+      return "the scene holds objects of an unknown type";
+    }
+    meshes.push_back(record.type == MESH ? static_cast<const Mesh*>(object) : NULL);
+
+    auto known = bsdfIndex.find(bsdf);
+    if (known != bsdfIndex.end()) {
+      record.bsdf = known->second;
+      objects.push_back(record);
+      continue;
+    }
+    BSDFRecord b;
+    if (!to_record(bsdf, &b)) return "the scene holds BSDFs of an unknown type";
+    record.bsdf = bsdfIndex[bsdf] = bsdfs.size();
+    bsdfs.push_back(b);
+    objects.push_back(record);
+  }
+
+  std::vector<LightRecord> lights;
+  for (const SceneLight* light : scene.lights) {
+    if (dynamic_cast<const EnvironmentLight*>(light)) continue;
+    LightRecord record;
+    if (!to_record(light, &record)) return "the scene holds lights that are not cached";
+    lights.push_back(record);
+  }
+
+  std::vector<BVHAccel::FlatNode> nodes;
+  bvh.flatten(&nodes);
+
+  std::string temp = filename + ".tmp";
+  FILE* file = fopen(temp.c_str(), "wb");
+  if (!file) return "cannot write the file";
+  Output out(file);
+  Header header;
+  memset(&header, 0, sizeof(header));
+  out.write(&header, sizeof(header));
+
+  // mesh buffers, then the tables pointing at them
+  for (size_t i = 0; i < objects.size(); i++) {
+    const Mesh* mesh = meshes[i];
+    if (!mesh) continue;
+    ObjectRecord& record = objects[i];
+    std::vector<uint32_t> indices;
+    for (size_t t = 0; t < mesh->num_triangles(); t++) {
+      indices.insert(indices.end(), mesh->get_triangle(t), mesh->get_triangle(t) + 3);
+    }
+    std::vector<double> instances;
+    for (const Matrix4x4& m : mesh->instances) {
+      for (int r = 0; r < 4; r++) {
+        for (int c = 0; c < 4; c++) instances.push_back(m(r, c));
+      }
+    }
+    record.positions = out.write(mesh->positions);
+    record.normals = out.write(mesh->normals);
+    record.indices = out.write(indices);
+    record.instances = out.write(instances);
+    record.numVertices = mesh->positions.size();
+    record.numIndices = indices.size();
+    record.numInstances = mesh->instances.size();
+  }
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.leafSize = bvh.max_leaf_size();
+  header.key = key;
+  header.bsdfs = out.write(bsdfs);
+  header.lights = out.write(lights);
+  header.objects = out.write(objects);
+  header.nodes = out.write(nodes);
+  header.ids = out.write(bvh.primitives);
+  header.numBsdfs = bsdfs.size();
+  header.numLights = lights.size();
+  header.numObjects = objects.size();
+  header.numNodes = nodes.size();
+  header.numIds = bvh.primitives.size();
+  header.view = view;
+  header.size = out.offset;
+
+  bool ok = out.ok && fseek(file, 0, SEEK_SET) == 0 &&
+            fwrite(&header, sizeof(header), 1, file) == 1;
+  ok = fclose(file) == 0 && ok;
+  if (ok && rename(temp.c_str(), filename.c_str()) != 0) {
+    // the target of a rename cannot exist on some systems
+    remove(filename.c_str());
+    ok = rename(temp.c_str(), filename.c_str()) == 0;
+  }
+  if (!ok) {
+    remove(temp.c_str());
+    return "cannot write the file";
+  }
+  return NULL;
+}
+
+SceneCache::SceneCache() : data(NULL), size(0) {}
+
+SceneCache::~SceneCache() { close(); }
+
+void SceneCache::close() {
+  if (data) munmap((void*) data, size);
+  data = NULL;
+  size = 0;
+}
+
+template <typename T>
+const T* SceneCache::array(uint64_t offset, uint64_t count) const {
+  if (offset % ALIGNMENT || offset > size || count > (size - offset) / sizeof(T)) {
+    return NULL;
+  }
+  return (const T*) (data + offset);
+}
+
+const char* SceneCache::open(const std::string& filename, uint64_t key) {
+  close();
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return "cannot open the file";
+  struct stat info;
+  if (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(Header)) {
+    ::close(fd);
+    return "not a scene cache";
+  }
+  size = info.st_size;
+  void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    size = 0;
+    return "cannot map the file";
+  }
+  data = (const char*) mapped;
+
+  const Header& header = *(const Header*) data;
+  const char* error = NULL;
+  if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+    error = "not a scene cache";
+  } else if (header.version != VERSION) {
+    error = "written by another version";
+  } else if (header.key != key) {
+    error = "written for another scene file";
+  } else if (header.size != size) {
+    error = "truncated";
+  } else {
+    error = check();
+  }
+  if (error) close();
+  return error;
+}
+
+// everything scene() and bvh() index, so that they cannot read out of the
+// mapping whatever the file holds
+const char* SceneCache::check() const {
+  const Header& header = *(const Header*) data;
+  const BSDFRecord* bsdfs = array<BSDFRecord>(header.bsdfs, header.numBsdfs);
+  const LightRecord* lights = array<LightRecord>(header.lights, header.numLights);
+  const ObjectRecord* objects = array<ObjectRecord>(header.objects, header.numObjects);
+  const BVHAccel::FlatNode* nodes =
+      array<BVHAccel::FlatNode>(header.nodes, header.numNodes);
+  const PrimitiveID* ids = array<PrimitiveID>(header.ids, header.numIds);
+  if (!bsdfs || !lights || !objects || !nodes || !ids) return "corrupted tables";
+
+  for (uint32_t i = 0; i < header.numBsdfs; i++) {
+    if (bsdfs[i].type >= NUM_BSDF_TYPES) return "corrupted BSDFs";
+  }
+  for (uint32_t i = 0; i < header.numLights; i++) {
+    if (lights[i].type >= NUM_LIGHT_TYPES) return "corrupted lights";
+  }
+
+  // primitives the scene objects add to a primitive list, by type
+  uint64_t count[3] = {0, 0, 0};
+  for (uint32_t i = 0; i < header.numObjects; i++) {
+    const ObjectRecord& object = objects[i];
+    if (object.type >= NUM_OBJECT_TYPES || object.bsdf >= header.numBsdfs) {
+      return "corrupted objects";
+    }
+    if (object.type == SPHERE) {
+      count[PrimitiveList::SPHERE]++;
+      continue;
+    }
+    const uint32_t* indices = array<uint32_t>(object.indices, object.numIndices);
+    if (!array<Vec3f>(object.positions, object.numVertices) ||
+        !array<Vec3f>(object.normals, object.numVertices) || !indices ||
+        !array<double>(object.instances, 16 * (uint64_t) object.numInstances) ||
+        object.numIndices % 3) {
+      return "corrupted meshes";
+    }
+    for (uint32_t j = 0; j < object.numIndices; j++) {
+      if (indices[j] >= object.numVertices) return "corrupted meshes";
+    }
+    if (object.numInstances) {
+      count[PrimitiveList::INSTANCE] += object.numInstances + 1;
+    } else {
+      count[PrimitiveList::TRIANGLE] += object.numIndices / 3;
+    }
+  }
+  for (uint32_t i = 0; i < header.numIds; i++) {
+    PrimitiveList::Type type = PrimitiveList::type(ids[i]);
+    if (type > PrimitiveList::INSTANCE || PrimitiveList::index(ids[i]) >= count[type]) {
+      return "corrupted primitive ids";
+    }
+  }
+
+  // children come after their parent, so the tree has no cycle
+  if (header.numNodes == 0 || nodes[0].range != header.numIds) return "corrupted BVH";
+  for (uint32_t i = 0; i < header.numNodes; i++) {
+    const BVHAccel::FlatNode& node = nodes[i];
+    if (node.start > header.numIds || node.range > header.numIds - node.start ||
+        (node.right && (node.right <= i + 1 || node.right >= header.numNodes))) {
+      return "corrupted BVH";
+    }
+  }
+  return NULL;
+}
+
+const SceneCache::View& SceneCache::view() const {
+  return ((const Header*) data)->view;
+}
+
+size_t SceneCache::num_triangles() const {
+  const Header& header = *(const Header*) data;
+  const ObjectRecord* objects = array<ObjectRecord>(header.objects, header.numObjects);
+  size_t triangles = 0;
+  for (uint32_t i = 0; i < header.numObjects; i++) {
+    if (objects[i].type == MESH) triangles += objects[i].numIndices / 3;
+  }
+  return triangles;
+}
+
+Scene* SceneCache::scene() const {
+  const Header& header = *(const Header*) data;
+  const BSDFRecord* bsdfRecords = array<BSDFRecord>(header.bsdfs, header.numBsdfs);
+  const LightRecord* lightRecords = array<LightRecord>(header.lights, header.numLights);
+  const ObjectRecord* objectRecords =
+      array<ObjectRecord>(header.objects, header.numObjects);
+
+  std::vector<BSDF*> bsdfs;
+  for (uint32_t i = 0; i < header.numBsdfs; i++) {
+    const BSDFRecord& b = bsdfRecords[i];
+    switch (b.type) {
+      case DIFFUSE:
+        bsdfs.push_back(new DiffuseBSDF(spectrum(b.color)));
+        break;
+      case MIRROR:
+        bsdfs.push_back(new MirrorBSDF(spectrum(b.color)));
+        break;
+      case REFRACTION:
+        bsdfs.push_back(new RefractionBSDF(spectrum(b.color), b.roughness, b.ior));
+        break;
+      case GLASS:
+        bsdfs.push_back(new GlassBSDF(spectrum(b.color), spectrum(b.reflectance),
+                                      b.roughness, b.ior));
+        break;
+      default:
+        bsdfs.push_back(new EmissionBSDF(spectrum(b.color)));
+        break;
+    }
+  }
+
+  std::vector<SceneObject*> objects;
+  for (uint32_t i = 0; i < header.numObjects; i++) {
+    const ObjectRecord& o = objectRecords[i];
+    if (o.type == SPHERE) {
+      objects.push_back(new SphereObject(vector(o.center), o.radius, bsdfs[o.bsdf]));
+      continue;
+    }
+    Mesh* mesh = new Mesh(array<Vec3f>(o.positions, o.numVertices),
+                          array<Vec3f>(o.normals, o.numVertices), o.numVertices,
+                          array<uint32_t>(o.indices, o.numIndices), o.numIndices,
+                          bsdfs[o.bsdf]);
+    const double* m = array<double>(o.instances, 16 * (uint64_t) o.numInstances);
+    for (uint32_t j = 0; j < o.numInstances; j++, m += 16) {
+      Matrix4x4 placement;
+      for (int r = 0; r < 4; r++) {
+        for (int c = 0; c < 4; c++) placement(r, c) = m[4 * r + c];
+      }
+      mesh->instances.push_back(placement);
+    }
+    objects.push_back(mesh);
+  }
+
+  std::vector<SceneLight*> lights;
+  for (uint32_t i = 0; i < header.numLights; i++) {
+    const LightRecord& l = lightRecords[i];
+    Spectrum radiance = spectrum(l.radiance);
+    switch (l.type) {
+      case DIRECTIONAL:
+        // the light stores the direction to it
+        lights.push_back(new DirectionalLight(radiance, -vector(l.direction)));
+        break;
+      case HEMISPHERE:
+        lights.push_back(new InfiniteHemisphereLight(radiance));
+        break;
+      case POINT:
+        lights.push_back(new PointLight(radiance, vector(l.position)));
+        break;
+      default:
+        lights.push_back(new AreaLight(radiance, vector(l.position), vector(l.direction),
+                                       vector(l.dimX), vector(l.dimY)));
+        break;
+    }
+  }
+  return new Scene(objects, lights);
+}
+
+BVHAccel* SceneCache::bvh(const PrimitiveList& primitives) const {
+  const Header& header = *(const Header*) data;
+  if (primitives.size() != header.numIds) return NULL;
+  return new BVHAccel(primitives,
+                      array<BVHAccel::FlatNode>(header.nodes, header.numNodes),
+                      header.numNodes, array<PrimitiveID>(header.ids, header.numIds),
+                      header.leafSize);
+}
+
+}  // namespace PROJ6850
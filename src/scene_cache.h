@@ -0,0 +1,138 @@
+#ifndef PROJ6850_SCENE_CACHE_H
+#define PROJ6850_SCENE_CACHE_H
+
+#include "bvh.h"
+#include "static_scene/scene.h"
+
+#include <cstdint>
+#include <string>
+
+namespace PROJ6850 {
+
+/**
+ * Binary cache of the static scene of a scene file and of its BVH, so that
+ * headless renders of a file that did not change skip parsing it, building
+ * its halfedge meshes and building the BVH.
+ *
+ * The cache holds the world-space triangle buffers of the meshes, the
+ * spheres, the parameters of the BSDFs and lights, the camera and the
+ * flattened BVH with its primitive ids. They are stored as arrays in the
+ * byte order of the host, and the file is mapped rather than read, so that
+ * loading is only copying the buffers.
+ *
+ * A cache is keyed by a hash of the bytes of the scene file and of the cache
+ * version, which changes with the layout and the BVH build. An edited file
+ * misses its cache, which is then written again. Scenes with moving meshes
+ * or with spot, sphere or mesh lights are not cached.
+ */
+class SceneCache {
+ public:
+  /**
+   * Camera of a scene as Application::load sets it up: the field of view and
+   * clip planes of the scene camera, then its placement around the scene.
+   */
+  struct View {
+    uint32_t configured;  ///< whether the scene has a camera
+    uint32_t placed;      ///< whether the camera was placed, false for an empty scene
+    float hFov, vFov, nClip, fClip;  ///< scene camera, fields of view in degrees
+    double target[3];     ///< point the camera looks at
+    double phi, theta;    ///< direction of the camera from the target, in radians
+    double distance, minDistance, maxDistance;  ///< distance to the target and its bounds
+  };
+
+  /**
+   * Key of the cache of a scene file.
+   * \return 0 if the file cannot be read
+   */
+  static uint64_t key(const std::string& scene_file);
+
+  /**
+   * Hash of what a static scene shades its geometry with: the parameters of
+   * the BSDF of every object, in order, and of every light, including the
+   * pixels of environment maps. The geometry itself is left out.
+   * \param scene static scene
+   * \param seed hash to chain from, see RenderCheckpoint::hash
+   */
+  static uint64_t shading_hash(const StaticScene::Scene& scene, uint64_t seed);
+
+  /**
+   * Write the cache of a scene, replacing the file. The scene is written to a
+   * temporary file first, so a cache is complete or missing.
+   * \param filename cache to write
+   * \param key key of the scene file, see key()
+   * \param scene static scene, environment lights are left out as they come
+   *        from the path tracer rather than the scene file
+   * \param bvh BVH built over the primitives of the scene objects, in order
+   * \param view camera of the scene
+   * \return NULL on success, the reason the scene was not cached otherwise
+   */
+  static const char* write(const std::string& filename, uint64_t key,
+                           const StaticScene::Scene& scene,
+                           const StaticScene::BVHAccel& bvh, const View& view);
+
+  SceneCache();
+
+  /**
+   * Destructor.
+   * Unmaps the cache. Scenes and BVHs built from it do not reference it.
+   */
+  ~SceneCache();
+
+  /**
+   * Map a cache and check that it holds a consistent scene for a key.
+   * \param filename cache to open
+   * \param key key of the scene file, see key()
+   * \return NULL on success, the reason the cache cannot be used otherwise
+   */
+  const char* open(const std::string& filename, uint64_t key);
+
+  /**
+   * Whether a cache is mapped.
+   */
+  bool is_open() const { return data != NULL; }
+
+  /**
+   * Camera of the cached scene.
+   */
+  const View& view() const;
+
+  /**
+   * Number of triangles of the cached scene, instances counted once.
+   */
+  size_t num_triangles() const;
+
+  /**
+   * Build the cached static scene. Like the scenes of
+   * DynamicScene::Scene::get_static_scene, its BSDFs are never freed.
+   */
+  StaticScene::Scene* scene() const;
+
+  /**
+   * Restore the cached BVH over the primitives of a scene built by scene().
+   * \return NULL if the list does not hold the cached primitives
+   */
+  StaticScene::BVHAccel* bvh(const StaticScene::PrimitiveList& primitives) const;
+
+ private:
+  SceneCache(const SceneCache&);
+  SceneCache& operator=(const SceneCache&);
+
+  struct BSDFRecord;
+  struct LightRecord;
+
+  // parameters of a BSDF or light, false for a type the cache does not hold
+  static bool to_record(const BSDF* bsdf, BSDFRecord* record);
+  static bool to_record(const StaticScene::SceneLight* light, LightRecord* record);
+
+  void close();
+  const char* check() const;
+  template <typename T>
+  const T* array(uint64_t offset, uint64_t count) const;
+
+  const char* data;  ///< mapped cache, NULL if none
+  size_t size;       ///< size of the mapping
+};
+
+}  // namespace PROJ6850
+
+#endif  // PROJ6850_SCENE_CACHE_H
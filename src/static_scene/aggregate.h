@@ -2,6 +2,7 @@
 #define PROJ6850_STATICSCENE_AGGREGATE_H
 
 #include "scene.h"
+#include "primitive_list.h"
 
 namespace PROJ6850 {
 namespace StaticScene {
@@ -17,6 +18,8 @@ namespace StaticScene {
  */
 class Aggregate : public Primitive {
  public:
+  virtual ~Aggregate() {}
+
   // Implements Primitive //
 
 
@@ -27,8 +30,11 @@ class Aggregate : public Primitive {
   // intersection information is to be updated (intersect2), the aggregate
   // implementation should store the address of the primitive that the ray
   // intersected and not that of the aggregate itself.
+  // Primitives are referenced by id into a PrimitiveList which must outlive
+  // the aggregate.
 
-  std::vector<Primitive*> primitives;  ///< primitives enclosed in the aggregate
+  const PrimitiveList* primitiveList;   ///< storage of the enclosed primitives
+  std::vector<PrimitiveID> primitives;  ///< ids of the primitives enclosed in the aggregate
 
   /**
    * Get BSDF.
@@ -113,8 +113,8 @@ namespace StaticScene {
       return bilinear_interpolate_coor(i, j);
 }
 
-Spectrum EnvironmentLight::sample_dir(const Ray& r) const {
-  Vector3D dir = r.d;
+Spectrum EnvironmentLight::sample_dir(const Rayf& r) const {
+  Vector3D dir = r.d.toVector3D();
   dir.normalize();
   double xx = dir.x, yy = dir.y, zz = dir.z;
   double theta = acos(yy), phi = atan2(xx, -1 * zz) + PI;
@@ -6,6 +6,9 @@
 #include "scene.h"
 
 namespace PROJ6850 {
+
+    class SceneCache;
+
     namespace StaticScene {
 
 // An environment light can be thought of as an infinitely big sphere centered
@@ -41,11 +44,12 @@ namespace PROJ6850 {
              * - Handling the edge cases correctly (what happens if you wrap around the
              *   environment map horizontally? What about vertically?).
              */
-            Spectrum sample_dir(const Ray& r) const;
+            Spectrum sample_dir(const Rayf& r) const;
 
 
 
         private:
+            friend class PROJ6850::SceneCache;
             const HDRImageBuffer* envMap;
             std::vector<float> p_cdf_theta;
             std::vector<float> p_cdf_theta_phi;
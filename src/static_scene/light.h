@@ -11,6 +11,9 @@
 #include "object.h"  // Mesh, SphereObject
 
 namespace PROJ6850 {
+
+    class SceneCache;
+
     namespace StaticScene {
 
 // Directional Light //
@@ -23,6 +26,7 @@ namespace PROJ6850 {
             bool is_delta_light() const { return true; }
 
         private:
+            friend class PROJ6850::SceneCache;
             Spectrum radiance;
             Vector3D dirToLight;
 
@@ -38,6 +42,7 @@ namespace PROJ6850 {
             bool is_delta_light() const { return false; }
 
         private:
+            friend class PROJ6850::SceneCache;
             Spectrum radiance;
             Matrix3x3 sampleToWorld;
             UniformHemisphereSampler3D sampler;
@@ -54,6 +59,7 @@ namespace PROJ6850 {
             bool is_delta_light() const { return true; }
 
         private:
+            friend class PROJ6850::SceneCache;
             Spectrum radiance;
             Vector3D position;
 
@@ -88,6 +94,7 @@ namespace PROJ6850 {
             bool is_delta_light() const { return false; }
 
         private:
+            friend class PROJ6850::SceneCache;
             Spectrum radiance;
             Vector3D position;
             Vector3D direction;
@@ -1,6 +1,7 @@
 #include "object.h"
 #include "sphere.h"
 #include "triangle.h"
+#include "primitive_list.h"
 
 #include <vector>
 #include <iostream>
@@ -16,20 +17,23 @@ namespace PROJ6850 {
 
         Mesh::Mesh(const HalfedgeMesh& mesh, BSDF* bsdf) {
           // triangulate mesh before sending to visualization or render mode
-          HalfedgeMesh _mesh(mesh);
-
-          // Triangulate if needed
           bool triNeeded = false;
           for (auto f = mesh.facesBegin(); f != mesh.facesEnd(); f++) {
             if(f->degree() != 3) {
               triNeeded = true;
             }
           }
+
+          // only copy the halfedge mesh when it has to be triangulated, the
+          // render copy below is all the static mesh keeps
+          HalfedgeMesh triangulated;
           if(triNeeded) {
-            _mesh.triangulate();
+            triangulated = mesh;
+            triangulated.triangulate();
           }
+          const HalfedgeMesh& _mesh = triNeeded ? triangulated : mesh;
 
-          unordered_map<const Vertex*, int> vertexLabels;
+          unordered_map<const Vertex*, uint32_t> vertexLabels;
           vector<const Vertex*> verts;
 
           size_t vertexI = 0;
@@ -41,13 +45,14 @@ namespace PROJ6850 {
             vertexI++;
           }
 
-          positions = new Vector3D[vertexI];
-          normals = new Vector3D[vertexI];
-          for (int i = 0; i < vertexI; i++) {
-            positions[i] = verts[i]->position;
-            normals[i] = verts[i]->normal();
+          positions.resize(vertexI);
+          normals.resize(vertexI);
+          for (size_t i = 0; i < vertexI; i++) {
+            positions[i] = Vec3f(verts[i]->position);
+            normals[i] = Vec3f(verts[i]->normal());
           }
 
+          indices.reserve(3 * _mesh.nFaces());
           for (FaceCIter f = _mesh.facesBegin(); f != _mesh.facesEnd(); f++) {
             HalfedgeCIter h = f->halfedge();
             indices.push_back(vertexLabels[&*h->vertex()]);
@@ -58,15 +63,43 @@ namespace PROJ6850 {
           this->bsdf = bsdf;
         }
 
-        vector<Primitive*> Mesh::get_primitives() const {
-          vector<Primitive*> primitives;
-          size_t num_triangles = indices.size() / 3;
-          for (size_t i = 0; i < num_triangles; ++i) {
-            Triangle* tri = new Triangle(this, indices[i * 3], indices[i * 3 + 1],
-                                         indices[i * 3 + 2]);
-            primitives.push_back(tri);
+        Mesh::Mesh(const Vec3f* positions, const Vec3f* normals, size_t num_vertices,
+                   const uint32_t* indices, size_t num_indices, BSDF* bsdf)
+                : positions(positions, positions + num_vertices),
+                  normals(normals, normals + num_vertices),
+                  bsdf(bsdf),
+                  indices(indices, indices + num_indices) {}
+
+        void Mesh::get_primitives(PrimitiveList* list) const {
+          if (instances.empty()) {
+            list->add_mesh(this);
+            return;
+          }
+
+          // the mesh itself is the first placement
+          vector<Matrix4x4> placements;
+          placements.reserve(instances.size() + 1);
+          placements.push_back(Matrix4x4::identity());
+          placements.insert(placements.end(), instances.begin(), instances.end());
+          list->add_instances(this, placements);
+        }
+
+        void Mesh::set_motion(const Matrix4x4& openToClose) {
+          Matrix4x4 normalToClose = openToClose.inv().T();
+          positions1.resize(positions.size());
+          normals1.resize(normals.size());
+          for (size_t i = 0; i < positions.size(); i++) {
+            Vector4D p = openToClose * Vector4D(positions[i].toVector3D(), 1.0);
+            Vector4D n = normalToClose * Vector4D(normals[i].toVector3D(), 0.0);
+            positions1[i] = Vec3f(p.projectTo3D());
+            normals1[i] = Vec3f(n.to3D().unit());
           }
-          return primitives;
+        }
+
+        size_t Mesh::memory_usage() const {
+          return (positions.capacity() + positions1.capacity()) * sizeof(Vec3f) +
+                 (normals.capacity() + normals1.capacity()) * sizeof(Vec3f) +
+                 indices.capacity() * sizeof(uint32_t);
         }
 
         BSDF* Mesh::get_bsdf() const { return bsdf; }
@@ -79,10 +112,8 @@ namespace PROJ6850 {
           this->bsdf = bsdf;
         }
 
-        std::vector<Primitive*> SphereObject::get_primitives() const {
-          std::vector<Primitive*> primitives;
-          primitives.push_back(new Sphere(this, o, r));
-          return primitives;
+        void SphereObject::get_primitives(PrimitiveList* list) const {
+          list->add_sphere(Sphere(this, Vec3f(o), r));
         }
 
         BSDF* SphereObject::get_bsdf() const { return bsdf; }
@@ -21,11 +21,47 @@ class Mesh : public SceneObject {
   Mesh(const HalfedgeMesh& mesh, BSDF* bsdf);
 
   /**
-   * Get all the primitives (Triangle) in the mesh.
-   * Note that Triangle reference the mesh for the actual data.
-   * \return all the primitives in the mesh
+   * Constructor.
+   * Construct a static mesh from world-space triangle buffers, e.g. those of
+   * a scene cache.
+   */
+  Mesh(const Vec3f* positions, const Vec3f* normals, size_t num_vertices,
+       const uint32_t* indices, size_t num_indices, BSDF* bsdf);
+
+  /**
+   * Add all the primitives (Triangle) in the mesh to the list.
+   * Note that the list references the mesh buffers for the actual data.
+   * A mesh with instances is added as instances of one shared BVH.
+   */
+  void get_primitives(PrimitiveList* list) const;
+
+  /**
+   * Number of triangles in the mesh.
+   */
+  size_t num_triangles() const { return indices.size() / 3; }
+
+  /**
+   * Vertex indices of the i-th triangle.
    */
-  vector<Primitive*> get_primitives() const;
+  const uint32_t* get_triangle(size_t i) const { return &indices[3 * i]; }
+
+  /**
+   * Make the mesh move during the shutter interval: the current positions
+   * are the ones at shutter open, and each vertex moves linearly to its
+   * position under the given transform at shutter close.
+   * \param openToClose transform from the mesh at open to the mesh at close
+   */
+  void set_motion(const Matrix4x4& openToClose);
+
+  /**
+   * Whether the mesh moves during the shutter interval.
+   */
+  bool has_motion() const { return !positions1.empty(); }
+
+  /**
+   * Heap memory used by the mesh buffers, in bytes.
+   */
+  size_t memory_usage() const;
 
   /**
    * Get the BSDF of the surface material of the mesh.
@@ -33,13 +69,17 @@ class Mesh : public SceneObject {
    */
   BSDF* get_bsdf() const;
 
-  Vector3D* positions;  ///< position array
-  Vector3D* normals;    ///< normal array
+  vector<Vec3f> positions;  ///< position array (single precision render copy)
+  vector<Vec3f> normals;    ///< normal array (single precision render copy)
+  vector<Vec3f> positions1; ///< positions at shutter close, empty if the mesh does not move
+  vector<Vec3f> normals1;   ///< normals at shutter close, empty if the mesh does not move
+
+  vector<Matrix4x4> instances;  ///< additional placements of the mesh
 
  private:
   BSDF* bsdf;  ///< BSDF of surface material
 
-  vector<size_t> indices;  ///< triangles defined by indices
+  vector<uint32_t> indices;  ///< triangles defined by indices
 };
 
 /**
@@ -54,11 +94,10 @@ class SphereObject : public SceneObject {
   SphereObject(const Vector3D& o, double r, BSDF* bsdf);
 
   /**
-  * Get all the primitives (Sphere) in the sphere object.
-  * Note that Sphere reference the sphere object for the actual data.
-  * \return all the primitives in the sphere object
+  * Add all the primitives (Sphere) in the sphere object to the list.
+  * Note that Sphere reference the sphere object for the surface material.
   */
-  std::vector<Primitive*> get_primitives() const;
+  void get_primitives(PrimitiveList* list) const;
 
   /**
    * Get the BSDF of the surface material of the sphere.
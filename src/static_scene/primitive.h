@@ -18,7 +18,7 @@ class Primitive {
    * Get the world space bounding box of the primitive.
    * \return world space bounding box of the primitive
    */
-  virtual BBox get_bbox() const = 0;
+  virtual BBoxf get_bbox() const = 0;
 
   /**
    * Ray - Primitive intersection.
@@ -28,7 +28,7 @@ class Primitive {
    * \return true if the given ray intersects with the primitive,
              false otherwise
    */
-  virtual bool intersect(const Ray& r) const = 0;
+  virtual bool intersect(const Rayf& r) const = 0;
 
   /**
    * Ray - Primitive intersection 2.
@@ -40,7 +40,7 @@ class Primitive {
    * \return true if the given ray intersects with the primitive,
              false otherwise
    */
-  virtual bool intersect(const Ray& r, Intersection* i) const = 0;
+  virtual bool intersect(const Rayf& r, Intersection* i) const = 0;
 
   /**
    * Get BSDF.
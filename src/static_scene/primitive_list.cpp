@@ -0,0 +1,168 @@
+#include "primitive_list.h"
+#include "../bvh.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace PROJ6850 {
+namespace StaticScene {
+
+PrimitiveList::~PrimitiveList() {
+  for (BVHAccel* accel : bottomLevels) delete accel;
+  for (PrimitiveList* list : bottomLists) delete list;
+}
+
+void PrimitiveList::add_mesh(const Mesh* mesh) {
+  size_t first = triMesh.size();
+  size_t count = mesh->num_triangles();
+  assert(first + count <= INDEX_MASK);
+
+  uint32_t m = (uint32_t) meshes.size();
+  meshes.push_back(mesh);
+  meshFirst.push_back((uint32_t) first);
+
+  triMesh.insert(triMesh.end(), count, m);
+  if (mesh->has_motion()) motion = true;
+  ids.reserve(ids.size() + count);
+  for (size_t i = 0; i < count; i++) {
+    ids.push_back(make_id(TRIANGLE, (uint32_t) (first + i)));
+  }
+}
+
+void PrimitiveList::add_instances(const Mesh* mesh,
+                                  const std::vector<Matrix4x4>& placements) {
+  PrimitiveList* bottom = new PrimitiveList();
+  bottom->add_mesh(mesh);
+  BVHAccel* accel = new BVHAccel(*bottom);
+  bottomLists.push_back(bottom);
+  bottomLevels.push_back(accel);
+
+  BBoxf bounds = accel->get_bbox();
+  BBox objectBox(bounds.min.toVector3D(), bounds.max.toVector3D());
+  for (const Matrix4x4& placement : placements) {
+    assert(instances.size() < INDEX_MASK);
+    MeshInstance instance;
+    instance.accel = accel;
+    instance.objectToWorld = placement;
+    instance.worldToObject = placement.inv();
+    for (int r = 0; r < 3; r++) {
+      for (int c = 0; c < 3; c++) {
+        instance.normalToWorld(r, c) = instance.worldToObject(c, r);
+      }
+    }
+
+    // world space bounds of the transformed object space box corners
+    BBox worldBox;
+    for (int corner = 0; corner < 8; corner++) {
+      Vector3D p((corner & 1) ? objectBox.max.x : objectBox.min.x,
+                 (corner & 2) ? objectBox.max.y : objectBox.min.y,
+                 (corner & 4) ? objectBox.max.z : objectBox.min.z);
+      worldBox.expand((placement * Vector4D(p, 1.0)).projectTo3D());
+    }
+    instance.bbox = BBoxf(worldBox);
+
+    ids.push_back(make_id(INSTANCE, (uint32_t) instances.size()));
+    instances.push_back(instance);
+  }
+}
+
+bool PrimitiveList::intersect_instance(uint32_t i, const Rayf& r,
+                                       Intersection* isect) const {
+  const MeshInstance& instance = instances[i];
+  Rayf r_obj = r.transform_by(instance.worldToObject);
+  if (!isect) return instance.accel->intersect(r_obj);
+
+  // the closest hit so far also bounds the search inside the instance
+  Intersection hit;
+  hit.t = isect->t;
+  if (!instance.accel->intersect(r_obj, &hit)) return false;
+  r.max_t = r_obj.max_t;
+
+  // move the hit back to world space, growing the error bound by the
+  // rounding of the transform (PBRT's Transform::operator() with error)
+  const Matrix4x4& m = instance.objectToWorld;
+  Vector3D p = hit.p.toVector3D(), p_error = hit.p_error.toVector3D();
+  float g3 = gamma_bound(3);
+  Vec3f world_error;
+  for (int row = 0; row < 3; row++) {
+    double abs_m_p = std::fabs(m(row, 3)), abs_m_error = 0;
+    for (int c = 0; c < 3; c++) {
+      abs_m_p += std::fabs(m(row, c) * p[c]);
+      abs_m_error += std::fabs(m(row, c)) * p_error[c];
+    }
+    world_error[row] = (float) ((g3 + 1) * abs_m_error + g3 * abs_m_p);
+  }
+
+  isect->t = hit.t;
+  isect->p = Vec3f((m * Vector4D(p, 1.0)).to3D());
+  isect->p_error = world_error;
+  isect->n = Vec3f((instance.normalToWorld * hit.n.toVector3D()).unit());
+  isect->ng = Vec3f((instance.normalToWorld * hit.ng.toVector3D()).unit());
+  isect->bsdf = hit.bsdf;
+  return true;
+}
+
+void PrimitiveList::add_sphere(const Sphere& sphere) {
+  assert(spheres.size() < INDEX_MASK);
+  ids.push_back(make_id(SPHERE, (uint32_t) spheres.size()));
+  spheres.push_back(sphere);
+}
+
+bool PrimitiveList::same_layout(const PrimitiveList& other) const {
+  if (ids != other.ids || motion != other.motion ||
+      meshes.size() != other.meshes.size() ||
+      spheres.size() != other.spheres.size() ||
+      instances.size() != other.instances.size() ||
+      bottomLists.size() != other.bottomLists.size()) {
+    return false;
+  }
+
+  // same triangle counts alone could still index different vertices
+  for (size_t m = 0; m < meshes.size(); m++) {
+    size_t count = meshes[m]->num_triangles();
+    if (other.meshes[m]->num_triangles() != count) return false;
+    if (count && !std::equal(meshes[m]->get_triangle(0),
+                             meshes[m]->get_triangle(0) + 3 * count,
+                             other.meshes[m]->get_triangle(0))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t PrimitiveList::memory_usage() const {
+  size_t bytes = meshes.capacity() * sizeof(const Mesh*) +
+                 meshFirst.capacity() * sizeof(uint32_t) +
+                 triMesh.capacity() * sizeof(uint32_t) +
+                 spheres.capacity() * sizeof(Sphere) +
+                 instances.capacity() * sizeof(MeshInstance) +
+                 ids.capacity() * sizeof(PrimitiveID);
+  for (const Mesh* mesh : meshes) {
+    bytes += mesh->memory_usage();
+  }
+  for (size_t i = 0; i < bottomLists.size(); i++) {
+    bytes += bottomLists[i]->memory_usage() +
+             bottomLevels[i]->primitives.capacity() * sizeof(PrimitiveID);
+  }
+  return bytes;
+}
+
+void PrimitiveList::draw(PrimitiveID id, const Color& c) const {
+  switch (type(id)) {
+    case TRIANGLE: triangle(index(id)).draw(c); break;
+    case SPHERE:   spheres[index(id)].draw(c); break;
+    default:       instances[index(id)].bbox.draw(c); break;
+  }
+}
+
+void PrimitiveList::drawOutline(PrimitiveID id, const Color& c) const {
+  switch (type(id)) {
+    case TRIANGLE: triangle(index(id)).drawOutline(c); break;
+    case SPHERE:   spheres[index(id)].drawOutline(c); break;
+    default:       break;
+  }
+}
+
+}  // namespace StaticScene
+}  // namespace PROJ6850
@@ -0,0 +1,205 @@
+#ifndef PROJ6850_STATICSCENE_PRIMITIVE_LIST_H
+#define PROJ6850_STATICSCENE_PRIMITIVE_LIST_H
+
+#include "triangle.h"
+#include "sphere.h"
+
+#include "PROJ6850/matrix3x3.h"
+#include "PROJ6850/matrix4x4.h"
+
+#include <vector>
+#include <cstdint>
+
+namespace PROJ6850 {
+namespace StaticScene {
+
+class BVHAccel;
+
+/**
+ * 32-bit handle of a primitive in a PrimitiveList.
+ * The top bits hold the primitive type and the remaining bits the index of
+ * the primitive among those of its type.
+ */
+typedef uint32_t PrimitiveID;
+
+/**
+ * A placement of a mesh that is shared between several instances.
+ * Rays are moved into the object space of the mesh and tested against its
+ * bottom level BVH; hits are moved back into world space.
+ */
+struct MeshInstance {
+  const BVHAccel* accel;    ///< shared bottom level accelerator
+  Matrix4x4 objectToWorld;  ///< placement of the mesh
+  Matrix4x4 worldToObject;  ///< inverse placement, applied to incoming rays
+  Matrix3x3 normalToWorld;  ///< inverse transpose of the placement
+  BBoxf bbox;               ///< world space bounding box
+};
+
+/**
+ * Flat storage of all the primitives the accelerators are built over.
+ * Triangles are not stored as objects: a triangle is an index range into the
+ * shared position/normal/index buffers of the mesh it belongs to, and the list
+ * only keeps which mesh each triangle comes from. Spheres are stored by value.
+ * Meshes placed several times become instances of a single bottom level BVH
+ * owned by the list, so the list built from the scene is the top level.
+ * Accelerators reference primitives by PrimitiveID and go through the list,
+ * which dispatches on the type bits instead of a virtual call.
+ */
+class PrimitiveList {
+ public:
+  enum Type {
+    TRIANGLE = 0,
+    SPHERE = 1,
+    INSTANCE = 2
+  };
+
+  static const int TYPE_SHIFT = 30;
+  static const uint32_t INDEX_MASK = (1u << TYPE_SHIFT) - 1;
+
+  static inline Type type(PrimitiveID id) { return (Type) (id >> TYPE_SHIFT); }
+  static inline uint32_t index(PrimitiveID id) { return id & INDEX_MASK; }
+  static inline PrimitiveID make_id(Type type, uint32_t index) {
+    return ((uint32_t) type << TYPE_SHIFT) | index;
+  }
+
+  PrimitiveList() : motion(false) {}
+
+  /**
+   * Destructor.
+   * Frees the bottom level structures of instanced meshes; meshes themselves
+   * are owned by the scene.
+   */
+  ~PrimitiveList();
+
+  /**
+   * Add all the triangles of a mesh. The list references the mesh buffers,
+   * so the mesh must outlive the list.
+   */
+  void add_mesh(const Mesh* mesh);
+
+  /**
+   * Add a mesh placed several times. A bottom level BVH is built once over
+   * the mesh triangles and each placement becomes one instance of it.
+   * \param mesh mesh to instance, must outlive the list
+   * \param placements object to world transform of each instance
+   */
+  void add_instances(const Mesh* mesh, const std::vector<Matrix4x4>& placements);
+
+  /**
+   * Add a sphere.
+   */
+  void add_sphere(const Sphere& sphere);
+
+  /**
+   * Check that another list holds the same primitives with the same ids,
+   * i.e. it was built from the same meshes and spheres with possibly moved
+   * vertices, so accelerators over this list can be refitted to the other.
+   */
+  bool same_layout(const PrimitiveList& other) const;
+
+  /**
+   * Ids of all the primitives, in the order they were added.
+   */
+  const std::vector<PrimitiveID>& get_ids() const { return ids; }
+
+  size_t size() const { return ids.size(); }
+  size_t num_triangles() const { return triMesh.size(); }
+  size_t num_instances() const { return instances.size(); }
+
+  /**
+   * Estimated heap memory used by the list and the mesh buffers it
+   * references, in bytes.
+   */
+  size_t memory_usage() const;
+
+  /**
+   * Whether some primitives move during the shutter interval.
+   */
+  bool has_motion() const { return motion; }
+
+  /**
+   * Bounds of a primitive over the whole shutter interval.
+   */
+  BBoxf get_bbox(PrimitiveID id) const {
+    switch (type(id)) {
+      case TRIANGLE: return triangle(index(id)).get_bbox();
+      case SPHERE:   return spheres[index(id)].get_bbox();
+      default:       return instances[index(id)].bbox;
+    }
+  }
+
+  /**
+   * Bounds of a primitive at a time within the shutter interval. Spheres and
+   * instance placements do not move, so only triangles differ from get_bbox.
+   */
+  BBoxf get_bbox(PrimitiveID id, float time) const {
+    switch (type(id)) {
+      case TRIANGLE: return triangle(index(id)).get_bbox(time);
+      case SPHERE:   return spheres[index(id)].get_bbox();
+      default:       return instances[index(id)].bbox;
+    }
+  }
+
+  /**
+   * Ray - Primitive intersection, see Primitive::intersect.
+   */
+  inline bool intersect(PrimitiveID id, const Rayf& r) const {
+    switch (type(id)) {
+      case TRIANGLE: return triangle(index(id)).intersect(r);
+      case SPHERE:   return spheres[index(id)].intersect(r);
+      default:       return intersect_instance(index(id), r, NULL);
+    }
+  }
+
+  /**
+   * Ray - Primitive intersection 2, see Primitive::intersect. The id of the
+   * intersected primitive is stored in the intersection.
+   */
+  inline bool intersect(PrimitiveID id, const Rayf& r, Intersection* i) const {
+    bool hit;
+    switch (type(id)) {
+      case TRIANGLE: hit = triangle(index(id)).intersect(r, i); break;
+      case SPHERE:   hit = spheres[index(id)].intersect(r, i); break;
+      default:       hit = intersect_instance(index(id), r, i); break;
+    }
+    if (hit) i->prim_id = id;
+    return hit;
+  }
+
+  /**
+   * Draw with OpenGL (for visualizer)
+   */
+  void draw(PrimitiveID id, const Color& c) const;
+
+  /**
+   * Draw outline with OpenGL (for visualizer)
+   */
+  void drawOutline(PrimitiveID id, const Color& c) const;
+
+ private:
+  PrimitiveList(const PrimitiveList&);
+  PrimitiveList& operator=(const PrimitiveList&);
+
+  bool intersect_instance(uint32_t i, const Rayf& r, Intersection* isect) const;
+
+  inline Triangle triangle(uint32_t i) const {
+    uint32_t m = triMesh[i];
+    const uint32_t* v = meshes[m]->get_triangle(i - meshFirst[m]);
+    return Triangle(meshes[m], v[0], v[1], v[2]);
+  }
+
+  std::vector<const Mesh*> meshes;  ///< meshes the triangles index into
+  std::vector<uint32_t> meshFirst;  ///< index of the first triangle of each mesh
+  std::vector<uint32_t> triMesh;    ///< mesh of each triangle
+  std::vector<Sphere> spheres;      ///< spheres, by value
+  std::vector<MeshInstance> instances;     ///< placements of instanced meshes
+  std::vector<PrimitiveList*> bottomLists; ///< owned triangles of instanced meshes
+  std::vector<BVHAccel*> bottomLevels;     ///< owned BVHs of instanced meshes
+  std::vector<PrimitiveID> ids;     ///< all primitives in insertion order
+  bool motion;                      ///< some primitives move during the shutter
+};
+
+}  // namespace StaticScene
+}  // namespace PROJ6850
+
+#endif  // PROJ6850_STATICSCENE_PRIMITIVE_LIST_H
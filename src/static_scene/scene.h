@@ -10,6 +10,32 @@
 namespace PROJ6850 {
 namespace StaticScene {
 
+class PrimitiveList;
+
+
+/**
+ * Bounds of a node whose primitives move during the shutter interval, at
+ * shutter open and close. Vertices move linearly, so the box interpolated at
+ * the time of a ray encloses everything the node holds at that time.
+ */
+    struct MotionBounds {
+        MotionBounds(const BBoxf &open, const BBoxf &close) : open(open), close(close) {}
+
+        /**
+         * Bounds at a time within the shutter interval, padded for the
+         * rounding of the interpolation.
+         */
+        inline BBoxf at(float time) const {
+          Vec3f min = (1.0f - time) * open.min + time * close.min;
+          Vec3f max = (1.0f - time) * open.max + time * close.max;
+          Vec3f pad = gamma_bound(3) * (abs(open.min) + abs(close.min) +
+                                        abs(open.max) + abs(close.max));
+          return BBoxf(min - pad, max + pad);
+        }
+
+        BBoxf open;   ///< bounds at shutter open
+        BBoxf close;  ///< bounds at shutter close
+    };
 
 /**
  * A node in the BVH accelerator aggregate.
@@ -19,22 +45,34 @@ namespace StaticScene {
  * index into the primitive vector for actual data. In this implementation all
  * primitives (index + range) are stored on leaf nodes. A leaf node has no child
  * node and its range should be no greater than the maximum leaf size used when
- * constructing the BVH.
+ * constructing the BVH. The kd-tree uses the same layout; since a primitive
+ * may overlap several kd-tree leaves, its primitive list holds duplicates.
+ * Nodes are allocated from the MemoryArena of the accelerator that owns them
+ * and must stay trivially destructible. When the primitives move, bb encloses
+ * them over the whole shutter interval and the BVH also stores their bounds
+ * at open and close.
  */
     struct AccelNode {
-        AccelNode(BBox bb, size_t start, size_t range) // flat tree representaation for BVH
-                : bb(bb), start(start), range(range), l(NULL), r(NULL) {} // set representation for kd-tree
-
-        AccelNode(BBox bb, std::set<int>& indices)
-                : bb(bb), start(0), range(0), indices(indices), l(NULL), r(NULL) {}
+        AccelNode(BBoxf bb, size_t start, size_t range) // flat tree representaation
+                : bb(bb), start(start), range(range), sah(0), motion(NULL), l(NULL), r(NULL) {}
 
         inline bool isLeaf() const { return l == NULL && r == NULL; }
 
-        BBox bb;       ///< bounding box of the node
+        /**
+         * Ray - node bounds intersection, at the time of the ray for moving
+         * nodes.
+         */
+        inline bool intersect(const Rayf &ray, float &t0, float &t1) const {
+          if (motion) return motion->at(ray.time).intersect(ray, t0, t1);
+          return bb.intersect(ray, t0, t1);
+        }
+
+        BBoxf bb;      ///< bounding box of the node
         size_t start;  ///< start index into the primitive list
         size_t range;  ///< range of index into the primitive list
+        float sah;     ///< SAH cost per unit area of the subtree when it was built
+        MotionBounds *motion;  ///< bounds at shutter open and close, NULL if static
 
-        std::set<int> indices; // index into the primitive list
         AccelNode *l;    ///< left child node
         AccelNode *r;    ///< right child node
 
@@ -50,6 +88,7 @@ namespace StaticScene {
     struct RenderingStat {
         int totalVisitedNodes;
         unsigned long long totalRayTriangleTest;
+        unsigned long long totalRays;
     };
 
 /**
@@ -57,11 +96,13 @@ namespace StaticScene {
  */
 class SceneObject {
  public:
+  virtual ~SceneObject() {}
+
   /**
-   * Get all the primitives in the scene object.
-   * \return a vector of all the primitives in the scene object
+   * Add all the primitives in the scene object to the given list.
+   * \param list primitive list the accelerators are built from
    */
-  virtual std::vector<Primitive*> get_primitives() const = 0;
+  virtual void get_primitives(PrimitiveList* list) const = 0;
 
   /**
    * Get the surface BSDF of the object's surface.
@@ -2,6 +2,7 @@
 
 #include <cmath>
 #include <cassert>
+#include <algorithm>
 
 #include "../bsdf.h"
 #include "../misc/sphere_drawing.h"
@@ -9,43 +10,53 @@
 namespace PROJ6850 {
     namespace StaticScene {
 
-        bool Sphere::test(const Ray& r, double& t1, double& t2) const {
+        bool Sphere::test(const Rayf& r, float& t1, float& t2) const {
           // Implement ray - sphere intersection test.
           // Return true if there are intersections and writing the
           // smaller of the two intersection times in t1 and the larger in t2.
 
           // convert ray to object space
-          Vector3D o_objSpace = r.o - o, d = r.d;
+          Vec3f o_objSpace = r.o - o, d = r.d;
 
           // solve (ox+tdx)^2 + (oy+tdy)^2 + (oz+tdz)^2 = r^2
-          double  A = d.norm2(), B = 2.0 * dot(d, o_objSpace),
+          float  A = d.norm2(), B = 2.0f * dot(d, o_objSpace),
                   C = o_objSpace.norm2() - r2;
-          double delta = B * B - 4.0 * A * C;
-          if (delta < 0.0)
+          float delta = B * B - 4.0f * A * C;
+          if (delta < 0.0f)
             return false;
 
-          double rootDelta = sqrtf(delta);
-            t1 = -0.5f * (B + rootDelta) / A;
-            t2 = -0.5f * (B - rootDelta) / A;
+          // numerically stable form of the quadratic roots, the textbook
+          // (-B +- sqrt(delta)) / 2A cancels catastrophically in float for
+          // rays starting close to the surface
+          float rootDelta = sqrtf(delta);
+          float q = (B < 0) ? -0.5f * (B - rootDelta) : -0.5f * (B + rootDelta);
+          // q is 0 only when B and A * C are, i.e. a degenerate direction or a
+          // ray starting on the sphere and tangent to it, whose only root t = 0
+          // is never past min_t
+          if (q == 0.0f)
+            return false;
+          t1 = q / A;
+          t2 = C / q;
+          if (t1 > t2) std::swap(t1, t2);
           return t2 > r.min_t;
         }
 
-        bool Sphere::intersect(const Ray& r) const {
-          double t1 = 0, t2 = 0;
+        bool Sphere::intersect(const Rayf& r) const {
+          float t1 = 0, t2 = 0;
           if (test(r, t1, t2)) {
             return (isBetween(t1, r.min_t, r.max_t) || isBetween(t2, r.min_t, r.max_t));
           }
           return false;
         }
 
-        bool Sphere::intersect(const Ray& r, Intersection* isect) const {
+        bool Sphere::intersect(const Rayf& r, Intersection* isect) const {
           // Implement ray - sphere intersection.
           // Note again that you might want to use the the Sphere::test helper here.
           // When an intersection takes place, the Intersection data should be updated
           // correspondingly.
-          double t1 = 0, t2 = 0;
+          float t1 = 0, t2 = 0;
           if (test(r, t1, t2) && (isBetween(t1, r.min_t, r.max_t) || isBetween(t2, r.min_t, r.max_t))) {
-            double t_hit = t1;
+            float t_hit = t1;
             if (!isBetween(t1, r.min_t, r.max_t)) {
               t_hit = t2;
               assert(isBetween(t2, r.min_t, r.max_t));
@@ -54,10 +65,17 @@ namespace PROJ6850 {
               return false;
             isect->t = t_hit;
             isect->bsdf = get_bsdf();
-            isect->primitive = this;
 
-            Vector3D hitPoint = r.o + t_hit * r.d;
-            isect->n = normal(hitPoint);
+            // re-project the hit point onto the sphere, which bounds its
+            // error by a few ulps of the radius regardless of t
+            Vec3f p_obj = r.o + t_hit * r.d - o;
+            p_obj *= this->r / p_obj.norm();
+            isect->p = o + p_obj;
+            isect->p_error = gamma_bound(5) * abs(p_obj) +
+                             gamma_bound(1) * (abs(o) + abs(p_obj));
+
+            isect->n = p_obj.unit();
+            isect->ng = isect->n;
 
             r.max_t = t_hit;
             return true;
@@ -65,13 +83,13 @@ namespace PROJ6850 {
           return false;
         }
 
-        void Sphere::draw(const Color& c) const { Misc::draw_sphere_opengl(o, r, c); }
+        void Sphere::draw(const Color& c) const { Misc::draw_sphere_opengl(o.toVector3D(), r, c); }
 
         void Sphere::drawOutline(const Color& c) const {
           // Misc::draw_sphere_opengl(o, r, c);
         }
 
-        bool Sphere::isBetween(double testNum, double min, double max) const {
+        bool Sphere::isBetween(float testNum, float min, float max) const {
           return ((testNum >= min) && (testNum <= max));
         }
 
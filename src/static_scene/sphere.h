@@ -14,21 +14,21 @@ namespace StaticScene {
  * radius. The sphere primitive may refer back to the sphere object for
  * other information such as surface material.
  */
-class Sphere : public Primitive {
+class Sphere {
  public:
   /**
    * Parameterized Constructor.
    * Construct a sphere with given origin & radius.
    */
-  Sphere(const SphereObject* object, const Vector3D& o, double r)
+  Sphere(const SphereObject* object, const Vec3f& o, float r)
       : object(object), o(o), r(r), r2(r * r) {}
 
   /**
    * Get the world space bounding box of the sphere.
    * \return world space bounding box of the sphere
    */
-  BBox get_bbox() const {
-    return BBox(o - Vector3D(r, r, r), o + Vector3D(r, r, r));
+  BBoxf get_bbox() const {
+    return BBoxf(o - Vec3f(r, r, r), o + Vec3f(r, r, r));
   }
 
   /**
@@ -39,7 +39,7 @@ class Sphere : public Primitive {
    * \return true if the given ray intersects with the sphere,
              false otherwise
    */
-  bool intersect(const Ray& r) const;
+  bool intersect(const Rayf& r) const;
 
   /**
    * Ray - Sphere intersection 2.
@@ -51,7 +51,7 @@ class Sphere : public Primitive {
    * \return true if the given ray intersects with the sphere,
              false otherwise
    */
-  bool intersect(const Ray& r, Intersection* i) const;
+  bool intersect(const Rayf& r, Intersection* i) const;
 
   /**
    * Get BSDF.
@@ -68,7 +68,7 @@ class Sphere : public Primitive {
    *          intersection and does not check if it's actually on the sphere
    * \return normal at the given point of intersection
    */
-  Vector3D normal(Vector3D p) const { return (p - o).unit(); }
+  Vec3f normal(Vec3f p) const { return (p - o).unit(); }
 
   /**
    * Draw with OpenGL (for visualizer)
@@ -86,14 +86,14 @@ class Sphere : public Primitive {
    * intersections and writing the smaller of the two intersection times in t1
    * and the larger in t2.
    */
-  bool test(const Ray& ray, double& t1, double& t2) const;
-    bool isBetween(double testNum, double min, double max) const;
+  bool test(const Rayf& ray, float& t1, float& t2) const;
+    bool isBetween(float testNum, float min, float max) const;
 
   const SphereObject* object;  ///< pointer to the sphere object
 
-  Vector3D o;  ///< origin of the sphere
-  double r;    ///< radius
-  double r2;   ///< radius squared
+  Vec3f o;   ///< origin of the sphere
+  float r;   ///< radius
+  float r2;  ///< radius squared
 
 };  // class Sphere
 
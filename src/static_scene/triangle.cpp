@@ -6,19 +6,20 @@
 namespace PROJ6850 {
     namespace StaticScene {
 
-        Triangle::Triangle(const Mesh* mesh, vector<size_t>& v) : mesh(mesh), v(v) {}
-        Triangle::Triangle(const Mesh* mesh, size_t v1, size_t v2, size_t v3)
-                : mesh(mesh), v1(v1), v2(v2), v3(v3) {}
+        BBoxf Triangle::get_bbox() const {
+          BBoxf bbox = get_bbox(0.0f);
+          if (mesh->has_motion()) bbox.expand(get_bbox(1.0f));
+          return bbox;
+        }
 
-        BBox Triangle::get_bbox() const {
-          // TODO (PathTracer):
-          Vector3D p1 = mesh->positions[v1], p2 = mesh->positions[v2], p3 = mesh->positions[v3];
-          Vector3D pMax = Vector3D( max(p1.x, p2.x, p3.x),  max(p1.y, p2.y, p3.y),  max(p1.z, p2.z, p3.z));
-          Vector3D pMin = Vector3D( min(p1.x, p2.x, p3.x),  min(p1.y, p2.y, p3.y),  min(p1.z, p2.z, p3.z));
-          return BBox(pMin, pMax);
+        BBoxf Triangle::get_bbox(float time) const {
+          Vec3f p1 = position(v1, time), p2 = position(v2, time), p3 = position(v3, time);
+          Vec3f pMax = Vec3f( max(p1.x, p2.x, p3.x),  max(p1.y, p2.y, p3.y),  max(p1.z, p2.z, p3.z));
+          Vec3f pMin = Vec3f( min(p1.x, p2.x, p3.x),  min(p1.y, p2.y, p3.y),  min(p1.z, p2.z, p3.z));
+          return BBoxf(pMin, pMax);
         }
 
-        double Triangle::max(double a, double b, double c) const {
+        float Triangle::max(float a, float b, float c) const {
           if (a > b && a > c)
             return a;
           if (b > c)
@@ -26,7 +27,7 @@ namespace PROJ6850 {
           return c;
         }
 
-        double Triangle::min(double a, double b, double c) const {
+        float Triangle::min(float a, float b, float c) const {
           if (a < b && a < c)
             return a;
           if (b < c)
@@ -34,16 +35,16 @@ namespace PROJ6850 {
           return c;
         }
 
-        bool Triangle::getIntersectInfo(const Ray &r, double &u, double &v, double &t) const{
-          Vector3D p0 = mesh->positions[v1], p1 = mesh->positions[v2], p2 = mesh->positions[v3];
-          Vector3D e1 = p1 - p0, e2 = p2 - p0,
+        bool Triangle::getIntersectInfo(const Rayf &r, float &u, float &v, float &t) const{
+          Vec3f p0 = position(v1, r.time), p1 = position(v2, r.time), p2 = position(v3, r.time);
+          Vec3f e1 = p1 - p0, e2 = p2 - p0,
                   s = r.o - p0,
                   s_x_e2 = cross(s, e2),
                   e1_x_d = cross(e1, r.d);
-          double u_x_area = -1.0 * dot(s_x_e2, r.d),
+          float u_x_area = -1.0f * dot(s_x_e2, r.d),
           v_x_area = dot(e1_x_d , s),
-          t_x_ara = -1.0 * dot(s_x_e2, e1);
-          double area = dot(e1_x_d, e2);
+          t_x_ara = -1.0f * dot(s_x_e2, e1);
+          float area = dot(e1_x_d, e2);
 
           // edge case: ray is parallel to the plane of the triangle
           if (area == 0) {
@@ -53,28 +54,39 @@ namespace PROJ6850 {
             v = v_x_area / area;
             t = t_x_ara / area;
             bool isValidTime = t <= r.max_t && t>= r.min_t;
-            return ((isValidTime) && (u >= 0.0) && (v >= 0.0) && (u <= 1.0) && (v <= 1.0) && (u + v <= 1.0 ));
+            return ((isValidTime) && (u >= 0.0f) && (v >= 0.0f) && (u <= 1.0f) && (v <= 1.0f) && (u + v <= 1.0f ));
         }
 
-        bool Triangle::intersect(const Ray& r) const {
-          double u = 0.0,v = 0.0,t = 0.0;
+        bool Triangle::intersect(const Rayf& r) const {
+          float u = 0.0f,v = 0.0f,t = 0.0f;
           return (getIntersectInfo(r, u, v, t));
         }
 
-        bool Triangle::intersect(const Ray& r, Intersection* isect) const {
-          double u = 0.0,v = 0.0,t = 0.0; // u is barycentric coordinate of
+        bool Triangle::intersect(const Rayf& r, Intersection* isect) const {
+          float u = 0.0f,v = 0.0f,t = 0.0f; // u is barycentric coordinate of
           if (getIntersectInfo(r, u, v, t)) {
             if (isect->t > t) {
               r.max_t = t;
-              Vector3D interpolatedNormal =  u * mesh->normals[v2] + v * mesh->normals[v3] + (1.0-u-v) * mesh->normals[v1];
+              Vec3f interpolatedNormal =  u * normal(v2, r.time) + v * normal(v3, r.time) + (1.0f-u-v) * normal(v1, r.time);
               interpolatedNormal.normalize();
               if (dot(interpolatedNormal, r.d) > 0) {
                 // intersection occurs at the back
-                interpolatedNormal *= -1.0;
+                interpolatedNormal *= -1.0f;
               }
+              Vec3f p0 = position(v1, r.time), p1 = position(v2, r.time), p2 = position(v3, r.time);
+              Vec3f geometricNormal = cross(p1 - p0, p2 - p0).unit();
+
+              // interpolate the hit point from the vertices rather than
+              // evaluating the ray at t: its error is then bounded by the
+              // (small) barycentric rounding instead of growing with t
+              float b0 = 1.0f - u - v;
+              Vec3f b0p0 = b0 * p0, b1p1 = u * p1, b2p2 = v * p2;
+              isect->p = b0p0 + b1p1 + b2p2;
+              isect->p_error = gamma_bound(7) * (abs(b0p0) + abs(b1p1) + abs(b2p2));
+
               isect->t = t;
               isect->n = interpolatedNormal;
-              isect->primitive = this;
+              isect->ng = geometricNormal;
               isect->bsdf = get_bsdf();
               return true;
             }
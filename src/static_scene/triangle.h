@@ -13,8 +13,10 @@ namespace StaticScene {
  * rather than holding the data itself. This means that its lifetime is tied
  * to that of the original mesh. The primitive may refer back to the mesh
  * object for other information such as normal, texcoord, material.
+ * Triangles are not stored anywhere: PrimitiveList builds one on the stack
+ * from the mesh index buffer whenever it needs to test or draw it.
  */
-class Triangle : public Primitive {
+class Triangle {
  public:
   /**
    * Constructor.
@@ -24,14 +26,21 @@ class Triangle : public Primitive {
    * \param v2 index of triangle vertex in the mesh's attribute arrays
    * \param v3 index of triangle vertex in the mesh's attribute arrays
    */
-  Triangle(const Mesh* mesh, vector<size_t>& v);
-  Triangle(const Mesh* mesh, size_t v1, size_t v2, size_t v3);
+  Triangle(const Mesh* mesh, uint32_t v1, uint32_t v2, uint32_t v3)
+      : mesh(mesh), v1(v1), v2(v2), v3(v3) {}
 
   /**
-   * Get the world space bounding box of the triangle.
+   * Get the world space bounding box of the triangle. For a moving mesh the
+   * box encloses the triangle over the whole shutter interval.
    * \return world space bounding box of the triangle
    */
-  BBox get_bbox() const;
+  BBoxf get_bbox() const;
+
+  /**
+   * Get the world space bounding box of the triangle at a given time.
+   * \param time time within the shutter interval, in [0, 1]
+   */
+  BBoxf get_bbox(float time) const;
 
 
   /**
@@ -42,7 +51,7 @@ class Triangle : public Primitive {
    * \return true if the given ray intersects with the triangle,
              false otherwise
    */
-  bool intersect(const Ray& r) const;
+  bool intersect(const Rayf& r) const;
 
   /**
    * Ray - Triangle intersection 2.
@@ -54,7 +63,7 @@ class Triangle : public Primitive {
    * \return true if the given ray intersects with the triangle,
              false otherwise
    */
-  bool intersect(const Ray& r, Intersection* i) const;
+  bool intersect(const Rayf& r, Intersection* i) const;
 
   /**
    * Get BSDF.
@@ -76,14 +85,23 @@ class Triangle : public Primitive {
  private:
   const Mesh* mesh;  ///< pointer to the mesh the triangle is a part of
 
-  size_t v1;  ///< index into the mesh attribute arrays
-  size_t v2;  ///< index into the mesh attribute arrays
-  size_t v3;  ///< index into the mesh attribute arrays
-
-  vector<size_t> v;
-  bool getIntersectInfo(const Ray &r, double &u_times_area, double &v_times_area, double &t_times_ara) const;
-    double max(double a, double b, double c) const;
-    double min(double a, double b, double c) const;
+  uint32_t v1;  ///< index into the mesh attribute arrays
+  uint32_t v2;  ///< index into the mesh attribute arrays
+  uint32_t v3;  ///< index into the mesh attribute arrays
+
+  // vertex attributes at a time within the shutter interval
+  inline Vec3f position(uint32_t v, float time) const {
+    if (!mesh->has_motion()) return mesh->positions[v];
+    return (1.0f - time) * mesh->positions[v] + time * mesh->positions1[v];
+  }
+  inline Vec3f normal(uint32_t v, float time) const {
+    if (!mesh->has_motion()) return mesh->normals[v];
+    return (1.0f - time) * mesh->normals[v] + time * mesh->normals1[v];
+  }
+
+  bool getIntersectInfo(const Rayf &r, float &u_times_area, float &v_times_area, float &t_times_ara) const;
+    float max(float a, float b, float c) const;
+    float min(float a, float b, float c) const;
 
 
 };  // class Triangle
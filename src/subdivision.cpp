@@ -0,0 +1,352 @@
+#include "subdivision.h"
+
+#include "work_queue.h"
+
+#include <algorithm>
+
+namespace PROJ6850 {
+
+namespace {
+
+typedef IndexedHalfedgeMesh::Id Id;
+
+// Where the elements of the coarse mesh go in the refined one.
+struct Numbering {
+  std::vector<Id> prev;         // halfedge before each halfedge
+  std::vector<Id> degree;       // vertices of each face or boundary loop
+  std::vector<Id> faceRank;     // rank of each face among faces, or of each
+                                // boundary loop among boundary loops
+  std::vector<Id> firstCorner;  // first refined quad of each face
+  std::vector<Id> corner;       // refined quad of each non-boundary halfedge
+  Id nCorners;
+  Id nLoops;
+};
+
+void number(const IndexedHalfedgeMesh& coarse, Numbering* n,
+            size_t num_threads) {
+  Size nH = coarse.halfedgeNext.size(), nF = coarse.faceHalfedge.size();
+  n->prev.resize(nH);
+  n->corner.resize(nH);
+  n->degree.resize(nF);
+  n->faceRank.resize(nF);
+  n->firstCorner.resize(nF);
+
+  parallel_for_ranges(nH, num_threads, [&](size_t begin, size_t end) {
+    for (Id h = begin; h < end; h++) n->prev[coarse.halfedgeNext[h]] = h;
+  });
+  parallel_for_ranges(nF, num_threads, [&](size_t begin, size_t end) {
+    for (Id f = begin; f < end; f++) n->degree[f] = coarse.faceDegree(f);
+  });
+
+  // Quads follow the faces they split, in face order.
+  Id nCorners = 0, nFaces = 0, nLoops = 0;
+  for (Id f = 0; f < nF; f++) {
+    if (coarse.faceIsBoundary[f]) {
+      n->faceRank[f] = nLoops++;
+    } else {
+      n->faceRank[f] = nFaces++;
+      n->firstCorner[f] = nCorners;
+      nCorners += n->degree[f];
+    }
+  }
+  n->nCorners = nCorners;
+  n->nLoops = nLoops;
+
+  parallel_for_ranges(nF, num_threads, [&](size_t begin, size_t end) {
+    for (Id f = begin; f < end; f++) {
+      bool boundary = coarse.faceIsBoundary[f];
+      Id c = n->firstCorner[f];
+      Id h = coarse.faceHalfedge[f];
+      do {
+        n->corner[h] = boundary ? IndexedHalfedgeMesh::NONE : c++;
+        h = coarse.halfedgeNext[h];
+      } while (h != coarse.faceHalfedge[f]);
+    }
+  });
+}
+
+/*
+ * Each coarse halfedge h, from a to b, splits into S0(h) = 2h from a to the
+ * edge vertex and S1(h) = 2h + 1 from there to b. Inside a face, the quad of
+ * h is bounded by S0(h), I0(h) from the edge vertex to the face vertex,
+ * I1(prev(h)) back out to the edge vertex of the previous halfedge, and
+ * S1(prev(h)). The I halfedges come after the S ones, a pair per quad.
+ * Edge e splits into edges 2e and 2e + 1; the edges between I0 and I1 come
+ * after those, one per quad.
+ */
+void buildTopology(const IndexedHalfedgeMesh& coarse, const Numbering& n,
+                   IndexedHalfedgeMesh* fine, size_t num_threads) {
+  Size nH = coarse.halfedgeNext.size(), nV = coarse.vertexHalfedge.size();
+  Size nE = coarse.edgeHalfedge.size(), nF = coarse.faceHalfedge.size();
+  Size nC = n.nCorners;
+  fine->resize(2 * nH + 2 * nC, nV + nE + nF - n.nLoops, 2 * nE + nC, nC,
+               n.nLoops);
+  Id faceVertices = nV + nE;
+
+  parallel_for_ranges(nH, num_threads, [&](size_t begin, size_t end) {
+    for (Id h = begin; h < end; h++) {
+      Id t = coarse.halfedgeTwin[h], next = coarse.halfedgeNext[h];
+      Id e = coarse.halfedgeEdge[h], f = coarse.halfedgeFace[h];
+      bool first = coarse.edgeHalfedge[e] == h;
+      Id s0 = 2 * h, s1 = 2 * h + 1;
+      Id e0 = first ? 2 * e : 2 * e + 1, e1 = first ? 2 * e + 1 : 2 * e;
+      if (first) {
+        fine->edgeHalfedge[2 * e] = s0;
+        fine->edgeHalfedge[2 * e + 1] = s1;
+      }
+      if (coarse.faceIsBoundary[f]) {
+        Id loop = nC + n.faceRank[f];
+        fine->setNeighbors(s0, s1, 2 * t + 1, coarse.halfedgeVertex[h], e0, loop);
+        fine->setNeighbors(s1, 2 * next, 2 * t, nV + e, e1, loop);
+        continue;
+      }
+      Id c = n.corner[h], cNext = n.corner[next];
+      Id i0 = 2 * nH + 2 * c, i1 = i0 + 1;
+      Id i1Prev = 2 * nH + 2 * n.corner[n.prev[h]] + 1;
+      fine->setNeighbors(s0, i0, 2 * t + 1, coarse.halfedgeVertex[h], e0, c);
+      fine->setNeighbors(s1, 2 * next, 2 * t, nV + e, e1, cNext);
+      fine->setNeighbors(i0, i1Prev, i1, nV + e, 2 * nE + c, c);
+      fine->setNeighbors(i1, s1, i0, faceVertices + n.faceRank[f], 2 * nE + c,
+                         cNext);
+      fine->edgeHalfedge[2 * nE + c] = i0;
+      fine->faceHalfedge[c] = s0;
+    }
+  });
+
+  // Boundary vertices keep referring to the boundary halfedge leaving them.
+  parallel_for_ranges(nV, num_threads, [&](size_t begin, size_t end) {
+    for (Id v = begin; v < end; v++) {
+      fine->vertexHalfedge[v] = 2 * coarse.vertexHalfedge[v];
+    }
+  });
+  parallel_for_ranges(nE, num_threads, [&](size_t begin, size_t end) {
+    for (Id e = begin; e < end; e++) {
+      Id h = coarse.edgeHalfedge[e];
+      if (coarse.isBoundaryHalfedge(coarse.halfedgeTwin[h])) {
+        h = coarse.halfedgeTwin[h];
+      }
+      fine->vertexHalfedge[nV + e] = 2 * h + 1;
+    }
+  });
+  parallel_for_ranges(nF, num_threads, [&](size_t begin, size_t end) {
+    for (Id f = begin; f < end; f++) {
+      Id h = coarse.faceHalfedge[f];
+      if (coarse.faceIsBoundary[f]) {
+        fine->faceHalfedge[nC + n.faceRank[f]] = 2 * h;
+      } else {
+        fine->vertexHalfedge[faceVertices + n.faceRank[f]] =
+            2 * nH + 2 * n.corner[h] + 1;
+      }
+    }
+  });
+}
+
+// Appends weights to a stencil row.
+struct Row {
+  Id* vertex;
+  double* weight;
+  size_t size;
+
+  void add(Id v, double w) {
+    vertex[size] = v;
+    weight[size++] = w;
+  }
+
+  // adds w / deg to each vertex of a face
+  void addFace(const IndexedHalfedgeMesh& mesh, const Numbering& n, Id f,
+               double w) {
+    w /= n.degree[f];
+    Id h = mesh.faceHalfedge[f];
+    do {
+      add(mesh.halfedgeVertex[h], w);
+      h = mesh.halfedgeNext[h];
+    } while (h != mesh.faceHalfedge[f]);
+  }
+
+  // sorts the weights by vertex and sums those of the same vertex
+  void merge() {
+    for (size_t i = 1; i < size; i++) {
+      Id v = vertex[i];
+      double w = weight[i];
+      size_t j = i;
+      for (; j > 0 && vertex[j - 1] > v; j--) {
+        vertex[j] = vertex[j - 1];
+        weight[j] = weight[j - 1];
+      }
+      vertex[j] = v;
+      weight[j] = w;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < size; i++) {
+      if (kept > 0 && vertex[kept - 1] == vertex[i]) {
+        weight[kept - 1] += weight[i];
+      } else {
+        vertex[kept] = vertex[i];
+        weight[kept++] = weight[i];
+      }
+    }
+    size = kept;
+  }
+};
+
+}  // namespace
+
+void QuadSubdivision::build(const IndexedHalfedgeMesh& coarse,
+                            bool useCatmullClark, IndexedHalfedgeMesh* fine,
+                            size_t num_threads) {
+  Numbering n;
+  number(coarse, &n, num_threads);
+  buildTopology(coarse, n, fine, num_threads);
+
+  Size nV = coarse.vertexHalfedge.size(), nE = coarse.edgeHalfedge.size();
+  Size nF = coarse.faceHalfedge.size();
+  Size nRows = fine->vertexHalfedge.size();
+  Id faceVertices = nV + nE;
+  coarseVertices = nV;
+
+  // The rows of the refined vertices, in their order: coarse vertices, then
+  // edges, then faces. Each row is filled into room for as many weights as
+  // it can have, then has the weights of a same vertex merged, and the rows
+  // are packed together at the end.
+  auto isSmoothEdge = [&](Id e) {
+    return useCatmullClark && !coarse.isBoundaryEdge(e);
+  };
+  auto isSmoothVertex = [&](Id v) {
+    return useCatmullClark && !coarse.isBoundaryVertex(v);
+  };
+  std::vector<size_t> room(nRows + 1, 0);
+  parallel_for_ranges(nV, num_threads, [&](size_t begin, size_t end) {
+    for (Id v = begin; v < end; v++) {
+      if (!useCatmullClark) {
+        room[v + 1] = 1;
+      } else if (!isSmoothVertex(v)) {
+        room[v + 1] = 3;
+      } else {
+        size_t size = 1;
+        Id h = coarse.vertexHalfedge[v];
+        do {
+          size += 1 + n.degree[coarse.halfedgeFace[h]];
+          h = coarse.halfedgeNext[coarse.halfedgeTwin[h]];
+        } while (h != coarse.vertexHalfedge[v]);
+        room[v + 1] = size;
+      }
+    }
+  });
+  parallel_for_ranges(nE, num_threads, [&](size_t begin, size_t end) {
+    for (Id e = begin; e < end; e++) {
+      Id h = coarse.edgeHalfedge[e];
+      room[nV + e + 1] =
+          isSmoothEdge(e) ? 2 + n.degree[coarse.halfedgeFace[h]] +
+                                n.degree[coarse.halfedgeFace[coarse.halfedgeTwin[h]]]
+                          : 2;
+    }
+  });
+  for (Id f = 0; f < nF; f++) {
+    if (!coarse.faceIsBoundary[f]) {
+      room[faceVertices + n.faceRank[f] + 1] = n.degree[f];
+    }
+  }
+  for (size_t r = 0; r < nRows; r++) room[r + 1] += room[r];
+
+  std::vector<Id> vertex(room[nRows]);
+  std::vector<double> weight(room[nRows]);
+  std::vector<size_t> size(nRows + 1, 0);
+  auto row = [&](size_t r) {
+    Row result = {&vertex[room[r]], &weight[room[r]], 0};
+    return result;
+  };
+
+  parallel_for_ranges(nV, num_threads, [&](size_t begin, size_t end) {
+    for (Id v = begin; v < end; v++) {
+      Row r = row(v);
+      Id vh = coarse.vertexHalfedge[v];
+      if (!useCatmullClark) {
+        r.add(v, 1);
+      } else if (!isSmoothVertex(v)) {
+        // moves along the boundary curve only, whichever halfedge the
+        // vertex refers to
+        while (!coarse.isBoundaryHalfedge(vh)) {
+          vh = coarse.halfedgeNext[coarse.halfedgeTwin[vh]];
+        }
+        r.add(coarse.halfedgeVertex[n.prev[vh]], 1. / 8);
+        r.add(v, 6. / 8);
+        r.add(coarse.halfedgeVertex[coarse.halfedgeNext[vh]], 1. / 8);
+      } else {
+        // (Q + 2R + (n - 3)S) / n, with Q the average of the face points
+        // around the vertex and R that of the edge midpoints
+        double valence = coarse.vertexDegree(v);
+        double w = 1 / (valence * valence);
+        r.add(v, (valence - 2) / valence);
+        Id h = vh;
+        do {
+          r.add(coarse.halfedgeVertex[coarse.halfedgeTwin[h]], w);
+          r.addFace(coarse, n, coarse.halfedgeFace[h], w);
+          h = coarse.halfedgeNext[coarse.halfedgeTwin[h]];
+        } while (h != vh);
+      }
+      r.merge();
+      size[v] = r.size;
+    }
+  });
+  parallel_for_ranges(nE, num_threads, [&](size_t begin, size_t end) {
+    for (Id e = begin; e < end; e++) {
+      Row r = row(nV + e);
+      Id h = coarse.edgeHalfedge[e], t = coarse.halfedgeTwin[h];
+      if (isSmoothEdge(e)) {
+        // average of the endpoints and the two face points
+        r.add(coarse.halfedgeVertex[h], 1. / 4);
+        r.add(coarse.halfedgeVertex[t], 1. / 4);
+        r.addFace(coarse, n, coarse.halfedgeFace[h], 1. / 4);
+        r.addFace(coarse, n, coarse.halfedgeFace[t], 1. / 4);
+        r.merge();
+      } else {
+        r.add(coarse.halfedgeVertex[h], 1. / 2);
+        r.add(coarse.halfedgeVertex[t], 1. / 2);
+      }
+      size[nV + e] = r.size;
+    }
+  });
+  parallel_for_ranges(nF, num_threads, [&](size_t begin, size_t end) {
+    for (Id f = begin; f < end; f++) {
+      if (coarse.faceIsBoundary[f]) continue;
+      Id point = faceVertices + n.faceRank[f];
+      Row r = row(point);
+      r.addFace(coarse, n, f, 1);
+      size[point] = r.size;
+    }
+  });
+
+  stencilStart.resize(nRows + 1);
+  stencilStart[0] = 0;
+  for (size_t r = 0; r < nRows; r++) stencilStart[r + 1] = stencilStart[r] + size[r];
+  stencilVertex.resize(stencilStart[nRows]);
+  stencilWeight.resize(stencilStart[nRows]);
+  parallel_for_ranges(nRows, num_threads, [&](size_t begin, size_t end) {
+    for (size_t r = begin; r < end; r++) {
+      std::copy(vertex.begin() + room[r], vertex.begin() + room[r] + size[r],
+                stencilVertex.begin() + stencilStart[r]);
+      std::copy(weight.begin() + room[r], weight.begin() + room[r] + size[r],
+                stencilWeight.begin() + stencilStart[r]);
+    }
+  });
+
+  refinePositions(coarse.position, &fine->position, num_threads);
+}
+
+void QuadSubdivision::refinePositions(
+    const std::vector<Vector3D>& coarsePositions,
+    std::vector<Vector3D>* finePositions, size_t num_threads) const {
+  finePositions->resize(nRefinedVertices());
+  parallel_for_ranges(nRefinedVertices(), num_threads,
+                      [&](size_t begin, size_t end) {
+    for (size_t r = begin; r < end; r++) {
+      Vector3D p;
+      for (size_t i = stencilStart[r]; i < stencilStart[r + 1]; i++) {
+        p += stencilWeight[i] * coarsePositions[stencilVertex[i]];
+      }
+      (*finePositions)[r] = p;
+    }
+  });
+}
+
+}  // namespace PROJ6850
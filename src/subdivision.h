@@ -0,0 +1,66 @@
+#ifndef PROJ6850_SUBDIVISION_H
+#define PROJ6850_SUBDIVISION_H
+
+#include "indexed_halfedge_mesh.h"
+
+#include <vector>
+
+namespace PROJ6850 {
+
+/**
+ * One level of Catmull-Clark or linear subdivision, which splits each face of
+ * degree n into n quads around a new vertex at its center, with new vertices
+ * on the edges. Refined vertices are numbered as
+ * HalfedgeMesh::assignSubdivisionIndices numbers them: the coarse vertices,
+ * then one per edge, then one per face; the quads of a face follow each
+ * other, starting at the corner of its halfedge.
+ *
+ * build() writes the refined connectivity straight into the arrays of the
+ * refined mesh, each coarse halfedge filling in the halfedges it splits
+ * into, and computes the stencil of each refined vertex: the weights giving
+ * its position from the coarse ones. All passes are split among threads
+ * over contiguous index ranges. The stencils are kept, so that when the
+ * coarse vertices move, the refined positions are a sparse matrix-vector
+ * product away (refinePositions()).
+ *
+ * On a boundary, edge vertices are edge midpoints and Catmull-Clark moves
+ * boundary vertices along the boundary curve only.
+ */
+class QuadSubdivision {
+ public:
+  typedef IndexedHalfedgeMesh::Id Id;
+
+  QuadSubdivision() : coarseVertices(0), stencilStart(1, 0) {}
+
+  /**
+   * Subdivide a mesh with no deleted elements (see
+   * IndexedHalfedgeMesh::compact).
+   * \param useCatmullClark whether to use the Catmull-Clark rules, or else
+   *        linear interpolation
+   * \param fine replaced with the refined mesh
+   * \param num_threads threads to split the passes among
+   */
+  void build(const IndexedHalfedgeMesh& coarse, bool useCatmullClark,
+             IndexedHalfedgeMesh* fine, size_t num_threads = 1);
+
+  /**
+   * Compute the refined vertex positions of the last build() for new
+   * positions of the coarse vertices.
+   */
+  void refinePositions(const std::vector<Vector3D>& coarsePositions,
+                       std::vector<Vector3D>* finePositions,
+                       size_t num_threads = 1) const;
+
+  Size nCoarseVertices() const { return coarseVertices; }
+  Size nRefinedVertices() const { return stencilStart.size() - 1; }
+
+ private:
+  Size coarseVertices;
+  std::vector<size_t> stencilStart;   ///< start of each row in the arrays below
+  std::vector<Id> stencilVertex;      ///< coarse vertex of each weight
+  std::vector<double> stencilWeight;  ///< weights
+};
+
+}  // namespace PROJ6850
+
+#endif  // PROJ6850_SUBDIVISION_H
@@ -0,0 +1,320 @@
+#include "tile_server.h"
+
+#include "PROJ6850/timer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace PROJ6850 {
+
+namespace {
+
+// message codes, each followed by its payload
+enum Message {
+  HELLO = 0x31544c50,  ///< "PLT1" and the worker's hash
+  TILE = 1,            ///< a tile to render
+  RESULT = 2,          ///< a tile record
+  FINISHED = 3,        ///< no tile is left
+  REJECTED = 4         ///< the worker's hash does not match
+};
+
+// a listening or connected socket, -1 on failure
+int open_socket(const std::string& address, bool server) {
+  if (address.find('/') != std::string::npos) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (address.size() >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, address.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    bool ok;
+    if (server) {
+      unlink(address.c_str());  // left by a killed server
+      ok = bind(fd, (sockaddr*) &addr, sizeof(addr)) == 0 && listen(fd, 16) == 0;
+    } else {
+      ok = connect(fd, (sockaddr*) &addr, sizeof(addr)) == 0;
+    }
+    if (!ok) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  size_t colon = address.rfind(':');
+  std::string host =
+      colon == std::string::npos ? "127.0.0.1" : address.substr(0, colon);
+  std::string port =
+      colon == std::string::npos ? address : address.substr(colon + 1);
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (server) hints.ai_flags = AI_PASSIVE;
+  addrinfo* list;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &list) != 0) return -1;
+  int fd = -1;
+  for (addrinfo* a = list; a && fd < 0; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd < 0) continue;
+    int one = 1;
+    bool ok;
+    if (server) {
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      ok = bind(fd, a->ai_addr, a->ai_addrlen) == 0 && listen(fd, 16) == 0;
+    } else {
+      ok = connect(fd, a->ai_addr, a->ai_addrlen) == 0;
+    }
+    if (!ok) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(list);
+  return fd;
+}
+
+// buffered streams over a connected socket, closing it with them; both are
+// NULL if either could not be opened
+struct Connection {
+  explicit Connection(int socket) : in(NULL), out(NULL) {
+    // the messages are small, send them as soon as they are flushed
+    int one = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int copy = dup(socket);
+    if (copy >= 0) out = fdopen(copy, "wb");
+    if (out) in = fdopen(socket, "rb");
+    if (!in) {
+      if (out) {
+        fclose(out);
+        out = NULL;
+      } else if (copy >= 0) {
+        close(copy);
+      }
+      close(socket);
+    }
+  }
+
+  ~Connection() {
+    if (in) fclose(in);
+    if (out) fclose(out);
+  }
+
+  bool read(uint32_t* value) { return fread(value, sizeof(*value), 1, in) == 1; }
+  bool write(uint32_t value) {
+    return fwrite(&value, sizeof(value), 1, out) == 1;
+  }
+
+  FILE* in;
+  FILE* out;
+};
+
+}  // namespace
+
+TileServer::TileServer(uint64_t hash, HDRImageBuffer& image, AOVBuffer& aovs,
+                       double timeout)
+    : hash(hash),
+      image(image),
+      aovs(aovs),
+      timeout(timeout),
+      connected(0),
+      outstanding(0),
+      received(0),
+      dropped(0),
+      busy(0),
+      stopping(false) {}
+
+const char* TileServer::run(const std::string& address) {
+  int listener = open_socket(address, true);
+  if (listener < 0) return "cannot listen on the address";
+  // a worker dying between two messages must not take the server with it
+  signal(SIGPIPE, SIG_IGN);
+  fprintf(stdout, "[TileServer] Serving tiles on %s\n", address.c_str());
+
+  Timer timer;
+  timer.start();
+  std::vector<std::thread> workers;
+  while (true) {
+    {
+      // stop once no tile is out on a worker and none is left to hand out,
+      // or the tiles left were given back by workers that are all gone
+      std::lock_guard<std::mutex> guard(lock);
+      if (canceled() ||
+          (outstanding == 0 && (!tiles_left() || (connected == 0 && dropped > 0)))) {
+        break;
+      }
+    }
+    pollfd request = {listener, POLLIN, 0};
+    if (poll(&request, 1, 100) > 0) {
+      int socket = accept(listener, NULL, NULL);
+      if (socket >= 0) {
+        workers.push_back(std::thread(&TileServer::serve_worker, this, socket,
+                                      workers.size() + 1));
+      }
+    }
+  }
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  changed.notify_all();
+  close(listener);
+  if (address.find('/') != std::string::npos) unlink(address.c_str());
+  for (std::thread& worker : workers) worker.join();
+  timer.stop();
+
+  // busy is the time workers spent on tiles, out of the time they were all
+  // connected; transfers and waiting for the last tiles lower it
+  double utilization =
+      workers.empty() ? 0 : busy / (timer.duration() * workers.size());
+  fprintf(stdout,
+          "[TileServer] %zu tiles from %zu workers in %.4f sec, %zu dropped, "
+          "%.1f%% busy\n",
+          received, workers.size(), timer.duration(), dropped,
+          100 * utilization);
+  return NULL;
+}
+
+void TileServer::serve_worker(int socket, size_t id) {
+  if (timeout > 0) {
+    timeval limit;
+    limit.tv_sec = (time_t) timeout;
+    limit.tv_usec = (suseconds_t) ((timeout - limit.tv_sec) * 1e6);
+    setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof(limit));
+  }
+  Connection connection(socket);
+  if (!connection.in) {
+    fprintf(stderr, "[TileServer] Cannot open the connection of worker %zu\n",
+            id);
+    return;
+  }
+  uint32_t code;
+  uint64_t worker_hash;
+  if (!connection.read(&code) || code != HELLO ||
+      fread(&worker_hash, sizeof(worker_hash), 1, connection.in) != 1) {
+    fprintf(stderr, "[TileServer] Worker %zu is not a tile worker\n", id);
+    return;
+  }
+  if (worker_hash != hash) {
+    connection.write(REJECTED);
+    fflush(connection.out);
+    fprintf(stderr, "[TileServer] Worker %zu renders another scene or "
+            "other settings\n", id);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    connected++;
+  }
+
+  size_t tiles = 0;
+  while (true) {
+    RenderTile tile;
+    {
+      // wait for a tile, or until the tiles out on other workers are in
+      std::unique_lock<std::mutex> guard(lock);
+      bool taken;
+      while (!(taken = next_tile(&tile)) && !stopping && outstanding > 0) {
+        changed.wait_for(guard, std::chrono::milliseconds(100));
+      }
+      if (!taken) break;
+      outstanding++;
+    }
+
+    Timer timer;
+    timer.start();
+    RenderTile result;
+    bool ok = connection.write(TILE) &&
+              fwrite(&tile, sizeof(tile), 1, connection.out) == 1 &&
+              fflush(connection.out) == 0 && connection.read(&code) &&
+              code == RESULT &&
+              RenderCheckpoint::read_tile(connection.in, &result, image,
+                                          aovs, &tile);
+    timer.stop();
+    if (ok) {
+      tile_done(result);
+      tiles++;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    outstanding--;
+    changed.notify_all();
+    if (!ok) {
+      connected--;
+      dropped++;
+      return_tile(tile);
+      fprintf(stderr, "[TileServer] Lost worker %zu, its tile (%u, %u) goes "
+              "to the others\n", id, tile.x, tile.y);
+      return;
+    }
+    received++;
+    busy += timer.duration();
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    connected--;
+  }
+  connection.write(FINISHED);
+  fflush(connection.out);
+  fprintf(stdout, "[TileServer] Worker %zu rendered %zu tiles\n", id, tiles);
+}
+
+const char* TileClient::run(const std::string& address, uint64_t hash,
+                            const HDRImageBuffer& image,
+                            const AOVBuffer& aovs,
+                            std::function<void(const RenderTile&)> render,
+                            size_t* tiles) {
+  signal(SIGPIPE, SIG_IGN);
+  int socket = open_socket(address, false);
+  for (int attempt = 0; socket < 0 && attempt < 100; attempt++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    socket = open_socket(address, false);
+  }
+  if (socket < 0) return "cannot connect to the server";
+
+  Connection connection(socket);
+  if (!connection.in) return "cannot open the connection";
+  if (!connection.write(HELLO) ||
+      fwrite(&hash, sizeof(hash), 1, connection.out) != 1 ||
+      fflush(connection.out) != 0) {
+    return "connection lost";
+  }
+  while (true) {
+    uint32_t code;
+    RenderTile tile;
+    if (!connection.read(&code)) return "connection lost";
+    if (code == FINISHED) return NULL;
+    if (code == REJECTED) {
+      return "the server renders another scene or other settings";
+    }
+    if (code != TILE || fread(&tile, sizeof(tile), 1, connection.in) != 1 ||
+        !tile.w || !tile.h || tile.x + tile.w > image.w ||
+        tile.y + tile.h > image.h) {
+      return "unexpected message from the server";
+    }
+    render(tile);
+    if (!connection.write(RESULT) ||
+        !RenderCheckpoint::write_tile(connection.out, tile, image, aovs) ||
+        fflush(connection.out) != 0) {
+      return "connection lost";
+    }
+    if (tiles) (*tiles)++;
+  }
+}
+
+}  // namespace PROJ6850
@@ -0,0 +1,106 @@
+#ifndef PROJ6850_TILE_SERVER_H
+#define PROJ6850_TILE_SERVER_H
+
+#include "image.h"
+#include "render_checkpoint.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace PROJ6850 {
+
+typedef RenderCheckpoint::Tile RenderTile;
+
+/**
+ * Serves the tiles of a render to worker processes over a socket, so that
+ * one render can use the cores of several processes (or machines).
+ *
+ * Addresses are "[HOST:]PORT" for TCP, HOST defaulting to 127.0.0.1, or the
+ * path of a Unix socket (any address with a '/').
+ *
+ * Protocol, in the byte order of the host: the worker sends a hello with the
+ * hash of its scene and settings. The server answers with tiles to render,
+ * each answered by a tile record (see RenderCheckpoint::write_tile), until
+ * it sends that the render is finished. Workers that load another scene are
+ * rejected, down to its materials, lights and environment map (see
+ * PathTracer::render_hash).
+ *
+ * A worker whose connection drops or that does not answer within the timeout
+ * is dropped and its tile goes back to the others. Once the last worker is
+ * gone, the server stops and leaves the tiles given back to its caller.
+ */
+class TileServer {
+ public:
+  /**
+   * Constructor.
+   * \param hash hash of the scene and settings workers must match
+   * \param image radiance the tiles received are written to
+   * \param aovs AOVs the tiles received are written to
+   * \param timeout seconds a worker may take to return a tile
+   */
+  TileServer(uint64_t hash, HDRImageBuffer& image, AOVBuffer& aovs,
+             double timeout);
+
+  /**
+   * Serve tiles until no tile is left to hand out and none is out on a
+   * worker, until the last worker is dropped, or until the render is
+   * canceled.
+   * \param address address to listen on
+   * \return NULL on success, the error message otherwise
+   */
+  const char* run(const std::string& address);
+
+  std::function<bool(RenderTile*)> next_tile;  ///< takes a tile to hand out, false if none waits
+  std::function<bool()> tiles_left;            ///< whether a tile waits to be handed out
+  std::function<void(const RenderTile&)> return_tile;  ///< gives back the tile of a dropped worker
+  std::function<void(const RenderTile&)> tile_done;    ///< called for each tile received
+  std::function<bool()> canceled;                      ///< whether to stop serving
+
+ private:
+  void serve_worker(int socket, size_t id);
+
+  uint64_t hash;
+  HDRImageBuffer& image;
+  AOVBuffer& aovs;
+  double timeout;
+
+  size_t connected;        ///< workers being served
+  size_t outstanding;      ///< tiles out on workers
+  size_t received;         ///< tiles received
+  size_t dropped;          ///< workers dropped with a tile
+  double busy;             ///< seconds spent waiting on tiles, summed over workers
+  bool stopping;           ///< set once the server stops handing out tiles
+  std::mutex lock;         ///< guards the tiles, the counters and next_tile
+  std::condition_variable changed;  ///< signaled when a tile is received or returned
+};
+
+/**
+ * Worker side of a TileServer.
+ */
+class TileClient {
+ public:
+  /**
+   * Connect to a server and render the tiles it hands out until it has no
+   * more. Connecting is retried for a while, so workers can be started
+   * before the server.
+   * \param address address of the server
+   * \param hash hash of the scene and settings
+   * \param image radiance, rendered tiles are read from it
+   * \param aovs AOVs, rendered tiles are read from them
+   * \param render renders a tile into image and aovs
+   * \param tiles if not NULL, incremented for each tile rendered
+   * \return NULL on success, the error message otherwise
+   */
+  static const char* run(const std::string& address, uint64_t hash,
+                         const HDRImageBuffer& image, const AOVBuffer& aovs,
+                         std::function<void(const RenderTile&)> render,
+                         size_t* tiles = NULL);
+};
+
+}  // namespace PROJ6850
+
+#endif  // PROJ6850_TILE_SERVER_H
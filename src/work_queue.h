@@ -2,6 +2,11 @@
 #define __WORK_QUEUE_H__
 
 #include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <thread>
 #include <vector>
 
 /**
@@ -49,4 +54,96 @@ class WorkQueue {
   }
 };
 
+/**
+ * Blocking queue holding at most a fixed number of items, used to hand work
+ * between pipeline stages running on different threads. Producers wait while
+ * the queue is full and consumers wait while it is empty, so a fast stage can
+ * only run a bounded number of items ahead of a slow one.
+ */
+template <class T>
+class BoundedQueue {
+ private:
+  std::deque<T> storage;
+  size_t capacity;
+  bool closed;
+  std::mutex lock;
+  std::condition_variable notFull;
+  std::condition_variable notEmpty;
+
+ public:
+  explicit BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+  /**
+   * Add an item, waiting for room if the queue is full.
+   * Returns false if the queue was closed, in which case the item is dropped.
+   */
+  bool push(const T& item) {
+    std::unique_lock<std::mutex> guard(lock);
+    notFull.wait(guard, [this] { return closed || storage.size() < capacity; });
+    if (closed) return false;
+    storage.push_back(item);
+    notEmpty.notify_one();
+    return true;
+  }
+
+  /**
+   * Take the oldest item, waiting for one if the queue is empty.
+   * Returns false once the queue is closed and drained.
+   */
+  bool pop(T* outPtr) {
+    std::unique_lock<std::mutex> guard(lock);
+    notEmpty.wait(guard, [this] { return closed || !storage.empty(); });
+    if (storage.empty()) return false;
+    *outPtr = storage.front();
+    storage.pop_front();
+    notFull.notify_one();
+    return true;
+  }
+
+  /**
+   * Stop accepting items and wake up all waiting threads. Items already in
+   * the queue can still be popped.
+   */
+  void close() {
+    std::lock_guard<std::mutex> guard(lock);
+    closed = true;
+    notFull.notify_all();
+    notEmpty.notify_all();
+  }
+};
+
+/**
+ * Call f(i) for every i in [0, count) on up to num_threads threads, the
+ * calling thread included, and return once all calls are done. Indices are
+ * handed out one at a time, so items of very different cost still balance.
+ * Calls must only write what belongs to their index.
+ */
+template <class F>
+void parallel_for(size_t count, size_t num_threads, F f) {
+  std::atomic<size_t> next(0);
+  auto work = [&]() {
+    for (size_t i; (i = next++) < count;) f(i);
+  };
+  size_t used = std::min(num_threads, count);
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < used; t++) threads.push_back(std::thread(work));
+  work();
+  for (std::thread& thread : threads) thread.join();
+}
+
+/**
+ * Call f(begin, end) for contiguous ranges covering [0, count), split among
+ * up to num_threads threads, for loops whose items are too cheap to hand out
+ * one at a time. There are a few ranges per thread so that they balance.
+ */
+template <class F>
+void parallel_for_ranges(size_t count, size_t num_threads, F f) {
+  size_t ranges = std::min(std::max<size_t>(num_threads, 1) * 4, count / 1024 + 1);
+  size_t size = (count + ranges - 1) / ranges;
+  parallel_for(ranges, num_threads, [&](size_t r) {
+    size_t begin = r * size, end = std::min(count, begin + size);
+    if (begin < end) f(begin, end);
+  });
+}
+
 #endif  // WORK_QUEUE_H_